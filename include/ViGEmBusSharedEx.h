@@ -0,0 +1,1605 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+//
+// Bus driver I/O control interface extensions.
+// 
+// Builds on top of ViGEm/km/BusShared.h (shipped with the client library) and
+// must be included after it. The control code range starting at
+// IOCTL_VIGEM_BASE + 0x300 is reserved for these extensions.
+// 
+
+#pragma once
+
+//
+// Input report of any supported target type
+// 
+typedef union _VIGEM_TARGET_REPORT
+{
+    XUSB_REPORT Xusb;
+
+    DS4_REPORT Ds4;
+
+    XGIP_REPORT Xgip;
+
+} VIGEM_TARGET_REPORT, *PVIGEM_TARGET_REPORT;
+
+#pragma region Report delivery accounting
+
+#define IOCTL_VIGEM_GET_REPORT_STATS        BUSENUM_RW_IOCTL(IOCTL_VIGEM_BASE + 0x307)
+
+//
+// What became of a submitted report
+// 
+// The XUSB, DS4 and XGIP submit requests return it in the output buffer,
+// if one at least sizeof(VIGEM_REPORT_DISPOSITION) bytes large is supplied.
+// 
+typedef enum _VIGEM_REPORT_DISPOSITION
+{
+    //
+    // Handed straight to a pending IN URB
+    // 
+    ViGEmReportDelivered,
+
+    //
+    // No IN URB pending, cached for the next one
+    // 
+    ViGEmReportCoalesced,
+
+    //
+    // Equal to the cached report, discarded by the dedupe policy
+    // 
+    ViGEmReportDeduped,
+
+    //
+    // No IN URB pending and the cached report it replaced never reached
+    // the host; the feeder is outrunning the host's polling
+    // 
+    ViGEmReportDropped
+
+} VIGEM_REPORT_DISPOSITION, *PVIGEM_REPORT_DISPOSITION;
+
+#define VIGEM_REPORT_DISPOSITIONS           0x04
+
+//
+// Queries the delivery counters of a device
+// 
+typedef struct _VIGEM_REPORT_STATS
+{
+    //
+    // sizeof(struct _VIGEM_REPORT_STATS)
+    // 
+    ULONG Size;
+
+    //
+    // Serial number of the device
+    // 
+    ULONG SerialNo;
+
+    //
+    // Number of reports submitted (out)
+    // 
+    ULONG64 Submitted;
+
+    //
+    // Number of submitted reports per disposition (out)
+    // 
+    ULONG64 Dispositions[VIGEM_REPORT_DISPOSITIONS];
+
+} VIGEM_REPORT_STATS, *PVIGEM_REPORT_STATS;
+
+VOID FORCEINLINE VIGEM_REPORT_STATS_INIT(
+    _Out_ PVIGEM_REPORT_STATS Stats,
+    _In_ ULONG SerialNo
+)
+{
+    RtlZeroMemory(Stats, sizeof(VIGEM_REPORT_STATS));
+
+    Stats->Size = sizeof(VIGEM_REPORT_STATS);
+    Stats->SerialNo = SerialNo;
+}
+
+#pragma endregion
+
+#pragma region Batch report submission
+
+#define IOCTL_VIGEM_SUBMIT_REPORT_BATCH     BUSENUM_RW_IOCTL(IOCTL_VIGEM_BASE + 0x300)
+
+//
+// Upper limit of entries accepted in a single batch
+// 
+#define VIGEM_SUBMIT_BATCH_MAX_ENTRIES      0x100
+
+//
+// Single report of a batch submission
+// 
+typedef struct _VIGEM_SUBMIT_BATCH_ENTRY
+{
+    //
+    // Serial number of target device
+    // 
+    ULONG SerialNo;
+
+    //
+    // Report layout used below, must match the type of the target device
+    // 
+    VIGEM_TARGET_TYPE TargetType;
+
+    //
+    // NTSTATUS of this submission, set by the bus
+    // 
+    LONG Status;
+
+    //
+    // What became of the report if Status is a success code, set by the bus
+    // 
+    VIGEM_REPORT_DISPOSITION Disposition;
+
+    //
+    // Report to submit
+    // 
+    VIGEM_TARGET_REPORT Report;
+
+} VIGEM_SUBMIT_BATCH_ENTRY, *PVIGEM_SUBMIT_BATCH_ENTRY;
+
+//
+// Submits reports to multiple targets with one request
+// 
+typedef struct _VIGEM_SUBMIT_BATCH
+{
+    //
+    // sizeof(struct _VIGEM_SUBMIT_BATCH)
+    // 
+    ULONG Size;
+
+    //
+    // Number of entries following
+    // 
+    ULONG Count;
+
+    //
+    // Variable-length array of reports
+    // 
+    VIGEM_SUBMIT_BATCH_ENTRY Entries[1];
+
+} VIGEM_SUBMIT_BATCH, *PVIGEM_SUBMIT_BATCH;
+
+//
+// Buffer size required for a batch holding the given number of entries
+// 
+#define VIGEM_SUBMIT_BATCH_SIZE(_count_) \
+    (FIELD_OFFSET(VIGEM_SUBMIT_BATCH, Entries) + (_count_) * sizeof(VIGEM_SUBMIT_BATCH_ENTRY))
+
+//
+// Initializes a batch buffer of VIGEM_SUBMIT_BATCH_SIZE(Count) bytes.
+// 
+VOID FORCEINLINE VIGEM_SUBMIT_BATCH_INIT(
+    _Out_ PVIGEM_SUBMIT_BATCH Batch,
+    _In_ ULONG Count
+)
+{
+    RtlZeroMemory(Batch, VIGEM_SUBMIT_BATCH_SIZE(Count));
+
+    Batch->Size = sizeof(VIGEM_SUBMIT_BATCH);
+    Batch->Count = Count;
+}
+
+#pragma endregion
+
+#pragma region Shared memory input slots
+
+#define IOCTL_VIGEM_MAP_INPUT_SLOT          BUSENUM_RW_IOCTL(IOCTL_VIGEM_BASE + 0x301)
+
+//
+// Number of slots in a session's shared input slot page
+// 
+#define VIGEM_INPUT_SLOTS_MAX               0x40
+
+//
+// Attempts a reader makes before giving up on a slot under concurrent writes
+// 
+#define VIGEM_INPUT_SLOT_READ_RETRIES       0x10
+
+//
+// Shared memory mailbox holding the latest report of one target.
+// 
+// Sequence is even while the slot is stable and odd while a writer is busy.
+// Writers claim the slot by moving an even value to odd, so multiple writer
+// threads serialize among themselves; readers never block writers.
+// 
+typedef struct DECLSPEC_ALIGN(64) _VIGEM_INPUT_SLOT
+{
+    //
+    // Sequence counter, bumped twice per write
+    // 
+    volatile LONG Sequence;
+
+    //
+    // Serial number of the target bound to this slot, set by the bus
+    // 
+    ULONG SerialNo;
+
+    //
+    // Latest report, layout depends on the bound target type
+    // 
+    VIGEM_TARGET_REPORT Report;
+
+} VIGEM_INPUT_SLOT, *PVIGEM_INPUT_SLOT;
+
+//
+// Binds a target to a slot of the caller's shared input slot page
+// 
+typedef struct _VIGEM_MAP_INPUT_SLOT
+{
+    //
+    // sizeof(struct _VIGEM_MAP_INPUT_SLOT)
+    // 
+    ULONG Size;
+
+    //
+    // Serial number of target device
+    // 
+    ULONG SerialNo;
+
+    //
+    // Index of the bound slot (out)
+    // 
+    ULONG SlotIndex;
+
+    //
+    // Number of slots in the page (out)
+    // 
+    ULONG SlotCount;
+
+    //
+    // Caller address of the slot page, same for all targets of a handle (out)
+    // 
+    ULONG64 Slots;
+
+} VIGEM_MAP_INPUT_SLOT, *PVIGEM_MAP_INPUT_SLOT;
+
+VOID FORCEINLINE VIGEM_MAP_INPUT_SLOT_INIT(
+    _Out_ PVIGEM_MAP_INPUT_SLOT Map,
+    _In_ ULONG SerialNo
+)
+{
+    RtlZeroMemory(Map, sizeof(VIGEM_MAP_INPUT_SLOT));
+
+    Map->Size = sizeof(VIGEM_MAP_INPUT_SLOT);
+    Map->SerialNo = SerialNo;
+}
+
+//
+// Publishes a report in a slot (feeder side).
+// 
+VOID FORCEINLINE VIGEM_INPUT_SLOT_WRITE(
+    _Inout_ PVIGEM_INPUT_SLOT Slot,
+    _In_reads_bytes_(Length) CONST VOID* Report,
+    _In_ SIZE_T Length
+)
+{
+    LONG sequence;
+
+    // Claim the slot; only succeeds from a stable (even) state
+    do
+    {
+        sequence = ReadNoFence(&Slot->Sequence) & ~1;
+    } while (InterlockedCompareExchange(&Slot->Sequence, sequence + 1, sequence) != sequence);
+
+    RtlCopyMemory((PVOID)&Slot->Report, Report, min(Length, sizeof(VIGEM_TARGET_REPORT)));
+
+    // Release; full barrier orders the report stores before the sequence
+    InterlockedExchange(&Slot->Sequence, sequence + 2);
+}
+
+//
+// Takes a consistent copy of a slot's report (bus side).
+// 
+// Returns FALSE if the slot didn't change since LastSequence or no stable
+// copy could be taken within VIGEM_INPUT_SLOT_READ_RETRIES attempts.
+// 
+BOOLEAN FORCEINLINE VIGEM_INPUT_SLOT_READ(
+    _In_ PVIGEM_INPUT_SLOT Slot,
+    _Out_writes_bytes_(Length) PVOID Report,
+    _In_ SIZE_T Length,
+    _Inout_ PLONG LastSequence
+)
+{
+    LONG begin;
+    ULONG i;
+
+    for (i = 0; i < VIGEM_INPUT_SLOT_READ_RETRIES; i++)
+    {
+        begin = ReadAcquire(&Slot->Sequence);
+
+        if (begin == *LastSequence)
+        {
+            return FALSE;
+        }
+
+        // Writer busy, retry
+        if (begin & 1)
+        {
+            YieldProcessor();
+            continue;
+        }
+
+        RtlCopyMemory(Report, (CONST VOID*)&Slot->Report, min(Length, sizeof(VIGEM_TARGET_REPORT)));
+
+        // Report loads must complete before re-checking the sequence
+        MemoryBarrier();
+
+        if (ReadNoFence(&Slot->Sequence) == begin)
+        {
+            *LastSequence = begin;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+#pragma endregion
+
+#pragma region Plugin latency statistics
+
+#define IOCTL_VIGEM_GET_PLUGIN_STATS        BUSENUM_RW_IOCTL(IOCTL_VIGEM_BASE + 0x302)
+
+//
+// Number of target types statistics are kept for, indexed by VIGEM_TARGET_TYPE
+// 
+#define VIGEM_PLUGIN_STATS_TARGET_TYPES     0x03
+
+//
+// Number of PDO stages statistics are kept for, indexed by VIGEM_PDO_STAGE
+// 
+#define VIGEM_PLUGIN_STATS_STAGES           0x03
+
+//
+// Number of latency buckets per stage; bucket n counts latencies in
+// [2^n, 2^(n+1)) microseconds, the first and last one are open-ended
+// 
+#define VIGEM_LATENCY_BUCKETS               0x18
+
+//
+// Plugin latencies of one target type
+// 
+typedef struct _VIGEM_PLUGIN_TARGET_STATS
+{
+    //
+    // Time from the plugin request to each stage's successful completion
+    // 
+    ULONG64 Latency[VIGEM_PLUGIN_STATS_STAGES][VIGEM_LATENCY_BUCKETS];
+
+    //
+    // Number of stages reporting failure
+    // 
+    ULONG64 Failures[VIGEM_PLUGIN_STATS_STAGES];
+
+    //
+    // Number of requests completed by the orphan sweep instead of a stage result
+    // 
+    ULONG64 Timeouts;
+
+} VIGEM_PLUGIN_TARGET_STATS, *PVIGEM_PLUGIN_TARGET_STATS;
+
+//
+// Queries plugin latency statistics of the bus
+// 
+typedef struct _VIGEM_PLUGIN_STATS
+{
+    //
+    // sizeof(struct _VIGEM_PLUGIN_STATS)
+    // 
+    ULONG Size;
+
+    //
+    // Per target type statistics (out)
+    // 
+    VIGEM_PLUGIN_TARGET_STATS Targets[VIGEM_PLUGIN_STATS_TARGET_TYPES];
+
+} VIGEM_PLUGIN_STATS, *PVIGEM_PLUGIN_STATS;
+
+VOID FORCEINLINE VIGEM_PLUGIN_STATS_INIT(
+    _Out_ PVIGEM_PLUGIN_STATS Stats
+)
+{
+    RtlZeroMemory(Stats, sizeof(VIGEM_PLUGIN_STATS));
+
+    Stats->Size = sizeof(VIGEM_PLUGIN_STATS);
+}
+
+#pragma endregion
+
+#pragma region Resource accounting
+
+#define IOCTL_VIGEM_GET_RESOURCE_STATS      BUSENUM_RW_IOCTL(IOCTL_VIGEM_BASE + 0x303)
+
+//
+// Framework object types tracked by the bus
+// 
+typedef enum _VIGEM_RESOURCE_TYPE
+{
+    ViGEmResourceDevice,
+    ViGEmResourceQueue,
+    ViGEmResourceTimer,
+    ViGEmResourceMemory,
+    ViGEmResourceCollection
+
+} VIGEM_RESOURCE_TYPE, *PVIGEM_RESOURCE_TYPE;
+
+//
+// Number of tracked object types, indexed by VIGEM_RESOURCE_TYPE
+// 
+#define VIGEM_RESOURCE_TYPES                0x05
+
+//
+// Queries live framework objects of the bus and optionally one of its devices
+// 
+typedef struct _VIGEM_RESOURCE_STATS
+{
+    //
+    // sizeof(struct _VIGEM_RESOURCE_STATS)
+    // 
+    ULONG Size;
+
+    //
+    // Serial number of the device to report on, 0 for bus totals only (in)
+    // 
+    ULONG SerialNo;
+
+    //
+    // Live objects created by the bus, including those of its devices (out)
+    // 
+    LONG BusObjects[VIGEM_RESOURCE_TYPES];
+
+    //
+    // Device interfaces registered by the bus (out)
+    // 
+    LONG BusInterfaces;
+
+    //
+    // Live objects created on behalf of the device identified by SerialNo (out)
+    // 
+    LONG DeviceObjects[VIGEM_RESOURCE_TYPES];
+
+} VIGEM_RESOURCE_STATS, *PVIGEM_RESOURCE_STATS;
+
+VOID FORCEINLINE VIGEM_RESOURCE_STATS_INIT(
+    _Out_ PVIGEM_RESOURCE_STATS Stats,
+    _In_ ULONG SerialNo
+)
+{
+    RtlZeroMemory(Stats, sizeof(VIGEM_RESOURCE_STATS));
+
+    Stats->Size = sizeof(VIGEM_RESOURCE_STATS);
+    Stats->SerialNo = SerialNo;
+}
+
+#pragma endregion
+
+#pragma region Duplicate report handling
+
+#define IOCTL_VIGEM_REPORT_DEDUPE           BUSENUM_RW_IOCTL(IOCTL_VIGEM_BASE + 0x304)
+
+//
+// What happens to a submitted report equal to the cached one
+// 
+typedef enum _VIGEM_DEDUPE_POLICY
+{
+    //
+    // Leave the policy unchanged, only query
+    // 
+    ViGEmDedupeQuery,
+
+    //
+    // Drop the report, no pending IN request is used up (default)
+    // 
+    ViGEmDedupeDrop,
+
+    //
+    // Deliver the report again, refreshing the host side
+    // 
+    ViGEmDedupeRefresh
+
+} VIGEM_DEDUPE_POLICY, *PVIGEM_DEDUPE_POLICY;
+
+//
+// Sets the duplicate report policy of a device and queries its counters
+// 
+typedef struct _VIGEM_REPORT_DEDUPE
+{
+    //
+    // sizeof(struct _VIGEM_REPORT_DEDUPE)
+    // 
+    ULONG Size;
+
+    //
+    // Serial number of the target device
+    // 
+    ULONG SerialNo;
+
+    //
+    // Policy to apply (in), policy in effect (out)
+    // 
+    VIGEM_DEDUPE_POLICY Policy;
+
+    //
+    // Reports submitted since the device got plugged in (out)
+    // 
+    ULONG64 Submitted;
+
+    //
+    // Submitted reports equal to the cached report (out)
+    // 
+    ULONG64 Duplicates;
+
+} VIGEM_REPORT_DEDUPE, *PVIGEM_REPORT_DEDUPE;
+
+VOID FORCEINLINE VIGEM_REPORT_DEDUPE_INIT(
+    _Out_ PVIGEM_REPORT_DEDUPE Dedupe,
+    _In_ ULONG SerialNo,
+    _In_ VIGEM_DEDUPE_POLICY Policy
+)
+{
+    RtlZeroMemory(Dedupe, sizeof(VIGEM_REPORT_DEDUPE));
+
+    Dedupe->Size = sizeof(VIGEM_REPORT_DEDUPE);
+    Dedupe->SerialNo = SerialNo;
+    Dedupe->Policy = Policy;
+}
+
+#pragma endregion
+
+#pragma region Bus state snapshot
+
+#define IOCTL_VIGEM_GET_STATE_SNAPSHOT      BUSENUM_RW_IOCTL(IOCTL_VIGEM_BASE + 0x305)
+
+//
+// Current state of a single device
+// 
+typedef struct _VIGEM_STATE_SNAPSHOT_ENTRY
+{
+    //
+    // Serial number of the device
+    // 
+    ULONG SerialNo;
+
+    //
+    // Device type, selects the member of Report
+    // 
+    VIGEM_TARGET_TYPE TargetType;
+
+    //
+    // Session owning the device
+    // 
+    LONG SessionId;
+
+    //
+    // Interrupt time (100ns units) the report got stored at, 0 if none submitted yet
+    // 
+    ULONG64 Timestamp;
+
+    //
+    // Last submitted report
+    // 
+    VIGEM_TARGET_REPORT Report;
+
+} VIGEM_STATE_SNAPSHOT_ENTRY, *PVIGEM_STATE_SNAPSHOT_ENTRY;
+
+//
+// Queries the current state of all devices on the bus; every entry is
+// consistent on its own, entries of different devices may be a few reports
+// apart
+// 
+typedef struct _VIGEM_STATE_SNAPSHOT
+{
+    //
+    // sizeof(struct _VIGEM_STATE_SNAPSHOT)
+    // 
+    ULONG Size;
+
+    //
+    // Number of entries returned (out)
+    // 
+    ULONG Count;
+
+    //
+    // Number of devices on the bus, more than Count if the buffer was too small (out)
+    // 
+    ULONG Total;
+
+    //
+    // One entry per device (out)
+    // 
+    VIGEM_STATE_SNAPSHOT_ENTRY Entries[ANYSIZE_ARRAY];
+
+} VIGEM_STATE_SNAPSHOT, *PVIGEM_STATE_SNAPSHOT;
+
+//
+// Buffer size required for a snapshot of _count_ devices
+// 
+#define VIGEM_STATE_SNAPSHOT_SIZE(_count_) \
+    (FIELD_OFFSET(VIGEM_STATE_SNAPSHOT, Entries) + (_count_) * sizeof(VIGEM_STATE_SNAPSHOT_ENTRY))
+
+VOID FORCEINLINE VIGEM_STATE_SNAPSHOT_INIT(
+    _Out_ PVIGEM_STATE_SNAPSHOT Snapshot
+)
+{
+    RtlZeroMemory(Snapshot, FIELD_OFFSET(VIGEM_STATE_SNAPSHOT, Entries));
+
+    Snapshot->Size = sizeof(VIGEM_STATE_SNAPSHOT);
+}
+
+#pragma endregion
+
+#pragma region Submit and wait for delivery
+
+#define IOCTL_VIGEM_SUBMIT_AND_WAIT         BUSENUM_RW_IOCTL(IOCTL_VIGEM_BASE + 0x306)
+
+//
+// Submits a report and completes once an IN URB picked it (or a newer one) up.
+// 
+// Completes with STATUS_SUCCESS on delivery and with STATUS_IO_TIMEOUT
+// if the deadline passed first. Fails with STATUS_NOT_SUPPORTED while a
+// report FIFO is attached to the device.
+// 
+typedef struct _VIGEM_SUBMIT_AND_WAIT
+{
+    //
+    // sizeof(struct _VIGEM_SUBMIT_AND_WAIT)
+    // 
+    ULONG Size;
+
+    //
+    // Serial number of target device
+    // 
+    ULONG SerialNo;
+
+    //
+    // Maximum time to wait for delivery in milliseconds, 0 to wait until cancelled
+    // 
+    ULONG TimeoutMs;
+
+    //
+    // Report to submit, laid out according to the device type
+    // 
+    VIGEM_TARGET_REPORT Report;
+
+    //
+    // What became of the report at submission (out)
+    // 
+    VIGEM_REPORT_DISPOSITION Disposition;
+
+    //
+    // QueryPerformanceCounter value the report got handed to the host at (out)
+    // 
+    // A duplicate of a report the host picked up before the request came in
+    // gets the last delivery any waiter got timed at instead.
+    // 
+    LONG64 DeliveredAt;
+
+} VIGEM_SUBMIT_AND_WAIT, *PVIGEM_SUBMIT_AND_WAIT;
+
+VOID FORCEINLINE VIGEM_SUBMIT_AND_WAIT_INIT(
+    _Out_ PVIGEM_SUBMIT_AND_WAIT Submit,
+    _In_ ULONG SerialNo,
+    _In_ ULONG TimeoutMs
+)
+{
+    RtlZeroMemory(Submit, sizeof(VIGEM_SUBMIT_AND_WAIT));
+
+    Submit->Size = sizeof(VIGEM_SUBMIT_AND_WAIT);
+    Submit->SerialNo = SerialNo;
+    Submit->TimeoutMs = TimeoutMs;
+}
+
+#pragma endregion
+
+#pragma region Delta report submission
+
+#define IOCTL_VIGEM_SUBMIT_DELTA            BUSENUM_RW_IOCTL(IOCTL_VIGEM_BASE + 0x308)
+
+//
+// Fields of an XUSB_REPORT, as bit indices of VIGEM_SUBMIT_DELTA.FieldMask
+// 
+typedef enum _VIGEM_XUSB_FIELD
+{
+    ViGEmXusbButtons,
+    ViGEmXusbLeftTrigger,
+    ViGEmXusbRightTrigger,
+    ViGEmXusbThumbLX,
+    ViGEmXusbThumbLY,
+    ViGEmXusbThumbRX,
+    ViGEmXusbThumbRY,
+    ViGEmXusbFields
+
+} VIGEM_XUSB_FIELD;
+
+//
+// Fields of a DS4_REPORT, as bit indices of VIGEM_SUBMIT_DELTA.FieldMask
+// 
+typedef enum _VIGEM_DS4_FIELD
+{
+    ViGEmDs4ThumbLX,
+    ViGEmDs4ThumbLY,
+    ViGEmDs4ThumbRX,
+    ViGEmDs4ThumbRY,
+    ViGEmDs4Buttons,
+    ViGEmDs4Special,
+    ViGEmDs4TriggerL,
+    ViGEmDs4TriggerR,
+    ViGEmDs4Fields
+
+} VIGEM_DS4_FIELD;
+
+//
+// Fields of an XGIP_REPORT, as bit indices of VIGEM_SUBMIT_DELTA.FieldMask
+// 
+typedef enum _VIGEM_XGIP_FIELD
+{
+    ViGEmXgipButtons1,
+    ViGEmXgipButtons2,
+    ViGEmXgipLeftTrigger,
+    ViGEmXgipRightTrigger,
+    ViGEmXgipThumbLX,
+    ViGEmXgipThumbLY,
+    ViGEmXgipThumbRX,
+    ViGEmXgipThumbRY,
+    ViGEmXgipFields
+
+} VIGEM_XGIP_FIELD;
+
+#define VIGEM_FIELD_BIT(_field_)            (1UL << (_field_))
+
+//
+// Updates some fields of a device's report, leaving the others as they are.
+// 
+// Values holds the new value of every field set in FieldMask, packed in
+// ascending field order with the field's native size and no padding. The
+// request is VIGEM_SUBMIT_DELTA_SIZE(<sum of those sizes>) bytes long.
+// 
+// The output buffer, if supplied, receives the VIGEM_REPORT_DISPOSITION.
+// 
+typedef struct _VIGEM_SUBMIT_DELTA
+{
+    //
+    // sizeof(struct _VIGEM_SUBMIT_DELTA)
+    // 
+    ULONG Size;
+
+    //
+    // Serial number of target device
+    // 
+    ULONG SerialNo;
+
+    //
+    // Fields to update, VIGEM_FIELD_BIT of the target type's field enum
+    // 
+    ULONG FieldMask;
+
+    //
+    // Packed field values
+    // 
+    UCHAR Values[ANYSIZE_ARRAY];
+
+} VIGEM_SUBMIT_DELTA, *PVIGEM_SUBMIT_DELTA;
+
+//
+// Buffer size required for a delta carrying _length_ bytes of values
+// 
+#define VIGEM_SUBMIT_DELTA_SIZE(_length_) \
+    (FIELD_OFFSET(VIGEM_SUBMIT_DELTA, Values) + (_length_))
+
+VOID FORCEINLINE VIGEM_SUBMIT_DELTA_INIT(
+    _Out_ PVIGEM_SUBMIT_DELTA Delta,
+    _In_ ULONG SerialNo
+)
+{
+    RtlZeroMemory(Delta, FIELD_OFFSET(VIGEM_SUBMIT_DELTA, Values));
+
+    Delta->Size = sizeof(VIGEM_SUBMIT_DELTA);
+    Delta->SerialNo = SerialNo;
+}
+
+#pragma endregion
+
+#pragma region Report mirror groups
+
+#define IOCTL_VIGEM_MIRROR                  BUSENUM_RW_IOCTL(IOCTL_VIGEM_BASE + 0x309)
+
+//
+// Maximum number of members of a mirror group
+// 
+#define VIGEM_MIRROR_MAX_MEMBERS            0x40
+
+typedef enum _VIGEM_MIRROR_OPERATION
+{
+    //
+    // Adds the member to the leader's group
+    // 
+    ViGEmMirrorAttach,
+
+    //
+    // Removes the member from the leader's group
+    // 
+    ViGEmMirrorDetach
+
+} VIGEM_MIRROR_OPERATION, *PVIGEM_MIRROR_OPERATION;
+
+//
+// Changes a mirror group; every report submitted to the leader also gets
+// submitted to all members, translated where their target types differ.
+// 
+// A group is named by its leader's serial. Leaders can't be members and
+// vice versa; the caller must own both devices.
+// 
+typedef struct _VIGEM_MIRROR
+{
+    //
+    // sizeof(struct _VIGEM_MIRROR)
+    // 
+    ULONG Size;
+
+    //
+    // Serial number of the group leader
+    // 
+    ULONG LeaderSerialNo;
+
+    //
+    // Serial number of the member to attach or detach
+    // 
+    ULONG MemberSerialNo;
+
+    //
+    // Change to apply
+    // 
+    VIGEM_MIRROR_OPERATION Operation;
+
+} VIGEM_MIRROR, *PVIGEM_MIRROR;
+
+VOID FORCEINLINE VIGEM_MIRROR_INIT(
+    _Out_ PVIGEM_MIRROR Mirror,
+    _In_ ULONG LeaderSerialNo,
+    _In_ ULONG MemberSerialNo,
+    _In_ VIGEM_MIRROR_OPERATION Operation
+)
+{
+    RtlZeroMemory(Mirror, sizeof(VIGEM_MIRROR));
+
+    Mirror->Size = sizeof(VIGEM_MIRROR);
+    Mirror->LeaderSerialNo = LeaderSerialNo;
+    Mirror->MemberSerialNo = MemberSerialNo;
+    Mirror->Operation = Operation;
+}
+
+#pragma endregion
+
+#pragma region Timed report playback
+
+#define IOCTL_VIGEM_PLAYBACK_LOAD           BUSENUM_RW_IOCTL(IOCTL_VIGEM_BASE + 0x30A)
+#define IOCTL_VIGEM_PLAYBACK_CONTROL        BUSENUM_RW_IOCTL(IOCTL_VIGEM_BASE + 0x30B)
+
+//
+// Timeline file format.
+// 
+// A timeline is a VIGEM_TIMELINE_HEADER directly followed by EntryCount
+// entries without any padding. Each entry is a 32-bit due time in
+// microseconds relative to the start of the playback, followed by
+// ReportSize bytes of bare report as laid out for the target type.
+// All values are little-endian, so timelines can be produced and checked
+// on any platform.
+// 
+// Due times must not decrease and must not exceed DurationUs, which is the
+// length of one pass when the playback loops.
+// 
+#define VIGEM_TIMELINE_MAGIC                0x4C544756 // "VGTL"
+#define VIGEM_TIMELINE_VERSION              0x01
+
+//
+// Largest timeline the bus accepts, in bytes
+// 
+#define VIGEM_TIMELINE_MAX_SIZE             0x1000000
+
+typedef struct _VIGEM_TIMELINE_HEADER
+{
+    //
+    // VIGEM_TIMELINE_MAGIC
+    // 
+    ULONG Magic;
+
+    //
+    // VIGEM_TIMELINE_VERSION
+    // 
+    USHORT Version;
+
+    //
+    // Size of the report of each entry, must match the target type
+    // 
+    USHORT ReportSize;
+
+    //
+    // Device type the reports are laid out for
+    // 
+    ULONG TargetType;
+
+    //
+    // Number of entries following the header
+    // 
+    ULONG EntryCount;
+
+    //
+    // Length of one pass in microseconds
+    // 
+    ULONG64 DurationUs;
+
+} VIGEM_TIMELINE_HEADER, *PVIGEM_TIMELINE_HEADER;
+
+//
+// Size of a single timeline entry
+// 
+#define VIGEM_TIMELINE_ENTRY_SIZE(_report_size_) \
+    (sizeof(ULONG) + (_report_size_))
+
+//
+// Size of a complete timeline of _count_ entries
+// 
+#define VIGEM_TIMELINE_SIZE(_report_size_, _count_) \
+    (sizeof(VIGEM_TIMELINE_HEADER) + (ULONG64)(_count_) * VIGEM_TIMELINE_ENTRY_SIZE(_report_size_))
+
+//
+// Uploads a timeline for a device, replacing the previous one.
+// 
+// Fails with STATUS_DEVICE_BUSY while a playback is running.
+// 
+typedef struct _VIGEM_PLAYBACK_LOAD
+{
+    //
+    // sizeof(struct _VIGEM_PLAYBACK_LOAD)
+    // 
+    ULONG Size;
+
+    //
+    // Serial number of target device
+    // 
+    ULONG SerialNo;
+
+    //
+    // Timeline header, the entries directly follow it
+    // 
+    VIGEM_TIMELINE_HEADER Timeline;
+
+} VIGEM_PLAYBACK_LOAD, *PVIGEM_PLAYBACK_LOAD;
+
+VOID FORCEINLINE VIGEM_PLAYBACK_LOAD_INIT(
+    _Out_ PVIGEM_PLAYBACK_LOAD Load,
+    _In_ ULONG SerialNo
+)
+{
+    RtlZeroMemory(Load, sizeof(VIGEM_PLAYBACK_LOAD));
+
+    Load->Size = sizeof(VIGEM_PLAYBACK_LOAD);
+    Load->SerialNo = SerialNo;
+}
+
+typedef enum _VIGEM_PLAYBACK_OPERATION
+{
+    //
+    // Starts playing the loaded timeline from its beginning
+    // 
+    ViGEmPlaybackStart,
+
+    //
+    // Stops the playback, the last played report stays in effect
+    // 
+    ViGEmPlaybackStop,
+
+    //
+    // Only returns the playback statistics
+    // 
+    ViGEmPlaybackQuery
+
+} VIGEM_PLAYBACK_OPERATION, *PVIGEM_PLAYBACK_OPERATION;
+
+//
+// Restart the timeline after each pass until stopped
+// 
+#define VIGEM_PLAYBACK_FLAG_LOOP            0x01
+
+//
+// Controls the playback of a loaded timeline and returns its statistics.
+// 
+// Jitter is the time an entry got played at minus the time it was
+// scheduled for, in microseconds.
+// 
+typedef struct _VIGEM_PLAYBACK_CONTROL
+{
+    //
+    // sizeof(struct _VIGEM_PLAYBACK_CONTROL)
+    // 
+    ULONG Size;
+
+    //
+    // Serial number of target device
+    // 
+    ULONG SerialNo;
+
+    //
+    // Action to take
+    // 
+    VIGEM_PLAYBACK_OPERATION Operation;
+
+    //
+    // VIGEM_PLAYBACK_FLAG_* applied on start
+    // 
+    ULONG Flags;
+
+    //
+    // TRUE while the playback runs (out)
+    // 
+    BOOLEAN Playing;
+
+    //
+    // Index of the next entry to play (out)
+    // 
+    ULONG EntryIndex;
+
+    //
+    // Number of completed passes of a looping playback (out)
+    // 
+    ULONG Loops;
+
+    //
+    // Number of entries played since the last start (out)
+    // 
+    ULONG64 Played;
+
+    //
+    // Smallest jitter seen (out)
+    // 
+    LONG64 JitterMinUs;
+
+    //
+    // Largest jitter seen (out)
+    // 
+    LONG64 JitterMaxUs;
+
+    //
+    // Sum of all jitter values, divide by Played for the mean (out)
+    // 
+    LONG64 JitterSumUs;
+
+} VIGEM_PLAYBACK_CONTROL, *PVIGEM_PLAYBACK_CONTROL;
+
+VOID FORCEINLINE VIGEM_PLAYBACK_CONTROL_INIT(
+    _Out_ PVIGEM_PLAYBACK_CONTROL Control,
+    _In_ ULONG SerialNo,
+    _In_ VIGEM_PLAYBACK_OPERATION Operation,
+    _In_ ULONG Flags
+)
+{
+    RtlZeroMemory(Control, sizeof(VIGEM_PLAYBACK_CONTROL));
+
+    Control->Size = sizeof(VIGEM_PLAYBACK_CONTROL);
+    Control->SerialNo = SerialNo;
+    Control->Operation = Operation;
+    Control->Flags = Flags;
+}
+
+#pragma endregion
+
+#pragma region Analog interpolation
+
+#define IOCTL_VIGEM_SET_INTERPOLATION       BUSENUM_RW_IOCTL(IOCTL_VIGEM_BASE + 0x30C)
+
+typedef enum _VIGEM_INTERPOLATION_MODE
+{
+    //
+    // IN URBs carry the last submitted report as is
+    // 
+    ViGEmInterpolationOff,
+
+    //
+    // Axes move linearly from the second to last to the last submitted
+    // report over one submission interval; adds one interval of latency
+    // 
+    ViGEmInterpolationLinear,
+
+    //
+    // Axes continue the motion between the last two submitted reports for
+    // at most one interval and return to the last report once the feeder
+    // missed two intervals
+    // 
+    ViGEmInterpolationExtrapolate
+
+} VIGEM_INTERPOLATION_MODE, *PVIGEM_INTERPOLATION_MODE;
+
+//
+// Sets how analog axes and triggers of IN URBs completed in between two
+// submissions get derived from the last two submitted reports.
+// 
+// Buttons always stay as submitted. Submissions further apart than
+// VIGEM_INTERPOLATION_MAX_INTERVAL_MS are treated as a step.
+// 
+typedef struct _VIGEM_SET_INTERPOLATION
+{
+    //
+    // sizeof(struct _VIGEM_SET_INTERPOLATION)
+    // 
+    ULONG Size;
+
+    //
+    // Serial number of target device
+    // 
+    ULONG SerialNo;
+
+    //
+    // Mode to apply
+    // 
+    VIGEM_INTERPOLATION_MODE Mode;
+
+} VIGEM_SET_INTERPOLATION, *PVIGEM_SET_INTERPOLATION;
+
+#define VIGEM_INTERPOLATION_MAX_INTERVAL_MS 0x64
+
+VOID FORCEINLINE VIGEM_SET_INTERPOLATION_INIT(
+    _Out_ PVIGEM_SET_INTERPOLATION Interpolation,
+    _In_ ULONG SerialNo,
+    _In_ VIGEM_INTERPOLATION_MODE Mode
+)
+{
+    RtlZeroMemory(Interpolation, sizeof(VIGEM_SET_INTERPOLATION));
+
+    Interpolation->Size = sizeof(VIGEM_SET_INTERPOLATION);
+    Interpolation->SerialNo = SerialNo;
+    Interpolation->Mode = Mode;
+}
+
+#pragma endregion
+
+#pragma region Report transform stage
+
+#define IOCTL_VIGEM_SET_TRANSFORM           BUSENUM_RW_IOCTL(IOCTL_VIGEM_BASE + 0x30D)
+
+//
+// Number of bits in the button word a transform remaps
+// 
+#define VIGEM_TRANSFORM_BUTTONS             0x10
+
+//
+// ButtonMap entry for an output button that is never pressed
+// 
+#define VIGEM_TRANSFORM_BUTTON_NONE         0xFF
+
+//
+// Apply ButtonMap to submitted reports
+// 
+#define VIGEM_TRANSFORM_FLAG_REMAP_BUTTONS  0x01
+
+//
+// Sizes of the lookup table of an 8-bit and a 16-bit field
+// 
+#define VIGEM_TRANSFORM_TABLE_SIZE_8        (0x100 * sizeof(UCHAR))
+#define VIGEM_TRANSFORM_TABLE_SIZE_16       (0x10000 * sizeof(USHORT))
+
+//
+// Sets the transform every report submitted to a device goes through
+// before it gets cached, replacing the previous one.
+// 
+// Lookup tables directly follow this structure, one per bit set in
+// AxisMask in ascending bit order. A table maps the raw value of its
+// field to the value to use instead; 16-bit fields are indexed with their
+// value reinterpreted as USHORT.
+// 
+// The button word is wButtons for XUSB and DS4 (where bits 0 to 3 hold the
+// d-pad hat and should map to themselves) and Buttons1/Buttons2 for XGIP.
+// 
+// An AxisMask of 0 without VIGEM_TRANSFORM_FLAG_REMAP_BUTTONS removes the
+// transform.
+// 
+typedef struct _VIGEM_SET_TRANSFORM
+{
+    //
+    // sizeof(struct _VIGEM_SET_TRANSFORM)
+    // 
+    ULONG Size;
+
+    //
+    // Serial number of target device
+    // 
+    ULONG SerialNo;
+
+    //
+    // VIGEM_TRANSFORM_FLAG_*
+    // 
+    ULONG Flags;
+
+    //
+    // Analog fields a table is supplied for, VIGEM_FIELD_BIT of the target type's field enum
+    // 
+    ULONG AxisMask;
+
+    //
+    // Source bit of each bit of the button word, or VIGEM_TRANSFORM_BUTTON_NONE
+    // 
+    UCHAR ButtonMap[VIGEM_TRANSFORM_BUTTONS];
+
+} VIGEM_SET_TRANSFORM, *PVIGEM_SET_TRANSFORM;
+
+VOID FORCEINLINE VIGEM_SET_TRANSFORM_INIT(
+    _Out_ PVIGEM_SET_TRANSFORM Transform,
+    _In_ ULONG SerialNo
+)
+{
+    UCHAR i;
+
+    RtlZeroMemory(Transform, sizeof(VIGEM_SET_TRANSFORM));
+
+    Transform->Size = sizeof(VIGEM_SET_TRANSFORM);
+    Transform->SerialNo = SerialNo;
+
+    for (i = 0; i < VIGEM_TRANSFORM_BUTTONS; i++)
+    {
+        Transform->ButtonMap[i] = i;
+    }
+}
+
+#pragma endregion
+
+#pragma region Canonical gamepad state
+
+#define IOCTL_VIGEM_SUBMIT_GAMEPAD_STATE    BUSENUM_RW_IOCTL(IOCTL_VIGEM_BASE + 0x30E)
+
+//
+// Buttons of the canonical gamepad state; the layout matches XUSB_GAMEPAD_*
+// with the touchpad click taking the bit XUSB leaves unused
+// 
+#define VIGEM_GAMEPAD_DPAD_UP               0x0001
+#define VIGEM_GAMEPAD_DPAD_DOWN             0x0002
+#define VIGEM_GAMEPAD_DPAD_LEFT             0x0004
+#define VIGEM_GAMEPAD_DPAD_RIGHT            0x0008
+#define VIGEM_GAMEPAD_START                 0x0010
+#define VIGEM_GAMEPAD_BACK                  0x0020
+#define VIGEM_GAMEPAD_LEFT_THUMB            0x0040
+#define VIGEM_GAMEPAD_RIGHT_THUMB           0x0080
+#define VIGEM_GAMEPAD_LEFT_SHOULDER         0x0100
+#define VIGEM_GAMEPAD_RIGHT_SHOULDER        0x0200
+#define VIGEM_GAMEPAD_GUIDE                 0x0400
+#define VIGEM_GAMEPAD_TOUCHPAD              0x0800
+#define VIGEM_GAMEPAD_A                     0x1000
+#define VIGEM_GAMEPAD_B                     0x2000
+#define VIGEM_GAMEPAD_X                     0x4000
+#define VIGEM_GAMEPAD_Y                     0x8000
+
+//
+// Motion fields of the state are valid
+// 
+#define VIGEM_GAMEPAD_FLAG_MOTION           0x01
+
+//
+// Touch fields of the state are valid
+// 
+#define VIGEM_GAMEPAD_FLAG_TOUCH            0x02
+
+//
+// Extent of the touch surface
+// 
+#define VIGEM_GAMEPAD_TOUCH_WIDTH           1920
+#define VIGEM_GAMEPAD_TOUCH_HEIGHT          943
+
+//
+// A finger on the touch surface
+// 
+typedef struct _VIGEM_GAMEPAD_TOUCH
+{
+    //
+    // Tracking number, stays the same while the finger is down
+    // 
+    UCHAR Id;
+
+    //
+    // TRUE while the finger is down
+    // 
+    BOOLEAN Active;
+
+    //
+    // Position, 0 to VIGEM_GAMEPAD_TOUCH_WIDTH - 1
+    // 
+    USHORT X;
+
+    //
+    // Position, 0 to VIGEM_GAMEPAD_TOUCH_HEIGHT - 1
+    // 
+    USHORT Y;
+
+} VIGEM_GAMEPAD_TOUCH, *PVIGEM_GAMEPAD_TOUCH;
+
+//
+// Gamepad state independent of the type of device it is submitted to
+// 
+typedef struct _VIGEM_GAMEPAD_STATE
+{
+    //
+    // VIGEM_GAMEPAD_* button bits
+    // 
+    USHORT Buttons;
+
+    //
+    // Analog triggers, 0 to 65535
+    // 
+    USHORT LeftTrigger;
+    USHORT RightTrigger;
+
+    //
+    // Thumb sticks, positive vertical values point up
+    // 
+    SHORT ThumbLX;
+    SHORT ThumbLY;
+    SHORT ThumbRX;
+    SHORT ThumbRY;
+
+    //
+    // VIGEM_GAMEPAD_FLAG_*
+    // 
+    USHORT Flags;
+
+    //
+    // Angular velocity (X, Y, Z) in raw sensor units
+    // 
+    SHORT Gyro[3];
+
+    //
+    // Acceleration (X, Y, Z) in raw sensor units
+    // 
+    SHORT Accel[3];
+
+    //
+    // Up to two fingers on the touch surface
+    // 
+    VIGEM_GAMEPAD_TOUCH Touch[2];
+
+} VIGEM_GAMEPAD_STATE, *PVIGEM_GAMEPAD_STATE;
+
+//
+// Submits a canonical gamepad state, the bus encodes it into the native
+// report of whatever type the device was plugged in as.
+// 
+// Devices without motion sensors or touch surface ignore those fields,
+// as do XGIP devices the guide button (it's not part of their report).
+// 
+// The output buffer, if supplied, receives the VIGEM_REPORT_DISPOSITION.
+// 
+typedef struct _VIGEM_SUBMIT_GAMEPAD_STATE
+{
+    //
+    // sizeof(struct _VIGEM_SUBMIT_GAMEPAD_STATE)
+    // 
+    ULONG Size;
+
+    //
+    // Serial number of target device
+    // 
+    ULONG SerialNo;
+
+    //
+    // State to encode and submit
+    // 
+    VIGEM_GAMEPAD_STATE State;
+
+} VIGEM_SUBMIT_GAMEPAD_STATE, *PVIGEM_SUBMIT_GAMEPAD_STATE;
+
+VOID FORCEINLINE VIGEM_SUBMIT_GAMEPAD_STATE_INIT(
+    _Out_ PVIGEM_SUBMIT_GAMEPAD_STATE Submit,
+    _In_ ULONG SerialNo
+)
+{
+    RtlZeroMemory(Submit, sizeof(VIGEM_SUBMIT_GAMEPAD_STATE));
+
+    Submit->Size = sizeof(VIGEM_SUBMIT_GAMEPAD_STATE);
+    Submit->SerialNo = SerialNo;
+}
+
+#pragma endregion
+
+#pragma region Report FIFO
+
+#define IOCTL_VIGEM_REPORT_FIFO             BUSENUM_RW_IOCTL(IOCTL_VIGEM_BASE + 0x30F)
+
+//
+// Largest number of reports a FIFO can hold
+// 
+#define VIGEM_REPORT_FIFO_MAX_CAPACITY      1024
+
+//
+// What happens to a report submitted to a full FIFO
+// 
+typedef enum _VIGEM_REPORT_FIFO_POLICY
+{
+    //
+    // The submitted report is refused
+    // 
+    ViGEmReportFifoDropNewest,
+
+    //
+    // The oldest queued report is discarded to make room
+    // 
+    ViGEmReportFifoDropOldest
+
+} VIGEM_REPORT_FIFO_POLICY, *PVIGEM_REPORT_FIFO_POLICY;
+
+typedef enum _VIGEM_REPORT_FIFO_OPERATION
+{
+    //
+    // Enable the FIFO with the given capacity and policy, emptying it if it was enabled
+    // 
+    ViGEmReportFifoEnable,
+
+    //
+    // Go back to delivering the latest report only
+    // 
+    ViGEmReportFifoDisable,
+
+    //
+    // Only return the counters
+    // 
+    ViGEmReportFifoQuery
+
+} VIGEM_REPORT_FIFO_OPERATION, *PVIGEM_REPORT_FIFO_OPERATION;
+
+//
+// Controls the report FIFO of a device.
+// 
+// Without FIFO every IN URB gets the latest submitted report and reports
+// submitted in between polls are lost. With it, submitted reports queue up
+// and every IN URB takes the next one; an empty FIFO repeats the last.
+// 
+// Delta submissions are refused while the FIFO is enabled.
+// 
+// Counters are returned in the output buffer and start over when the
+// FIFO gets enabled.
+// 
+typedef struct _VIGEM_REPORT_FIFO
+{
+    //
+    // sizeof(struct _VIGEM_REPORT_FIFO)
+    // 
+    ULONG Size;
+
+    //
+    // Serial number of target device
+    // 
+    ULONG SerialNo;
+
+    VIGEM_REPORT_FIFO_OPERATION Operation;
+
+    //
+    // Number of reports to hold, a power of two up to VIGEM_REPORT_FIFO_MAX_CAPACITY
+    // 
+    ULONG Capacity;
+
+    VIGEM_REPORT_FIFO_POLICY Policy;
+
+    //
+    // Number of reports currently queued (out)
+    // 
+    ULONG Depth;
+
+    //
+    // Highest number of reports ever queued (out)
+    // 
+    ULONG HighWater;
+
+    //
+    // Number of reports queued (out)
+    // 
+    ULONG64 Queued;
+
+    //
+    // Number of queued reports handed to IN URBs (out)
+    // 
+    ULONG64 Delivered;
+
+    //
+    // Number of IN URBs that found the FIFO empty and got the last report again (out)
+    // 
+    ULONG64 Repeated;
+
+    //
+    // Number of reports refused by ViGEmReportFifoDropNewest (out)
+    // 
+    ULONG64 Refused;
+
+    //
+    // Number of queued reports discarded by ViGEmReportFifoDropOldest (out)
+    // 
+    ULONG64 Evicted;
+
+    //
+    // Longest time a report spent queued, in microseconds (out)
+    // 
+    ULONG64 MaxWaitUs;
+
+} VIGEM_REPORT_FIFO, *PVIGEM_REPORT_FIFO;
+
+VOID FORCEINLINE VIGEM_REPORT_FIFO_INIT(
+    _Out_ PVIGEM_REPORT_FIFO Fifo,
+    _In_ ULONG SerialNo,
+    _In_ VIGEM_REPORT_FIFO_OPERATION Operation
+)
+{
+    RtlZeroMemory(Fifo, sizeof(VIGEM_REPORT_FIFO));
+
+    Fifo->Size = sizeof(VIGEM_REPORT_FIFO);
+    Fifo->SerialNo = SerialNo;
+    Fifo->Operation = Operation;
+}
+
+#pragma endregion
+
+#pragma region Handle binding
+
+#define IOCTL_VIGEM_BIND_TARGET             BUSENUM_RW_IOCTL(IOCTL_VIGEM_BASE + 0x310)
+
+//
+// Binds the calling handle to one of the targets it plugged in
+// 
+// Submits and notification requests sent through a bound handle for that
+// serial skip the target lookup and the ownership check. A handle that isn't
+// bound gets bound to the next target it plugs in once the bus created it;
+// a plug-in that fails before leaves the handle unbound.
+// 
+typedef struct _VIGEM_BIND_TARGET
+{
+    //
+    // sizeof(struct _VIGEM_BIND_TARGET)
+    // 
+    ULONG Size;
+
+    //
+    // Serial number of target device, 0 to drop the binding
+    // 
+    ULONG SerialNo;
+
+    //
+    // Serial number the handle was bound to before this request (out)
+    // 
+    ULONG PreviousSerialNo;
+
+} VIGEM_BIND_TARGET, *PVIGEM_BIND_TARGET;
+
+VOID FORCEINLINE VIGEM_BIND_TARGET_INIT(
+    _Out_ PVIGEM_BIND_TARGET Bind,
+    _In_ ULONG SerialNo
+)
+{
+    RtlZeroMemory(Bind, sizeof(VIGEM_BIND_TARGET));
+
+    Bind->Size = sizeof(VIGEM_BIND_TARGET);
+    Bind->SerialNo = SerialNo;
+}
+
+#pragma endregion
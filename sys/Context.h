@@ -71,6 +71,180 @@ typedef struct _PDO_IDENTIFICATION_DESCRIPTION
 
 } PDO_IDENTIFICATION_DESCRIPTION, *PPDO_IDENTIFICATION_DESCRIPTION;
 
+struct _PDO_DEVICE_DATA;
+
+//
+// Location of a single field within an input report
+// 
+typedef struct _VIGEM_REPORT_FIELD
+{
+    USHORT Offset;
+
+    USHORT Length;
+
+} VIGEM_REPORT_FIELD, *PVIGEM_REPORT_FIELD;
+
+#define VIGEM_REPORT_FIELD_OF(_type_, _field_) \
+    { FIELD_OFFSET(_type_, _field_), RTL_FIELD_SIZE(_type_, _field_) }
+
+//
+// Value range of an analog input report field
+// 
+typedef enum _VIGEM_AXIS_TYPE
+{
+    //
+    // 0 to 255
+    // 
+    ViGEmAxisUnsigned8,
+
+    //
+    // -32768 to 32767
+    // 
+    ViGEmAxisSigned16,
+
+    //
+    // 0 to 1023, stored in 16 bits
+    // 
+    ViGEmAxisUnsigned10
+
+} VIGEM_AXIS_TYPE;
+
+//
+// Location and range of an analog axis within an input report
+// 
+typedef struct _VIGEM_REPORT_AXIS
+{
+    USHORT Offset;
+
+    USHORT Type;
+
+} VIGEM_REPORT_AXIS, *PVIGEM_REPORT_AXIS;
+
+#define VIGEM_REPORT_AXIS_OF(_type_, _field_, _axis_) \
+    { FIELD_OFFSET(_type_, _field_), _axis_ }
+
+//
+// Target type specific behaviour, bound to a PDO once on creation.
+// 
+typedef struct _VIGEM_TARGET_OPS
+{
+    //
+    // Device type implemented
+    // 
+    VIGEM_TARGET_TYPE TargetType;
+
+    //
+    // Size of the complete configuration descriptor
+    // 
+    ULONG DescriptorSize;
+
+    //
+    // Minimum URB length of a configuration selection
+    // 
+    ULONG ConfigurationSize;
+
+    //
+    // Size of the target's input report
+    // 
+    ULONG ReportSize;
+
+    //
+    // Fields of the target's input report, in delta submission bit order
+    // 
+    const VIGEM_REPORT_FIELD* Fields;
+
+    //
+    // Number of entries in Fields
+    // 
+    ULONG FieldCount;
+
+    //
+    // Analog axes and triggers of the target's input report
+    // 
+    const VIGEM_REPORT_AXIS* Axes;
+
+    //
+    // Number of entries in Axes, at most AXES_BLEND_LANES
+    // 
+    ULONG AxisCount;
+
+    //
+    // Offset of the input report within an IN URB transfer buffer
+    // 
+    ULONG UrbReportOffset;
+
+    //
+    // Offset of the 16-bit button word within the input report
+    // 
+    ULONG ButtonsOffset;
+
+    //
+    // Sets device description and hardware IDs before the PDO is created
+    // 
+    NTSTATUS(*PreparePdo)(
+        PWDFDEVICE_INIT DeviceInit,
+        PPDO_IDENTIFICATION_DESCRIPTION Description,
+        PUNICODE_STRING DeviceId,
+        PUNICODE_STRING DeviceDescription);
+
+    //
+    // Initializes the target context of a newly created PDO
+    // 
+    NTSTATUS(*AssignPdoContext)(WDFDEVICE Device, PPDO_IDENTIFICATION_DESCRIPTION Description);
+
+    //
+    // Exposes target specific interfaces on power-up
+    // 
+    NTSTATUS(*PrepareHardware)(WDFDEVICE Device);
+
+    VOID(*GetDeviceDescriptorType)(PUSB_DEVICE_DESCRIPTOR pDescriptor, struct _PDO_DEVICE_DATA* pCommon);
+
+    VOID(*GetConfigurationDescriptorType)(PUCHAR Buffer, ULONG Length);
+
+    VOID(*SelectConfiguration)(PUSBD_INTERFACE_INFORMATION pInfo);
+
+    //
+    // Handles IN and OUT interrupt transfers
+    // 
+    NTSTATUS(*BulkOrInterruptTransfer)(PURB Urb, WDFDEVICE Device, WDFREQUEST Request);
+
+    //
+    // Stores a submitted report in the report cache; Queue receives the queue
+    // of IN URBs waiting for it, or NULL if there is nothing to deliver.
+    // 
+    // If MergeMask is set only the report bytes it covers get submitted,
+    // the rest is taken from the cache within the same write section.
+    // 
+    NTSTATUS(*CacheReport)(WDFDEVICE Device, PVOID Report, const UCHAR* MergeMask, WDFQUEUE* Queue);
+
+    //
+    // Wraps a bare report in the submit structure of the target type
+    // 
+    VOID(*WrapReport)(PVOID Submit, ULONG SerialNo, PVIGEM_TARGET_REPORT Report);
+
+    //
+    // Extracts the bare report from the submit structure of the target type,
+    // returns FALSE if the submission carries no input report
+    // 
+    BOOLEAN(*UnwrapReport)(PVOID Submit, PVIGEM_TARGET_REPORT Report);
+
+    //
+    // Copies the report cache into an IN URB transfer buffer
+    // 
+    VOID(*CopyReportToUrb)(WDFDEVICE Device, PURB Urb);
+
+    //
+    // Returns the queue the target parks input report IN URBs in
+    // 
+    WDFQUEUE(*GetInRequestQueue)(WDFDEVICE Device);
+
+    //
+    // Parks a user-mode notification request, NULL if not supported
+    // 
+    NTSTATUS(*QueueNotification)(WDFDEVICE Device, WDFREQUEST Request);
+
+} VIGEM_TARGET_OPS, *PVIGEM_TARGET_OPS;
+
 //
 // The PDO device-extension (context).
 //
@@ -86,11 +260,21 @@ typedef struct _PDO_DEVICE_DATA
     // 
     DWORD OwnerProcessId;
 
+    //
+    // SessionId of the file handle that plugged in this PDO
+    // 
+    LONG SessionId;
+
     //
     // Device type this PDO is emulating
     // 
     VIGEM_TARGET_TYPE TargetType;
 
+    //
+    // Operations of TargetType
+    // 
+    const VIGEM_TARGET_OPS* Ops;
+
     //
     // If set, the vendor ID the emulated device is reporting
     // 
@@ -116,10 +300,240 @@ typedef struct _PDO_DEVICE_DATA
     //
     WDFQUEUE PendingNotificationRequests;
 
+    //
+    // Set while the report cache holds an update no IN URB has picked up yet
+    // 
+    volatile LONG ReportPending;
+
+    //
+    // Guards the target specific report cache against concurrent submitters
+    // and torn reads
+    // 
+    SEQLOCK ReportLock;
+
+    //
+    // Link in the bus serial index; its rundown is held by every caller a
+    // lookup handed this PDO to and drained on cleanup
+    // 
+    SERIAL_INDEX_ENTRY IndexEntry;
+
+    //
+    // Link in the device list of the owning session
+    // 
+    LIST_ENTRY SessionEntry;
+
+    //
+    // Shared input slot page this PDO is bound to, if any
+    // 
+    WDFMEMORY InputSlots;
+
+    //
+    // Input slot the driver pulls reports from, NULL if unbound
+    // 
+    PVIGEM_INPUT_SLOT volatile InputSlot;
+
+    //
+    // Index of the bound input slot within the page
+    // 
+    ULONG InputSlotIndex;
+
+    //
+    // Sequence of the last slot contents submitted to the cache
+    // 
+    LONG InputSlotSequence;
+
+    //
+    // Periodic timer pulling the input slot for non-polled targets
+    // 
+    WDFTIMER InputSlotTimer;
+
+    //
+    // Live framework objects created on behalf of this PDO
+    // 
+    volatile LONG LiveObjects[VIGEM_RESOURCE_TYPES];
+
+    //
+    // Handling of submitted reports equal to the cached one
+    // 
+    VIGEM_DEDUPE_POLICY DedupePolicy;
+
+    //
+    // Per-processor report counters, indexed by processor number
+    // 
+    struct _PDO_REPORT_COUNTERS* ReportCounters;
+
+    //
+    // Number of entries in ReportCounters
+    // 
+    ULONG ReportCountersCount;
+
+    //
+    // Bus state table this PDO's row lives in, NULL until it got added
+    // 
+    PSTATE_TABLE StateTable;
+
+    //
+    // Submitters waiting for their report to be picked up by an IN URB
+    // 
+    WDFQUEUE PendingDeliveryWaiters;
+
+    //
+    // Completes delivery waiters whose deadline passed
+    // 
+    WDFTIMER DeliveryWaitTimer;
+
+    //
+    // Guards DeliveryWaitDeadline and arming DeliveryWaitTimer
+    // 
+    WDFSPINLOCK DeliveryWaitLock;
+
+    //
+    // Performance counter value DeliveryWaitTimer is armed for, MAXLONG64 if idle
+    // 
+    LONG64 DeliveryWaitDeadline;
+
+    //
+    // Report cache versions copied to IN URBs and submitters waiting for them
+    // 
+    DELIVERY_TRACKER Delivery;
+
+    //
+    // Serial of the mirror group leader this PDO is a member of, 0 if none
+    // 
+    ULONG MirrorLeader;
+
+    //
+    // Guards the member list against torn reads by submitters
+    // 
+    SEQLOCK MirrorMembersLock;
+
+    //
+    // Number of PDOs mirroring the reports of this one
+    // 
+    volatile LONG MirrorCount;
+
+    //
+    // Serials of the PDOs mirroring the reports of this one
+    // 
+    ULONG MirrorMembers[VIGEM_MIRROR_MAX_MEMBERS];
+
+    //
+    // Set once the PDO left mirroring for good, guarded by MirrorLock
+    // 
+    BOOLEAN MirrorReleased;
+
+    //
+    // One-shot timer playing back an uploaded timeline, NULL until the first upload
+    // 
+    WDFTIMER PlaybackTimer;
+
+    //
+    // Blending of analog axes between the last two submitted reports, a
+    // VIGEM_INTERPOLATION_MODE; set with InterlockedExchange, readers take
+    // it once per pass with ReadNoFence
+    // 
+    volatile LONG InterpolationMode;
+
+    //
+    // Guards the submission history below
+    // 
+    SEQLOCK InterpolationLock;
+
+    //
+    // Performance counter values of the last two submissions, [1] is the newest
+    // 
+    LONG64 InterpolationTime[2];
+
+    //
+    // Axes of the last two submissions widened to SHORT, [1] is the newest
+    // 
+    SHORT InterpolationAxes[2][AXES_BLEND_LANES];
+
+    //
+    // Periodic timer completing IN URBs in between submissions for
+    // targets the host doesn't poll on its own, NULL until first enabled
+    // 
+    WDFTIMER InterpolationTimer;
+
+    //
+    // Transform applied to submitted reports, NULL if none
+    // 
+    const struct _TRANSFORM* Transform;
+
+    //
+    // Buffer holding Transform
+    // 
+    WDFMEMORY TransformMemory;
+
+    //
+    // Keeps Transform alive while a submission uses it
+    // 
+    WDFSPINLOCK TransformLock;
+
+    //
+    // Queue of submitted reports waiting for IN URBs, NULL if disabled
+    // 
+    struct _REPORT_FIFO* ReportFifo;
+
+    //
+    // Buffer holding ReportFifo
+    // 
+    WDFMEMORY ReportFifoMemory;
+
+    //
+    // Serialize submissions and deliveries among themselves; swapping the
+    // FIFO takes both, in this order
+    // 
+    WDFSPINLOCK ReportFifoPushLock;
+    WDFSPINLOCK ReportFifoPopLock;
+
 } PDO_DEVICE_DATA, *PPDO_DEVICE_DATA;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(PDO_DEVICE_DATA, PdoGetData)
 
+//
+// Report counters of a PDO kept by one processor.
+// 
+// Every processor only ever touches its own cache line so submitters
+// on different processors don't contend; readers sum up all blocks.
+// 
+typedef struct DECLSPEC_CACHEALIGN _PDO_REPORT_COUNTERS
+{
+    //
+    // Number of reports submitted
+    // 
+    volatile LONG64 Submitted;
+
+    //
+    // Number of submitted reports equal to the cached one
+    // 
+    volatile LONG64 Duplicates;
+
+    //
+    // Number of submitted reports per VIGEM_REPORT_DISPOSITION
+    // 
+    volatile LONG64 Dispositions[VIGEM_REPORT_DISPOSITIONS];
+
+} PDO_REPORT_COUNTERS, *PPDO_REPORT_COUNTERS;
+
+//
+// Counters of the current processor; stale if the caller gets rescheduled,
+// which only costs an uncontended interlocked operation on another line.
+// 
+FORCEINLINE
+PPDO_REPORT_COUNTERS
+PdoGetReportCounters(
+    _In_ PPDO_DEVICE_DATA PdoData
+)
+{
+    return &PdoData->ReportCounters[KeGetCurrentProcessorNumberEx(NULL)];
+}
+
+//
+// Number of serials the bus can assign on its own (serial 0 is never used)
+// 
+#define FDO_SERIAL_BITMAP_SIZE      SERIAL_ALLOCATOR_SERIALS
+
 //
 // FDO (bus device) context data
 // 
@@ -136,20 +550,75 @@ typedef struct _FDO_DEVICE_DATA
     LONG NextSessionId;
 
     //
-    // Collection holding pending plugin requests
+    // Serial-keyed table and timing wheel of pending plugin requests
     // 
-    WDFCOLLECTION PendingPluginRequests;
+    PLUGIN_TABLE PendingPlugins;
 
     //
-    // Sync lock for pending request collection
+    // Sync lock for pending request table and wheel
     // 
     WDFSPINLOCK PendingPluginRequestsLock;
 
+    //
+    // Plugin latency statistics, guarded by PendingPluginRequestsLock
+    // 
+    VIGEM_PLUGIN_STATS PluginStats;
+
     //
     // Periodic timer sweeping up orphaned requests
     // 
     WDFTIMER PendingPluginRequestsCleanupTimer;
 
+    //
+    // Serial-keyed index of created PDOs
+    // 
+    SERIAL_INDEX PdoIndex;
+
+    //
+    // Serials in use or reserved by pending plugin requests
+    // 
+    SERIAL_ALLOCATOR Serials;
+
+    //
+    // Open sessions (file handles) keyed by SessionId
+    // 
+    SESSION_INDEX Sessions;
+
+    //
+    // Sync lock for session index and per-session device lists
+    // 
+    WDFWAITLOCK SessionIndexLock;
+
+    //
+    // Sync lock serializing input slot mapping and binding
+    // 
+    WDFWAITLOCK InputSlotsLock;
+
+    //
+    // Sync lock serializing mirror group changes
+    // 
+    WDFWAITLOCK MirrorLock;
+
+    //
+    // Live framework objects created by the bus and its PDOs
+    // 
+    volatile LONG LiveObjects[VIGEM_RESOURCE_TYPES];
+
+    //
+    // Number of device interfaces registered
+    // 
+    volatile LONG LiveInterfaces;
+
+    //
+    // Set once the USB device interface shared by all PDOs got registered
+    // 
+    volatile LONG UsbInterfaceCreated;
+
+    //
+    // Current input state of all PDOs
+    // 
+    PSTATE_TABLE StateTable;
+
 } FDO_DEVICE_DATA, *PFDO_DEVICE_DATA;
 
 #define FDO_FIRST_SESSION_ID 100
@@ -162,9 +631,46 @@ WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(FDO_DEVICE_DATA, FdoGetData)
 typedef struct _FDO_FILE_DATA
 {
     //
-    // SessionId associated with file handle.  Used to map file handles to emulated gamepad devices
+    // SessionId and the PDOs plugged in through this session, linked in the
+    // session index of the bus
     // 
-    LONG SessionId;
+    SESSION_INDEX_SESSION Session;
+
+    //
+    // Shared input slot page of this session, created on first use
+    // 
+    WDFMEMORY InputSlots;
+
+    //
+    // MDL describing the input slot page
+    // 
+    PMDL InputSlotsMdl;
+
+    //
+    // Address the input slot page is mapped at in the owning process
+    // 
+    PVOID InputSlotsUserAddress;
+
+    //
+    // Referenced process the input slot page is mapped into
+    // 
+    PEPROCESS InputSlotsProcess;
+
+    //
+    // Serial number this handle is bound to, 0 if unbound
+    // 
+    ULONG BoundSerialNo;
+
+    //
+    // PDO of the bound serial once it exists, cleared when it goes away
+    // 
+    // Only PDOs of this session get bound, so ownership is settled at bind time.
+    // Changed under SessionIndexLock and BoundPdoLock held exclusive; submits
+    // take BoundPdoLock shared while they acquire the PDO's lookup rundown.
+    // 
+    WDFDEVICE BoundPdo;
+
+    EX_SPIN_LOCK BoundPdoLock;
 
 } FDO_FILE_DATA, *PFDO_FILE_DATA;
 
@@ -176,9 +682,9 @@ WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(FDO_FILE_DATA, FileObjectGetData)
 typedef struct _FDO_PLUGIN_REQUEST_DATA
 {
     //
-    // Unique serial number of the device on the bus
+    // Link in the pending plugin table, holds the serial of the device
     // 
-    ULONG Serial;
+    PLUGIN_TABLE_ENTRY PendingEntry;
 
     //
     // High resolution timestamp taken when this request got moved to pending state
@@ -190,7 +696,59 @@ typedef struct _FDO_PLUGIN_REQUEST_DATA
     // 
     LARGE_INTEGER Frequency;
 
+    //
+    // Number of bytes returned on completion (non-zero if the bus picked the serial)
+    // 
+    ULONG_PTR Information;
+
+    //
+    // Device type requested, used to attribute plugin statistics
+    // 
+    VIGEM_TARGET_TYPE TargetType;
+
 } FDO_PLUGIN_REQUEST_DATA, *PFDO_PLUGIN_REQUEST_DATA;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(FDO_PLUGIN_REQUEST_DATA, PluginRequestGetData)
 
+//
+// Accounting context attached to framework objects tracked by the bus
+// 
+typedef struct _TRACKED_OBJECT_DATA
+{
+    //
+    // Bus the object is accounted to
+    // 
+    WDFDEVICE Device;
+
+    //
+    // PDO the object got created for (referenced), NULL for bus objects
+    // 
+    WDFDEVICE Pdo;
+
+    //
+    // Object type
+    // 
+    VIGEM_RESOURCE_TYPE Type;
+
+} TRACKED_OBJECT_DATA, *PTRACKED_OBJECT_DATA;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(TRACKED_OBJECT_DATA, TrackedObjectGetData)
+
+//
+// Context of a request waiting for its report to be delivered
+// 
+typedef struct _DELIVERY_WAIT_DATA
+{
+    //
+    // ReportLock sequence the submitted report got cached at
+    // 
+    LONG Version;
+
+    //
+    // Performance counter value the wait expires at, MAXLONG64 for none
+    // 
+    LONG64 Deadline;
+
+} DELIVERY_WAIT_DATA, *PDELIVERY_WAIT_DATA;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DELIVERY_WAIT_DATA, DeliveryWaitGetData)
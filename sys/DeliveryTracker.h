@@ -0,0 +1,131 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+//
+// Tracks which report cache version reached the host and who waits for it.
+// 
+// A submitter waiting for delivery counts itself in before it submits, so
+// the IN URB copying its report, or a newer one, always finds it counted.
+// Deliveries nobody waits for skip the timestamp and the waiter queue walk;
+// those are the bulk of them, the host polls whether or not anyone waits.
+// 
+typedef struct _DELIVERY_TRACKER
+{
+    //
+    // ReportLock sequence of the last report cache copied to an IN URB
+    // 
+    volatile LONG DeliveredVersion;
+
+    //
+    // Submitters between counting themselves in and their wait ending
+    // 
+    volatile LONG WaiterCount;
+
+    //
+    // Performance counter value of the last copy to an IN URB made while
+    // someone waited
+    // 
+    volatile LONG64 LastDeliveryTime;
+
+} DELIVERY_TRACKER, *PDELIVERY_TRACKER;
+
+//
+// Counts a submitter in; has to happen before its report gets submitted.
+// 
+FORCEINLINE
+VOID
+DeliveryTrackerWaitBegin(
+    _Inout_ PDELIVERY_TRACKER Tracker
+)
+{
+    InterlockedIncrement(&Tracker->WaiterCount);
+}
+
+FORCEINLINE
+VOID
+DeliveryTrackerWaitEnd(
+    _Inout_ PDELIVERY_TRACKER Tracker
+)
+{
+    InterlockedDecrement(&Tracker->WaiterCount);
+}
+
+//
+// Returns TRUE if the report cache at Version or a newer one went out.
+// 
+FORCEINLINE
+BOOLEAN
+DeliveryTrackerIsDelivered(
+    _In_ PDELIVERY_TRACKER Tracker,
+    _In_ LONG Version
+)
+{
+    return ((LONG)((ULONG)ReadAcquire(&Tracker->DeliveredVersion) - (ULONG)Version) >= 0);
+}
+
+//
+// Records that the report cache at Version went out to the host.
+// 
+// QueryTime only gets called if someone waits. Returns TRUE if there are
+// waiters to release.
+// 
+FORCEINLINE
+BOOLEAN
+DeliveryTrackerDeliver(
+    _Inout_ PDELIVERY_TRACKER Tracker,
+    _In_ LONG Version,
+    _In_ LONG64(*QueryTime)(VOID)
+)
+{
+    BOOLEAN waiters = (ReadAcquire(&Tracker->WaiterCount) != 0);
+    LONG current;
+
+    // Stamped before the version, whoever sees the version sees its time
+    if (waiters)
+    {
+        InterlockedExchange64(&Tracker->LastDeliveryTime, QueryTime());
+    }
+
+    //
+    // Concurrent deliveries may finish out of order, only ever move forward;
+    // sequence numbers wrap, hence the unsigned difference
+    // 
+    do
+    {
+        current = ReadAcquire(&Tracker->DeliveredVersion);
+
+        if ((LONG)((ULONG)Version - (ULONG)current) <= 0)
+        {
+            break;
+        }
+
+    } while (InterlockedCompareExchange(&Tracker->DeliveredVersion, Version, current) != current);
+
+    return waiters;
+}
@@ -31,14 +31,54 @@
 
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text (INIT, DriverEntry)
+#pragma alloc_text (INIT, Bus_LoadTraceSettings)
 #pragma alloc_text (PAGE, Bus_EvtDeviceAdd)
 #pragma alloc_text (PAGE, Bus_DeviceFileCreate)
 #pragma alloc_text (PAGE, Bus_FileClose)
+#pragma alloc_text (PAGE, Bus_FileCleanup)
 #pragma alloc_text (PAGE, Bus_EvtDriverContextCleanup)
 #pragma alloc_text (PAGE, Bus_PdoStageResult)
 #endif
 
 
+//
+// Log every n-th hot-path trace call; 0 and 1 log all of them
+// 
+LONG TraceHotSampleRate = 1;
+volatile LONG TraceHotSampleCount = 0;
+
+//
+// Reads the trace settings from the driver's Parameters key.
+// 
+VOID Bus_LoadTraceSettings(WDFDRIVER Driver)
+{
+    NTSTATUS        status;
+    WDFKEY          keyParams;
+    ULONG           value;
+
+    DECLARE_CONST_UNICODE_STRING(valueName, L"HotPathTraceSampleRate");
+
+    status = WdfDriverOpenParametersRegistryKey(Driver, KEY_READ, WDF_NO_OBJECT_ATTRIBUTES, &keyParams);
+    if (!NT_SUCCESS(status))
+    {
+        return;
+    }
+
+    status = WdfRegistryQueryULong(keyParams, &valueName, &value);
+    if (NT_SUCCESS(status))
+    {
+        TraceHotSampleRate = (value > MAXLONG) ? MAXLONG : (LONG)value;
+    }
+
+    WdfRegistryClose(keyParams);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_DRIVER,
+        "Hot-path tracing %s, sample rate 1/%d",
+        VIGEM_HOT_PATH_TRACING ? "enabled" : "compiled out",
+        TraceHotSampleRate);
+}
+
 //
 // Driver entry routine.
 // 
@@ -76,6 +116,10 @@ NTSTATUS DriverEntry(IN PDRIVER_OBJECT DriverObject, IN PUNICODE_STRING Registry
         WPP_CLEANUP(DriverObject);
         KdPrint((DRIVERNAME "WdfDriverCreate failed with status 0x%x\n", status));
     }
+    else
+    {
+        Bus_LoadTraceSettings(driver);
+    }
 
     return status;
 }
@@ -100,6 +144,7 @@ NTSTATUS Bus_EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit)
     VIGEM_BUS_INTERFACE         busInterface;
     PINTERFACE                  interfaceHeader;
     WDF_TIMER_CONFIG            reqTimerCfg;
+    WDFMEMORY                   stateTableMemory;
 
     UNREFERENCED_PARAMETER(Driver);
 
@@ -125,7 +170,7 @@ NTSTATUS Bus_EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit)
 
 #pragma region Assign File Object Configuration
 
-    WDF_FILEOBJECT_CONFIG_INIT(&foConfig, Bus_DeviceFileCreate, Bus_FileClose, NULL);
+    WDF_FILEOBJECT_CONFIG_INIT(&foConfig, Bus_DeviceFileCreate, Bus_FileClose, Bus_FileCleanup);
 
     WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&fileHandleAttributes, FDO_FILE_DATA);
 
@@ -133,6 +178,9 @@ NTSTATUS Bus_EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit)
 
 #pragma endregion
 
+    // Some requests need the address space of the requesting process
+    WdfDeviceInitSetIoInCallerContextCallback(DeviceInit, Bus_EvtIoInCallerContext);
+
 #pragma region Create FDO
 
     WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&fdoAttributes, FDO_DEVICE_DATA);
@@ -162,36 +210,110 @@ NTSTATUS Bus_EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit)
 
 #pragma endregion
 
-#pragma region Create pending requests collection & lock
+#pragma region Create pending requests table & lock
+
+    PluginTableInit(&pFDOData->PendingPlugins);
 
     WDF_OBJECT_ATTRIBUTES_INIT(&collectionAttributes);
     collectionAttributes.ParentObject = device;
 
-    status = WdfCollectionCreate(&collectionAttributes, &pFDOData->PendingPluginRequests);
+    status = WdfSpinLockCreate(&collectionAttributes, &pFDOData->PendingPluginRequestsLock);
     if (!NT_SUCCESS(status))
     {
         TraceEvents(TRACE_LEVEL_ERROR,
             TRACE_DRIVER,
-            "WdfCollectionCreate failed with status %!STATUS!",
+            "WdfSpinLockCreate failed with status %!STATUS!",
             status);
         return STATUS_UNSUCCESSFUL;
     }
 
+#pragma endregion
+
+#pragma region Create serial allocator
+
+    SerialAllocatorInit(&pFDOData->Serials);
+
+#pragma endregion
+
+#pragma region Create session index & lock
+
+    SessionIndexInit(&pFDOData->Sessions);
+
     WDF_OBJECT_ATTRIBUTES_INIT(&collectionAttributes);
     collectionAttributes.ParentObject = device;
 
-    status = WdfSpinLockCreate(&collectionAttributes, &pFDOData->PendingPluginRequestsLock);
+    status = WdfWaitLockCreate(&collectionAttributes, &pFDOData->SessionIndexLock);
     if (!NT_SUCCESS(status))
     {
         TraceEvents(TRACE_LEVEL_ERROR,
             TRACE_DRIVER,
-            "WdfSpinLockCreate failed with status %!STATUS!",
+            "WdfWaitLockCreate (SessionIndexLock) failed with status %!STATUS!",
             status);
         return STATUS_UNSUCCESSFUL;
     }
 
 #pragma endregion
 
+#pragma region Create input slot lock
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&collectionAttributes);
+    collectionAttributes.ParentObject = device;
+
+    status = WdfWaitLockCreate(&collectionAttributes, &pFDOData->InputSlotsLock);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DRIVER,
+            "WdfWaitLockCreate (InputSlotsLock) failed with status %!STATUS!",
+            status);
+        return STATUS_UNSUCCESSFUL;
+    }
+
+#pragma endregion
+
+#pragma region Create mirror group lock
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&collectionAttributes);
+    collectionAttributes.ParentObject = device;
+
+    status = WdfWaitLockCreate(&collectionAttributes, &pFDOData->MirrorLock);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DRIVER,
+            "WdfWaitLockCreate (MirrorLock) failed with status %!STATUS!",
+            status);
+        return STATUS_UNSUCCESSFUL;
+    }
+
+#pragma endregion
+
+#pragma region Create bus state table
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&collectionAttributes);
+    collectionAttributes.ParentObject = device;
+
+    status = WdfMemoryCreate(&collectionAttributes,
+        NonPagedPoolNx,
+        VIGEM_POOL_TAG,
+        sizeof(STATE_TABLE),
+        &stateTableMemory,
+        (PVOID*)&pFDOData->StateTable);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DRIVER,
+            "WdfMemoryCreate (StateTable) failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    Bus_TrackObject(device, NULL, stateTableMemory, ViGEmResourceMemory);
+
+    StateTableInit(pFDOData->StateTable);
+
+#pragma endregion
+
 #pragma region Create timer for sweeping up orphaned requests
 
     WDF_TIMER_CONFIG_INIT_PERIODIC(
@@ -211,6 +333,8 @@ NTSTATUS Bus_EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit)
         return status;
     }
 
+    Bus_TrackObject(device, NULL, pFDOData->PendingPluginRequestsCleanupTimer, ViGEmResourceTimer);
+
 #pragma endregion
 
 #pragma region Add query interface
@@ -275,6 +399,8 @@ NTSTATUS Bus_EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit)
         return status;
     }
 
+    Bus_TrackObject(device, NULL, queue, ViGEmResourceQueue);
+
 #pragma endregion
 
 #pragma region Expose FDO interface
@@ -290,6 +416,8 @@ NTSTATUS Bus_EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit)
         return status;
     }
 
+    InterlockedIncrement(&pFDOData->LiveInterfaces);
+
 #pragma endregion
 
 #pragma region Set bus information
@@ -354,9 +482,11 @@ Bus_DeviceFileCreate(
             refCount = InterlockedIncrement(&pFDOData->InterfaceReferenceCounter);
             sessionId = InterlockedIncrement(&pFDOData->NextSessionId);
 
-            pFileData->SessionId = sessionId;
+            pFileData->Session.Id = sessionId;
             status = STATUS_SUCCESS;
 
+            Bus_SessionIndexAdd(Device, pFileData);
+
             TraceEvents(TRACE_LEVEL_INFORMATION,
                 TRACE_DRIVER,
                 "File/session id = %d, device ref. count = %d",
@@ -379,12 +509,7 @@ Bus_FileClose(
 )
 {
     WDFDEVICE                      device;
-    WDFDEVICE                      hChild;
-    NTSTATUS                       status;
-    WDFCHILDLIST                   list;
-    WDF_CHILD_LIST_ITERATOR        iterator;
-    WDF_CHILD_RETRIEVE_INFO        childInfo;
-    PDO_IDENTIFICATION_DESCRIPTION description;
+    NTSTATUS                       status = STATUS_SUCCESS;
     PFDO_FILE_DATA                 pFileData = NULL;
     PFDO_DEVICE_DATA               pFDOData = NULL;
     LONG                           refCount = 0;
@@ -425,59 +550,37 @@ Bus_FileClose(
             (int)refCount);
     }
 
-    list = WdfFdoGetDefaultChildList(device);
-
-    WDF_CHILD_LIST_ITERATOR_INIT(&iterator, WdfRetrievePresentChildren);
-
-    WdfChildListBeginIteration(list, &iterator);
+    //
+    // Unplug devices owned by this session
+    // 
+    Bus_SessionUnplugAll(device, pFileData, TRUE);
 
-    for (;;)
-    {
-        WDF_CHILD_RETRIEVE_INFO_INIT(&childInfo, &description.Header);
-        WDF_CHILD_IDENTIFICATION_DESCRIPTION_HEADER_INIT(&description.Header, sizeof(description));
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DRIVER, "%!FUNC! Exit with status %!STATUS!", status);
+}
 
-        status = WdfChildListRetrieveNextDevice(list, &iterator, &hChild, &childInfo);
-        if (!NT_SUCCESS(status) || status == STATUS_NO_MORE_ENTRIES)
-        {
-            break;
-        }
+//
+// Gets called when the last handle of a session goes away.
+// 
+_Use_decl_annotations_
+VOID
+Bus_FileCleanup(
+    WDFFILEOBJECT FileObject
+)
+{
+    PFDO_FILE_DATA pFileData = NULL;
 
-        TraceEvents(TRACE_LEVEL_VERBOSE,
-            TRACE_DRIVER,
-            "PDO properties: status = %!STATUS!, pdoPID = %d, curPID = %d, pdoSID = %d, curSID = %d, internal = %d",
-            (int)childInfo.Status,
-            (int)description.OwnerProcessId,
-            (int)CURRENT_PROCESS_ID(),
-            (int)description.SessionId,
-            (int)pFileData->SessionId,
-            (int)description.OwnerIsDriver
-        );
+    PAGED_CODE();
 
-        // Only unplug devices with matching session id
-        if (childInfo.Status == WdfChildListRetrieveDeviceSuccess
-            && description.SessionId == pFileData->SessionId
-            && !description.OwnerIsDriver)
-        {
-            TraceEvents(TRACE_LEVEL_INFORMATION,
-                TRACE_DRIVER,
-                "Unplugging device with serial %d",
-                description.SerialNo);
-
-            // "Unplug" child
-            status = WdfChildListUpdateChildDescriptionAsMissing(list, &description.Header);
-            if (!NT_SUCCESS(status))
-            {
-                TraceEvents(TRACE_LEVEL_ERROR,
-                    TRACE_DRIVER,
-                    "WdfChildListUpdateChildDescriptionAsMissing failed with status %!STATUS!",
-                    status);
-            }
-        }
+    pFileData = FileObjectGetData(FileObject);
+    if (pFileData == NULL)
+    {
+        return;
     }
 
-    WdfChildListEndIteration(list, &iterator);
-
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DRIVER, "%!FUNC! Exit with status %!STATUS!", status);
+    //
+    // User-mode mappings have to be torn down before the process exits
+    // 
+    InputSlot_Unmap(pFileData);
 }
 
 VOID
@@ -524,11 +627,9 @@ Bus_PdoStageResult(
     _In_ NTSTATUS Status
 )
 {
-    ULONG               i;
-    PFDO_DEVICE_DATA    pFdoData;
-    WDFREQUEST          curRequest;
-    ULONG               curSerial;
-    ULONG               items;
+    PFDO_DEVICE_DATA            pFdoData;
+    PFDO_PLUGIN_REQUEST_DATA    pPluginData;
+    LARGE_INTEGER               pcNow;
 
     UNREFERENCED_PARAMETER(InterfaceHeader);
 
@@ -541,65 +642,66 @@ Bus_PdoStageResult(
 
     pFdoData = FdoGetData(InterfaceHeader->Context);
 
-    //
-    // If any stage fails or is last stage, get associated request and complete it
-    // 
-    if (!NT_SUCCESS(Status) || Stage == ViGEmPdoInitFinished)
-    {
-        WdfSpinLockAcquire(pFdoData->PendingPluginRequestsLock);
-
-        items = WdfCollectionGetCount(pFdoData->PendingPluginRequests);
+    pcNow = KeQueryPerformanceCounter(NULL);
 
-        TraceEvents(TRACE_LEVEL_INFORMATION,
-            TRACE_DRIVER,
-            "Items count: %d",
-            items);
+    WdfSpinLockAcquire(pFdoData->PendingPluginRequestsLock);
 
-        for (i = 0; i < items; i++)
-        {
-            curRequest = WdfCollectionGetItem(pFdoData->PendingPluginRequests, i);
-            curSerial = PluginRequestGetData(curRequest)->Serial;
+    pPluginData = Bus_PluginRequestFind(pFdoData, Serial);
 
-            TraceEvents(TRACE_LEVEL_INFORMATION,
-                TRACE_DRIVER,
-                "Serial: %d, curSerial: %d",
-                Serial, curSerial);
+    if (pPluginData != NULL)
+    {
+        Bus_PluginStatsRecordStage(pFdoData, pPluginData, Stage, Status, pcNow);
 
-            if (Serial == curSerial)
-            {
-                WdfRequestComplete(curRequest, Status);
+        //
+        // If any stage fails or is last stage, the associated request gets completed
+        // 
+        if (!NT_SUCCESS(Status) || Stage == ViGEmPdoInitFinished)
+        {
+            Bus_PluginRequestUnlink(pFdoData, pPluginData);
+        }
+        else
+        {
+            pPluginData = NULL;
+        }
+    }
 
-                WdfCollectionRemove(pFdoData->PendingPluginRequests, curRequest);
+    WdfSpinLockRelease(pFdoData->PendingPluginRequestsLock);
 
-                TraceEvents(TRACE_LEVEL_INFORMATION,
-                    TRACE_DRIVER,
-                    "Removed item with serial: %d",
-                    curSerial);
+    if (pPluginData != NULL)
+    {
+        WdfRequestCompleteWithInformation(
+            WdfObjectContextGetObject(pPluginData),
+            Status,
+            NT_SUCCESS(Status) ? pPluginData->Information : 0
+        );
 
-                break;
-            }
-        }
-        WdfSpinLockRelease(pFdoData->PendingPluginRequestsLock);
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_DRIVER,
+            "Removed item with serial: %d",
+            Serial);
     }
 
     TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DRIVER, "%!FUNC! Exit");
 }
 
+//
+// Advances the timing wheel by one tick and completes every request that
+// expired in it.
+// 
 _Use_decl_annotations_
 VOID
 Bus_PlugInRequestCleanUpEvtTimerFunc(
     WDFTIMER  Timer
 )
 {
-    ULONG                       i;
     PFDO_DEVICE_DATA            pFdoData;
-    WDFREQUEST                  curRequest;
-    ULONG                       items;
     WDFDEVICE                   device;
     PFDO_PLUGIN_REQUEST_DATA    pPluginData;
     LONGLONG                    freq;
     LARGE_INTEGER               pcNow;
     LONGLONG                    ellapsed;
+    PLIST_ENTRY                 entry;
+    LIST_ENTRY                  expired;
 
 
     TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DRIVER, "%!FUNC! Entry");
@@ -607,55 +709,58 @@ Bus_PlugInRequestCleanUpEvtTimerFunc(
     device = WdfTimerGetParentObject(Timer);
     pFdoData = FdoGetData(device);
 
+    InitializeListHead(&expired);
+
     WdfSpinLockAcquire(pFdoData->PendingPluginRequestsLock);
 
-    items = WdfCollectionGetCount(pFdoData->PendingPluginRequests);
+    PluginTableAdvance(&pFdoData->PendingPlugins, &expired);
+
+    for (entry = expired.Flink; entry != &expired; entry = entry->Flink)
+    {
+        pPluginData = CONTAINING_RECORD(entry, FDO_PLUGIN_REQUEST_DATA, PendingEntry.WheelEntry);
+
+        Bus_PluginStatsRecordTimeout(pFdoData, pPluginData);
+    }
 
     TraceEvents(TRACE_LEVEL_INFORMATION,
         TRACE_DRIVER,
         "Items count: %d",
-        items);
+        pFdoData->PendingPlugins.Count);
 
     //
-    // Collection is empty; no need to keep timer running
+    // Table is empty; no need to keep timer running
     // 
-    if (items == 0)
+    if (pFdoData->PendingPlugins.Count == 0)
     {
         TraceEvents(TRACE_LEVEL_VERBOSE,
             TRACE_DRIVER,
-            "Collection is empty, stopping periodic timer");
+            "Table is empty, stopping periodic timer");
         WdfTimerStop(Timer, FALSE);
     }
 
-    for (i = 0; i < items; i++)
+    WdfSpinLockRelease(pFdoData->PendingPluginRequestsLock);
+
+    pcNow = KeQueryPerformanceCounter(NULL);
+
+    while (!IsListEmpty(&expired))
     {
-        curRequest = WdfCollectionGetItem(pFdoData->PendingPluginRequests, i);
-        pPluginData = PluginRequestGetData(curRequest);
+        entry = RemoveHeadList(&expired);
+        pPluginData = CONTAINING_RECORD(entry, FDO_PLUGIN_REQUEST_DATA, PendingEntry.WheelEntry);
 
         freq = pPluginData->Frequency.QuadPart / ORC_PC_FREQUENCY_DIVIDER;
-        pcNow = KeQueryPerformanceCounter(NULL);
         ellapsed = (pcNow.QuadPart - pPluginData->Timestamp.QuadPart) / freq;
 
-        TraceEvents(TRACE_LEVEL_VERBOSE,
+        TraceEvents(TRACE_LEVEL_INFORMATION,
             TRACE_DRIVER,
-            "PDO (serial = %d) plugin request age: %llu ms",
-            pPluginData->Serial, ellapsed);
-
-        if (ellapsed >= ORC_REQUEST_MAX_AGE)
-        {
-            WdfRequestComplete(curRequest, STATUS_SUCCESS);
-
-            WdfCollectionRemove(pFdoData->PendingPluginRequests, curRequest);
-
-            TraceEvents(TRACE_LEVEL_INFORMATION,
-                TRACE_DRIVER,
-                "Removed item with serial: %d",
-                pPluginData->Serial);
+            "Removed item with serial: %d (age: %llu ms)",
+            pPluginData->PendingEntry.Serial, ellapsed);
 
-            break;
-        }
+        WdfRequestCompleteWithInformation(
+            WdfObjectContextGetObject(pPluginData),
+            STATUS_SUCCESS,
+            pPluginData->Information
+        );
     }
-    WdfSpinLockRelease(pFdoData->PendingPluginRequestsLock);
 
     TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DRIVER, "%!FUNC! Exit");
 }
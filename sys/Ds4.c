@@ -29,11 +29,13 @@
 #include <hidclass.h>
 #include "ds4.tmh"
 
-NTSTATUS Ds4_PreparePdo(PWDFDEVICE_INIT DeviceInit, PUNICODE_STRING DeviceId, PUNICODE_STRING DeviceDescription)
+NTSTATUS Ds4_PreparePdo(PWDFDEVICE_INIT DeviceInit, PPDO_IDENTIFICATION_DESCRIPTION Description, PUNICODE_STRING DeviceId, PUNICODE_STRING DeviceDescription)
 {
     NTSTATUS status;
     UNICODE_STRING buffer;
 
+    UNREFERENCED_PARAMETER(Description);
+
     // prepare device description
     status = RtlUnicodeStringInit(DeviceDescription, L"Virtual DualShock 4 Controller");
     if (!NT_SUCCESS(status))
@@ -165,8 +167,22 @@ NTSTATUS Ds4_PrepareHardware(WDFDEVICE Device)
 
 NTSTATUS Ds4_AssignPdoContext(WDFDEVICE Device, PPDO_IDENTIFICATION_DESCRIPTION Description)
 {
-    NTSTATUS            status;
-    PDS4_DEVICE_DATA    ds4 = Ds4GetData(Device);
+    NTSTATUS                status;
+    PDS4_DEVICE_DATA        ds4 = NULL;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+
+    // Add DS4-specific device data context
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, DS4_DEVICE_DATA);
+
+    status = WdfObjectAllocateContext(Device, &attributes, (PVOID)&ds4);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_DS4,
+            "WdfObjectAllocateContext failed with status %!STATUS!",
+            status);
+        return status;
+    }
 
     // Initialize periodic timer
     WDF_TIMER_CONFIG timerConfig;
@@ -190,6 +206,8 @@ NTSTATUS Ds4_AssignPdoContext(WDFDEVICE Device, PPDO_IDENTIFICATION_DESCRIPTION
         return status;
     }
 
+    Bus_TrackObject(WdfPdoGetParent(Device), Device, ds4->PendingUsbInRequestsTimer, ViGEmResourceTimer);
+
     // Load/generate MAC address
 
     // TODO: tidy up this region
@@ -424,45 +442,270 @@ VOID Ds4_PendingUsbRequestsTimerFunc(
     _In_ WDFTIMER Timer
 )
 {
-    NTSTATUS                status;
-    WDFREQUEST              usbRequest;
     WDFDEVICE               hChild;
-    PDS4_DEVICE_DATA        ds4Data;
-    PIRP                    pendingIrp;
-    PIO_STACK_LOCATION      irpStack;
     PPDO_DEVICE_DATA        pdoData;
+    BOOLEAN                 delivered;
 
-    TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_DS4, "%!FUNC! Entry");
+    TraceHot(TRACE_DS4, "%!FUNC! Entry");
 
     hChild = WdfTimerGetParentObject(Timer);
     pdoData = PdoGetData(hChild);
-    ds4Data = Ds4GetData(hChild);
 
-    // Get pending USB request
-    status = WdfIoQueueRetrieveNextRequest(pdoData->PendingUsbInRequests, &usbRequest);
+    // Refresh the cache from a bound input slot first
+    InputSlot_Pull(hChild);
+
+    // Replay the cache to a pending USB request, if any
+    delivered = ReportMailboxDeliver(&pdoData->ReportPending, &BusMailboxOps, hChild, pdoData->PendingUsbInRequests);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DS4, "%!FUNC! Exit (delivered: %d)", delivered);
+}
+
+//
+// Dispatches interrupt transfers of the DS4 HID endpoints.
+// 
+NTSTATUS Ds4_BulkOrInterruptTransfer(PURB urb, WDFDEVICE Device, WDFREQUEST Request)
+{
+    struct _URB_BULK_OR_INTERRUPT_TRANSFER*     pTransfer = &urb->UrbBulkOrInterruptTransfer;
+    NTSTATUS                                    status;
+    PPDO_DEVICE_DATA                            pdoData = PdoGetData(Device);
+    WDFREQUEST                                  notifyRequest;
+
+    PDS4_DEVICE_DATA ds4Data = Ds4GetData(Device);
+
+    // Data coming FROM us TO higher driver
+    if (pTransfer->TransferFlags & USBD_TRANSFER_DIRECTION_IN
+        && pTransfer->PipeHandle == (USBD_PIPE_HANDLE)0xFFFF0084)
+    {
+        TraceHot(TRACE_DS4,
+            ">> >> >> Incoming request, queuing...");
+
+        // Deliver latest cached report or wait for the "feeder"
+        return Bus_QueueInRequest(Device, pdoData->PendingUsbInRequests, Request, urb);
+    }
+
+    // Store relevant bytes of buffer in PDO context
+    RtlCopyBytes(&ds4Data->OutputReport,
+        (PUCHAR)pTransfer->TransferBuffer + DS4_OUTPUT_BUFFER_OFFSET,
+        DS4_OUTPUT_BUFFER_LENGTH);
+
+    // Notify user-mode process that new data is available
+    status = WdfIoQueueRetrieveNextRequest(pdoData->PendingNotificationRequests, &notifyRequest);
 
     if (NT_SUCCESS(status))
     {
-        // Get pending IRP
-        pendingIrp = WdfRequestWdmGetIrp(usbRequest);
-        irpStack = IoGetCurrentIrpStackLocation(pendingIrp);
+        PDS4_REQUEST_NOTIFICATION notify = NULL;
+
+        status = WdfRequestRetrieveOutputBuffer(notifyRequest, sizeof(DS4_REQUEST_NOTIFICATION), (PVOID)&notify, NULL);
+
+        if (NT_SUCCESS(status))
+        {
+            // Assign values to output buffer
+            notify->Size = sizeof(DS4_REQUEST_NOTIFICATION);
+            notify->SerialNo = pdoData->SerialNo;
+            notify->Report = ds4Data->OutputReport;
+
+            WdfRequestCompleteWithInformation(notifyRequest, status, notify->Size);
+        }
+        else
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_DS4,
+                "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+                status);
+        }
+    }
 
-        // Get USB request block
-        PURB urb = (PURB)irpStack->Parameters.Others.Argument1;
+    return STATUS_SUCCESS;
+}
 
-        // Get transfer buffer
-        PUCHAR Buffer = (PUCHAR)urb->UrbBulkOrInterruptTransfer.TransferBuffer;
-        // Set buffer length to report size
-        urb->UrbBulkOrInterruptTransfer.TransferBufferLength = DS4_REPORT_SIZE;
+//
+// Bits of a DS4 report not taken into account when looking for changes;
+// the upper six bits of the special buttons byte carry the frame counter
+// 
+static const UCHAR Ds4ReportIgnoreMask[sizeof(DS4_REPORT)] =
+{
+    [FIELD_OFFSET(DS4_REPORT, bSpecial)] = DS4_REPORT_FRAME_COUNTER_MASK
+};
 
-        // Copy cached report to transfer buffer 
-        if (Buffer)
-            RtlCopyBytes(Buffer, ds4Data->Report, DS4_REPORT_SIZE);
+//
+// Caches a submitted report, skipping it if the input hasn't changed.
+// 
+NTSTATUS Ds4_CacheReport(WDFDEVICE Device, PVOID Report, const UCHAR* MergeMask, WDFQUEUE* Queue)
+{
+    PPDO_DEVICE_DATA pdoData = PdoGetData(Device);
+    PDS4_DEVICE_DATA ds4 = Ds4GetData(Device);
+    KIRQL irql;
+
+    *Queue = NULL;
+
+    SeqLockWriteBegin(&pdoData->ReportLock, &irql);
 
-        // Complete pending request
-        WdfRequestComplete(usbRequest, status);
+    // Fill in the fields a delta submission left out
+    if (MergeMask != NULL)
+    {
+        ReportMergeMasked(&((PDS4_SUBMIT_REPORT)Report)->Report, ds4->Report + 1, MergeMask, sizeof(DS4_REPORT));
     }
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DS4, "%!FUNC! Exit with status %!STATUS!", status);
+    // Don't waste pending IRP if input hasn't changed
+    if (Bus_DropDuplicateReport(pdoData,
+        ds4->Report + 1,
+        &((PDS4_SUBMIT_REPORT)Report)->Report,
+        Ds4ReportIgnoreMask,
+        sizeof(DS4_REPORT)))
+    {
+        SeqLockWriteAbort(&pdoData->ReportLock, irql);
+
+        TraceHot(TRACE_DS4,
+            "Input report hasn't changed since last update");
+        return STATUS_SUCCESS;
+    }
+
+    /* Copy report to cache
+     * Skip first byte as it contains the never changing report id */
+    RtlCopyBytes(ds4->Report + 1, &((PDS4_SUBMIT_REPORT)Report)->Report, sizeof(DS4_REPORT));
+
+    Bus_StateTableStore(pdoData, &((PDS4_SUBMIT_REPORT)Report)->Report);
+
+    SeqLockWriteEnd(&pdoData->ReportLock, irql);
+
+    *Queue = pdoData->PendingUsbInRequests;
+
+    return STATUS_SUCCESS;
+}
+
+VOID Ds4_WrapReport(PVOID Submit, ULONG SerialNo, PVIGEM_TARGET_REPORT Report)
+{
+    DS4_SUBMIT_REPORT_INIT((PDS4_SUBMIT_REPORT)Submit, SerialNo);
+    ((PDS4_SUBMIT_REPORT)Submit)->Report = Report->Ds4;
+}
+
+BOOLEAN Ds4_UnwrapReport(PVOID Submit, PVIGEM_TARGET_REPORT Report)
+{
+    Report->Ds4 = ((PDS4_SUBMIT_REPORT)Submit)->Report;
+
+    return TRUE;
+}
+
+//
+// Packs a finger as 7-bit id with an inactive flag, followed by 12-bit X and Y
+// 
+static VOID Ds4_EncodeTouchPoint(PUCHAR Buffer, const VIGEM_GAMEPAD_TOUCH* Touch)
+{
+    USHORT x = min(Touch->X, VIGEM_GAMEPAD_TOUCH_WIDTH - 1);
+    USHORT y = min(Touch->Y, VIGEM_GAMEPAD_TOUCH_HEIGHT - 1);
+
+    Buffer[0] = (UCHAR)((Touch->Id & 0x7F) | (Touch->Active ? 0x00 : 0x80));
+    Buffer[1] = (UCHAR)(x & 0xFF);
+    Buffer[2] = (UCHAR)(((x >> 8) & 0x0F) | ((y & 0x0F) << 4));
+    Buffer[3] = (UCHAR)(y >> 4);
 }
 
+//
+// Writes the motion and touch data of a canonical state into the cached
+// input report, according to its flags.
+// 
+VOID Ds4_CacheMotion(WDFDEVICE Device, const VIGEM_GAMEPAD_STATE* State)
+{
+    PPDO_DEVICE_DATA pdoData = PdoGetData(Device);
+    PDS4_DEVICE_DATA ds4 = Ds4GetData(Device);
+    KIRQL irql;
+
+    SeqLockWriteBegin(&pdoData->ReportLock, &irql);
+
+    if (State->Flags & VIGEM_GAMEPAD_FLAG_MOTION)
+    {
+        RtlCopyBytes(ds4->Report + DS4_REPORT_GYRO_OFFSET, State->Gyro, sizeof(State->Gyro));
+        RtlCopyBytes(ds4->Report + DS4_REPORT_ACCEL_OFFSET, State->Accel, sizeof(State->Accel));
+    }
+
+    if (State->Flags & VIGEM_GAMEPAD_FLAG_TOUCH)
+    {
+        // One touch packet, led by its own counter
+        ds4->Report[DS4_REPORT_TOUCH_COUNT_OFFSET] = 1;
+        ds4->Report[DS4_REPORT_TOUCH_OFFSET]++;
+
+        Ds4_EncodeTouchPoint(ds4->Report + DS4_REPORT_TOUCH_OFFSET + 1, &State->Touch[0]);
+        Ds4_EncodeTouchPoint(ds4->Report + DS4_REPORT_TOUCH_OFFSET + 1 + DS4_REPORT_TOUCH_POINT_SIZE, &State->Touch[1]);
+    }
+
+    SeqLockWriteEnd(&pdoData->ReportLock, irql);
+}
+
+VOID Ds4_CopyReportToUrb(WDFDEVICE Device, PURB Urb)
+{
+    PUCHAR Buffer = (PUCHAR)Urb->UrbBulkOrInterruptTransfer.TransferBuffer;
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+
+    Urb->UrbBulkOrInterruptTransfer.TransferBufferLength = DS4_REPORT_SIZE;
+
+    if (Buffer)
+    {
+        SeqLockReadCopy(&PdoGetData(Device)->ReportLock, Buffer, Ds4GetData(Device)->Report, DS4_REPORT_SIZE);
+
+        //
+        // Stamp the copy rather than the cache; this needs no write section
+        // and every re-send of an unchanged cache still looks like a fresh report
+        // 
+        counter = KeQueryPerformanceCounter(&frequency);
+
+        Ds4_StampReport(Buffer,
+            (ULONG)InterlockedIncrement(&Ds4GetData(Device)->FrameCounter) - 1,
+            Ds4_CounterToMicroseconds(counter.QuadPart, frequency.QuadPart));
+    }
+}
+
+//
+// Input report fields, indexed by VIGEM_DS4_FIELD
+// 
+static const VIGEM_REPORT_FIELD Ds4ReportFields[ViGEmDs4Fields] =
+{
+    [ViGEmDs4ThumbLX] = VIGEM_REPORT_FIELD_OF(DS4_REPORT, bThumbLX),
+    [ViGEmDs4ThumbLY] = VIGEM_REPORT_FIELD_OF(DS4_REPORT, bThumbLY),
+    [ViGEmDs4ThumbRX] = VIGEM_REPORT_FIELD_OF(DS4_REPORT, bThumbRX),
+    [ViGEmDs4ThumbRY] = VIGEM_REPORT_FIELD_OF(DS4_REPORT, bThumbRY),
+    [ViGEmDs4Buttons] = VIGEM_REPORT_FIELD_OF(DS4_REPORT, wButtons),
+    [ViGEmDs4Special] = VIGEM_REPORT_FIELD_OF(DS4_REPORT, bSpecial),
+    [ViGEmDs4TriggerL] = VIGEM_REPORT_FIELD_OF(DS4_REPORT, bTriggerL),
+    [ViGEmDs4TriggerR] = VIGEM_REPORT_FIELD_OF(DS4_REPORT, bTriggerR)
+};
+
+//
+// Analog axes of the input report
+// 
+static const VIGEM_REPORT_AXIS Ds4ReportAxes[] =
+{
+    VIGEM_REPORT_AXIS_OF(DS4_REPORT, bThumbLX, ViGEmAxisUnsigned8),
+    VIGEM_REPORT_AXIS_OF(DS4_REPORT, bThumbLY, ViGEmAxisUnsigned8),
+    VIGEM_REPORT_AXIS_OF(DS4_REPORT, bThumbRX, ViGEmAxisUnsigned8),
+    VIGEM_REPORT_AXIS_OF(DS4_REPORT, bThumbRY, ViGEmAxisUnsigned8),
+    VIGEM_REPORT_AXIS_OF(DS4_REPORT, bTriggerL, ViGEmAxisUnsigned8),
+    VIGEM_REPORT_AXIS_OF(DS4_REPORT, bTriggerR, ViGEmAxisUnsigned8)
+};
+
+const VIGEM_TARGET_OPS Ds4TargetOps =
+{
+    .TargetType = DualShock4Wired,
+    .DescriptorSize = DS4_DESCRIPTOR_SIZE,
+    .ConfigurationSize = DS4_CONFIGURATION_SIZE,
+    .ReportSize = sizeof(DS4_REPORT),
+    .Fields = Ds4ReportFields,
+    .FieldCount = ViGEmDs4Fields,
+    .Axes = Ds4ReportAxes,
+    .AxisCount = ARRAYSIZE(Ds4ReportAxes),
+    .UrbReportOffset = 1,
+    .ButtonsOffset = FIELD_OFFSET(DS4_REPORT, wButtons),
+    .PreparePdo = Ds4_PreparePdo,
+    .AssignPdoContext = Ds4_AssignPdoContext,
+    .PrepareHardware = Ds4_PrepareHardware,
+    .GetDeviceDescriptorType = Ds4_GetDeviceDescriptorType,
+    .GetConfigurationDescriptorType = Ds4_GetConfigurationDescriptorType,
+    .SelectConfiguration = Ds4_SelectConfiguration,
+    .BulkOrInterruptTransfer = Ds4_BulkOrInterruptTransfer,
+    .CacheReport = Ds4_CacheReport,
+    .WrapReport = Ds4_WrapReport,
+    .UnwrapReport = Ds4_UnwrapReport,
+    .CopyReportToUrb = Ds4_CopyReportToUrb,
+    .GetInRequestQueue = Bus_GetInRequestQueue,
+    .QueueNotification = Bus_ForwardNotification
+};
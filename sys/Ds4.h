@@ -67,6 +67,11 @@ typedef struct _DS4_DEVICE_DATA
     //
     UCHAR Report[DS4_REPORT_SIZE];
 
+    //
+    // Number of input reports delivered, the low 6 bits go out as frame counter
+    // 
+    volatile LONG FrameCounter;
+
     //
     // Output report cache
     //
@@ -99,16 +104,25 @@ Bus_Ds4SubmitReport(
     WDFDEVICE Device,
     ULONG SerialNo,
     PDS4_SUBMIT_REPORT Report,
-    _In_ BOOLEAN FromInterface
+    _In_ BOOLEAN FromInterface,
+    _Out_opt_ PVIGEM_REPORT_DISPOSITION Disposition
 );
 
 //
 // DS4-specific functions
 // 
-NTSTATUS Ds4_PreparePdo(PWDFDEVICE_INIT DeviceInit, PUNICODE_STRING DeviceId, PUNICODE_STRING DeviceDescription);
+NTSTATUS Ds4_PreparePdo(PWDFDEVICE_INIT DeviceInit, PPDO_IDENTIFICATION_DESCRIPTION Description, PUNICODE_STRING DeviceId, PUNICODE_STRING DeviceDescription);
 NTSTATUS Ds4_PrepareHardware(WDFDEVICE Device);
 NTSTATUS Ds4_AssignPdoContext(WDFDEVICE Device, PPDO_IDENTIFICATION_DESCRIPTION Description);
 VOID Ds4_GetConfigurationDescriptorType(PUCHAR Buffer, ULONG Length);
 VOID Ds4_GetDeviceDescriptorType(PUSB_DEVICE_DESCRIPTOR pDescriptor, PPDO_DEVICE_DATA pCommon);
 VOID Ds4_SelectConfiguration(PUSBD_INTERFACE_INFORMATION pInfo);
+NTSTATUS Ds4_BulkOrInterruptTransfer(PURB urb, WDFDEVICE Device, WDFREQUEST Request);
+NTSTATUS Ds4_CacheReport(WDFDEVICE Device, PVOID Report, const UCHAR* MergeMask, WDFQUEUE* Queue);
+VOID Ds4_WrapReport(PVOID Submit, ULONG SerialNo, PVIGEM_TARGET_REPORT Report);
+BOOLEAN Ds4_UnwrapReport(PVOID Submit, PVIGEM_TARGET_REPORT Report);
+VOID Ds4_CopyReportToUrb(WDFDEVICE Device, PURB Urb);
+VOID Ds4_CacheMotion(WDFDEVICE Device, const VIGEM_GAMEPAD_STATE* State);
+
+extern const VIGEM_TARGET_OPS Ds4TargetOps;
 
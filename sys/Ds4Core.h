@@ -0,0 +1,83 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+//
+// Input report bytes the bus maintains on behalf of the feeder
+// 
+#define DS4_REPORT_SPECIAL_OFFSET                       0x07
+#define DS4_REPORT_FRAME_COUNTER_MASK                   0xFC
+#define DS4_REPORT_TIMESTAMP_OFFSET                     0x0A
+
+//
+// Motion and touch bytes of the input report
+// 
+#define DS4_REPORT_GYRO_OFFSET                          0x0D
+#define DS4_REPORT_ACCEL_OFFSET                         0x13
+#define DS4_REPORT_TOUCH_COUNT_OFFSET                   0x21
+#define DS4_REPORT_TOUCH_OFFSET                         0x22
+#define DS4_REPORT_TOUCH_POINT_SIZE                     0x04
+
+//
+// Stamps frame counter and timestamp into an outgoing input report.
+// 
+// A real controller bumps the 6-bit counter in the upper bits of byte 7
+// with every report and puts a free running 16-bit timestamp in units of
+// 16/3 microseconds into bytes 10 and 11.
+// 
+FORCEINLINE
+VOID
+Ds4_StampReport(
+    _Inout_updates_bytes_(DS4_REPORT_TIMESTAMP_OFFSET + 2) PUCHAR Buffer,
+    _In_ ULONG Frame,
+    _In_ ULONG64 Microseconds
+)
+{
+    USHORT timestamp = (USHORT)(Microseconds * 3 / 16);
+
+    Buffer[DS4_REPORT_SPECIAL_OFFSET] = (UCHAR)((Buffer[DS4_REPORT_SPECIAL_OFFSET] & ~DS4_REPORT_FRAME_COUNTER_MASK)
+        | ((Frame << 2) & DS4_REPORT_FRAME_COUNTER_MASK));
+
+    Buffer[DS4_REPORT_TIMESTAMP_OFFSET] = (UCHAR)(timestamp & 0xFF);
+    Buffer[DS4_REPORT_TIMESTAMP_OFFSET + 1] = (UCHAR)(timestamp >> 8);
+}
+
+//
+// Converts a performance counter value to microseconds without overflowing
+// on long uptimes.
+// 
+FORCEINLINE
+ULONG64
+Ds4_CounterToMicroseconds(
+    _In_ LONG64 Counter,
+    _In_ LONG64 Frequency
+)
+{
+    return (ULONG64)(Counter / Frequency) * 1000000
+        + (ULONG64)(Counter % Frequency) * 1000000 / Frequency;
+}
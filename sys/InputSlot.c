@@ -0,0 +1,424 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "busenum.h"
+#include "inputslot.tmh"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, InputSlot_Map)
+#pragma alloc_text (PAGE, InputSlot_Unmap)
+#endif
+
+//
+// Binds a PDO to a slot of the calling session's shared input slot page.
+// 
+// The page is created and mapped into the caller on first use, so this is
+// dispatched from Bus_EvtIoInCallerContext in the requesting thread. Later
+// binds of the same handle have to come from the process it got mapped into.
+// 
+NTSTATUS InputSlot_Map(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred)
+{
+    NTSTATUS                status;
+    PVIGEM_MAP_INPUT_SLOT   map;
+    size_t                  length = 0;
+    WDFFILEOBJECT           fileObject;
+    PFDO_FILE_DATA          pFileData;
+    PFDO_DEVICE_DATA        pFdoData;
+    WDFDEVICE               hChild;
+    PPDO_DEVICE_DATA        pdoData;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    WDF_TIMER_CONFIG        timerConfig;
+    WDFMEMORY               memory;
+    PVOID                   buffer;
+    PMDL                    mdl;
+    PVOID                   userAddress;
+    PVIGEM_INPUT_SLOT       slots;
+    PINPUT_SLOTS_DATA       slotsData;
+    ULONG                   index;
+
+    PAGED_CODE();
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_INPUTSLOT, "%!FUNC! Entry");
+
+    *Transferred = 0;
+
+    // Only a user-mode caller has an address space to map into
+    if (WdfRequestGetRequestorMode(Request) != UserMode)
+    {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIGEM_MAP_INPUT_SLOT), (PVOID)&map, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_INPUTSLOT,
+            "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    if (map->Size != sizeof(VIGEM_MAP_INPUT_SLOT) || map->SerialNo == 0)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // Slot location is returned in place
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIGEM_MAP_INPUT_SLOT), &buffer, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_INPUTSLOT,
+            "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    fileObject = WdfRequestGetFileObject(Request);
+    if (fileObject == NULL)
+    {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    pFileData = FileObjectGetData(fileObject);
+    pFdoData = FdoGetData(Device);
+
+    hChild = Bus_GetPdo(Device, map->SerialNo);
+    if (hChild == NULL)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_INPUTSLOT,
+            "Bus_GetPdo: no PDO with serial %d found",
+            map->SerialNo);
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    pdoData = PdoGetData(hChild);
+
+    if (!IS_OWNER(pdoData))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_INPUTSLOT,
+            "PID mismatch: %d != %d",
+            pdoData->OwnerProcessId,
+            CURRENT_PROCESS_ID());
+        Bus_PutPdo(hChild);
+        return STATUS_ACCESS_DENIED;
+    }
+
+    WdfWaitLockAcquire(pFdoData->InputSlotsLock, NULL);
+
+#pragma region Create and map session page
+
+    if (pFileData->InputSlots == NULL)
+    {
+        WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, INPUT_SLOTS_DATA);
+        attributes.ParentObject = Device;
+
+        status = WdfMemoryCreate(&attributes, NonPagedPoolNx, VIGEM_POOL_TAG, PAGE_SIZE, &memory, &buffer);
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_INPUTSLOT,
+                "WdfMemoryCreate failed with status %!STATUS!",
+                status);
+            goto mapEnd;
+        }
+
+        Bus_TrackObject(Device, NULL, memory, ViGEmResourceMemory);
+
+        RtlZeroMemory(buffer, PAGE_SIZE);
+
+        mdl = IoAllocateMdl(buffer, PAGE_SIZE, FALSE, FALSE, NULL);
+        if (mdl == NULL)
+        {
+            WdfObjectDelete(memory);
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto mapEnd;
+        }
+
+        MmBuildMdlForNonPagedPool(mdl);
+
+        __try
+        {
+            userAddress = MmMapLockedPagesSpecifyCache(
+                mdl,
+                UserMode,
+                MmCached,
+                NULL,
+                FALSE,
+                NormalPagePriority | MdlMappingNoExecute
+            );
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            userAddress = NULL;
+        }
+
+        if (userAddress == NULL)
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_INPUTSLOT,
+                "MmMapLockedPagesSpecifyCache failed");
+
+            IoFreeMdl(mdl);
+            WdfObjectDelete(memory);
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto mapEnd;
+        }
+
+        pFileData->InputSlots = memory;
+        pFileData->InputSlotsMdl = mdl;
+        pFileData->InputSlotsUserAddress = userAddress;
+        pFileData->InputSlotsProcess = PsGetCurrentProcess();
+
+        ObReferenceObject(pFileData->InputSlotsProcess);
+    }
+    else if (pFileData->InputSlotsProcess != PsGetCurrentProcess())
+    {
+        // Handle got duplicated, the page address means nothing to this caller
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_INPUTSLOT,
+            "Input slot page is mapped into another process");
+        status = STATUS_ACCESS_DENIED;
+        goto mapEnd;
+    }
+
+#pragma endregion
+
+    slots = WdfMemoryGetBuffer(pFileData->InputSlots, NULL);
+    slotsData = InputSlotsGetData(pFileData->InputSlots);
+
+#pragma region Bind slot
+
+    if (pdoData->InputSlots != NULL)
+    {
+        // Re-mapping from the same session just reports the existing slot
+        if (pdoData->InputSlots != pFileData->InputSlots)
+        {
+            status = STATUS_DEVICE_BUSY;
+            goto mapEnd;
+        }
+
+        index = pdoData->InputSlotIndex;
+    }
+    else
+    {
+        for (index = 0; index < VIGEM_INPUT_SLOTS_MAX; index++)
+        {
+            if (!(slotsData->BoundMask & (1LL << index)))
+            {
+                break;
+            }
+        }
+
+        if (index == VIGEM_INPUT_SLOTS_MAX)
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_INPUTSLOT,
+                "No free input slot left in session page");
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto mapEnd;
+        }
+
+        //
+        // XUSB and XGIP park IN URBs until data arrives so they need
+        // something to pull the slot; DS4 piggybacks on its flush timer
+        // 
+        if (pdoData->TargetType != DualShock4Wired)
+        {
+            WDF_TIMER_CONFIG_INIT_PERIODIC(&timerConfig, InputSlot_EvtTimerFunc, INPUT_SLOT_POLL_PERIOD);
+            WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+            attributes.ParentObject = hChild;
+
+            status = WdfTimerCreate(&timerConfig, &attributes, &pdoData->InputSlotTimer);
+            if (!NT_SUCCESS(status))
+            {
+                TraceEvents(TRACE_LEVEL_ERROR,
+                    TRACE_INPUTSLOT,
+                    "WdfTimerCreate failed with status %!STATUS!",
+                    status);
+                goto mapEnd;
+            }
+
+            Bus_TrackObject(Device, hChild, pdoData->InputSlotTimer, ViGEmResourceTimer);
+        }
+
+        InterlockedOr64(&slotsData->BoundMask, 1LL << index);
+
+        slots[index].Sequence = 0;
+        slots[index].SerialNo = pdoData->SerialNo;
+        RtlZeroMemory(&slots[index].Report, sizeof(VIGEM_TARGET_REPORT));
+
+        // Page has to outlive the session while the PDO still reads from it
+        WdfObjectReference(pFileData->InputSlots);
+
+        pdoData->InputSlots = pFileData->InputSlots;
+        pdoData->InputSlotIndex = index;
+        pdoData->InputSlotSequence = 0;
+
+        InterlockedExchangePointer((PVOID volatile*)&pdoData->InputSlot, &slots[index]);
+
+        if (pdoData->InputSlotTimer != NULL)
+        {
+            WdfTimerStart(pdoData->InputSlotTimer, WDF_REL_TIMEOUT_IN_MS(INPUT_SLOT_POLL_PERIOD));
+        }
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_INPUTSLOT,
+            "Bound serial %d to input slot %d",
+            pdoData->SerialNo,
+            index);
+    }
+
+#pragma endregion
+
+    map->SlotIndex = index;
+    map->SlotCount = VIGEM_INPUT_SLOTS_MAX;
+    map->Slots = (ULONG64)(ULONG_PTR)pFileData->InputSlotsUserAddress;
+
+    *Transferred = sizeof(VIGEM_MAP_INPUT_SLOT);
+
+mapEnd:
+
+    WdfWaitLockRelease(pFdoData->InputSlotsLock);
+
+    Bus_PutPdo(hChild);
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_INPUTSLOT, "%!FUNC! Exit with status %!STATUS!", status);
+
+    return status;
+}
+
+//
+// Tears down the session's user-mode view of its input slot page.
+// 
+// The last handle of a session may be closed by another process than the
+// one the page got mapped into, so this attaches to the mapping process if
+// necessary. PDOs still bound to the page keep it alive and continue to see
+// its last contents.
+// 
+VOID InputSlot_Unmap(
+    _In_ PFDO_FILE_DATA FileData)
+{
+    KAPC_STATE  apcState;
+    BOOLEAN     attached = FALSE;
+
+    PAGED_CODE();
+
+    if (FileData->InputSlots == NULL)
+    {
+        return;
+    }
+
+    if (FileData->InputSlotsProcess != PsGetCurrentProcess())
+    {
+        KeStackAttachProcess(FileData->InputSlotsProcess, &apcState);
+        attached = TRUE;
+    }
+
+    MmUnmapLockedPages(FileData->InputSlotsUserAddress, FileData->InputSlotsMdl);
+
+    if (attached)
+    {
+        KeUnstackDetachProcess(&apcState);
+    }
+
+    ObDereferenceObject(FileData->InputSlotsProcess);
+    IoFreeMdl(FileData->InputSlotsMdl);
+
+    WdfObjectDelete(FileData->InputSlots);
+
+    FileData->InputSlots = NULL;
+    FileData->InputSlotsMdl = NULL;
+    FileData->InputSlotsUserAddress = NULL;
+    FileData->InputSlotsProcess = NULL;
+}
+
+//
+// Unbinds a PDO from its input slot, called on PDO teardown.
+// 
+VOID InputSlot_Release(
+    _In_ WDFDEVICE Pdo)
+{
+    PPDO_DEVICE_DATA    pdoData = PdoGetData(Pdo);
+    PVIGEM_INPUT_SLOT   slot;
+
+    if (pdoData->InputSlots == NULL)
+    {
+        return;
+    }
+
+    slot = InterlockedExchangePointer((PVOID volatile*)&pdoData->InputSlot, NULL);
+    if (slot != NULL)
+    {
+        slot->SerialNo = 0;
+    }
+
+    InterlockedAnd64(&InputSlotsGetData(pdoData->InputSlots)->BoundMask, ~(1LL << pdoData->InputSlotIndex));
+
+    WdfObjectDereference(pdoData->InputSlots);
+    pdoData->InputSlots = NULL;
+}
+
+//
+// Moves a new report published in the bound input slot into the report cache.
+// 
+// Returns TRUE if the cache got updated.
+// 
+BOOLEAN InputSlot_Pull(
+    _In_ WDFDEVICE Pdo)
+{
+    PPDO_DEVICE_DATA    pdoData = PdoGetData(Pdo);
+    PVIGEM_INPUT_SLOT   slot;
+    VIGEM_TARGET_REPORT report;
+
+    slot = ReadPointerAcquire((PVOID volatile*)&pdoData->InputSlot);
+    if (slot == NULL)
+    {
+        return FALSE;
+    }
+
+    if (!VIGEM_INPUT_SLOT_READ(slot, &report, sizeof(VIGEM_TARGET_REPORT), &pdoData->InputSlotSequence))
+    {
+        return FALSE;
+    }
+
+    return NT_SUCCESS(Bus_SubmitTargetReportToPdo(Pdo, &report, NULL));
+}
+
+//
+// Periodically pulls the input slot of targets without a flush timer.
+// 
+VOID InputSlot_EvtTimerFunc(
+    _In_ WDFTIMER Timer)
+{
+    InputSlot_Pull(WdfTimerGetParentObject(Timer));
+}
@@ -0,0 +1,69 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+//
+// Poll period of the input slot timer for targets the host doesn't poll
+// on its own (XUSB and XGIP park IN URBs until a report arrives)
+// 
+#define INPUT_SLOT_POLL_PERIOD          0x04 // ms
+
+typedef struct _INPUT_SLOTS_DATA
+{
+    //
+    // Bitmap of slots currently bound to a PDO, kept out of the shared page
+    // 
+    volatile LONG64 BoundMask;
+
+} INPUT_SLOTS_DATA, *PINPUT_SLOTS_DATA;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(INPUT_SLOTS_DATA, InputSlotsGetData)
+
+C_ASSERT(VIGEM_INPUT_SLOTS_MAX <= sizeof(LONG64) * 8);
+C_ASSERT(sizeof(VIGEM_INPUT_SLOT) * VIGEM_INPUT_SLOTS_MAX <= PAGE_SIZE);
+
+
+NTSTATUS InputSlot_Map(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred
+);
+
+VOID InputSlot_Unmap(
+    _In_ PFDO_FILE_DATA FileData
+);
+
+VOID InputSlot_Release(
+    _In_ WDFDEVICE Pdo
+);
+
+BOOLEAN InputSlot_Pull(
+    _In_ WDFDEVICE Pdo
+);
+
+EVT_WDF_TIMER InputSlot_EvtTimerFunc;
@@ -0,0 +1,554 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "busenum.h"
+#include "playback.tmh"
+
+#pragma region Playback engine
+
+//
+// Current performance counter value in microseconds.
+// 
+static LONG64 Playback_Now(VOID)
+{
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+
+    counter = KeQueryPerformanceCounter(&frequency);
+
+    return (counter.QuadPart / frequency.QuadPart) * 1000000
+        + (counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+}
+
+//
+// Raises the system timer resolution for a running playback or drops it again.
+// 
+static VOID Playback_SetResolution(PPLAYBACK_DATA Playback, BOOLEAN Raise)
+{
+    if (Raise)
+    {
+        if (InterlockedExchange(&Playback->ResolutionRaised, TRUE) == FALSE)
+        {
+            ExSetTimerResolution(PLAYBACK_TIMER_RESOLUTION, TRUE);
+        }
+    }
+    else
+    {
+        if (InterlockedExchange(&Playback->ResolutionRaised, FALSE) == TRUE)
+        {
+            ExSetTimerResolution(0, FALSE);
+        }
+    }
+}
+
+//
+// Arms the playback timer for the next due entry.
+// 
+// Caller must hold the playback lock.
+// 
+static VOID Playback_Arm(WDFTIMER Timer, LONG64 Due, LONG64 Now)
+{
+    WdfTimerStart(Timer, WDF_REL_TIMEOUT_IN_US((ULONGLONG)max(Due - Now - PLAYBACK_EARLY_WINDOW_US, 1)));
+}
+
+//
+// Gets the playback timer of a PDO, creating it on first use.
+// 
+static NTSTATUS Playback_GetTimer(WDFDEVICE Device, WDFDEVICE Pdo, WDFTIMER* Timer)
+{
+    NTSTATUS                status;
+    PPDO_DEVICE_DATA        pdoData = PdoGetData(Pdo);
+    WDF_TIMER_CONFIG        timerConfig;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    WDFTIMER                timer;
+    PPLAYBACK_DATA          playback;
+
+    timer = ReadPointerAcquire((PVOID volatile*)&pdoData->PlaybackTimer);
+    if (timer != NULL)
+    {
+        *Timer = timer;
+        return STATUS_SUCCESS;
+    }
+
+    WDF_TIMER_CONFIG_INIT(&timerConfig, Playback_EvtTimerFunc);
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, PLAYBACK_DATA);
+    attributes.ParentObject = Pdo;
+
+    status = WdfTimerCreate(&timerConfig, &attributes, &timer);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_PLAYBACK,
+            "WdfTimerCreate failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    playback = PlaybackGetData(timer);
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = timer;
+
+    status = WdfSpinLockCreate(&attributes, &playback->Lock);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_PLAYBACK,
+            "WdfSpinLockCreate failed with status %!STATUS!",
+            status);
+        WdfObjectDelete(timer);
+        return status;
+    }
+
+    // Lost a race against a concurrent upload
+    if (InterlockedCompareExchangePointer((PVOID volatile*)&pdoData->PlaybackTimer, timer, NULL) != NULL)
+    {
+        WdfObjectDelete(timer);
+        *Timer = pdoData->PlaybackTimer;
+        return STATUS_SUCCESS;
+    }
+
+    Bus_TrackObject(Device, Pdo, timer, ViGEmResourceTimer);
+
+    *Timer = timer;
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Uploads a timeline for a PDO.
+// 
+NTSTATUS Playback_Load(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred)
+{
+    NTSTATUS                status;
+    PVIGEM_PLAYBACK_LOAD    load;
+    size_t                  length = 0;
+    size_t                  timelineLength;
+    WDFDEVICE               hChild;
+    PPDO_DEVICE_DATA        pdoData;
+    WDFTIMER                timer;
+    PPLAYBACK_DATA          playback;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    WDFMEMORY               memory;
+    WDFMEMORY               previous;
+    PVOID                   buffer;
+    PLAYBACK_TIMELINE       timeline;
+
+    PAGED_CODE();
+
+    *Transferred = 0;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIGEM_PLAYBACK_LOAD), (PVOID)&load, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_PLAYBACK,
+            "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    if (load->Size != sizeof(VIGEM_PLAYBACK_LOAD) || load->SerialNo == 0)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    timelineLength = length - FIELD_OFFSET(VIGEM_PLAYBACK_LOAD, Timeline);
+
+    if (timelineLength > VIGEM_TIMELINE_MAX_SIZE)
+    {
+        return STATUS_INVALID_BUFFER_SIZE;
+    }
+
+    hChild = Bus_GetPdo(Device, load->SerialNo);
+    if (hChild == NULL)
+    {
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    pdoData = PdoGetData(hChild);
+
+    if (!IS_OWNER(pdoData))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_PLAYBACK,
+            "PID mismatch: %d != %d",
+            pdoData->OwnerProcessId,
+            CURRENT_PROCESS_ID());
+        status = STATUS_ACCESS_DENIED;
+        goto loadEnd;
+    }
+
+    status = Playback_GetTimer(Device, hChild, &timer);
+    if (!NT_SUCCESS(status))
+    {
+        goto loadEnd;
+    }
+
+    playback = PlaybackGetData(timer);
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = timer;
+
+    status = WdfMemoryCreate(&attributes, NonPagedPoolNx, VIGEM_POOL_TAG, timelineLength, &memory, &buffer);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_PLAYBACK,
+            "WdfMemoryCreate failed with status %!STATUS!",
+            status);
+        goto loadEnd;
+    }
+
+    Bus_TrackObject(Device, hChild, memory, ViGEmResourceMemory);
+
+    // Validate our own copy so the caller can't change it behind our back
+    RtlCopyMemory(buffer, &load->Timeline, timelineLength);
+
+    status = Playback_ParseTimeline(buffer, timelineLength, pdoData->TargetType, pdoData->Ops->ReportSize, &timeline);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_PLAYBACK,
+            "Rejected timeline for serial %d with status %!STATUS!",
+            pdoData->SerialNo,
+            status);
+        WdfObjectDelete(memory);
+        goto loadEnd;
+    }
+
+    WdfSpinLockAcquire(playback->Lock);
+
+    if (playback->Playing)
+    {
+        WdfSpinLockRelease(playback->Lock);
+        WdfObjectDelete(memory);
+        status = STATUS_DEVICE_BUSY;
+        goto loadEnd;
+    }
+
+    previous = playback->TimelineMemory;
+
+    playback->TimelineMemory = memory;
+    playback->Timeline = timeline;
+    Playback_CursorInit(&playback->Cursor, 0, FALSE);
+
+    WdfSpinLockRelease(playback->Lock);
+
+    if (previous != NULL)
+    {
+        WdfObjectDelete(previous);
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_PLAYBACK,
+        "Loaded timeline of %d entries for serial %d",
+        timeline.EntryCount,
+        pdoData->SerialNo);
+
+    status = STATUS_SUCCESS;
+
+loadEnd:
+
+    Bus_PutPdo(hChild);
+
+    return status;
+}
+
+//
+// Starts or stops the playback of a PDO and returns its statistics.
+// 
+NTSTATUS Playback_Control(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred)
+{
+    NTSTATUS                    status = STATUS_SUCCESS;
+    PVIGEM_PLAYBACK_CONTROL     control;
+    VIGEM_PLAYBACK_OPERATION    operation;
+    ULONG                       flags;
+    size_t                      length = 0;
+    WDFDEVICE                   hChild;
+    PPDO_DEVICE_DATA            pdoData;
+    WDFTIMER                    timer;
+    PPLAYBACK_DATA              playback;
+    LONG64                      now;
+    LONG64                      due;
+    BOOLEAN                     playing;
+
+    PAGED_CODE();
+
+    *Transferred = 0;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIGEM_PLAYBACK_CONTROL), (PVOID)&control, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_PLAYBACK,
+            "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    if (control->Size != sizeof(VIGEM_PLAYBACK_CONTROL)
+        || (ULONG)control->Operation > ViGEmPlaybackQuery
+        || (control->Flags & ~VIGEM_PLAYBACK_FLAG_LOOP) != 0)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    operation = control->Operation;
+    flags = control->Flags;
+
+    hChild = Bus_GetPdo(Device, control->SerialNo);
+    if (hChild == NULL)
+    {
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    pdoData = PdoGetData(hChild);
+
+    if (operation != ViGEmPlaybackQuery && !IS_OWNER(pdoData))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_PLAYBACK,
+            "PID mismatch: %d != %d",
+            pdoData->OwnerProcessId,
+            CURRENT_PROCESS_ID());
+        status = STATUS_ACCESS_DENIED;
+        goto controlEnd;
+    }
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIGEM_PLAYBACK_CONTROL), (PVOID)&control, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_PLAYBACK,
+            "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+            status);
+        goto controlEnd;
+    }
+
+    timer = ReadPointerAcquire((PVOID volatile*)&pdoData->PlaybackTimer);
+    if (timer == NULL)
+    {
+        status = STATUS_INVALID_DEVICE_STATE;
+        goto controlEnd;
+    }
+
+    playback = PlaybackGetData(timer);
+
+    switch (operation)
+    {
+    case ViGEmPlaybackStart:
+
+        Playback_SetResolution(playback, TRUE);
+
+        now = Playback_Now();
+
+        WdfSpinLockAcquire(playback->Lock);
+
+        if (playback->TimelineMemory == NULL)
+        {
+            status = STATUS_INVALID_DEVICE_STATE;
+        }
+        else if ((flags & VIGEM_PLAYBACK_FLAG_LOOP) && playback->Timeline.DurationUs == 0)
+        {
+            // Would replay the whole timeline over and over without time passing
+            status = STATUS_INVALID_PARAMETER;
+        }
+        else
+        {
+            Playback_CursorInit(&playback->Cursor, now, (flags & VIGEM_PLAYBACK_FLAG_LOOP) != 0);
+
+            playback->Played = 0;
+            playback->JitterMinUs = MAXLONG64;
+            playback->JitterMaxUs = MINLONG64;
+            playback->JitterSumUs = 0;
+            playback->Playing = TRUE;
+
+            (void)Playback_NextDueTime(&playback->Timeline, &playback->Cursor, &due);
+
+            Playback_Arm(timer, due, now);
+        }
+
+        WdfSpinLockRelease(playback->Lock);
+
+        break;
+
+    case ViGEmPlaybackStop:
+
+        WdfSpinLockAcquire(playback->Lock);
+        playback->Playing = FALSE;
+        WdfSpinLockRelease(playback->Lock);
+
+        WdfTimerStop(timer, FALSE);
+
+        break;
+
+    case ViGEmPlaybackQuery:
+        break;
+    }
+
+    WdfSpinLockAcquire(playback->Lock);
+
+    playing = playback->Playing;
+
+    control->Playing = playing;
+    control->EntryIndex = playback->Cursor.Index;
+    control->Loops = playback->Cursor.Loops;
+    control->Played = playback->Played;
+
+    if (playback->Played != 0)
+    {
+        control->JitterMinUs = playback->JitterMinUs;
+        control->JitterMaxUs = playback->JitterMaxUs;
+        control->JitterSumUs = playback->JitterSumUs;
+    }
+    else
+    {
+        control->JitterMinUs = 0;
+        control->JitterMaxUs = 0;
+        control->JitterSumUs = 0;
+    }
+
+    WdfSpinLockRelease(playback->Lock);
+
+    // Also covers playbacks that ran out on their own since the last call
+    if (!playing)
+    {
+        Playback_SetResolution(playback, FALSE);
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        *Transferred = sizeof(VIGEM_PLAYBACK_CONTROL);
+    }
+
+controlEnd:
+
+    Bus_PutPdo(hChild);
+
+    return status;
+}
+
+//
+// Stops any playback of a PDO, called on PDO teardown.
+// 
+VOID Playback_Release(
+    _In_ WDFDEVICE Pdo)
+{
+    WDFTIMER        timer = PdoGetData(Pdo)->PlaybackTimer;
+    PPLAYBACK_DATA  playback;
+
+    PAGED_CODE();
+
+    if (timer == NULL)
+    {
+        return;
+    }
+
+    playback = PlaybackGetData(timer);
+
+    WdfSpinLockAcquire(playback->Lock);
+    playback->Playing = FALSE;
+    WdfSpinLockRelease(playback->Lock);
+
+    WdfTimerStop(timer, TRUE);
+
+    Playback_SetResolution(playback, FALSE);
+}
+
+//
+// Plays all entries that are due and re-arms for the next one.
+// 
+VOID Playback_EvtTimerFunc(
+    _In_ WDFTIMER Timer)
+{
+    PPLAYBACK_DATA      playback = PlaybackGetData(Timer);
+    WDFDEVICE           hChild = WdfTimerGetParentObject(Timer);
+    VIGEM_TARGET_REPORT report;
+    ULONG               entry;
+    ULONG               burst;
+    LONG64              now;
+    LONG64              scheduled;
+    LONG64              jitter;
+    LONG64              due;
+
+    now = Playback_Now();
+
+    WdfSpinLockAcquire(playback->Lock);
+
+    if (!playback->Playing)
+    {
+        WdfSpinLockRelease(playback->Lock);
+        return;
+    }
+
+    for (burst = 0; burst < PLAYBACK_MAX_BURST; burst++)
+    {
+        if (!Playback_NextDue(&playback->Timeline, &playback->Cursor, now + PLAYBACK_EARLY_WINDOW_US, &entry, &scheduled))
+        {
+            break;
+        }
+
+        RtlZeroMemory(&report, sizeof(VIGEM_TARGET_REPORT));
+        RtlCopyMemory(&report,
+            playback->Timeline.Entries + (SIZE_T)entry * playback->Timeline.EntrySize + sizeof(ULONG),
+            playback->Timeline.ReportSize);
+
+        (void)Bus_SubmitTargetReportToPdo(hChild, &report, NULL);
+
+        jitter = now - scheduled;
+
+        playback->Played++;
+        playback->JitterMinUs = min(playback->JitterMinUs, jitter);
+        playback->JitterMaxUs = max(playback->JitterMaxUs, jitter);
+        playback->JitterSumUs += jitter;
+    }
+
+    if (Playback_NextDueTime(&playback->Timeline, &playback->Cursor, &due))
+    {
+        Playback_Arm(Timer, due, now);
+    }
+    else
+    {
+        playback->Playing = FALSE;
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_PLAYBACK,
+            "Playback finished after %I64u entries",
+            playback->Played);
+    }
+
+    WdfSpinLockRelease(playback->Lock);
+}
+
+#pragma endregion
@@ -0,0 +1,90 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+//
+// Resolution requested from the system timer while a playback runs (100ns units)
+// 
+#define PLAYBACK_TIMER_RESOLUTION       10000
+
+//
+// Playback state, context of the PDO's playback timer
+// 
+typedef struct _PLAYBACK_DATA
+{
+    //
+    // Protects everything below
+    // 
+    WDFSPINLOCK Lock;
+
+    //
+    // Buffer holding the uploaded timeline, NULL if none
+    // 
+    WDFMEMORY TimelineMemory;
+
+    PLAYBACK_TIMELINE Timeline;
+
+    PLAYBACK_CURSOR Cursor;
+
+    BOOLEAN Playing;
+
+    ULONG64 Played;
+
+    LONG64 JitterMinUs;
+
+    LONG64 JitterMaxUs;
+
+    LONG64 JitterSumUs;
+
+    //
+    // Set while the system timer resolution is raised on our behalf
+    // 
+    volatile LONG ResolutionRaised;
+
+} PLAYBACK_DATA, *PPLAYBACK_DATA;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(PLAYBACK_DATA, PlaybackGetData)
+
+
+NTSTATUS Playback_Load(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred
+);
+
+NTSTATUS Playback_Control(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred
+);
+
+VOID Playback_Release(
+    _In_ WDFDEVICE Pdo
+);
+
+EVT_WDF_TIMER Playback_EvtTimerFunc;
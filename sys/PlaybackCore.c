@@ -0,0 +1,183 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Platform.h"
+#include "PlaybackCore.h"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, Playback_ParseTimeline)
+#endif
+
+#pragma region Scheduling
+
+//
+// The scheduler only works on the clock values it gets passed so it can
+// be driven by the performance counter as well as by a virtual clock.
+// 
+
+//
+// Due time of an entry relative to the start of its pass.
+// 
+FORCEINLINE ULONG Playback_EntryDue(const PLAYBACK_TIMELINE* Timeline, ULONG Index)
+{
+    ULONG due;
+
+    // Entries are packed, so the due time may be unaligned
+    RtlCopyMemory(&due, Timeline->Entries + (SIZE_T)Index * Timeline->EntrySize, sizeof(ULONG));
+
+    return due;
+}
+
+//
+// Checks an uploaded timeline and describes its entries.
+// 
+NTSTATUS Playback_ParseTimeline(
+    _In_reads_bytes_(Length) const VOID* Buffer,
+    _In_ size_t Length,
+    _In_ VIGEM_TARGET_TYPE TargetType,
+    _In_ ULONG ReportSize,
+    _Out_ PPLAYBACK_TIMELINE Timeline)
+{
+    const VIGEM_TIMELINE_HEADER*    header = Buffer;
+    ULONG                           i;
+    ULONG                           due;
+    ULONG                           previous = 0;
+
+    PAGED_CODE();
+
+    if (Length < sizeof(VIGEM_TIMELINE_HEADER))
+    {
+        return STATUS_INVALID_BUFFER_SIZE;
+    }
+
+    if (header->Magic != VIGEM_TIMELINE_MAGIC
+        || header->Version != VIGEM_TIMELINE_VERSION
+        || header->TargetType != (ULONG)TargetType
+        || header->ReportSize != ReportSize)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (header->EntryCount == 0
+        || VIGEM_TIMELINE_SIZE(ReportSize, header->EntryCount) != (ULONG64)Length)
+    {
+        return STATUS_INVALID_BUFFER_SIZE;
+    }
+
+    Timeline->Entries = (const UCHAR*)(header + 1);
+    Timeline->EntryCount = header->EntryCount;
+    Timeline->EntrySize = (ULONG)VIGEM_TIMELINE_ENTRY_SIZE(ReportSize);
+    Timeline->ReportSize = ReportSize;
+    Timeline->DurationUs = header->DurationUs;
+
+    for (i = 0; i < Timeline->EntryCount; i++)
+    {
+        due = Playback_EntryDue(Timeline, i);
+
+        if (due < previous)
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        previous = due;
+    }
+
+    if (previous > Timeline->DurationUs)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Positions a cursor on the first entry of a playback starting at Now.
+// 
+VOID Playback_CursorInit(
+    _Out_ PPLAYBACK_CURSOR Cursor,
+    _In_ LONG64 Now,
+    _In_ BOOLEAN Loop)
+{
+    Cursor->Index = 0;
+    Cursor->Loops = 0;
+    Cursor->Origin = Now;
+    Cursor->Loop = Loop;
+}
+
+//
+// Gets the clock value the next entry is due at.
+// 
+// Returns FALSE once a non-looping playback is through.
+// 
+BOOLEAN Playback_NextDueTime(
+    _In_ const PLAYBACK_TIMELINE* Timeline,
+    _In_ const PLAYBACK_CURSOR* Cursor,
+    _Out_ PLONG64 Due)
+{
+    if (Cursor->Index >= Timeline->EntryCount)
+    {
+        return FALSE;
+    }
+
+    *Due = Cursor->Origin + Playback_EntryDue(Timeline, Cursor->Index);
+
+    return TRUE;
+}
+
+//
+// Takes the next entry off the cursor if it is due at Now.
+// 
+// Returns FALSE if nothing is due (yet).
+// 
+BOOLEAN Playback_NextDue(
+    _In_ const PLAYBACK_TIMELINE* Timeline,
+    _Inout_ PPLAYBACK_CURSOR Cursor,
+    _In_ LONG64 Now,
+    _Out_ PULONG Entry,
+    _Out_ PLONG64 Scheduled)
+{
+    LONG64 due;
+
+    if (!Playback_NextDueTime(Timeline, Cursor, &due) || due > Now)
+    {
+        return FALSE;
+    }
+
+    *Entry = Cursor->Index;
+    *Scheduled = due;
+
+    if (++Cursor->Index == Timeline->EntryCount && Cursor->Loop)
+    {
+        Cursor->Index = 0;
+        Cursor->Origin += (LONG64)Timeline->DurationUs;
+        Cursor->Loops++;
+    }
+
+    return TRUE;
+}
+
+#pragma endregion
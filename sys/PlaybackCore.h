@@ -0,0 +1,112 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+//
+// Entries due within this window get played on the current timer tick
+// rather than a tick late, centering the jitter around zero
+// 
+#define PLAYBACK_EARLY_WINDOW_US        500
+
+//
+// Maximum number of entries played per timer tick when catching up
+// 
+#define PLAYBACK_MAX_BURST              0x40
+
+//
+// Validated timeline, entries point into the uploaded buffer
+// 
+typedef struct _PLAYBACK_TIMELINE
+{
+    const UCHAR* Entries;
+
+    ULONG EntryCount;
+
+    ULONG EntrySize;
+
+    ULONG ReportSize;
+
+    ULONG64 DurationUs;
+
+} PLAYBACK_TIMELINE, *PPLAYBACK_TIMELINE;
+
+//
+// Position of a playback; times are on the clock passed to the scheduler
+// 
+typedef struct _PLAYBACK_CURSOR
+{
+    //
+    // Next entry to play
+    // 
+    ULONG Index;
+
+    //
+    // Completed passes
+    // 
+    ULONG Loops;
+
+    //
+    // Clock value the current pass started at
+    // 
+    LONG64 Origin;
+
+    //
+    // Wrap around after the last entry
+    // 
+    BOOLEAN Loop;
+
+} PLAYBACK_CURSOR, *PPLAYBACK_CURSOR;
+
+
+NTSTATUS Playback_ParseTimeline(
+    _In_reads_bytes_(Length) const VOID* Buffer,
+    _In_ size_t Length,
+    _In_ VIGEM_TARGET_TYPE TargetType,
+    _In_ ULONG ReportSize,
+    _Out_ PPLAYBACK_TIMELINE Timeline
+);
+
+VOID Playback_CursorInit(
+    _Out_ PPLAYBACK_CURSOR Cursor,
+    _In_ LONG64 Now,
+    _In_ BOOLEAN Loop
+);
+
+BOOLEAN Playback_NextDueTime(
+    _In_ const PLAYBACK_TIMELINE* Timeline,
+    _In_ const PLAYBACK_CURSOR* Cursor,
+    _Out_ PLONG64 Due
+);
+
+BOOLEAN Playback_NextDue(
+    _In_ const PLAYBACK_TIMELINE* Timeline,
+    _Inout_ PPLAYBACK_CURSOR Cursor,
+    _In_ LONG64 Now,
+    _Out_ PULONG Entry,
+    _Out_ PLONG64 Scheduled
+);
@@ -0,0 +1,214 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+//
+// Bucket count of a plugin table (must be a power of two)
+// 
+#define PLUGIN_TABLE_BUCKETS        0x40
+
+#define PLUGIN_TABLE_HASH(_serial_) ((_serial_) & (PLUGIN_TABLE_BUCKETS - 1))
+
+//
+// Slot count of the timing wheel; has to span more ticks than a request may
+// live so every slot holds a single generation
+// 
+#define PLUGIN_TABLE_WHEEL_SLOTS    0x08
+
+//
+// Link embedded in a pending plugin request
+// 
+typedef struct _PLUGIN_TABLE_ENTRY
+{
+    //
+    // Link in the serial-keyed bucket
+    // 
+    LIST_ENTRY TableEntry;
+
+    //
+    // Link in the timing wheel slot of ExpiryTick
+    // 
+    LIST_ENTRY WheelEntry;
+
+    //
+    // Unique serial number of the device on the bus
+    // 
+    ULONG Serial;
+
+    //
+    // Wheel tick at which the request gets completed if still pending
+    // 
+    ULONG ExpiryTick;
+
+} PLUGIN_TABLE_ENTRY, *PPLUGIN_TABLE_ENTRY;
+
+//
+// Pending plugin requests, hashed by serial and slotted on a timing wheel by
+// the tick they expire at.
+// 
+// Lookups by serial only walk one bucket and a wheel tick only visits the
+// requests expiring in it. No locking of its own; the bus guards it with
+// PendingPluginRequestsLock.
+// 
+typedef struct _PLUGIN_TABLE
+{
+    LIST_ENTRY Buckets[PLUGIN_TABLE_BUCKETS];
+
+    LIST_ENTRY Wheel[PLUGIN_TABLE_WHEEL_SLOTS];
+
+    //
+    // Current tick of the timing wheel
+    // 
+    ULONG Tick;
+
+    //
+    // Number of requests in the table
+    // 
+    ULONG Count;
+
+} PLUGIN_TABLE, *PPLUGIN_TABLE;
+
+FORCEINLINE
+VOID
+PluginTableInit(
+    _Out_ PPLUGIN_TABLE Table
+)
+{
+    ULONG i;
+
+    for (i = 0; i < PLUGIN_TABLE_BUCKETS; i++)
+    {
+        InitializeListHead(&Table->Buckets[i]);
+    }
+
+    for (i = 0; i < PLUGIN_TABLE_WHEEL_SLOTS; i++)
+    {
+        InitializeListHead(&Table->Wheel[i]);
+    }
+
+    Table->Tick = 0;
+    Table->Count = 0;
+}
+
+//
+// Returns the request with the given serial, NULL if there is none.
+// 
+FORCEINLINE
+PPLUGIN_TABLE_ENTRY
+PluginTableFind(
+    _In_ const PLUGIN_TABLE* Table,
+    _In_ ULONG Serial
+)
+{
+    const LIST_ENTRY* bucket = &Table->Buckets[PLUGIN_TABLE_HASH(Serial)];
+    PLIST_ENTRY entry;
+    PPLUGIN_TABLE_ENTRY request;
+
+    for (entry = bucket->Flink; entry != bucket; entry = entry->Flink)
+    {
+        request = CONTAINING_RECORD(entry, PLUGIN_TABLE_ENTRY, TableEntry);
+
+        if (request->Serial == Serial)
+        {
+            return request;
+        }
+    }
+
+    return NULL;
+}
+
+//
+// Tracks a request and schedules its expiry Ticks wheel ticks from now.
+// 
+// Ticks must stay below PLUGIN_TABLE_WHEEL_SLOTS. The wheel may be up to one
+// tick into its period already, hence the extra tick so a request never
+// expires before Ticks full periods passed.
+// 
+FORCEINLINE
+VOID
+PluginTableLink(
+    _Inout_ PPLUGIN_TABLE Table,
+    _Inout_ PPLUGIN_TABLE_ENTRY Entry,
+    _In_ ULONG Serial,
+    _In_ ULONG Ticks
+)
+{
+    Entry->Serial = Serial;
+    Entry->ExpiryTick = Table->Tick + Ticks + 1;
+
+    InsertTailList(&Table->Buckets[PLUGIN_TABLE_HASH(Serial)], &Entry->TableEntry);
+    InsertTailList(&Table->Wheel[Entry->ExpiryTick % PLUGIN_TABLE_WHEEL_SLOTS], &Entry->WheelEntry);
+
+    Table->Count++;
+}
+
+//
+// Stops tracking a request.
+// 
+FORCEINLINE
+VOID
+PluginTableUnlink(
+    _Inout_ PPLUGIN_TABLE Table,
+    _Inout_ PPLUGIN_TABLE_ENTRY Entry
+)
+{
+    RemoveEntryList(&Entry->TableEntry);
+    RemoveEntryList(&Entry->WheelEntry);
+
+    Table->Count--;
+}
+
+//
+// Advances the wheel by one tick and moves every request expiring in it to
+// Expired, linked by WheelEntry in the order they got tracked.
+// 
+FORCEINLINE
+VOID
+PluginTableAdvance(
+    _Inout_ PPLUGIN_TABLE Table,
+    _Inout_ PLIST_ENTRY Expired
+)
+{
+    ULONG tick = ++Table->Tick;
+    PLIST_ENTRY slot = &Table->Wheel[tick % PLUGIN_TABLE_WHEEL_SLOTS];
+    PLIST_ENTRY entry;
+    PPLUGIN_TABLE_ENTRY request;
+
+    for (entry = slot->Flink; entry != slot;)
+    {
+        request = CONTAINING_RECORD(entry, PLUGIN_TABLE_ENTRY, WheelEntry);
+        entry = entry->Flink;
+
+        if ((LONG)(tick - request->ExpiryTick) >= 0)
+        {
+            PluginTableUnlink(Table, request);
+
+            InsertTailList(Expired, &request->WheelEntry);
+        }
+    }
+}
@@ -54,10 +54,11 @@ VOID Bus_EvtIoDeviceControl(
     PXGIP_SUBMIT_INTERRUPT      xgipInterrupt = NULL;
     PVIGEM_CHECK_VERSION        pCheckVersion = NULL;
     PXUSB_GET_USER_INDEX        pXusbGetUserIndex = NULL;
+    VIGEM_REPORT_DISPOSITION    disposition;
 
     Device = WdfIoQueueGetDevice(Queue);
 
-    TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_QUEUE, "%!FUNC! Entry (device: 0x%p)", Device);
+    TraceHot(TRACE_QUEUE, "%!FUNC! Entry (device: 0x%p)", Device);
 
     switch (IoControlCode)
     {
@@ -113,8 +114,7 @@ VOID Bus_EvtIoDeviceControl(
 #pragma region IOCTL_XUSB_SUBMIT_REPORT
     case IOCTL_XUSB_SUBMIT_REPORT:
 
-        TraceEvents(TRACE_LEVEL_VERBOSE,
-            TRACE_QUEUE,
+        TraceHot(TRACE_QUEUE,
             "IOCTL_XUSB_SUBMIT_REPORT");
 
         status = WdfRequestRetrieveInputBuffer(Request, sizeof(XUSB_SUBMIT_REPORT), (PVOID)&xusbSubmit, &length);
@@ -141,7 +141,12 @@ VOID Bus_EvtIoDeviceControl(
                 break;
             }
 
-            status = Bus_XusbSubmitReport(Device, xusbSubmit->SerialNo, xusbSubmit, FALSE);
+            status = Bus_SubmitRequestReport(Device, Request, xusbSubmit->SerialNo, xusbSubmit, &disposition);
+
+            if (NT_SUCCESS(status))
+            {
+                Bus_ReturnDisposition(Request, disposition, &length);
+            }
         }
 
         break;
@@ -197,8 +202,7 @@ VOID Bus_EvtIoDeviceControl(
 #pragma region IOCTL_DS4_SUBMIT_REPORT
     case IOCTL_DS4_SUBMIT_REPORT:
 
-        TraceEvents(TRACE_LEVEL_VERBOSE,
-            TRACE_QUEUE,
+        TraceHot(TRACE_QUEUE,
             "IOCTL_DS4_SUBMIT_REPORT");
 
         status = WdfRequestRetrieveInputBuffer(Request, sizeof(DS4_SUBMIT_REPORT), (PVOID)&ds4Submit, &length);
@@ -225,7 +229,12 @@ VOID Bus_EvtIoDeviceControl(
                 break;
             }
 
-            status = Bus_Ds4SubmitReport(Device, ds4Submit->SerialNo, ds4Submit, FALSE);
+            status = Bus_SubmitRequestReport(Device, Request, ds4Submit->SerialNo, ds4Submit, &disposition);
+
+            if (NT_SUCCESS(status))
+            {
+                Bus_ReturnDisposition(Request, disposition, &length);
+            }
         }
 
         break;
@@ -281,8 +290,7 @@ VOID Bus_EvtIoDeviceControl(
 #pragma region IOCTL_XGIP_SUBMIT_REPORT
     case IOCTL_XGIP_SUBMIT_REPORT:
 
-        TraceEvents(TRACE_LEVEL_VERBOSE,
-            TRACE_QUEUE,
+        TraceHot(TRACE_QUEUE,
             "IOCTL_XGIP_SUBMIT_REPORT");
 
         status = WdfRequestRetrieveInputBuffer(Request, sizeof(XGIP_SUBMIT_REPORT), (PVOID)&xgipSubmit, &length);
@@ -302,7 +310,12 @@ VOID Bus_EvtIoDeviceControl(
                 break;
             }
 
-            status = Bus_XgipSubmitReport(Device, xgipSubmit->SerialNo, xgipSubmit, FALSE);
+            status = Bus_SubmitRequestReport(Device, Request, xgipSubmit->SerialNo, xgipSubmit, &disposition);
+
+            if (NT_SUCCESS(status))
+            {
+                Bus_ReturnDisposition(Request, disposition, &length);
+            }
         }
 
         break;
@@ -336,6 +349,194 @@ VOID Bus_EvtIoDeviceControl(
         break;
 #pragma endregion 
 
+#pragma region IOCTL_VIGEM_SUBMIT_REPORT_BATCH
+    case IOCTL_VIGEM_SUBMIT_REPORT_BATCH:
+
+        TraceHot(TRACE_QUEUE,
+            "IOCTL_VIGEM_SUBMIT_REPORT_BATCH");
+
+        status = Bus_SubmitReportBatch(Device, Request, &length);
+
+        break;
+#pragma endregion
+
+#pragma region IOCTL_VIGEM_GET_PLUGIN_STATS
+    case IOCTL_VIGEM_GET_PLUGIN_STATS:
+
+        TraceEvents(TRACE_LEVEL_VERBOSE,
+            TRACE_QUEUE,
+            "IOCTL_VIGEM_GET_PLUGIN_STATS");
+
+        status = Bus_GetPluginStats(Device, Request, &length);
+
+        break;
+#pragma endregion
+
+#pragma region IOCTL_VIGEM_GET_RESOURCE_STATS
+    case IOCTL_VIGEM_GET_RESOURCE_STATS:
+
+        TraceEvents(TRACE_LEVEL_VERBOSE,
+            TRACE_QUEUE,
+            "IOCTL_VIGEM_GET_RESOURCE_STATS");
+
+        status = Bus_GetResourceStats(Device, Request, &length);
+
+        break;
+#pragma endregion
+
+#pragma region IOCTL_VIGEM_REPORT_DEDUPE
+    case IOCTL_VIGEM_REPORT_DEDUPE:
+
+        TraceEvents(TRACE_LEVEL_VERBOSE,
+            TRACE_QUEUE,
+            "IOCTL_VIGEM_REPORT_DEDUPE");
+
+        status = Bus_ReportDedupe(Device, Request, &length);
+
+        break;
+#pragma endregion
+
+#pragma region IOCTL_VIGEM_GET_STATE_SNAPSHOT
+    case IOCTL_VIGEM_GET_STATE_SNAPSHOT:
+
+        TraceEvents(TRACE_LEVEL_VERBOSE,
+            TRACE_QUEUE,
+            "IOCTL_VIGEM_GET_STATE_SNAPSHOT");
+
+        status = Bus_GetStateSnapshot(Device, Request, &length);
+
+        break;
+#pragma endregion
+
+#pragma region IOCTL_VIGEM_SUBMIT_AND_WAIT
+    case IOCTL_VIGEM_SUBMIT_AND_WAIT:
+
+        TraceHot(TRACE_QUEUE,
+            "IOCTL_VIGEM_SUBMIT_AND_WAIT");
+
+        status = Bus_SubmitAndWait(Device, Request, &length);
+
+        break;
+#pragma endregion
+
+#pragma region IOCTL_VIGEM_GET_REPORT_STATS
+    case IOCTL_VIGEM_GET_REPORT_STATS:
+
+        TraceEvents(TRACE_LEVEL_VERBOSE,
+            TRACE_QUEUE,
+            "IOCTL_VIGEM_GET_REPORT_STATS");
+
+        status = Bus_GetReportStats(Device, Request, &length);
+
+        break;
+#pragma endregion
+
+#pragma region IOCTL_VIGEM_SUBMIT_DELTA
+    case IOCTL_VIGEM_SUBMIT_DELTA:
+
+        TraceHot(TRACE_QUEUE,
+            "IOCTL_VIGEM_SUBMIT_DELTA");
+
+        status = Bus_SubmitDelta(Device, Request, &length);
+
+        break;
+#pragma endregion
+
+#pragma region IOCTL_VIGEM_SUBMIT_GAMEPAD_STATE
+    case IOCTL_VIGEM_SUBMIT_GAMEPAD_STATE:
+
+        TraceHot(TRACE_QUEUE,
+            "IOCTL_VIGEM_SUBMIT_GAMEPAD_STATE");
+
+        status = Bus_SubmitGamepadState(Device, Request, &length);
+
+        break;
+#pragma endregion
+
+#pragma region IOCTL_VIGEM_MIRROR
+    case IOCTL_VIGEM_MIRROR:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_QUEUE,
+            "IOCTL_VIGEM_MIRROR");
+
+        status = Bus_Mirror(Device, Request, &length);
+
+        break;
+#pragma endregion
+
+#pragma region IOCTL_VIGEM_PLAYBACK_LOAD
+    case IOCTL_VIGEM_PLAYBACK_LOAD:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_QUEUE,
+            "IOCTL_VIGEM_PLAYBACK_LOAD");
+
+        status = Playback_Load(Device, Request, &length);
+
+        break;
+#pragma endregion
+
+#pragma region IOCTL_VIGEM_PLAYBACK_CONTROL
+    case IOCTL_VIGEM_PLAYBACK_CONTROL:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_QUEUE,
+            "IOCTL_VIGEM_PLAYBACK_CONTROL");
+
+        status = Playback_Control(Device, Request, &length);
+
+        break;
+#pragma endregion
+
+#pragma region IOCTL_VIGEM_SET_INTERPOLATION
+    case IOCTL_VIGEM_SET_INTERPOLATION:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_QUEUE,
+            "IOCTL_VIGEM_SET_INTERPOLATION");
+
+        status = Bus_SetInterpolation(Device, Request, &length);
+
+        break;
+#pragma endregion
+
+#pragma region IOCTL_VIGEM_SET_TRANSFORM
+    case IOCTL_VIGEM_SET_TRANSFORM:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_QUEUE,
+            "IOCTL_VIGEM_SET_TRANSFORM");
+
+        status = Transform_Configure(Device, Request, &length);
+
+        break;
+#pragma endregion
+
+#pragma region IOCTL_VIGEM_REPORT_FIFO
+    case IOCTL_VIGEM_REPORT_FIFO:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_QUEUE,
+            "IOCTL_VIGEM_REPORT_FIFO");
+
+        status = ReportFifo_Control(Device, Request, &length);
+
+        break;
+#pragma endregion
+
+#pragma region IOCTL_VIGEM_BIND_TARGET
+    case IOCTL_VIGEM_BIND_TARGET:
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_QUEUE,
+            "IOCTL_VIGEM_BIND_TARGET");
+
+        status = Bus_BindTarget(Device, Request, &length);
+
+        break;
+#pragma endregion
+
 #pragma region IOCTL_XUSB_GET_USER_INDEX
     case IOCTL_XUSB_GET_USER_INDEX:
 
@@ -389,7 +590,45 @@ VOID Bus_EvtIoDeviceControl(
         WdfRequestCompleteWithInformation(Request, status, length);
     }
     
-    TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_QUEUE, "%!FUNC! Exit with status %!STATUS!", status);
+    TraceHot(TRACE_QUEUE, "%!FUNC! Exit with status %!STATUS!", status);
+}
+
+//
+// Sees every request in the context of the requesting thread before it's queued.
+// 
+// Requests mapping memory into the caller are handled right here, all others
+// go on to the default queue.
+// 
+VOID Bus_EvtIoInCallerContext(
+    _In_ WDFDEVICE  Device,
+    _In_ WDFREQUEST Request
+)
+{
+    NTSTATUS                status;
+    WDF_REQUEST_PARAMETERS  params;
+    size_t                  length = 0;
+
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(Request, &params);
+
+    if (params.Type == WdfRequestTypeDeviceControl
+        && params.Parameters.DeviceIoControl.IoControlCode == IOCTL_VIGEM_MAP_INPUT_SLOT)
+    {
+        TraceEvents(TRACE_LEVEL_VERBOSE,
+            TRACE_QUEUE,
+            "IOCTL_VIGEM_MAP_INPUT_SLOT");
+
+        status = InputSlot_Map(Device, Request, &length);
+
+        WdfRequestCompleteWithInformation(Request, status, length);
+        return;
+    }
+
+    status = WdfDeviceEnqueueRequest(Device, Request);
+    if (!NT_SUCCESS(status))
+    {
+        WdfRequestComplete(Request, status);
+    }
 }
 
 //
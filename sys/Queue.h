@@ -30,3 +30,4 @@
 EVT_WDF_IO_QUEUE_IO_DEFAULT Bus_EvtIoDefault;
 EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL Bus_EvtIoDeviceControl;
 EVT_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL Bus_EvtIoInternalDeviceControl;
+EVT_WDF_IO_IN_CALLER_CONTEXT Bus_EvtIoInCallerContext;
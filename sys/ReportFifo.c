@@ -0,0 +1,312 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "busenum.h"
+#include "reportfifo.tmh"
+
+//
+// Queues a submitted report with the motion data that came along.
+// 
+// Returns STATUS_DEVICE_BUSY if the FIFO refused it and
+// STATUS_INVALID_DEVICE_STATE if the PDO has no FIFO (anymore).
+// 
+NTSTATUS ReportFifo_Submit(WDFDEVICE Pdo, const VIGEM_TARGET_REPORT* Report, const VIGEM_GAMEPAD_STATE* Motion)
+{
+    PPDO_DEVICE_DATA    pdoData = PdoGetData(Pdo);
+    REPORT_FIFO_SAMPLE  sample;
+    NTSTATUS            status;
+
+    sample.Time = KeQueryPerformanceCounter(NULL).QuadPart;
+    sample.Report = *Report;
+
+    if (Motion != NULL)
+    {
+        sample.Motion = *Motion;
+    }
+    else
+    {
+        RtlZeroMemory(&sample.Motion, sizeof(VIGEM_GAMEPAD_STATE));
+    }
+
+    WdfSpinLockAcquire(pdoData->ReportFifoPushLock);
+
+    if (pdoData->ReportFifo == NULL)
+    {
+        status = STATUS_INVALID_DEVICE_STATE;
+    }
+    else
+    {
+        status = ReportFifo_Push(pdoData->ReportFifo, &sample) ? STATUS_SUCCESS : STATUS_DEVICE_BUSY;
+    }
+
+    WdfSpinLockRelease(pdoData->ReportFifoPushLock);
+
+    return status;
+}
+
+//
+// Moves the next queued report into the report cache ahead of a delivery,
+// leaving the cache as it is if there's none, and flags the cache pending
+// again while more are queued.
+// 
+// The caller holds ReportFifoPopLock until the cache got copied, so
+// concurrent deliveries take turns rather than each other's reports.
+// 
+VOID ReportFifo_Pull(WDFDEVICE Pdo)
+{
+    PPDO_DEVICE_DATA    pdoData = PdoGetData(Pdo);
+    PREPORT_FIFO        fifo = pdoData->ReportFifo;
+    REPORT_FIFO_SAMPLE  sample;
+    WDFQUEUE            queue;
+    LONG64              wait;
+    union
+    {
+        XUSB_SUBMIT_REPORT Xusb;
+        DS4_SUBMIT_REPORT Ds4;
+        XGIP_SUBMIT_REPORT Xgip;
+    } submit;
+
+    if (fifo == NULL)
+    {
+        return;
+    }
+
+    if (!ReportFifo_Pop(fifo, &sample))
+    {
+        InterlockedIncrementNoFence64(&fifo->Repeated);
+        return;
+    }
+
+    wait = KeQueryPerformanceCounter(NULL).QuadPart - sample.Time;
+
+    if (wait > ReadNoFence64(&fifo->MaxWait))
+    {
+        WriteNoFence64(&fifo->MaxWait, wait);
+    }
+
+    pdoData->Ops->WrapReport(&submit, pdoData->SerialNo, &sample.Report);
+
+    (void)pdoData->Ops->CacheReport(Pdo, &submit, NULL, &queue);
+
+    if (pdoData->TargetType == DualShock4Wired
+        && (sample.Motion.Flags & (VIGEM_GAMEPAD_FLAG_MOTION | VIGEM_GAMEPAD_FLAG_TOUCH)))
+    {
+        Ds4_CacheMotion(Pdo, &sample.Motion);
+    }
+
+    if (ReadAcquire(&fifo->Head) != ReadAcquire(&fifo->Tail))
+    {
+        InterlockedExchange(&pdoData->ReportPending, TRUE);
+    }
+}
+
+//
+// Fills in the counters of a control request from the PDO's FIFO.
+// 
+static VOID ReportFifo_GetCounters(PPDO_DEVICE_DATA PdoData, PVIGEM_REPORT_FIFO Control)
+{
+    PREPORT_FIFO    fifo;
+    LARGE_INTEGER   frequency;
+
+    Control->Capacity = 0;
+    Control->Policy = ViGEmReportFifoDropNewest;
+    Control->Depth = 0;
+    Control->HighWater = 0;
+    Control->Queued = 0;
+    Control->Delivered = 0;
+    Control->Repeated = 0;
+    Control->Refused = 0;
+    Control->Evicted = 0;
+    Control->MaxWaitUs = 0;
+
+    // Keeps the FIFO alive, swapping it takes both locks
+    WdfSpinLockAcquire(PdoData->ReportFifoPopLock);
+
+    fifo = PdoData->ReportFifo;
+
+    if (fifo != NULL)
+    {
+        KeQueryPerformanceCounter(&frequency);
+
+        Control->Capacity = fifo->Mask + 1;
+        Control->Policy = fifo->Policy;
+        Control->Depth = (ULONG)ReadAcquire(&fifo->Tail) - (ULONG)ReadAcquire(&fifo->Head);
+        Control->HighWater = (ULONG)ReadNoFence(&fifo->HighWater);
+        Control->Queued = (ULONG64)ReadNoFence64(&fifo->Queued);
+        Control->Delivered = (ULONG64)ReadNoFence64(&fifo->Delivered);
+        Control->Repeated = (ULONG64)ReadNoFence64(&fifo->Repeated);
+        Control->Refused = (ULONG64)ReadNoFence64(&fifo->Refused);
+        Control->Evicted = (ULONG64)ReadNoFence64(&fifo->Evicted);
+        Control->MaxWaitUs = (ULONG64)ReadNoFence64(&fifo->MaxWait) * 1000000 / (ULONG64)frequency.QuadPart;
+    }
+
+    WdfSpinLockRelease(PdoData->ReportFifoPopLock);
+}
+
+//
+// Enables, disables or queries the report FIFO of a PDO.
+// 
+NTSTATUS ReportFifo_Control(WDFDEVICE Device, WDFREQUEST Request, size_t* Transferred)
+{
+    NTSTATUS                status;
+    PVIGEM_REPORT_FIFO      control;
+    VIGEM_REPORT_FIFO       counters;
+    WDFDEVICE               hChild;
+    PPDO_DEVICE_DATA        pdoData;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    WDFMEMORY               memory = NULL;
+    WDFMEMORY               previous;
+    PREPORT_FIFO            fifo = NULL;
+    size_t                  length = 0;
+
+    *Transferred = 0;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIGEM_REPORT_FIFO), (PVOID)&control, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_REPORTFIFO,
+            "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    if (control->Size != sizeof(VIGEM_REPORT_FIFO) || (ULONG)control->Operation > ViGEmReportFifoQuery)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (control->Operation == ViGEmReportFifoEnable
+        && (control->Capacity < 2
+            || control->Capacity > VIGEM_REPORT_FIFO_MAX_CAPACITY
+            || (control->Capacity & (control->Capacity - 1)) != 0
+            || (ULONG)control->Policy > ViGEmReportFifoDropOldest))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    hChild = Bus_GetPdo(Device, control->SerialNo);
+
+    if (hChild == NULL)
+    {
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    pdoData = PdoGetData(hChild);
+
+    if (!IS_OWNER(pdoData))
+    {
+        status = STATUS_ACCESS_DENIED;
+        goto controlEnd;
+    }
+
+    // The counters of a FIFO about to go away are the last ones it has
+    ReportFifo_GetCounters(pdoData, &counters);
+
+    if (control->Operation == ViGEmReportFifoEnable)
+    {
+        WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+        attributes.ParentObject = hChild;
+
+        status = WdfMemoryCreate(&attributes,
+            NonPagedPoolNx,
+            VIGEM_POOL_TAG,
+            REPORT_FIFO_SIZE(control->Capacity),
+            &memory,
+            (PVOID)&fifo);
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_REPORTFIFO,
+                "WdfMemoryCreate failed with status %!STATUS!",
+                status);
+            goto controlEnd;
+        }
+
+        Bus_TrackObject(Device, hChild, memory, ViGEmResourceMemory);
+
+        RtlZeroMemory(fifo, FIELD_OFFSET(REPORT_FIFO, Samples));
+
+        fifo->Mask = control->Capacity - 1;
+        fifo->Policy = control->Policy;
+    }
+
+    if (control->Operation != ViGEmReportFifoQuery)
+    {
+        WdfSpinLockAcquire(pdoData->ReportFifoPushLock);
+        WdfSpinLockAcquire(pdoData->ReportFifoPopLock);
+
+        previous = pdoData->ReportFifoMemory;
+
+        pdoData->ReportFifoMemory = memory;
+        pdoData->ReportFifo = fifo;
+
+        WdfSpinLockRelease(pdoData->ReportFifoPopLock);
+        WdfSpinLockRelease(pdoData->ReportFifoPushLock);
+
+        // Neither side can still be looking at it now
+        if (previous != NULL)
+        {
+            WdfObjectDelete(previous);
+        }
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_REPORTFIFO,
+            "Report FIFO of serial %d set to capacity %d",
+            pdoData->SerialNo,
+            fifo != NULL ? fifo->Mask + 1 : 0);
+    }
+
+    if (control->Operation == ViGEmReportFifoEnable)
+    {
+        ReportFifo_GetCounters(pdoData, &counters);
+    }
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIGEM_REPORT_FIFO), (PVOID)&control, &length);
+    if (!NT_SUCCESS(status))
+    {
+        // Counters are optional
+        status = STATUS_SUCCESS;
+        goto controlEnd;
+    }
+
+    counters.Size = sizeof(VIGEM_REPORT_FIFO);
+    counters.SerialNo = control->SerialNo;
+    counters.Operation = control->Operation;
+
+    *control = counters;
+
+    *Transferred = sizeof(VIGEM_REPORT_FIFO);
+
+    status = STATUS_SUCCESS;
+
+controlEnd:
+
+    Bus_PutPdo(hChild);
+
+    return status;
+}
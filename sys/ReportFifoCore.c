@@ -0,0 +1,108 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Platform.h"
+#include "ReportFifoCore.h"
+
+#pragma region Ring
+
+//
+// Queues a sample. On a full ring the policy decides whether the oldest
+// sample makes room or this one gets refused, in which case FALSE is returned.
+// 
+// Callers serialize among themselves, never against ReportFifo_Pop.
+// 
+BOOLEAN ReportFifo_Push(PREPORT_FIFO Fifo, const REPORT_FIFO_SAMPLE* Sample)
+{
+    ULONG tail = (ULONG)ReadNoFence(&Fifo->Tail);
+    ULONG head = (ULONG)ReadAcquire(&Fifo->Head);
+    ULONG depth;
+
+    if (tail - head > Fifo->Mask)
+    {
+        if (Fifo->Policy == ViGEmReportFifoDropNewest)
+        {
+            InterlockedIncrementNoFence64(&Fifo->Refused);
+            return FALSE;
+        }
+
+        //
+        // The consumer may have taken it meanwhile, either way the slot is
+        // free now; a consumer still copying it fails its compare-exchange
+        // 
+        if (InterlockedCompareExchange(&Fifo->Head, (LONG)(head + 1), (LONG)head) == (LONG)head)
+        {
+            InterlockedIncrementNoFence64(&Fifo->Evicted);
+        }
+    }
+
+    Fifo->Samples[tail & Fifo->Mask] = *Sample;
+
+    WriteRelease(&Fifo->Tail, (LONG)(tail + 1));
+
+    InterlockedIncrementNoFence64(&Fifo->Queued);
+
+    depth = tail + 1 - (ULONG)ReadNoFence(&Fifo->Head);
+
+    if ((LONG)depth > ReadNoFence(&Fifo->HighWater))
+    {
+        WriteNoFence(&Fifo->HighWater, (LONG)depth);
+    }
+
+    return TRUE;
+}
+
+//
+// Takes the oldest sample, FALSE if the ring is empty.
+// 
+// Callers serialize among themselves, never against ReportFifo_Push.
+// 
+BOOLEAN ReportFifo_Pop(PREPORT_FIFO Fifo, PREPORT_FIFO_SAMPLE Sample)
+{
+    LONG head;
+
+    for (;;)
+    {
+        head = ReadAcquire(&Fifo->Head);
+
+        if (head == ReadAcquire(&Fifo->Tail))
+        {
+            return FALSE;
+        }
+
+        *Sample = Fifo->Samples[(ULONG)head & Fifo->Mask];
+
+        // Only keep the copy if the producer didn't evict the sample under it
+        if (InterlockedCompareExchange(&Fifo->Head, head + 1, head) == head)
+        {
+            InterlockedIncrementNoFence64(&Fifo->Delivered);
+            return TRUE;
+        }
+    }
+}
+
+#pragma endregion
@@ -0,0 +1,104 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+//
+// A report as it was submitted
+// 
+typedef struct _REPORT_FIFO_SAMPLE
+{
+    //
+    // Performance counter value at submission
+    // 
+    LONG64 Time;
+
+    VIGEM_TARGET_REPORT Report;
+
+    //
+    // DS4 motion and touch data submitted along, Motion.Flags is 0 if none
+    // 
+    VIGEM_GAMEPAD_STATE Motion;
+
+} REPORT_FIFO_SAMPLE, *PREPORT_FIFO_SAMPLE;
+
+//
+// Bounded single-producer/single-consumer ring of submitted reports.
+// 
+// Head and Tail run freely and get masked on access. The producer owns
+// Tail, the consumer owns Head; the producer only ever moves Head to
+// evict, which the consumer notices through its compare-exchange.
+// 
+typedef struct _REPORT_FIFO
+{
+    ULONG Mask;
+
+    VIGEM_REPORT_FIFO_POLICY Policy;
+
+    //
+    // Producer side
+    // 
+    DECLSPEC_CACHEALIGN volatile LONG Tail;
+
+    volatile LONG HighWater;
+
+    volatile LONG64 Queued;
+
+    volatile LONG64 Refused;
+
+    volatile LONG64 Evicted;
+
+    //
+    // Consumer side
+    // 
+    DECLSPEC_CACHEALIGN volatile LONG Head;
+
+    volatile LONG64 Delivered;
+
+    volatile LONG64 Repeated;
+
+    //
+    // Longest time a sample spent queued, in performance counter ticks
+    // 
+    volatile LONG64 MaxWait;
+
+    DECLSPEC_CACHEALIGN REPORT_FIFO_SAMPLE Samples[ANYSIZE_ARRAY];
+
+} REPORT_FIFO, *PREPORT_FIFO;
+
+#define REPORT_FIFO_SIZE(_capacity_)    (FIELD_OFFSET(REPORT_FIFO, Samples) + (_capacity_) * sizeof(REPORT_FIFO_SAMPLE))
+
+
+BOOLEAN ReportFifo_Push(
+    _Inout_ PREPORT_FIFO Fifo,
+    _In_ const REPORT_FIFO_SAMPLE* Sample
+);
+
+BOOLEAN ReportFifo_Pop(
+    _Inout_ PREPORT_FIFO Fifo,
+    _Out_ PREPORT_FIFO_SAMPLE Sample
+);
@@ -0,0 +1,160 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+//
+// Latest-value mailbox between report submitters and IN URBs.
+// 
+// The report cache is the mailbox; a flag tells whether it holds an update
+// no IN URB has picked up yet. IN URBs finding nothing to pick up get parked
+// until the next submission. The handshake only depends on the flag and on
+// the queue operations it gets passed, so it runs on the host against a
+// simulated queue as well.
+// 
+typedef struct _REPORT_MAILBOX_OPS
+{
+    //
+    // Takes the oldest IN request parked in Queue, FALSE if there is none
+    // 
+    BOOLEAN(*Retrieve)(PVOID Queue, PVOID* Request);
+
+    //
+    // Parks an IN request in Queue
+    // 
+    NTSTATUS(*Park)(PVOID Queue, PVOID Request);
+
+    //
+    // Completes a retrieved IN request with the cached report of Pdo
+    // 
+    VOID(*Complete)(PVOID Pdo, PVOID Request);
+
+} REPORT_MAILBOX_OPS, *PREPORT_MAILBOX_OPS;
+
+//
+// Hands the cache to a parked IN request, returns FALSE if none is parked.
+// 
+FORCEINLINE
+BOOLEAN
+ReportMailboxDeliver(
+    _Inout_ volatile LONG* Pending,
+    _In_ const REPORT_MAILBOX_OPS* Ops,
+    _In_ PVOID Pdo,
+    _In_ PVOID Queue
+)
+{
+    PVOID request;
+
+    if (!Ops->Retrieve(Queue, &request))
+    {
+        return FALSE;
+    }
+
+    // Cache is about to be delivered
+    InterlockedExchange(Pending, FALSE);
+
+    Ops->Complete(Pdo, request);
+
+    return TRUE;
+}
+
+//
+// Publishes an updated cache and hands it to a parked IN request.
+// 
+// The cache gets flagged as undelivered before looking for a parked request
+// so an IN request arriving in between picks it up instead of parking.
+// Queued is set if the update waits in a FIFO, where replacing a report
+// still waiting for its URB loses nothing.
+// 
+FORCEINLINE
+VIGEM_REPORT_DISPOSITION
+ReportMailboxSubmit(
+    _Inout_ volatile LONG* Pending,
+    _In_ const REPORT_MAILBOX_OPS* Ops,
+    _In_ PVOID Pdo,
+    _In_ PVOID Queue,
+    _In_ BOOLEAN Queued
+)
+{
+    VIGEM_REPORT_DISPOSITION disposition;
+
+    disposition = InterlockedExchange(Pending, TRUE) && !Queued
+        ? ViGEmReportDropped
+        : ViGEmReportCoalesced;
+
+    if (ReportMailboxDeliver(Pending, Ops, Pdo, Queue))
+    {
+        disposition = ViGEmReportDelivered;
+    }
+
+    return disposition;
+}
+
+//
+// Handles an IN request asking for input data.
+// 
+// Returns STATUS_SUCCESS if the caller is to complete Request with the cache
+// right away and STATUS_PENDING once it got parked.
+// 
+FORCEINLINE
+NTSTATUS
+ReportMailboxArrive(
+    _Inout_ volatile LONG* Pending,
+    _In_ const REPORT_MAILBOX_OPS* Ops,
+    _In_ PVOID Pdo,
+    _In_ PVOID Queue,
+    _In_ PVOID Request
+)
+{
+    NTSTATUS status;
+
+    if (InterlockedExchange(Pending, FALSE))
+    {
+        return STATUS_SUCCESS;
+    }
+
+    status = Ops->Park(Queue, Request);
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    //
+    // A report may have been cached while the request got parked and the
+    // submitter found no request to complete; deliver it now. The flag is
+    // only cleared while holding a request to deliver the cache with,
+    // otherwise a submitter racing for the same request loses its update.
+    // 
+    KeMemoryBarrier();
+
+    if (ReadNoFence(Pending))
+    {
+        ReportMailboxDeliver(Pending, Ops, Pdo, Queue);
+    }
+
+    return STATUS_PENDING;
+}
@@ -0,0 +1,210 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+//
+// Sequence lock guarding a small data block (e.g. a report cache).
+// 
+// Writers exclude each other and bump the sequence to an odd value while
+// modifying the data; readers never block writers, they copy the data and
+// retry if the sequence changed meanwhile. Writers run at DISPATCH_LEVEL for
+// the duration of the write so a reader can't spin on a preempted writer.
+// 
+// The sequence protocol itself doesn't depend on the kernel and gets tested
+// on the host; only the IRQL handling of the SeqLockWrite* wrappers does.
+// 
+typedef struct _SEQLOCK
+{
+    volatile LONG Sequence;
+
+} SEQLOCK, *PSEQLOCK;
+
+#pragma region Sequence protocol
+
+//
+// Claims the write side, spinning while another writer is inside.
+// 
+FORCEINLINE
+VOID
+SeqLockWriteAcquire(
+    _Inout_ PSEQLOCK Lock
+)
+{
+    LONG sequence;
+
+    for (;;)
+    {
+        sequence = ReadAcquire(&Lock->Sequence);
+
+        if (!(sequence & 1)
+            && InterlockedCompareExchange(&Lock->Sequence, sequence + 1, sequence) == sequence)
+        {
+            break;
+        }
+
+        YieldProcessor();
+    }
+}
+
+//
+// Releases the write side, publishing the modified data.
+// 
+FORCEINLINE
+VOID
+SeqLockWriteRelease(
+    _Inout_ PSEQLOCK Lock
+)
+{
+    InterlockedIncrement(&Lock->Sequence);
+}
+
+//
+// Releases the write side without having modified the data; readers that
+// started before the write don't need to retry.
+// 
+FORCEINLINE
+VOID
+SeqLockWriteCancel(
+    _Inout_ PSEQLOCK Lock
+)
+{
+    InterlockedDecrement(&Lock->Sequence);
+}
+
+//
+// Starts a read, waiting for a write in progress to finish.
+// 
+FORCEINLINE
+LONG
+SeqLockReadBegin(
+    _In_ PSEQLOCK Lock
+)
+{
+    LONG sequence;
+
+    while ((sequence = ReadAcquire(&Lock->Sequence)) & 1)
+    {
+        YieldProcessor();
+    }
+
+    return sequence;
+}
+
+//
+// Returns TRUE if the data read since SeqLockReadBegin may be torn.
+// 
+FORCEINLINE
+BOOLEAN
+SeqLockReadRetry(
+    _In_ PSEQLOCK Lock,
+    _In_ LONG Sequence
+)
+{
+    KeMemoryBarrier();
+
+    return (ReadNoFence(&Lock->Sequence) != Sequence);
+}
+
+//
+// Takes a consistent snapshot of the guarded data.
+// 
+FORCEINLINE
+VOID
+SeqLockReadCopy(
+    _In_ PSEQLOCK Lock,
+    _Out_writes_bytes_(Length) PVOID Destination,
+    _In_reads_bytes_(Length) const VOID* Source,
+    _In_ SIZE_T Length
+)
+{
+    LONG sequence;
+
+    do
+    {
+        sequence = SeqLockReadBegin(Lock);
+
+        RtlCopyMemory(Destination, Source, Length);
+
+    } while (SeqLockReadRetry(Lock, sequence));
+}
+
+#pragma endregion
+
+#if !defined(VIGEM_HOST_BUILD)
+
+#pragma region Kernel writers
+
+//
+// Enters the write section, spinning while another writer is inside.
+// 
+FORCEINLINE
+_IRQL_raises_(DISPATCH_LEVEL)
+VOID
+SeqLockWriteBegin(
+    _Inout_ PSEQLOCK Lock,
+    _Out_ _IRQL_saves_ PKIRQL OldIrql
+)
+{
+    KeRaiseIrql(DISPATCH_LEVEL, OldIrql);
+
+    SeqLockWriteAcquire(Lock);
+}
+
+//
+// Leaves the write section, publishing the modified data.
+// 
+FORCEINLINE
+VOID
+SeqLockWriteEnd(
+    _Inout_ PSEQLOCK Lock,
+    _In_ _IRQL_restores_ KIRQL OldIrql
+)
+{
+    SeqLockWriteRelease(Lock);
+
+    KeLowerIrql(OldIrql);
+}
+
+//
+// Leaves the write section without having modified the data.
+// 
+FORCEINLINE
+VOID
+SeqLockWriteAbort(
+    _Inout_ PSEQLOCK Lock,
+    _In_ _IRQL_restores_ KIRQL OldIrql
+)
+{
+    SeqLockWriteCancel(Lock);
+
+    KeLowerIrql(OldIrql);
+}
+
+#pragma endregion
+
+#endif
@@ -0,0 +1,166 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+//
+// Number of serials the bus can assign on its own (serial 0 is never used)
+// 
+#define SERIAL_ALLOCATOR_SERIALS    0x400
+
+#define SERIAL_ALLOCATOR_WORDS      (SERIAL_ALLOCATOR_SERIALS / 32)
+
+//
+// Bitmap of the serials in use or reserved by pending plugin requests.
+// 
+// Allocation takes the lowest free serial. Hint keeps it from rescanning the
+// words below the lowest free bit, so a bus with many devices plugged in
+// doesn't pay for them on every allocation.
+// 
+typedef struct _SERIAL_ALLOCATOR
+{
+    EX_SPIN_LOCK Lock;
+
+    //
+    // Lowest word that may have a clear bit
+    // 
+    ULONG Hint;
+
+    ULONG Used[SERIAL_ALLOCATOR_WORDS];
+
+} SERIAL_ALLOCATOR, *PSERIAL_ALLOCATOR;
+
+FORCEINLINE
+VOID
+SerialAllocatorInit(
+    _Out_ PSERIAL_ALLOCATOR Allocator
+)
+{
+    RtlZeroMemory(Allocator, sizeof(SERIAL_ALLOCATOR));
+
+    // Serial 0 is invalid
+    Allocator->Used[0] = 1;
+}
+
+//
+// Picks the lowest free serial and marks it used.
+// 
+// Returns 0 if all serials the bus hands out are taken.
+// 
+FORCEINLINE
+ULONG
+SerialAllocatorAllocate(
+    _Inout_ PSERIAL_ALLOCATOR Allocator
+)
+{
+    ULONG serial = 0;
+    ULONG word;
+    ULONG bit;
+    KIRQL irql;
+
+    irql = ExAcquireSpinLockExclusive(&Allocator->Lock);
+
+    for (word = Allocator->Hint; word < SERIAL_ALLOCATOR_WORDS; word++)
+    {
+        if (BitScanForward(&bit, ~Allocator->Used[word]))
+        {
+            Allocator->Used[word] |= 1UL << bit;
+            serial = word * 32 + bit;
+            break;
+        }
+    }
+
+    Allocator->Hint = word;
+
+    ExReleaseSpinLockExclusive(&Allocator->Lock, irql);
+
+    return serial;
+}
+
+//
+// Marks a caller-chosen serial used so the allocator won't hand it out.
+// 
+// Returns TRUE if this call took the serial; serials outside the bitmap
+// and serials already marked are left alone.
+// 
+FORCEINLINE
+BOOLEAN
+SerialAllocatorReserve(
+    _Inout_ PSERIAL_ALLOCATOR Allocator,
+    _In_ ULONG Serial
+)
+{
+    ULONG mask = 1UL << (Serial % 32);
+    BOOLEAN reserved = FALSE;
+    KIRQL irql;
+
+    if (Serial >= SERIAL_ALLOCATOR_SERIALS)
+    {
+        return FALSE;
+    }
+
+    irql = ExAcquireSpinLockExclusive(&Allocator->Lock);
+
+    if ((Allocator->Used[Serial / 32] & mask) == 0)
+    {
+        Allocator->Used[Serial / 32] |= mask;
+        reserved = TRUE;
+    }
+
+    ExReleaseSpinLockExclusive(&Allocator->Lock, irql);
+
+    return reserved;
+}
+
+//
+// Returns a serial to the allocator.
+// 
+FORCEINLINE
+VOID
+SerialAllocatorRelease(
+    _Inout_ PSERIAL_ALLOCATOR Allocator,
+    _In_ ULONG Serial
+)
+{
+    KIRQL irql;
+
+    if (Serial == 0 || Serial >= SERIAL_ALLOCATOR_SERIALS)
+    {
+        return;
+    }
+
+    irql = ExAcquireSpinLockExclusive(&Allocator->Lock);
+
+    Allocator->Used[Serial / 32] &= ~(1UL << (Serial % 32));
+
+    if (Serial / 32 < Allocator->Hint)
+    {
+        Allocator->Hint = Serial / 32;
+    }
+
+    ExReleaseSpinLockExclusive(&Allocator->Lock, irql);
+}
@@ -0,0 +1,239 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+//
+// Bucket count of a serial index (must be a power of two)
+// 
+#define SERIAL_INDEX_BUCKETS        0x100
+
+#define SERIAL_INDEX_HASH(_serial_) ((_serial_) & (SERIAL_INDEX_BUCKETS - 1))
+
+//
+// Link embedded in an object kept in a serial index
+// 
+typedef struct _SERIAL_INDEX_ENTRY
+{
+    struct _SERIAL_INDEX_ENTRY* Next;
+
+    ULONG SerialNo;
+
+    //
+    // Held by everyone who looked the object up, see SerialIndexAcquire
+    // 
+    EX_RUNDOWN_REF Rundown;
+
+} SERIAL_INDEX_ENTRY, *PSERIAL_INDEX_ENTRY;
+
+//
+// Intrusive hash of objects keyed by serial number.
+// 
+// Serials are handed out from the bottom up, so the low bits spread them
+// over the buckets evenly. SerialIndexFind/Insert/Remove do no locking of
+// their own; SerialIndexAcquire/Publish/Withdraw wrap them in Lock.
+// 
+typedef struct _SERIAL_INDEX
+{
+    //
+    // Reader/writer lock; lookups share it
+    // 
+    EX_SPIN_LOCK Lock;
+
+    PSERIAL_INDEX_ENTRY Buckets[SERIAL_INDEX_BUCKETS];
+
+} SERIAL_INDEX, *PSERIAL_INDEX;
+
+//
+// Returns the entry with the given serial, NULL if there is none.
+// 
+FORCEINLINE
+PSERIAL_INDEX_ENTRY
+SerialIndexFind(
+    _In_ const SERIAL_INDEX* Index,
+    _In_ ULONG SerialNo
+)
+{
+    PSERIAL_INDEX_ENTRY entry;
+
+    for (entry = Index->Buckets[SERIAL_INDEX_HASH(SerialNo)];
+        entry != NULL;
+        entry = entry->Next)
+    {
+        if (entry->SerialNo == SerialNo)
+        {
+            break;
+        }
+    }
+
+    return entry;
+}
+
+//
+// Links an entry in under the given serial.
+// 
+FORCEINLINE
+VOID
+SerialIndexInsert(
+    _Inout_ PSERIAL_INDEX Index,
+    _Inout_ PSERIAL_INDEX_ENTRY Entry,
+    _In_ ULONG SerialNo
+)
+{
+    PSERIAL_INDEX_ENTRY* bucket = &Index->Buckets[SERIAL_INDEX_HASH(SerialNo)];
+
+    Entry->SerialNo = SerialNo;
+    Entry->Next = *bucket;
+    *bucket = Entry;
+}
+
+//
+// Unlinks an entry, returns FALSE if it wasn't linked in.
+// 
+FORCEINLINE
+BOOLEAN
+SerialIndexRemove(
+    _Inout_ PSERIAL_INDEX Index,
+    _Inout_ PSERIAL_INDEX_ENTRY Entry
+)
+{
+    PSERIAL_INDEX_ENTRY* link;
+
+    for (link = &Index->Buckets[SERIAL_INDEX_HASH(Entry->SerialNo)];
+        *link != NULL;
+        link = &(*link)->Next)
+    {
+        if (*link == Entry)
+        {
+            *link = Entry->Next;
+            Entry->Next = NULL;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+#pragma region Locked access
+
+//
+// Looks up an object and protects it from teardown until SerialIndexRelease.
+// 
+// Returns NULL if there is no such serial or the object is running down.
+// 
+FORCEINLINE
+PSERIAL_INDEX_ENTRY
+SerialIndexAcquire(
+    _In_ PSERIAL_INDEX Index,
+    _In_ ULONG SerialNo
+)
+{
+    PSERIAL_INDEX_ENTRY entry;
+    KIRQL irql;
+
+    irql = ExAcquireSpinLockShared(&Index->Lock);
+
+    entry = SerialIndexFind(Index, SerialNo);
+
+    if (entry != NULL && !ExAcquireRundownProtection(&entry->Rundown))
+    {
+        entry = NULL;
+    }
+
+    ExReleaseSpinLockShared(&Index->Lock, irql);
+
+    return entry;
+}
+
+FORCEINLINE
+VOID
+SerialIndexRelease(
+    _In_ PSERIAL_INDEX_ENTRY Entry
+)
+{
+    ExReleaseRundownProtection(&Entry->Rundown);
+}
+
+//
+// Makes a fully initialized object visible to lookups.
+// 
+FORCEINLINE
+VOID
+SerialIndexPublish(
+    _Inout_ PSERIAL_INDEX Index,
+    _Inout_ PSERIAL_INDEX_ENTRY Entry,
+    _In_ ULONG SerialNo
+)
+{
+    KIRQL irql;
+
+    ExInitializeRundownProtection(&Entry->Rundown);
+
+    irql = ExAcquireSpinLockExclusive(&Index->Lock);
+
+    SerialIndexInsert(Index, Entry, SerialNo);
+
+    ExReleaseSpinLockExclusive(&Index->Lock, irql);
+}
+
+//
+// Hides an object from new lookups, returns FALSE if it wasn't published.
+// 
+// Earlier lookups keep it until they release it, see SerialIndexDrain.
+// 
+FORCEINLINE
+BOOLEAN
+SerialIndexWithdraw(
+    _Inout_ PSERIAL_INDEX Index,
+    _Inout_ PSERIAL_INDEX_ENTRY Entry
+)
+{
+    BOOLEAN removed;
+    KIRQL irql;
+
+    irql = ExAcquireSpinLockExclusive(&Index->Lock);
+
+    removed = SerialIndexRemove(Index, Entry);
+
+    ExReleaseSpinLockExclusive(&Index->Lock, irql);
+
+    return removed;
+}
+
+//
+// Waits until every lookup that found the object released it.
+// 
+FORCEINLINE
+VOID
+SerialIndexDrain(
+    _Inout_ PSERIAL_INDEX_ENTRY Entry
+)
+{
+    ExWaitForRundownProtectionRelease(&Entry->Rundown);
+}
+
+#pragma endregion
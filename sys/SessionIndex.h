@@ -0,0 +1,140 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+//
+// Bucket count of a session index (must be a power of two)
+// 
+#define SESSION_INDEX_BUCKETS       0x10
+
+#define SESSION_INDEX_HASH(_id_)    ((ULONG)(_id_) & (SESSION_INDEX_BUCKETS - 1))
+
+//
+// Session (file handle) entry embedded in the file object context
+// 
+typedef struct _SESSION_INDEX_SESSION
+{
+    //
+    // Link in the bucket of Id, Flink is NULL until the session got added
+    // 
+    LIST_ENTRY Link;
+
+    //
+    // Devices plugged in through this session, linked by an entry in their
+    // own context
+    // 
+    LIST_ENTRY Devices;
+
+    //
+    // SessionId associated with file handle.  Used to map file handles to emulated gamepad devices
+    // 
+    LONG Id;
+
+} SESSION_INDEX_SESSION, *PSESSION_INDEX_SESSION;
+
+//
+// Open sessions hashed by SessionId.
+// 
+// Finding the session of a device only walks one bucket, and a session's
+// own device list spares walking every child on the bus. No locking of its
+// own; the bus guards it and all device lists with SessionIndexLock.
+// 
+typedef struct _SESSION_INDEX
+{
+    LIST_ENTRY Buckets[SESSION_INDEX_BUCKETS];
+
+} SESSION_INDEX, *PSESSION_INDEX;
+
+FORCEINLINE
+VOID
+SessionIndexInit(
+    _Out_ PSESSION_INDEX Index
+)
+{
+    ULONG i;
+
+    for (i = 0; i < SESSION_INDEX_BUCKETS; i++)
+    {
+        InitializeListHead(&Index->Buckets[i]);
+    }
+}
+
+//
+// Adds a session with an empty device list.
+// 
+FORCEINLINE
+VOID
+SessionIndexAdd(
+    _Inout_ PSESSION_INDEX Index,
+    _Inout_ PSESSION_INDEX_SESSION Session
+)
+{
+    InitializeListHead(&Session->Devices);
+
+    InsertTailList(&Index->Buckets[SESSION_INDEX_HASH(Session->Id)], &Session->Link);
+}
+
+//
+// Returns the session with the given ID, NULL if there is none.
+// 
+FORCEINLINE
+PSESSION_INDEX_SESSION
+SessionIndexFind(
+    _In_ const SESSION_INDEX* Index,
+    _In_ LONG Id
+)
+{
+    const LIST_ENTRY* bucket = &Index->Buckets[SESSION_INDEX_HASH(Id)];
+    PLIST_ENTRY entry;
+    PSESSION_INDEX_SESSION session;
+
+    for (entry = bucket->Flink; entry != bucket; entry = entry->Flink)
+    {
+        session = CONTAINING_RECORD(entry, SESSION_INDEX_SESSION, Link);
+
+        if (session->Id == Id)
+        {
+            return session;
+        }
+    }
+
+    return NULL;
+}
+
+//
+// Removes a session; its device list is left to the caller.
+// 
+FORCEINLINE
+VOID
+SessionIndexRemove(
+    _Inout_ PSESSION_INDEX_SESSION Session
+)
+{
+    RemoveEntryList(&Session->Link);
+    InitializeListHead(&Session->Link);
+}
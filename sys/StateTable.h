@@ -0,0 +1,278 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+//
+// One row per serial the bus can assign on its own
+// 
+#define STATE_TABLE_ROWS            SERIAL_ALLOCATOR_SERIALS
+
+//
+// Marks a row no PDO is using
+// 
+#define STATE_TABLE_UNUSED          0xFF
+
+//
+// Optimistic copies of a row a reader makes before it holds off writers
+// 
+#define STATE_TABLE_READ_RETRIES    4
+
+//
+// Current input state of one PDO
+// 
+typedef struct DECLSPEC_CACHEALIGN _STATE_TABLE_ROW
+{
+    //
+    // Guards the row; writers of different PDOs never contend
+    // 
+    SEQLOCK Lock;
+
+    //
+    // Target type of the PDO, STATE_TABLE_UNUSED if no PDO is using the row
+    // 
+    UCHAR TargetType;
+
+    //
+    // Session owning the PDO
+    // 
+    LONG SessionId;
+
+    //
+    // Interrupt time of the last stored report, 0 if none yet
+    // 
+    ULONG64 Timestamp;
+
+    VIGEM_TARGET_REPORT Report;
+
+} STATE_TABLE_ROW, *PSTATE_TABLE_ROW;
+
+//
+// Current input state of all PDOs, indexed by serial.
+// 
+// Each row is a sequence lock of its own, so a report store only excludes
+// stores to the same PDO and a snapshot copies one row at a time. Entries of
+// a snapshot are consistent each, not with each other.
+// 
+typedef struct _STATE_TABLE
+{
+    //
+    // Rows above this serial have never been used
+    // 
+    volatile LONG HighestSerial;
+
+    STATE_TABLE_ROW Rows[STATE_TABLE_ROWS];
+
+} STATE_TABLE, *PSTATE_TABLE;
+
+FORCEINLINE
+VOID
+StateTableInit(
+    _Out_ PSTATE_TABLE Table
+)
+{
+    ULONG i;
+
+    RtlZeroMemory(Table, sizeof(STATE_TABLE));
+
+    for (i = 0; i < STATE_TABLE_ROWS; i++)
+    {
+        Table->Rows[i].TargetType = STATE_TABLE_UNUSED;
+    }
+}
+
+//
+// Hands a row to a new PDO with a zeroed report.
+// 
+// Serial has to be below STATE_TABLE_ROWS.
+// 
+FORCEINLINE
+VOID
+StateTableClaim(
+    _Inout_ PSTATE_TABLE Table,
+    _In_ ULONG Serial,
+    _In_ UCHAR TargetType,
+    _In_ LONG SessionId
+)
+{
+    PSTATE_TABLE_ROW row = &Table->Rows[Serial];
+    LONG highest;
+
+    SeqLockWriteAcquire(&row->Lock);
+
+    row->TargetType = TargetType;
+    row->SessionId = SessionId;
+    row->Timestamp = 0;
+
+    RtlZeroMemory(&row->Report, sizeof(row->Report));
+
+    SeqLockWriteRelease(&row->Lock);
+
+    // Only after the row is filled in, a snapshot may pick it up from here
+    while ((highest = ReadAcquire(&Table->HighestSerial)) < (LONG)Serial
+        && InterlockedCompareExchange(&Table->HighestSerial, (LONG)Serial, highest) != highest)
+    {
+    }
+}
+
+FORCEINLINE
+VOID
+StateTableRelease(
+    _Inout_ PSTATE_TABLE Table,
+    _In_ ULONG Serial
+)
+{
+    PSTATE_TABLE_ROW row = &Table->Rows[Serial];
+
+    SeqLockWriteAcquire(&row->Lock);
+
+    row->TargetType = STATE_TABLE_UNUSED;
+
+    SeqLockWriteRelease(&row->Lock);
+}
+
+//
+// Stores the current report of a claimed row.
+// 
+FORCEINLINE
+VOID
+StateTableStore(
+    _Inout_ PSTATE_TABLE Table,
+    _In_ ULONG Serial,
+    _In_reads_bytes_(Length) const VOID* Report,
+    _In_ ULONG Length,
+    _In_ ULONG64 Timestamp
+)
+{
+    PSTATE_TABLE_ROW row = &Table->Rows[Serial];
+
+    SeqLockWriteAcquire(&row->Lock);
+
+    RtlCopyMemory(&row->Report, Report, Length);
+
+    row->Timestamp = Timestamp;
+
+    SeqLockWriteRelease(&row->Lock);
+}
+
+//
+// Copies one row into a snapshot entry, returns FALSE if it is unused.
+// 
+// A reader that keeps losing to writers takes the row's write side for one
+// last copy instead of retrying without bound, so a PDO submitting back to
+// back can't starve a snapshot. Callers must not get preempted while in
+// here, writers would spin on them.
+// 
+FORCEINLINE
+BOOLEAN
+StateTableRead(
+    _In_ PSTATE_TABLE Table,
+    _In_ ULONG Serial,
+    _Out_ PVIGEM_STATE_SNAPSHOT_ENTRY Entry
+)
+{
+    PSTATE_TABLE_ROW row = &Table->Rows[Serial];
+    UCHAR targetType;
+    LONG sequence;
+    ULONG attempt;
+
+    for (attempt = 0; ; attempt++)
+    {
+        if (attempt == STATE_TABLE_READ_RETRIES)
+        {
+            SeqLockWriteAcquire(&row->Lock);
+        }
+        else
+        {
+            sequence = SeqLockReadBegin(&row->Lock);
+        }
+
+        targetType = row->TargetType;
+        Entry->SessionId = row->SessionId;
+        Entry->Timestamp = row->Timestamp;
+        RtlCopyMemory(&Entry->Report, &row->Report, sizeof(Entry->Report));
+
+        if (attempt == STATE_TABLE_READ_RETRIES)
+        {
+            // Nothing got modified, readers in between needn't retry
+            SeqLockWriteCancel(&row->Lock);
+            break;
+        }
+
+        if (!SeqLockReadRetry(&row->Lock, sequence))
+        {
+            break;
+        }
+    }
+
+    Entry->SerialNo = Serial;
+    Entry->TargetType = (VIGEM_TARGET_TYPE)targetType;
+
+    return (targetType != STATE_TABLE_UNUSED);
+}
+
+//
+// Copies the rows in use into Entries in serial order, up to Capacity of
+// them, and returns how many got copied. Total receives the number of rows
+// in use.
+// 
+FORCEINLINE
+ULONG
+StateTableSnapshot(
+    _In_ PSTATE_TABLE Table,
+    _Out_writes_(Capacity) PVIGEM_STATE_SNAPSHOT_ENTRY Entries,
+    _In_ ULONG Capacity,
+    _Out_ PULONG Total
+)
+{
+    VIGEM_STATE_SNAPSHOT_ENTRY spare;
+    ULONG count = 0;
+    ULONG highest;
+    ULONG serial;
+
+    *Total = 0;
+
+    highest = min((ULONG)ReadAcquire(&Table->HighestSerial), STATE_TABLE_ROWS - 1);
+
+    for (serial = 1; serial <= highest; serial++)
+    {
+        // Rows past the buffer only get counted
+        if (!StateTableRead(Table, serial, (count < Capacity) ? &Entries[count] : &spare))
+        {
+            continue;
+        }
+
+        (*Total)++;
+
+        if (count < Capacity)
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,242 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "busenum.h"
+#include "transform.tmh"
+
+//
+// Checks whether a report field is one of the target's analog axes.
+// 
+static BOOLEAN Transform_IsAxis(const VIGEM_TARGET_OPS* Ops, const VIGEM_REPORT_FIELD* Field)
+{
+    ULONG i;
+
+    for (i = 0; i < Ops->AxisCount; i++)
+    {
+        if (Ops->Axes[i].Offset == Field->Offset)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+//
+// Sets or removes the transform of a PDO.
+// 
+NTSTATUS Transform_Configure(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred)
+{
+    NTSTATUS                status;
+    PVIGEM_SET_TRANSFORM    config;
+    size_t                  length = 0;
+    size_t                  required;
+    WDFDEVICE               hChild;
+    PPDO_DEVICE_DATA        pdoData;
+    const VIGEM_TARGET_OPS* ops;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    WDFMEMORY               memory = NULL;
+    WDFMEMORY               previous;
+    PTRANSFORM              transform = NULL;
+    const UCHAR*            source;
+    PUCHAR                  tables;
+    ULONG                   field;
+    ULONG                   bit;
+
+    *Transferred = 0;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIGEM_SET_TRANSFORM), (PVOID)&config, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_TRANSFORM,
+            "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    if (config->Size != sizeof(VIGEM_SET_TRANSFORM)
+        || (config->Flags & ~VIGEM_TRANSFORM_FLAG_REMAP_BUTTONS) != 0)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    hChild = Bus_GetPdo(Device, config->SerialNo);
+
+    if (hChild == NULL)
+    {
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    pdoData = PdoGetData(hChild);
+    ops = pdoData->Ops;
+
+    if (!IS_OWNER(pdoData))
+    {
+        status = STATUS_ACCESS_DENIED;
+        goto configEnd;
+    }
+
+#pragma region Validate
+
+    if (config->AxisMask >= VIGEM_FIELD_BIT(ops->FieldCount))
+    {
+        status = STATUS_INVALID_PARAMETER;
+        goto configEnd;
+    }
+
+    required = sizeof(VIGEM_SET_TRANSFORM);
+
+    for (field = 0; field < ops->FieldCount; field++)
+    {
+        if (!(config->AxisMask & VIGEM_FIELD_BIT(field)))
+        {
+            continue;
+        }
+
+        if (!Transform_IsAxis(ops, &ops->Fields[field]))
+        {
+            status = STATUS_INVALID_PARAMETER;
+            goto configEnd;
+        }
+
+        required += ops->Fields[field].Length == sizeof(USHORT)
+            ? VIGEM_TRANSFORM_TABLE_SIZE_16
+            : VIGEM_TRANSFORM_TABLE_SIZE_8;
+    }
+
+    if (length != required)
+    {
+        status = STATUS_INVALID_BUFFER_SIZE;
+        goto configEnd;
+    }
+
+    for (bit = 0; bit < VIGEM_TRANSFORM_BUTTONS; bit++)
+    {
+        if (config->ButtonMap[bit] >= VIGEM_TRANSFORM_BUTTONS
+            && config->ButtonMap[bit] != VIGEM_TRANSFORM_BUTTON_NONE)
+        {
+            status = STATUS_INVALID_PARAMETER;
+            goto configEnd;
+        }
+    }
+
+#pragma endregion
+
+#pragma region Compile
+
+    if (config->AxisMask != 0 || (config->Flags & VIGEM_TRANSFORM_FLAG_REMAP_BUTTONS))
+    {
+        WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+        attributes.ParentObject = hChild;
+
+        status = WdfMemoryCreate(&attributes,
+            NonPagedPoolNx,
+            VIGEM_POOL_TAG,
+            sizeof(TRANSFORM) + required - sizeof(VIGEM_SET_TRANSFORM),
+            &memory,
+            (PVOID)&transform);
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_TRANSFORM,
+                "WdfMemoryCreate failed with status %!STATUS!",
+                status);
+            goto configEnd;
+        }
+
+        Bus_TrackObject(Device, hChild, memory, ViGEmResourceMemory);
+
+        RtlZeroMemory(transform, sizeof(TRANSFORM));
+
+        source = (const UCHAR*)(config + 1);
+        tables = (PUCHAR)(transform + 1);
+
+        for (field = 0; field < ops->FieldCount; field++)
+        {
+            PTRANSFORM_TABLE table;
+            size_t size;
+
+            if (!(config->AxisMask & VIGEM_FIELD_BIT(field)))
+            {
+                continue;
+            }
+
+            table = &transform->Tables[transform->TableCount++];
+            table->Offset = ops->Fields[field].Offset;
+            table->Wide = ops->Fields[field].Length == sizeof(USHORT);
+            table->Table = tables;
+
+            size = table->Wide ? VIGEM_TRANSFORM_TABLE_SIZE_16 : VIGEM_TRANSFORM_TABLE_SIZE_8;
+
+            RtlCopyMemory(tables, source, size);
+
+            source += size;
+            tables += size;
+        }
+
+        transform->ButtonsOffset = (USHORT)ops->ButtonsOffset;
+        transform->RemapButtons = (config->Flags & VIGEM_TRANSFORM_FLAG_REMAP_BUTTONS) != 0;
+
+        Transform_CompileButtons(transform, config->ButtonMap);
+    }
+
+#pragma endregion
+
+    WdfSpinLockAcquire(pdoData->TransformLock);
+
+    previous = pdoData->TransformMemory;
+
+    pdoData->TransformMemory = memory;
+    pdoData->Transform = transform;
+
+    WdfSpinLockRelease(pdoData->TransformLock);
+
+    // No submission can still be looking at it now
+    if (previous != NULL)
+    {
+        WdfObjectDelete(previous);
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_TRANSFORM,
+        "Transform of serial %d set (axes 0x%X, flags 0x%X)",
+        pdoData->SerialNo,
+        config->AxisMask,
+        config->Flags);
+
+    status = STATUS_SUCCESS;
+
+configEnd:
+
+    Bus_PutPdo(hChild);
+
+    return status;
+}
@@ -0,0 +1,105 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Platform.h"
+#include "Util.h"
+#include "TransformCore.h"
+
+//
+// Runs a bare report through a compiled transform in place.
+// 
+// Table lookups are gathers, which SSE2 and NEON can't do, and there are
+// at most AXES_BLEND_LANES of them per report; they stay scalar. The
+// button permutation costs two lookups regardless of the map.
+// 
+VOID Transform_Apply(
+    _In_ const TRANSFORM* Transform,
+    _Inout_ PUCHAR Report)
+{
+    ULONG   i;
+    USHORT  value;
+
+    for (i = 0; i < Transform->TableCount; i++)
+    {
+        const TRANSFORM_TABLE* table = &Transform->Tables[i];
+
+        if (table->Wide)
+        {
+            RtlCopyMemory(&value, Report + table->Offset, sizeof(USHORT));
+            value = ((const USHORT*)table->Table)[value];
+            RtlCopyMemory(Report + table->Offset, &value, sizeof(USHORT));
+        }
+        else
+        {
+            Report[table->Offset] = ((const UCHAR*)table->Table)[Report[table->Offset]];
+        }
+    }
+
+    if (Transform->RemapButtons)
+    {
+        RtlCopyMemory(&value, Report + Transform->ButtonsOffset, sizeof(USHORT));
+        value = Transform->ButtonsLow[value & 0xFF] | Transform->ButtonsHigh[value >> 8];
+        RtlCopyMemory(Report + Transform->ButtonsOffset, &value, sizeof(USHORT));
+    }
+}
+
+//
+// Spreads a button permutation over the per-byte tables of a transform.
+// 
+// ButtonMap holds the source bit of each bit of the button word, the
+// tables are expected to be zeroed.
+// 
+VOID Transform_CompileButtons(
+    _Inout_ PTRANSFORM Transform,
+    _In_reads_(VIGEM_TRANSFORM_BUTTONS) const UCHAR* ButtonMap)
+{
+    ULONG   bit;
+    ULONG   i;
+    ULONG   b;
+
+    for (b = 0; b < 0x100; b++)
+    {
+        for (i = 0; i < VIGEM_TRANSFORM_BUTTONS; i++)
+        {
+            bit = ButtonMap[i];
+
+            if (bit == VIGEM_TRANSFORM_BUTTON_NONE)
+            {
+                continue;
+            }
+
+            if (bit < 8 && (b & (1 << bit)))
+            {
+                Transform->ButtonsLow[b] |= (USHORT)(1 << i);
+            }
+            else if (bit >= 8 && (b & (1 << (bit - 8))))
+            {
+                Transform->ButtonsHigh[b] |= (USHORT)(1 << i);
+            }
+        }
+    }
+}
@@ -0,0 +1,83 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+//
+// Lookup table bound to a single report field
+// 
+typedef struct _TRANSFORM_TABLE
+{
+    //
+    // Offset of the field within the bare report
+    // 
+    USHORT Offset;
+
+    //
+    // TRUE for a 16-bit field and USHORT table
+    // 
+    BOOLEAN Wide;
+
+    const VOID* Table;
+
+} TRANSFORM_TABLE, *PTRANSFORM_TABLE;
+
+//
+// Compiled transform of a PDO, the lookup tables follow it in the same buffer
+// 
+typedef struct _TRANSFORM
+{
+    ULONG TableCount;
+
+    TRANSFORM_TABLE Tables[AXES_BLEND_LANES];
+
+    //
+    // Offset of the button word within the bare report
+    // 
+    USHORT ButtonsOffset;
+
+    BOOLEAN RemapButtons;
+
+    //
+    // Remapped button word contributions of its low and high byte
+    // 
+    USHORT ButtonsLow[0x100];
+
+    USHORT ButtonsHigh[0x100];
+
+} TRANSFORM, *PTRANSFORM;
+
+
+VOID Transform_Apply(
+    _In_ const TRANSFORM* Transform,
+    _Inout_ PUCHAR Report
+);
+
+VOID Transform_CompileButtons(
+    _Inout_ PTRANSFORM Transform,
+    _In_reads_(VIGEM_TRANSFORM_BUTTONS) const UCHAR* ButtonMap
+);
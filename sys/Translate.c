@@ -0,0 +1,399 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Platform.h"
+#include "Translate.h"
+
+//
+// The sum of _a_ to _d_ for the bits of nibble _n_ that are set, _a_ being bit 0
+// 
+#define TRANSLATE_NIBBLE(_n_, _a_, _b_, _c_, _d_)   \
+    ((((_n_) >> 0) & 1) * (_a_) | (((_n_) >> 1) & 1) * (_b_) | \
+     (((_n_) >> 2) & 1) * (_c_) | (((_n_) >> 3) & 1) * (_d_))
+
+//
+// Lookup table of every value of a nibble whose bits map to _a_ to _d_
+// 
+#define TRANSLATE_NIBBLE_TABLE(_a_, _b_, _c_, _d_)  \
+    { \
+        TRANSLATE_NIBBLE(0x0, _a_, _b_, _c_, _d_), TRANSLATE_NIBBLE(0x1, _a_, _b_, _c_, _d_), \
+        TRANSLATE_NIBBLE(0x2, _a_, _b_, _c_, _d_), TRANSLATE_NIBBLE(0x3, _a_, _b_, _c_, _d_), \
+        TRANSLATE_NIBBLE(0x4, _a_, _b_, _c_, _d_), TRANSLATE_NIBBLE(0x5, _a_, _b_, _c_, _d_), \
+        TRANSLATE_NIBBLE(0x6, _a_, _b_, _c_, _d_), TRANSLATE_NIBBLE(0x7, _a_, _b_, _c_, _d_), \
+        TRANSLATE_NIBBLE(0x8, _a_, _b_, _c_, _d_), TRANSLATE_NIBBLE(0x9, _a_, _b_, _c_, _d_), \
+        TRANSLATE_NIBBLE(0xA, _a_, _b_, _c_, _d_), TRANSLATE_NIBBLE(0xB, _a_, _b_, _c_, _d_), \
+        TRANSLATE_NIBBLE(0xC, _a_, _b_, _c_, _d_), TRANSLATE_NIBBLE(0xD, _a_, _b_, _c_, _d_), \
+        TRANSLATE_NIBBLE(0xE, _a_, _b_, _c_, _d_), TRANSLATE_NIBBLE(0xF, _a_, _b_, _c_, _d_)  \
+    }
+
+//
+// Looks up the four nibbles of a 16-bit button word and combines the results
+// 
+#define TRANSLATE_LOOKUP(_tables_, _buttons_)   \
+    ((_tables_)[0][(_buttons_) & 0x0F] | (_tables_)[1][((_buttons_) >> 4) & 0x0F] | \
+     (_tables_)[2][((_buttons_) >> 8) & 0x0F] | (_tables_)[3][((_buttons_) >> 12) & 0x0F])
+
+//
+// XGIP button word, Buttons1 in the low and Buttons2 in the high byte
+// 
+#define TRANSLATE_XGIP_MENU             0x0004
+#define TRANSLATE_XGIP_VIEW             0x0008
+#define TRANSLATE_XGIP_A                0x0010
+#define TRANSLATE_XGIP_B                0x0020
+#define TRANSLATE_XGIP_X                0x0040
+#define TRANSLATE_XGIP_Y                0x0080
+#define TRANSLATE_XGIP_DPAD_UP          0x0100
+#define TRANSLATE_XGIP_DPAD_DOWN        0x0200
+#define TRANSLATE_XGIP_DPAD_LEFT        0x0400
+#define TRANSLATE_XGIP_DPAD_RIGHT       0x0800
+#define TRANSLATE_XGIP_LEFT_SHOULDER    0x1000
+#define TRANSLATE_XGIP_RIGHT_SHOULDER   0x2000
+#define TRANSLATE_XGIP_LEFT_THUMB       0x4000
+#define TRANSLATE_XGIP_RIGHT_THUMB      0x8000
+
+//
+// Button mapping of a target type, by nibble of the button word
+// 
+typedef struct _TRANSLATE_LAYOUT
+{
+    //
+    // Native bits of each canonical nibble value, DS4 bSpecial goes in bits 16 to 23
+    // 
+    ULONG Encode[4][16];
+
+    //
+    // Canonical bits of each native nibble value
+    // 
+    USHORT Decode[4][16];
+
+} TRANSLATE_LAYOUT;
+
+static const TRANSLATE_LAYOUT TranslateXusbLayout =
+{
+    .Encode =
+    {
+        TRANSLATE_NIBBLE_TABLE(XUSB_GAMEPAD_DPAD_UP, XUSB_GAMEPAD_DPAD_DOWN, XUSB_GAMEPAD_DPAD_LEFT, XUSB_GAMEPAD_DPAD_RIGHT),
+        TRANSLATE_NIBBLE_TABLE(XUSB_GAMEPAD_START, XUSB_GAMEPAD_BACK, XUSB_GAMEPAD_LEFT_THUMB, XUSB_GAMEPAD_RIGHT_THUMB),
+        TRANSLATE_NIBBLE_TABLE(XUSB_GAMEPAD_LEFT_SHOULDER, XUSB_GAMEPAD_RIGHT_SHOULDER, XUSB_GAMEPAD_GUIDE, 0),
+        TRANSLATE_NIBBLE_TABLE(XUSB_GAMEPAD_A, XUSB_GAMEPAD_B, XUSB_GAMEPAD_X, XUSB_GAMEPAD_Y)
+    },
+    .Decode =
+    {
+        TRANSLATE_NIBBLE_TABLE(VIGEM_GAMEPAD_DPAD_UP, VIGEM_GAMEPAD_DPAD_DOWN, VIGEM_GAMEPAD_DPAD_LEFT, VIGEM_GAMEPAD_DPAD_RIGHT),
+        TRANSLATE_NIBBLE_TABLE(VIGEM_GAMEPAD_START, VIGEM_GAMEPAD_BACK, VIGEM_GAMEPAD_LEFT_THUMB, VIGEM_GAMEPAD_RIGHT_THUMB),
+        TRANSLATE_NIBBLE_TABLE(VIGEM_GAMEPAD_LEFT_SHOULDER, VIGEM_GAMEPAD_RIGHT_SHOULDER, VIGEM_GAMEPAD_GUIDE, 0),
+        TRANSLATE_NIBBLE_TABLE(VIGEM_GAMEPAD_A, VIGEM_GAMEPAD_B, VIGEM_GAMEPAD_X, VIGEM_GAMEPAD_Y)
+    }
+};
+
+//
+// The DS4 D-Pad is a hat in bits 0 to 3 of wButtons; opposing canonical
+// directions cancel out. The other nibbles hold square/cross/circle/triangle,
+// shoulders/triggers and share/options/thumbs.
+// 
+static const TRANSLATE_LAYOUT TranslateDs4Layout =
+{
+    .Encode =
+    {
+        {
+            DS4_BUTTON_DPAD_NONE,       // -
+            DS4_BUTTON_DPAD_NORTH,      // U
+            DS4_BUTTON_DPAD_SOUTH,      // D
+            DS4_BUTTON_DPAD_NONE,       // U D
+            DS4_BUTTON_DPAD_WEST,       // L
+            DS4_BUTTON_DPAD_NORTHWEST,  // U L
+            DS4_BUTTON_DPAD_SOUTHWEST,  // D L
+            DS4_BUTTON_DPAD_WEST,       // U D L
+            DS4_BUTTON_DPAD_EAST,       // R
+            DS4_BUTTON_DPAD_NORTHEAST,  // U R
+            DS4_BUTTON_DPAD_SOUTHEAST,  // D R
+            DS4_BUTTON_DPAD_EAST,       // U D R
+            DS4_BUTTON_DPAD_NONE,       // L R
+            DS4_BUTTON_DPAD_NORTH,      // U L R
+            DS4_BUTTON_DPAD_SOUTH,      // D L R
+            DS4_BUTTON_DPAD_NONE        // U D L R
+        },
+        TRANSLATE_NIBBLE_TABLE(DS4_BUTTON_OPTIONS, DS4_BUTTON_SHARE, DS4_BUTTON_THUMB_LEFT, DS4_BUTTON_THUMB_RIGHT),
+        TRANSLATE_NIBBLE_TABLE(DS4_BUTTON_SHOULDER_LEFT, DS4_BUTTON_SHOULDER_RIGHT,
+            DS4_SPECIAL_BUTTON_PS << 16, DS4_SPECIAL_BUTTON_TOUCHPAD << 16),
+        TRANSLATE_NIBBLE_TABLE(DS4_BUTTON_CROSS, DS4_BUTTON_CIRCLE, DS4_BUTTON_SQUARE, DS4_BUTTON_TRIANGLE)
+    },
+    .Decode =
+    {
+        {
+            [DS4_BUTTON_DPAD_NORTH] = VIGEM_GAMEPAD_DPAD_UP,
+            [DS4_BUTTON_DPAD_NORTHEAST] = VIGEM_GAMEPAD_DPAD_UP | VIGEM_GAMEPAD_DPAD_RIGHT,
+            [DS4_BUTTON_DPAD_EAST] = VIGEM_GAMEPAD_DPAD_RIGHT,
+            [DS4_BUTTON_DPAD_SOUTHEAST] = VIGEM_GAMEPAD_DPAD_DOWN | VIGEM_GAMEPAD_DPAD_RIGHT,
+            [DS4_BUTTON_DPAD_SOUTH] = VIGEM_GAMEPAD_DPAD_DOWN,
+            [DS4_BUTTON_DPAD_SOUTHWEST] = VIGEM_GAMEPAD_DPAD_DOWN | VIGEM_GAMEPAD_DPAD_LEFT,
+            [DS4_BUTTON_DPAD_WEST] = VIGEM_GAMEPAD_DPAD_LEFT,
+            [DS4_BUTTON_DPAD_NORTHWEST] = VIGEM_GAMEPAD_DPAD_UP | VIGEM_GAMEPAD_DPAD_LEFT
+        },
+        TRANSLATE_NIBBLE_TABLE(VIGEM_GAMEPAD_X, VIGEM_GAMEPAD_A, VIGEM_GAMEPAD_B, VIGEM_GAMEPAD_Y),
+        TRANSLATE_NIBBLE_TABLE(VIGEM_GAMEPAD_LEFT_SHOULDER, VIGEM_GAMEPAD_RIGHT_SHOULDER, 0, 0),
+        TRANSLATE_NIBBLE_TABLE(VIGEM_GAMEPAD_BACK, VIGEM_GAMEPAD_START, VIGEM_GAMEPAD_LEFT_THUMB, VIGEM_GAMEPAD_RIGHT_THUMB)
+    }
+};
+
+//
+// Canonical bits of the DS4 PS and touchpad buttons, bits 0 and 1 of bSpecial
+// 
+static const USHORT TranslateDs4Special[16] =
+    TRANSLATE_NIBBLE_TABLE(VIGEM_GAMEPAD_GUIDE, VIGEM_GAMEPAD_TOUCHPAD, 0, 0);
+
+//
+// The guide button isn't part of the XGIP input report
+// 
+static const TRANSLATE_LAYOUT TranslateXgipLayout =
+{
+    .Encode =
+    {
+        TRANSLATE_NIBBLE_TABLE(TRANSLATE_XGIP_DPAD_UP, TRANSLATE_XGIP_DPAD_DOWN, TRANSLATE_XGIP_DPAD_LEFT, TRANSLATE_XGIP_DPAD_RIGHT),
+        TRANSLATE_NIBBLE_TABLE(TRANSLATE_XGIP_MENU, TRANSLATE_XGIP_VIEW, TRANSLATE_XGIP_LEFT_THUMB, TRANSLATE_XGIP_RIGHT_THUMB),
+        TRANSLATE_NIBBLE_TABLE(TRANSLATE_XGIP_LEFT_SHOULDER, TRANSLATE_XGIP_RIGHT_SHOULDER, 0, 0),
+        TRANSLATE_NIBBLE_TABLE(TRANSLATE_XGIP_A, TRANSLATE_XGIP_B, TRANSLATE_XGIP_X, TRANSLATE_XGIP_Y)
+    },
+    .Decode =
+    {
+        TRANSLATE_NIBBLE_TABLE(0, 0, VIGEM_GAMEPAD_START, VIGEM_GAMEPAD_BACK),
+        TRANSLATE_NIBBLE_TABLE(VIGEM_GAMEPAD_A, VIGEM_GAMEPAD_B, VIGEM_GAMEPAD_X, VIGEM_GAMEPAD_Y),
+        TRANSLATE_NIBBLE_TABLE(VIGEM_GAMEPAD_DPAD_UP, VIGEM_GAMEPAD_DPAD_DOWN, VIGEM_GAMEPAD_DPAD_LEFT, VIGEM_GAMEPAD_DPAD_RIGHT),
+        TRANSLATE_NIBBLE_TABLE(VIGEM_GAMEPAD_LEFT_SHOULDER, VIGEM_GAMEPAD_RIGHT_SHOULDER, VIGEM_GAMEPAD_LEFT_THUMB, VIGEM_GAMEPAD_RIGHT_THUMB)
+    }
+};
+
+//
+// Signed 16-bit axis to DS4 axis (0x80 is centered)
+// 
+#define TRANSLATE_AXIS_TO_DS4(_value_)      ((UCHAR)(((_value_) >> 8) + 0x80))
+
+//
+// DS4 axis to signed 16-bit axis, stretched to cover the full range
+// 
+#define TRANSLATE_AXIS_FROM_DS4(_value_)    ((SHORT)((_value_) * 0x101 - 0x8000))
+
+//
+// 8-bit and 10-bit triggers to 16-bit, stretched to cover the full range
+// 
+#define TRANSLATE_TRIGGER_FROM_8(_value_)   ((USHORT)((_value_) * 0x101))
+#define TRANSLATE_TRIGGER_FROM_10(_value_)  ((USHORT)(((_value_) & 0x3FF) << 6 | ((_value_) & 0x3FF) >> 4))
+
+static VOID Translate_EncodeXusb(const VIGEM_GAMEPAD_STATE* State, PXUSB_REPORT Target)
+{
+    Target->wButtons = (USHORT)TRANSLATE_LOOKUP(TranslateXusbLayout.Encode, State->Buttons);
+
+    Target->bLeftTrigger = (BYTE)(State->LeftTrigger >> 8);
+    Target->bRightTrigger = (BYTE)(State->RightTrigger >> 8);
+
+    Target->sThumbLX = State->ThumbLX;
+    Target->sThumbLY = State->ThumbLY;
+    Target->sThumbRX = State->ThumbRX;
+    Target->sThumbRY = State->ThumbRY;
+}
+
+static VOID Translate_EncodeDs4(const VIGEM_GAMEPAD_STATE* State, PDS4_REPORT Target)
+{
+    UCHAR   left = (UCHAR)(State->LeftTrigger >> 8);
+    UCHAR   right = (UCHAR)(State->RightTrigger >> 8);
+    ULONG   buttons = TRANSLATE_LOOKUP(TranslateDs4Layout.Encode, State->Buttons)
+        | (ULONG)(left != 0) * DS4_BUTTON_TRIGGER_LEFT
+        | (ULONG)(right != 0) * DS4_BUTTON_TRIGGER_RIGHT;
+
+    //
+    // DS4 vertical axes grow downwards
+    // 
+    Target->bThumbLX = TRANSLATE_AXIS_TO_DS4(State->ThumbLX);
+    Target->bThumbLY = (UCHAR)(0xFF - TRANSLATE_AXIS_TO_DS4(State->ThumbLY));
+    Target->bThumbRX = TRANSLATE_AXIS_TO_DS4(State->ThumbRX);
+    Target->bThumbRY = (UCHAR)(0xFF - TRANSLATE_AXIS_TO_DS4(State->ThumbRY));
+
+    Target->wButtons = (USHORT)buttons;
+    Target->bSpecial = (BYTE)(buttons >> 16);
+
+    Target->bTriggerL = left;
+    Target->bTriggerR = right;
+}
+
+static VOID Translate_EncodeXgip(const VIGEM_GAMEPAD_STATE* State, PXGIP_REPORT Target)
+{
+    ULONG buttons = TRANSLATE_LOOKUP(TranslateXgipLayout.Encode, State->Buttons);
+
+    Target->Buttons1 = (UCHAR)buttons;
+    Target->Buttons2 = (UCHAR)(buttons >> 8);
+
+    Target->LeftTrigger = (USHORT)(State->LeftTrigger >> 6);
+    Target->RightTrigger = (USHORT)(State->RightTrigger >> 6);
+
+    Target->ThumbLX = State->ThumbLX;
+    Target->ThumbLY = State->ThumbLY;
+    Target->ThumbRX = State->ThumbRX;
+    Target->ThumbRY = State->ThumbRY;
+}
+
+static VOID Translate_DecodeXusb(const XUSB_REPORT* Source, PVIGEM_GAMEPAD_STATE State)
+{
+    State->Buttons = (USHORT)TRANSLATE_LOOKUP(TranslateXusbLayout.Decode, Source->wButtons);
+
+    State->LeftTrigger = TRANSLATE_TRIGGER_FROM_8(Source->bLeftTrigger);
+    State->RightTrigger = TRANSLATE_TRIGGER_FROM_8(Source->bRightTrigger);
+
+    State->ThumbLX = Source->sThumbLX;
+    State->ThumbLY = Source->sThumbLY;
+    State->ThumbRX = Source->sThumbRX;
+    State->ThumbRY = Source->sThumbRY;
+}
+
+static VOID Translate_DecodeDs4(const DS4_REPORT* Source, PVIGEM_GAMEPAD_STATE State)
+{
+    State->Buttons = (USHORT)(TRANSLATE_LOOKUP(TranslateDs4Layout.Decode, Source->wButtons)
+        | TranslateDs4Special[Source->bSpecial & 0x0F]);
+
+    State->LeftTrigger = TRANSLATE_TRIGGER_FROM_8(Source->bTriggerL);
+    State->RightTrigger = TRANSLATE_TRIGGER_FROM_8(Source->bTriggerR);
+
+    State->ThumbLX = TRANSLATE_AXIS_FROM_DS4(Source->bThumbLX);
+    State->ThumbLY = TRANSLATE_AXIS_FROM_DS4(0xFF - Source->bThumbLY);
+    State->ThumbRX = TRANSLATE_AXIS_FROM_DS4(Source->bThumbRX);
+    State->ThumbRY = TRANSLATE_AXIS_FROM_DS4(0xFF - Source->bThumbRY);
+}
+
+static VOID Translate_DecodeXgip(const XGIP_REPORT* Source, PVIGEM_GAMEPAD_STATE State)
+{
+    USHORT buttons = (USHORT)(Source->Buttons1 | Source->Buttons2 << 8);
+
+    State->Buttons = (USHORT)TRANSLATE_LOOKUP(TranslateXgipLayout.Decode, buttons);
+
+    State->LeftTrigger = TRANSLATE_TRIGGER_FROM_10(Source->LeftTrigger);
+    State->RightTrigger = TRANSLATE_TRIGGER_FROM_10(Source->RightTrigger);
+
+    State->ThumbLX = Source->ThumbLX;
+    State->ThumbLY = Source->ThumbLY;
+    State->ThumbRX = Source->ThumbRX;
+    State->ThumbRY = Source->ThumbRY;
+}
+
+//
+// Encodes a canonical gamepad state into the native report of TargetType.
+// 
+// Encoders only look up tables and shift; the trigger precision a target
+// lacks is dropped, as are buttons it doesn't have.
+// 
+NTSTATUS Translate_EncodeGamepad(
+    const VIGEM_GAMEPAD_STATE* State,
+    VIGEM_TARGET_TYPE TargetType,
+    PVIGEM_TARGET_REPORT Target
+)
+{
+    RtlZeroMemory(Target, sizeof(VIGEM_TARGET_REPORT));
+
+    switch (TargetType)
+    {
+    case Xbox360Wired:
+        Translate_EncodeXusb(State, &Target->Xusb);
+        return STATUS_SUCCESS;
+    case DualShock4Wired:
+        Translate_EncodeDs4(State, &Target->Ds4);
+        return STATUS_SUCCESS;
+    case XboxOneWired:
+        Translate_EncodeXgip(State, &Target->Xgip);
+        return STATUS_SUCCESS;
+    default:
+        return STATUS_NOT_SUPPORTED;
+    }
+}
+
+//
+// Decodes a native report of SourceType into a canonical gamepad state,
+// stretching values to the canonical range. Encoding the result again
+// yields the original report, minus bits the target type doesn't define.
+// 
+NTSTATUS Translate_DecodeGamepad(
+    VIGEM_TARGET_TYPE SourceType,
+    const VIGEM_TARGET_REPORT* Source,
+    PVIGEM_GAMEPAD_STATE State
+)
+{
+    RtlZeroMemory(State, sizeof(VIGEM_GAMEPAD_STATE));
+
+    switch (SourceType)
+    {
+    case Xbox360Wired:
+        Translate_DecodeXusb(&Source->Xusb, State);
+        return STATUS_SUCCESS;
+    case DualShock4Wired:
+        Translate_DecodeDs4(&Source->Ds4, State);
+        return STATUS_SUCCESS;
+    case XboxOneWired:
+        Translate_DecodeXgip(&Source->Xgip, State);
+        return STATUS_SUCCESS;
+    default:
+        return STATUS_NOT_SUPPORTED;
+    }
+}
+
+//
+// Tells whether reports of SourceType can be translated to TargetType.
+// 
+BOOLEAN Translate_IsSupported(VIGEM_TARGET_TYPE SourceType, VIGEM_TARGET_TYPE TargetType)
+{
+    if (SourceType == TargetType)
+        return TRUE;
+
+    return (SourceType == Xbox360Wired || SourceType == DualShock4Wired || SourceType == XboxOneWired)
+        && (TargetType == Xbox360Wired || TargetType == DualShock4Wired || TargetType == XboxOneWired);
+}
+
+//
+// Converts a report between target types through the canonical state,
+// mapping buttons by position.
+// 
+NTSTATUS Translate_Report(
+    VIGEM_TARGET_TYPE SourceType,
+    const VIGEM_TARGET_REPORT* Source,
+    VIGEM_TARGET_TYPE TargetType,
+    PVIGEM_TARGET_REPORT Target
+)
+{
+    NTSTATUS            status;
+    VIGEM_GAMEPAD_STATE state;
+
+    if (SourceType == TargetType)
+    {
+        *Target = *Source;
+        return STATUS_SUCCESS;
+    }
+
+    status = Translate_DecodeGamepad(SourceType, Source, &state);
+
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    return Translate_EncodeGamepad(&state, TargetType, Target);
+}
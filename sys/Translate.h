@@ -0,0 +1,56 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+BOOLEAN
+Translate_IsSupported(
+    _In_ VIGEM_TARGET_TYPE SourceType,
+    _In_ VIGEM_TARGET_TYPE TargetType
+);
+
+NTSTATUS
+Translate_Report(
+    _In_ VIGEM_TARGET_TYPE SourceType,
+    _In_ const VIGEM_TARGET_REPORT* Source,
+    _In_ VIGEM_TARGET_TYPE TargetType,
+    _Out_ PVIGEM_TARGET_REPORT Target
+);
+
+NTSTATUS
+Translate_EncodeGamepad(
+    _In_ const VIGEM_GAMEPAD_STATE* State,
+    _In_ VIGEM_TARGET_TYPE TargetType,
+    _Out_ PVIGEM_TARGET_REPORT Target
+);
+
+NTSTATUS
+Translate_DecodeGamepad(
+    _In_ VIGEM_TARGET_TYPE SourceType,
+    _In_ const VIGEM_TARGET_REPORT* Source,
+    _Out_ PVIGEM_GAMEPAD_STATE State
+);
@@ -34,6 +34,16 @@
 
 #define IS_OWNER(_pdo_) (_pdo_->OwnerProcessId == CURRENT_PROCESS_ID())
 
+//
+// Number of axis values AxesBlend works on at once
+// 
+#define AXES_BLEND_LANES    0x08
+
+//
+// Blend weight representing 1.0
+// 
+#define AXES_BLEND_ONE      0x2000
+
 //
 // Represents a MAC address.
 //
@@ -50,3 +60,8 @@ typedef struct _MAC_ADDRESS
 
 VOID ReverseByteArray(PUCHAR Array, INT Length);
 VOID GenerateRandomMacAddress(PMAC_ADDRESS Address);
+ULONG LatencyBucketIndex(ULONG64 Microseconds);
+BOOLEAN ReportEqualMasked(const VOID* Left, const VOID* Right, const UCHAR* IgnoreMask, ULONG Length);
+VOID ReportMergeMasked(VOID* Destination, const VOID* Source, const UCHAR* KeepMask, ULONG Length);
+VOID AxesBlend(const SHORT* Previous, const SHORT* Current, SHORT* Output, SHORT WeightPrevious, SHORT WeightCurrent);
+BOOLEAN AxesBlendWeights(VIGEM_INTERPOLATION_MODE Mode, const LONG64* Time, LONG64 Now, LONG64 Frequency, PSHORT WeightPrevious, PSHORT WeightCurrent);
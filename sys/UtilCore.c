@@ -0,0 +1,250 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+//
+// Helpers of util.c that need neither the kernel nor the framework; they
+// get built into the host tests as well.
+// 
+
+#include "Platform.h"
+#include "Util.h"
+
+#if defined(_M_AMD64)
+#include <emmintrin.h>
+#elif defined(_M_ARM64)
+#include <arm64_neon.h>
+#endif
+
+
+//
+// Maps a latency to its log2 histogram bucket (see VIGEM_LATENCY_BUCKETS).
+// 
+ULONG LatencyBucketIndex(ULONG64 Microseconds)
+{
+    ULONG index = 0;
+
+    while (Microseconds > 1 && index < VIGEM_LATENCY_BUCKETS - 1)
+    {
+        Microseconds >>= 1;
+        index++;
+    }
+
+    return index;
+}
+
+//
+// Compares two reports, ignoring the bits set in IgnoreMask (optional).
+// 
+// Takes 16 bytes at a time where vector registers are usable in kernel mode
+// without saving the floating point state (x64, ARM64); x86 stays scalar.
+// 
+BOOLEAN ReportEqualMasked(const VOID* Left, const VOID* Right, const UCHAR* IgnoreMask, ULONG Length)
+{
+    const UCHAR*    l = (const UCHAR*)Left;
+    const UCHAR*    r = (const UCHAR*)Right;
+    ULONG           i = 0;
+
+#if defined(_M_AMD64)
+    for (; i + 16 <= Length; i += 16)
+    {
+        __m128i diff = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)(l + i)),
+            _mm_loadu_si128((const __m128i*)(r + i)));
+
+        if (IgnoreMask != NULL)
+            diff = _mm_andnot_si128(_mm_loadu_si128((const __m128i*)(IgnoreMask + i)), diff);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF)
+            return FALSE;
+    }
+#elif defined(_M_ARM64)
+    for (; i + 16 <= Length; i += 16)
+    {
+        uint8x16_t diff = veorq_u8(vld1q_u8(l + i), vld1q_u8(r + i));
+
+        if (IgnoreMask != NULL)
+            diff = vbicq_u8(diff, vld1q_u8(IgnoreMask + i));
+
+        if (vmaxvq_u8(diff) != 0)
+            return FALSE;
+    }
+#endif
+
+    for (; i + sizeof(ULONG64) <= Length; i += sizeof(ULONG64))
+    {
+        ULONG64 diff = *(const ULONG64 UNALIGNED*)(l + i) ^ *(const ULONG64 UNALIGNED*)(r + i);
+
+        if (IgnoreMask != NULL)
+            diff &= ~*(const ULONG64 UNALIGNED*)(IgnoreMask + i);
+
+        if (diff != 0)
+            return FALSE;
+    }
+
+    for (; i < Length; i++)
+    {
+        UCHAR diff = l[i] ^ r[i];
+
+        if (IgnoreMask != NULL)
+            diff &= ~IgnoreMask[i];
+
+        if (diff != 0)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// Merges Source into Destination, keeping the bytes of Destination whose
+// KeepMask byte is set (0xFF) and taking all others from Source.
+// 
+VOID ReportMergeMasked(VOID* Destination, const VOID* Source, const UCHAR* KeepMask, ULONG Length)
+{
+    UCHAR*          d = (UCHAR*)Destination;
+    const UCHAR*    s = (const UCHAR*)Source;
+    ULONG           i = 0;
+
+#if defined(_M_AMD64)
+    for (; i + 16 <= Length; i += 16)
+    {
+        __m128i keep = _mm_loadu_si128((const __m128i*)(KeepMask + i));
+
+        _mm_storeu_si128((__m128i*)(d + i), _mm_or_si128(
+            _mm_and_si128(keep, _mm_loadu_si128((const __m128i*)(d + i))),
+            _mm_andnot_si128(keep, _mm_loadu_si128((const __m128i*)(s + i)))));
+    }
+#elif defined(_M_ARM64)
+    for (; i + 16 <= Length; i += 16)
+    {
+        vst1q_u8(d + i, vbslq_u8(vld1q_u8(KeepMask + i), vld1q_u8(d + i), vld1q_u8(s + i)));
+    }
+#endif
+
+    for (; i + sizeof(ULONG64) <= Length; i += sizeof(ULONG64))
+    {
+        ULONG64 keep = *(const ULONG64 UNALIGNED*)(KeepMask + i);
+
+        *(ULONG64 UNALIGNED*)(d + i) = (*(ULONG64 UNALIGNED*)(d + i) & keep)
+            | (*(const ULONG64 UNALIGNED*)(s + i) & ~keep);
+    }
+
+    for (; i < Length; i++)
+    {
+        d[i] = (d[i] & KeepMask[i]) | (s[i] & ~KeepMask[i]);
+    }
+}
+
+//
+// Blends two sets of AXES_BLEND_LANES axis values:
+// 
+//   Output = (Previous * WeightPrevious + Current * WeightCurrent) / AXES_BLEND_ONE
+// 
+// rounded to nearest and saturated to SHORT. Weights may be negative for
+// extrapolation but must not exceed 2 * AXES_BLEND_ONE in magnitude.
+// 
+VOID AxesBlend(const SHORT* Previous, const SHORT* Current, SHORT* Output, SHORT WeightPrevious, SHORT WeightCurrent)
+{
+#if defined(_M_AMD64)
+    __m128i previous = _mm_loadu_si128((const __m128i*)Previous);
+    __m128i current = _mm_loadu_si128((const __m128i*)Current);
+    __m128i weights = _mm_set1_epi32((int)(((ULONG)(USHORT)WeightCurrent << 16) | (USHORT)WeightPrevious));
+    __m128i round = _mm_set1_epi32(AXES_BLEND_ONE / 2);
+
+    // Interleaved (previous, current) pairs multiply-add against (WeightPrevious, WeightCurrent)
+    __m128i low = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(previous, current), weights), round), 13);
+    __m128i high = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(previous, current), weights), round), 13);
+
+    _mm_storeu_si128((__m128i*)Output, _mm_packs_epi32(low, high));
+#elif defined(_M_ARM64)
+    int16x8_t previous = vld1q_s16(Previous);
+    int16x8_t current = vld1q_s16(Current);
+
+    int32x4_t low = vmlal_n_s16(vmull_n_s16(vget_low_s16(previous), WeightPrevious), vget_low_s16(current), WeightCurrent);
+    int32x4_t high = vmlal_n_s16(vmull_n_s16(vget_high_s16(previous), WeightPrevious), vget_high_s16(current), WeightCurrent);
+
+    vst1q_s16(Output, vcombine_s16(vqrshrn_n_s32(low, 13), vqrshrn_n_s32(high, 13)));
+#else
+    ULONG i;
+
+    for (i = 0; i < AXES_BLEND_LANES; i++)
+    {
+        LONG value = ((LONG)Previous[i] * WeightPrevious + (LONG)Current[i] * WeightCurrent + AXES_BLEND_ONE / 2) >> 13;
+
+        Output[i] = (SHORT)max(min(value, MAXSHORT), -MAXSHORT - 1);
+    }
+#endif
+}
+
+//
+// Gets the blend weights for the axes at Now.
+// 
+// Returns FALSE if the last submitted report should go out as is.
+// 
+BOOLEAN AxesBlendWeights(
+    VIGEM_INTERPOLATION_MODE Mode,
+    const LONG64* Time,
+    LONG64 Now,
+    LONG64 Frequency,
+    PSHORT WeightPrevious,
+    PSHORT WeightCurrent
+)
+{
+    LONG64 interval = Time[1] - Time[0];
+    LONG64 fraction;
+
+    if (interval <= 0 || interval > Frequency * VIGEM_INTERPOLATION_MAX_INTERVAL_MS / 1000)
+    {
+        return FALSE;
+    }
+
+    // Time since the last submission in AXES_BLEND_ONE per interval
+    fraction = max(Now - Time[1], 0) * AXES_BLEND_ONE / interval;
+
+    if (Mode == ViGEmInterpolationLinear)
+    {
+        fraction = min(fraction, AXES_BLEND_ONE);
+
+        *WeightPrevious = (SHORT)(AXES_BLEND_ONE - fraction);
+        *WeightCurrent = (SHORT)fraction;
+
+        return TRUE;
+    }
+
+    // Feeder stalled, stop guessing
+    if (fraction > 2 * AXES_BLEND_ONE)
+    {
+        return FALSE;
+    }
+
+    fraction = min(fraction, AXES_BLEND_ONE);
+
+    *WeightPrevious = (SHORT)-fraction;
+    *WeightCurrent = (SHORT)(AXES_BLEND_ONE + fraction);
+
+    return TRUE;
+}
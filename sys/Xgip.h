@@ -90,12 +90,21 @@ Bus_XgipSubmitInterrupt(
 // 
 NTSTATUS Xgip_PreparePdo(
     PWDFDEVICE_INIT DeviceInit,
+    PPDO_IDENTIFICATION_DESCRIPTION Description,
     PUNICODE_STRING DeviceId,
     PUNICODE_STRING DeviceDescription
 );
 NTSTATUS Xgip_PrepareHardware(WDFDEVICE Device);
-NTSTATUS Xgip_AssignPdoContext(WDFDEVICE Device);
+NTSTATUS Xgip_AssignPdoContext(WDFDEVICE Device, PPDO_IDENTIFICATION_DESCRIPTION Description);
 VOID Xgip_GetConfigurationDescriptorType(PUCHAR Buffer, ULONG Length);
 VOID Xgip_GetDeviceDescriptorType(PUSB_DEVICE_DESCRIPTOR pDescriptor, PPDO_DEVICE_DATA pCommon);
 VOID Xgip_SelectConfiguration(PUSBD_INTERFACE_INFORMATION pInfo);
+NTSTATUS Xgip_BulkOrInterruptTransfer(PURB urb, WDFDEVICE Device, WDFREQUEST Request);
+NTSTATUS Xgip_CacheReport(WDFDEVICE Device, PVOID Report, const UCHAR* MergeMask, WDFQUEUE* Queue);
+VOID Xgip_WrapReport(PVOID Submit, ULONG SerialNo, PVIGEM_TARGET_REPORT Report);
+BOOLEAN Xgip_UnwrapReport(PVOID Submit, PVIGEM_TARGET_REPORT Report);
+VOID Xgip_CopyReportToUrb(WDFDEVICE Device, PURB Urb);
+WDFQUEUE Xgip_GetInRequestQueue(WDFDEVICE Device);
+
+extern const VIGEM_TARGET_OPS XgipTargetOps;
 
@@ -123,16 +123,24 @@ Bus_XusbSubmitReport(
     WDFDEVICE Device,
     ULONG SerialNo,
     PXUSB_SUBMIT_REPORT Report,
-    _In_ BOOLEAN FromInterface
+    _In_ BOOLEAN FromInterface,
+    _Out_opt_ PVIGEM_REPORT_DISPOSITION Disposition
 );
 
 //
 // XUSB-specific functions
 // 
-NTSTATUS Xusb_PreparePdo(PWDFDEVICE_INIT DeviceInit, USHORT VendorId, USHORT ProductId, PUNICODE_STRING DeviceId, PUNICODE_STRING DeviceDescription);
+NTSTATUS Xusb_PreparePdo(PWDFDEVICE_INIT DeviceInit, PPDO_IDENTIFICATION_DESCRIPTION Description, PUNICODE_STRING DeviceId, PUNICODE_STRING DeviceDescription);
 NTSTATUS Xusb_PrepareHardware(WDFDEVICE Device);
-NTSTATUS Xusb_AssignPdoContext(WDFDEVICE Device);
+NTSTATUS Xusb_AssignPdoContext(WDFDEVICE Device, PPDO_IDENTIFICATION_DESCRIPTION Description);
 VOID Xusb_GetConfigurationDescriptorType(PUCHAR Buffer, ULONG Length);
 VOID Xusb_GetDeviceDescriptorType(PUSB_DEVICE_DESCRIPTOR pDescriptor, PPDO_DEVICE_DATA pCommon);
 VOID Xusb_SelectConfiguration(PUSBD_INTERFACE_INFORMATION pInfo);
 NTSTATUS Xusb_GetUserIndex(WDFDEVICE Device, PXUSB_GET_USER_INDEX Request);
+NTSTATUS Xusb_BulkOrInterruptTransfer(PURB urb, WDFDEVICE Device, WDFREQUEST Request);
+NTSTATUS Xusb_CacheReport(WDFDEVICE Device, PVOID Report, const UCHAR* MergeMask, WDFQUEUE* Queue);
+VOID Xusb_WrapReport(PVOID Submit, ULONG SerialNo, PVIGEM_TARGET_REPORT Report);
+BOOLEAN Xusb_UnwrapReport(PVOID Submit, PVIGEM_TARGET_REPORT Report);
+VOID Xusb_CopyReportToUrb(WDFDEVICE Device, PURB Urb);
+
+extern const VIGEM_TARGET_OPS XusbTargetOps;
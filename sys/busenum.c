@@ -33,6 +33,7 @@
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text (PAGE, Bus_PlugInDevice)
 #pragma alloc_text (PAGE, Bus_UnPlugDevice)
+#pragma alloc_text (PAGE, Bus_PdoIndexDrain)
 #endif
 
 
@@ -55,6 +56,9 @@ NTSTATUS Bus_PlugInDevice(
     WDF_OBJECT_ATTRIBUTES           requestAttribs;
     PFDO_PLUGIN_REQUEST_DATA        pReqData;
     PFDO_DEVICE_DATA                pFdoData;
+    PVOID                           outBuffer;
+    BOOLEAN                         serialAssigned = FALSE;
+    BOOLEAN                         serialReserved = FALSE;
 
     PAGED_CODE();
 
@@ -81,12 +85,22 @@ NTSTATUS Bus_PlugInDevice(
         return STATUS_INVALID_PARAMETER;
     }
 
+    //
+    // Serial no. 0 lets the bus pick one, handed back in the output buffer
+    // 
     if (plugIn->SerialNo == 0)
     {
-        TraceEvents(TRACE_LEVEL_ERROR,
-            TRACE_BUSENUM,
-            "Serial no. 0 not allowed");
-        return STATUS_INVALID_PARAMETER;
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIGEM_PLUGIN_TARGET), &outBuffer, NULL);
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_BUSENUM,
+                "Serial no. 0 requires an output buffer (%!STATUS!)",
+                status);
+            return status;
+        }
+
+        serialAssigned = TRUE;
     }
 
     *Transferred = length;
@@ -120,7 +134,7 @@ NTSTATUS Bus_PlugInDevice(
     description.SerialNo = plugIn->SerialNo;
     description.TargetType = plugIn->TargetType;
     description.OwnerProcessId = CURRENT_PROCESS_ID();
-    description.SessionId = pFileData->SessionId;
+    description.SessionId = pFileData->Session.Id;
     description.OwnerIsDriver = IsInternal;
 
     // Set default IDs if supplied values are invalid
@@ -159,6 +173,40 @@ NTSTATUS Bus_PlugInDevice(
         description.ProductId = plugIn->ProductId;
     }
 
+    if (serialAssigned)
+    {
+        description.SerialNo = Bus_SerialAllocate(pFdoData);
+        if (description.SerialNo == 0)
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_BUSENUM,
+                "No free serial left to assign");
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        serialReserved = TRUE;
+
+        // Input and output share the system buffer
+        plugIn->SerialNo = description.SerialNo;
+    }
+    else
+    {
+        serialReserved = Bus_SerialReserve(pFdoData, description.SerialNo);
+
+        //
+        // A set bit belongs to a device that exists or is still being torn
+        // down; its cleanup would free the bit and state row of a new one
+        // 
+        if (!serialReserved && description.SerialNo < FDO_SERIAL_BITMAP_SIZE)
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_BUSENUM,
+                "Serial %d is still in use",
+                description.SerialNo);
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+
     TraceEvents(TRACE_LEVEL_VERBOSE,
         TRACE_BUSENUM,
         "New PDO properties: serial = %d, type = %d, pid = %d, session = %d, internal = %d, vid = 0x%04X, pid = 0x%04X",
@@ -171,101 +219,148 @@ NTSTATUS Bus_PlugInDevice(
         description.ProductId
     );
 
-    WdfSpinLockAcquire(pFdoData->PendingPluginRequestsLock);
-
-    TraceEvents(TRACE_LEVEL_VERBOSE,
-        TRACE_BUSENUM,
-        "Current pending requests count: %d",
-        WdfCollectionGetCount(pFdoData->PendingPluginRequests));
-
-    status = WdfChildListAddOrUpdateChildDescriptionAsPresent(WdfFdoGetDefaultChildList(Device), &description.Header, NULL);
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&requestAttribs, FDO_PLUGIN_REQUEST_DATA);
 
+    //
+    // Allocate context data to request
+    // 
+    status = WdfObjectAllocateContext(Request, &requestAttribs, (PVOID)&pReqData);
     if (!NT_SUCCESS(status))
     {
         TraceEvents(TRACE_LEVEL_ERROR,
             TRACE_BUSENUM,
-            "WdfChildListAddOrUpdateChildDescriptionAsPresent failed with status %!STATUS!",
+            "WdfObjectAllocateContext failed with status %!STATUS!",
             status);
 
         goto pluginEnd;
     }
 
     //
-    // The requested serial number is already in use
+    // Glue current serial to request
     // 
-    if (status == STATUS_OBJECT_NAME_EXISTS)
-    {
-        status = STATUS_INVALID_PARAMETER;
+    pReqData->PendingEntry.Serial = description.SerialNo;
+    pReqData->TargetType = description.TargetType;
 
-        TraceEvents(TRACE_LEVEL_ERROR,
-            TRACE_BUSENUM,
-            "The described PDO already exists (%!STATUS!)",
-            status);
+    //
+    // Report the assigned serial back to the caller on completion
+    // 
+    pReqData->Information = serialAssigned ? sizeof(VIGEM_PLUGIN_TARGET) : 0;
 
-        goto pluginEnd;
-    }
+    //
+    // Timestamp the request to track its age
+    // 
+    pReqData->Timestamp = KeQueryPerformanceCounter(&pReqData->Frequency);
 
-    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&requestAttribs, FDO_PLUGIN_REQUEST_DATA);
+    WdfSpinLockAcquire(pFdoData->PendingPluginRequestsLock);
+
+    TraceEvents(TRACE_LEVEL_VERBOSE,
+        TRACE_BUSENUM,
+        "Current pending requests count: %d",
+        pFdoData->PendingPlugins.Count);
 
     //
-    // Allocate context data to request
+    // A device with this serial is still being brought up
     // 
-    status = WdfObjectAllocateContext(Request, &requestAttribs, (PVOID)&pReqData);
-    if (!NT_SUCCESS(status))
+    if (Bus_PluginRequestFind(pFdoData, description.SerialNo) != NULL)
     {
+        WdfSpinLockRelease(pFdoData->PendingPluginRequestsLock);
+
         TraceEvents(TRACE_LEVEL_ERROR,
             TRACE_BUSENUM,
-            "WdfObjectAllocateContext failed with status %!STATUS!",
-            status);
+            "Plugin request with serial %d already pending",
+            description.SerialNo);
 
+        status = STATUS_INVALID_PARAMETER;
         goto pluginEnd;
     }
 
     //
-    // Glue current serial to request
+    // Track the request before the child exists so a stage result
+    // arriving right after creation can't miss it
     // 
-    pReqData->Serial = plugIn->SerialNo;
+    Bus_PluginRequestLink(pFdoData, pReqData);
 
     //
-    // Timestamp the request to track its age
+    // First pending request; start clean-up timer
     // 
-    pReqData->Timestamp = KeQueryPerformanceCounter(&pReqData->Frequency);
+    if (pFdoData->PendingPlugins.Count == 1)
+    {
+        WdfTimerStart(
+            pFdoData->PendingPluginRequestsCleanupTimer,
+            WDF_REL_TIMEOUT_IN_MS(ORC_TIMER_PERIODIC_DUE_TIME)
+        );
+        TraceEvents(TRACE_LEVEL_VERBOSE,
+            TRACE_DRIVER,
+            "Started periodic timer");
+    }
+
+    WdfSpinLockRelease(pFdoData->PendingPluginRequestsLock);
 
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_BUSENUM,
+        "Added item with serial: %d",
+        description.SerialNo);
+
+    status = WdfChildListAddOrUpdateChildDescriptionAsPresent(WdfFdoGetDefaultChildList(Device), &description.Header, NULL);
+
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfChildListAddOrUpdateChildDescriptionAsPresent failed with status %!STATUS!",
+            status);
+    }
     //
-    // Keep track of pending request in collection
+    // The requested serial number is already in use
     // 
-    status = WdfCollectionAdd(pFdoData->PendingPluginRequests, Request);
-    if (!NT_SUCCESS(status))
+    else if (status == STATUS_OBJECT_NAME_EXISTS)
     {
+        status = STATUS_INVALID_PARAMETER;
+
         TraceEvents(TRACE_LEVEL_ERROR,
             TRACE_BUSENUM,
-            "WdfCollectionAdd failed with status %!STATUS!",
+            "The described PDO already exists (%!STATUS!)",
             status);
+    }
 
-        goto pluginEnd;
+    if (NT_SUCCESS(status))
+    {
+        status = STATUS_PENDING;
     }
+    else
+    {
+        WdfSpinLockAcquire(pFdoData->PendingPluginRequestsLock);
 
-    TraceEvents(TRACE_LEVEL_INFORMATION,
-        TRACE_BUSENUM,
-        "Added item with serial: %d",
-        plugIn->SerialNo);
+        //
+        // Withdraw the request; if it's gone it already got completed
+        // and neither it nor its buffers may be touched anymore
+        // 
+        if (Bus_PluginRequestFind(pFdoData, description.SerialNo) == pReqData)
+        {
+            Bus_PluginRequestUnlink(pFdoData, pReqData);
+        }
+        else
+        {
+            if (serialReserved)
+            {
+                Bus_SerialRelease(pFdoData, description.SerialNo);
+            }
 
-    //
-    // At least one request present in the collection; start clean-up timer
-    // 
-    WdfTimerStart(
-        pFdoData->PendingPluginRequestsCleanupTimer,
-        WDF_REL_TIMEOUT_IN_MS(ORC_TIMER_PERIODIC_DUE_TIME)
-    );
-    TraceEvents(TRACE_LEVEL_VERBOSE,
-        TRACE_DRIVER,
-        "Started periodic timer");
+            status = STATUS_PENDING;
+        }
 
-    status = NT_SUCCESS(status) ? STATUS_PENDING : status;
+        WdfSpinLockRelease(pFdoData->PendingPluginRequestsLock);
+    }
 
 pluginEnd:
 
-    WdfSpinLockRelease(pFdoData->PendingPluginRequestsLock);
+    //
+    // Serial goes back to the allocator if no child got created for it
+    // 
+    if (!NT_SUCCESS(status) && serialReserved)
+    {
+        Bus_SerialRelease(pFdoData, description.SerialNo);
+    }
 
     TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_BUSENUM, "%!FUNC! Exit with status %!STATUS!", status);
 
@@ -343,6 +438,44 @@ NTSTATUS Bus_UnPlugDevice(
         }
     }
 
+    //
+    // Single device; found through the serial index
+    // 
+    if (!unplugAll)
+    {
+        hChild = Bus_GetPdo(Device, unPlug->SerialNo);
+
+        if (hChild != NULL)
+        {
+            // Only unplug owned children
+            if (IsInternal || PdoGetData(hChild)->SessionId == pFileData->Session.Id)
+            {
+                // Gone for new submissions right away
+                Bus_PdoIndexRemove(Device, hChild);
+
+                Bus_ReportPdoMissing(Device, unPlug->SerialNo);
+            }
+
+            Bus_PutPdo(hChild);
+        }
+
+        TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_BUSENUM, "%!FUNC! Exit with status %!STATUS!", STATUS_SUCCESS);
+
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // All devices of the calling session; found through the session index
+    // 
+    if (!IsInternal)
+    {
+        Bus_SessionUnplugAll(Device, pFileData, FALSE);
+
+        TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_BUSENUM, "%!FUNC! Exit with status %!STATUS!", STATUS_SUCCESS);
+
+        return STATUS_SUCCESS;
+    }
+
     TraceEvents(TRACE_LEVEL_VERBOSE,
         TRACE_BUSENUM,
         "Starting child list traversal");
@@ -380,35 +513,17 @@ NTSTATUS Bus_UnPlugDevice(
             continue;
         }
 
-        // Child isn't the one we looked for, skip
-        if (!unplugAll && description.SerialNo != unPlug->SerialNo)
-        {
-            TraceEvents(TRACE_LEVEL_VERBOSE,
-                TRACE_BUSENUM,
-                "Seeking serial mismatch: %d != %d",
-                description.SerialNo,
-                unPlug->SerialNo);
-            continue;
-        }
-
-        TraceEvents(TRACE_LEVEL_VERBOSE,
-            TRACE_BUSENUM,
-            "description.SessionId = %d, pFileData->SessionId = %d",
-            description.SessionId,
-            pFileData->SessionId);
+        // Gone for new submissions right away
+        Bus_PdoIndexRemove(Device, hChild);
 
-        // Only unplug owned children
-        if (IsInternal || description.SessionId == pFileData->SessionId)
+        // Unplug child
+        status = WdfChildListUpdateChildDescriptionAsMissing(list, &description.Header);
+        if (!NT_SUCCESS(status))
         {
-            // Unplug child
-            status = WdfChildListUpdateChildDescriptionAsMissing(list, &description.Header);
-            if (!NT_SUCCESS(status))
-            {
-                TraceEvents(TRACE_LEVEL_ERROR,
-                    TRACE_BUSENUM,
-                    "WdfChildListUpdateChildDescriptionAsMissing failed with status %!STATUS!",
-                    status);
-            }
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_BUSENUM,
+                "WdfChildListUpdateChildDescriptionAsMissing failed with status %!STATUS!",
+                status);
         }
     }
 
@@ -426,11 +541,11 @@ NTSTATUS Bus_UnPlugDevice(
 //
 // Sends a report update to an XUSB PDO.
 // 
-NTSTATUS Bus_XusbSubmitReport(WDFDEVICE Device, ULONG SerialNo, PXUSB_SUBMIT_REPORT Report, BOOLEAN FromInterface)
+NTSTATUS Bus_XusbSubmitReport(WDFDEVICE Device, ULONG SerialNo, PXUSB_SUBMIT_REPORT Report, BOOLEAN FromInterface, PVIGEM_REPORT_DISPOSITION Disposition)
 {
-    TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_BUSENUM, "%!FUNC! Entry");
+    TraceHot(TRACE_BUSENUM, "%!FUNC! Entry");
 
-    return Bus_SubmitReport(Device, SerialNo, Report, FromInterface);
+    return Bus_SubmitReport(Device, SerialNo, Report, FromInterface, Disposition);
 }
 
 //
@@ -441,86 +556,31 @@ NTSTATUS Bus_QueueNotification(WDFDEVICE Device, ULONG SerialNo, WDFREQUEST Requ
     NTSTATUS                    status = STATUS_INVALID_PARAMETER;
     WDFDEVICE                   hChild;
     PPDO_DEVICE_DATA            pdoData;
-    PXUSB_DEVICE_DATA           xusbData;
-    PDS4_DEVICE_DATA            ds4Data;
 
 
     TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_BUSENUM, "%!FUNC! Entry");
 
-    hChild = Bus_GetPdo(Device, SerialNo);
-
-    // Validate child
-    if (hChild == NULL)
+    status = Bus_GetRequestPdo(Device, Request, SerialNo, &hChild);
+    if (!NT_SUCCESS(status))
     {
-        TraceEvents(TRACE_LEVEL_ERROR,
-            TRACE_BUSENUM,
-            "Bus_GetPdo: PDO with serial %d not found",
-            SerialNo);
-        return STATUS_NO_SUCH_DEVICE;
+        return status;
     }
 
-    // Check common context
     pdoData = PdoGetData(hChild);
-    if (pdoData == NULL)
-    {
-        TraceEvents(TRACE_LEVEL_ERROR,
-            TRACE_BUSENUM,
-            "PdoGetData failed");
-        return STATUS_INVALID_PARAMETER;
-    }
-
-    // Check if caller owns this PDO
-    if (!IS_OWNER(pdoData))
-    {
-        TraceEvents(TRACE_LEVEL_ERROR,
-            TRACE_BUSENUM,
-            "PDO & Request ownership mismatch: %d != %d",
-            pdoData->OwnerProcessId,
-            CURRENT_PROCESS_ID());
-        return STATUS_ACCESS_DENIED;
-    }
 
     // Queue the request for later completion by the PDO and return STATUS_PENDING
-    switch (pdoData->TargetType)
+    if (pdoData->Ops->QueueNotification == NULL)
     {
-    case Xbox360Wired:
-
-        xusbData = XusbGetData(hChild);
-
-        if (xusbData == NULL)
-        {
-            TraceEvents(TRACE_LEVEL_ERROR,
-                TRACE_BUSENUM,
-                "XusbGetData failed");
-            break;
-        }
-
-        status = WdfRequestForwardToIoQueue(Request, pdoData->PendingNotificationRequests);
-
-        break;
-    case DualShock4Wired:
-
-        ds4Data = Ds4GetData(hChild);
-
-        if (ds4Data == NULL)
-        {
-            TraceEvents(TRACE_LEVEL_ERROR,
-                TRACE_BUSENUM,
-                "Ds4GetData failed");
-            break;
-        }
-
-        status = WdfRequestForwardToIoQueue(Request, pdoData->PendingNotificationRequests);
-
-        break;
-    default:
         status = STATUS_NOT_SUPPORTED;
         TraceEvents(TRACE_LEVEL_WARNING,
             TRACE_BUSENUM,
             "Unknown target type: %d (%!STATUS!)",
             pdoData->TargetType,
             status);
-        break;
+    }
+    else
+    {
+        status = pdoData->Ops->QueueNotification(hChild, Request);
     }
 
     if (!NT_SUCCESS(status))
@@ -531,6 +591,8 @@ NTSTATUS Bus_QueueNotification(WDFDEVICE Device, ULONG SerialNo, WDFREQUEST Requ
             status);
     }
 
+    Bus_PutPdo(hChild);
+
     status = (NT_SUCCESS(status)) ? STATUS_PENDING : status;
 
     TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_BUSENUM, "%!FUNC! Exit with status %!STATUS!", status);
@@ -538,288 +600,2749 @@ NTSTATUS Bus_QueueNotification(WDFDEVICE Device, ULONG SerialNo, WDFREQUEST Requ
     return status;
 }
 
+//
+// Parks a notification request on the PDO's inverted call queue.
+// 
+NTSTATUS Bus_ForwardNotification(WDFDEVICE Pdo, WDFREQUEST Request)
+{
+    return WdfRequestForwardToIoQueue(Request, PdoGetData(Pdo)->PendingNotificationRequests);
+}
+
 //
 // Sends a report update to a DS4 PDO.
 // 
-NTSTATUS Bus_Ds4SubmitReport(WDFDEVICE Device, ULONG SerialNo, PDS4_SUBMIT_REPORT Report, BOOLEAN FromInterface)
+NTSTATUS Bus_Ds4SubmitReport(WDFDEVICE Device, ULONG SerialNo, PDS4_SUBMIT_REPORT Report, BOOLEAN FromInterface, PVIGEM_REPORT_DISPOSITION Disposition)
 {
-    TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_BUSENUM, "%!FUNC! Entry");
+    TraceHot(TRACE_BUSENUM, "%!FUNC! Entry");
 
-    return Bus_SubmitReport(Device, SerialNo, Report, FromInterface);
+    return Bus_SubmitReport(Device, SerialNo, Report, FromInterface, Disposition);
 }
 
-NTSTATUS Bus_XgipSubmitReport(WDFDEVICE Device, ULONG SerialNo, PXGIP_SUBMIT_REPORT Report, BOOLEAN FromInterface)
+NTSTATUS Bus_XgipSubmitReport(WDFDEVICE Device, ULONG SerialNo, PXGIP_SUBMIT_REPORT Report, BOOLEAN FromInterface, PVIGEM_REPORT_DISPOSITION Disposition)
 {
-    TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_BUSENUM, "%!FUNC! Entry");
+    TraceHot(TRACE_BUSENUM, "%!FUNC! Entry");
 
-    return Bus_SubmitReport(Device, SerialNo, Report, FromInterface);
+    return Bus_SubmitReport(Device, SerialNo, Report, FromInterface, Disposition);
 }
 
 NTSTATUS Bus_XgipSubmitInterrupt(WDFDEVICE Device, ULONG SerialNo, PXGIP_SUBMIT_INTERRUPT Report, BOOLEAN FromInterface)
 {
-    TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_BUSENUM, "%!FUNC! Entry");
+    TraceHot(TRACE_BUSENUM, "%!FUNC! Entry");
 
-    return Bus_SubmitReport(Device, SerialNo, Report, FromInterface);
+    return Bus_SubmitReport(Device, SerialNo, Report, FromInterface, NULL);
 }
 
-WDFDEVICE Bus_GetPdo(IN WDFDEVICE Device, IN ULONG SerialNo)
+//
+// Returns the operations implementing a target type, NULL if unknown.
+// 
+const VIGEM_TARGET_OPS* Bus_GetTargetOps(VIGEM_TARGET_TYPE TargetType)
 {
-    WDFCHILDLIST                list;
-    WDF_CHILD_RETRIEVE_INFO     info;
-
-    list = WdfFdoGetDefaultChildList(Device);
+    switch (TargetType)
+    {
+    case Xbox360Wired:
+        return &XusbTargetOps;
+    case DualShock4Wired:
+        return &Ds4TargetOps;
+    case XboxOneWired:
+        return &XgipTargetOps;
+    default:
+        return NULL;
+    }
+}
 
-    PDO_IDENTIFICATION_DESCRIPTION description;
+//
+// Looks up a PDO by its serial number.
+// 
+// Called for every submitted report, so this walks the FDO's own serial index
+// instead of letting the child list compare every child. The index lock is
+// only taken shared, lookups don't serialize against each other.
+// 
+// The returned PDO is protected from cleanup until it's handed back with
+// Bus_PutPdo, so callers may use its queues, locks and timers meanwhile.
+// 
+WDFDEVICE Bus_GetPdo(IN WDFDEVICE Device, IN ULONG SerialNo)
+{
+    PSERIAL_INDEX_ENTRY         entry;
 
-    WDF_CHILD_IDENTIFICATION_DESCRIPTION_HEADER_INIT(&description.Header, sizeof(description));
+    // Fails for a PDO that is being cleaned up
+    entry = SerialIndexAcquire(&FdoGetData(Device)->PdoIndex, SerialNo);
 
-    description.SerialNo = SerialNo;
+    if (entry == NULL)
+    {
+        return NULL;
+    }
 
-    WDF_CHILD_RETRIEVE_INFO_INIT(&info, &description.Header);
+    return (WDFDEVICE)WdfObjectContextGetObject(CONTAINING_RECORD(entry, PDO_DEVICE_DATA, IndexEntry));
+}
 
-    return WdfChildListRetrievePdo(list, &info);
+//
+// Hands back a PDO obtained from Bus_GetPdo or Bus_GetRequestPdo.
+// 
+VOID Bus_PutPdo(IN WDFDEVICE Pdo)
+{
+    SerialIndexRelease(&PdoGetData(Pdo)->IndexEntry);
 }
 
-NTSTATUS Bus_SubmitReport(WDFDEVICE Device, ULONG SerialNo, PVOID Report, BOOLEAN FromInterface)
+//
+// Returns the PDO the request's handle is bound to if it matches SerialNo.
+// 
+// A handle only ever gets bound to a PDO it plugged in itself, so a hit needs
+// neither the serial index nor an ownership check.
+// 
+WDFDEVICE Bus_GetBoundPdo(IN WDFREQUEST Request, IN ULONG SerialNo)
 {
-    NTSTATUS                    status = STATUS_SUCCESS;
+    WDFFILEOBJECT               fileObject;
+    PFDO_FILE_DATA              pFileData;
     WDFDEVICE                   hChild;
-    PPDO_DEVICE_DATA            pdoData;
-    WDFREQUEST                  usbRequest;
-    PIRP                        pendingIrp;
-    BOOLEAN                     changed;
+    KIRQL                       irql;
 
+    fileObject = WdfRequestGetFileObject(Request);
+    if (fileObject == NULL)
+    {
+        return NULL;
+    }
+
+    pFileData = FileObjectGetData(fileObject);
+
+    //
+    // The PDO can't finish cleanup while it's still bound, so it stays
+    // valid until the rundown is ours
+    // 
+    irql = ExAcquireSpinLockShared(&pFileData->BoundPdoLock);
+
+    hChild = pFileData->BoundPdo;
+
+    if (hChild != NULL
+        && (PdoGetData(hChild)->SerialNo != SerialNo
+            || !ExAcquireRundownProtection(&PdoGetData(hChild)->IndexEntry.Rundown)))
+    {
+        hChild = NULL;
+    }
+
+    ExReleaseSpinLockShared(&pFileData->BoundPdoLock, irql);
+
+    return hChild;
+}
+
+//
+// Resolves the PDO a request addresses and makes sure the caller owns it.
+// 
+// Takes the handle binding if it matches, else looks the serial up. On success
+// the caller hands the PDO back with Bus_PutPdo.
+// 
+NTSTATUS Bus_GetRequestPdo(WDFDEVICE Device, WDFREQUEST Request, ULONG SerialNo, WDFDEVICE* Pdo)
+{
+    WDFDEVICE                   hChild;
+    PPDO_DEVICE_DATA            pdoData;
+
+    hChild = Bus_GetBoundPdo(Request, SerialNo);
+
+    if (hChild == NULL)
+    {
+        hChild = Bus_GetPdo(Device, SerialNo);
+
+        if (hChild == NULL)
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_BUSENUM,
+                "Bus_GetPdo: PDO with serial %d not found",
+                SerialNo);
+            return STATUS_NO_SUCH_DEVICE;
+        }
+
+        pdoData = PdoGetData(hChild);
+
+        if (!IS_OWNER(pdoData))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_BUSENUM,
+                "PDO & Request ownership mismatch: %d != %d",
+                pdoData->OwnerProcessId,
+                CURRENT_PROCESS_ID());
+            Bus_PutPdo(hChild);
+            return STATUS_ACCESS_DENIED;
+        }
+    }
+
+    *Pdo = hChild;
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Publishes a fully initialized PDO in the serial index.
+// 
+VOID Bus_PdoIndexInsert(WDFDEVICE Device, WDFDEVICE Pdo)
+{
+    PPDO_DEVICE_DATA            pdoData = PdoGetData(Pdo);
+
+    SerialIndexPublish(&FdoGetData(Device)->PdoIndex, &pdoData->IndexEntry, pdoData->SerialNo);
+
+    TraceEvents(TRACE_LEVEL_VERBOSE,
+        TRACE_BUSENUM,
+        "Indexed PDO 0x%p with serial %d",
+        Pdo, pdoData->SerialNo);
+}
+
+//
+// Unlinks a PDO from the serial index, if present.
+// 
+// Called as soon as the child is reported missing so no new lookup finds it,
+// and once more on cleanup. Takes the PDO out of its mirror group as well.
+// Callers already holding the PDO keep it until they hand it back, see
+// Bus_PdoIndexDrain.
+// 
+VOID Bus_PdoIndexRemove(WDFDEVICE Device, WDFDEVICE Pdo)
+{
+    PPDO_DEVICE_DATA            pdoData = PdoGetData(Pdo);
+
+    PAGED_CODE();
+
+    //
+    // Out of any mirror group first, while the partners can still be
+    // looked up by serial
+    // 
+    Bus_MirrorRelease(Device, Pdo);
+
+    if (SerialIndexWithdraw(&FdoGetData(Device)->PdoIndex, &pdoData->IndexEntry))
+    {
+        TraceEvents(TRACE_LEVEL_VERBOSE,
+            TRACE_BUSENUM,
+            "Removed PDO 0x%p with serial %d from index",
+            Pdo, pdoData->SerialNo);
+    }
+}
+
+//
+// Waits until every caller that looked the PDO up handed it back.
+// 
+// Must run on cleanup after Bus_PdoIndexRemove and before the PDO's child
+// objects go away.
+// 
+VOID Bus_PdoIndexDrain(WDFDEVICE Pdo)
+{
+    PAGED_CODE();
+
+    SerialIndexDrain(&PdoGetData(Pdo)->IndexEntry);
+}
+
+//
+// Reports the child with the given serial as unplugged.
+// 
+NTSTATUS Bus_ReportPdoMissing(WDFDEVICE Device, ULONG SerialNo)
+{
+    NTSTATUS                        status;
+    PDO_IDENTIFICATION_DESCRIPTION  description;
+
+    //
+    // Children are identified by serial alone
+    // 
+    RtlZeroMemory(&description, sizeof(description));
+    WDF_CHILD_IDENTIFICATION_DESCRIPTION_HEADER_INIT(&description.Header, sizeof(description));
+    description.SerialNo = SerialNo;
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_BUSENUM,
+        "Unplugging device with serial %d",
+        SerialNo);
+
+    status = WdfChildListUpdateChildDescriptionAsMissing(WdfFdoGetDefaultChildList(Device), &description.Header);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfChildListUpdateChildDescriptionAsMissing failed with status %!STATUS!",
+            status);
+    }
+
+    return status;
+}
+
+//
+// Publishes the PDO a session's handle is bound to.
+// 
+// Caller must hold SessionIndexLock.
+// 
+static VOID Bus_SessionSetBoundPdoLocked(PFDO_FILE_DATA FileData, WDFDEVICE Pdo)
+{
+    KIRQL irql;
+
+    irql = ExAcquireSpinLockExclusive(&FileData->BoundPdoLock);
+    FileData->BoundPdo = Pdo;
+    ExReleaseSpinLockExclusive(&FileData->BoundPdoLock, irql);
+}
+
+//
+// Binds a session's handle to one of its PDOs, or unbinds it if SerialNo is 0.
+// 
+// A serial that isn't linked to the session yet stays pending and gets picked
+// up by Bus_SessionIndexInsertPdo. Returns FALSE if no PDO got bound.
+// 
+// Caller must hold SessionIndexLock.
+// 
+BOOLEAN Bus_SessionBindLocked(PFDO_FILE_DATA FileData, ULONG SerialNo)
+{
+    PLIST_ENTRY         entry;
+    PPDO_DEVICE_DATA    pdoData;
+    WDFDEVICE           hChild = NULL;
+
+    for (entry = FileData->Session.Devices.Flink;
+        SerialNo != 0 && entry != &FileData->Session.Devices;
+        entry = entry->Flink)
+    {
+        pdoData = CONTAINING_RECORD(entry, PDO_DEVICE_DATA, SessionEntry);
+
+        if (pdoData->SerialNo == SerialNo)
+        {
+            hChild = (WDFDEVICE)WdfObjectContextGetObject(pdoData);
+            break;
+        }
+    }
+
+    FileData->BoundSerialNo = SerialNo;
+    Bus_SessionSetBoundPdoLocked(FileData, hChild);
+
+    return (hChild != NULL);
+}
+
+//
+// Binds the requesting handle to one of the PDOs it plugged in.
+// 
+NTSTATUS Bus_BindTarget(WDFDEVICE Device, WDFREQUEST Request, size_t* Transferred)
+{
+    NTSTATUS                    status;
+    PFDO_DEVICE_DATA            pFdoData = FdoGetData(Device);
+    PVIGEM_BIND_TARGET          bind;
+    WDFFILEOBJECT               fileObject;
+    PFDO_FILE_DATA              pFileData;
+    ULONG                       previous;
+    size_t                      length = 0;
+
+    *Transferred = 0;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIGEM_BIND_TARGET), (PVOID)&bind, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    if (bind->Size != sizeof(VIGEM_BIND_TARGET) || length != sizeof(VIGEM_BIND_TARGET))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIGEM_BIND_TARGET), (PVOID)&bind, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    fileObject = WdfRequestGetFileObject(Request);
+    if (fileObject == NULL)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    pFileData = FileObjectGetData(fileObject);
+
+    // Session never made it into the index
+    if (pFileData->Session.Link.Flink == NULL)
+    {
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    WdfWaitLockAcquire(pFdoData->SessionIndexLock, NULL);
+
+    previous = pFileData->BoundSerialNo;
+
+    //
+    // Only PDOs of this session qualify, which also settles ownership
+    // 
+    if (!Bus_SessionBindLocked(pFileData, bind->SerialNo) && bind->SerialNo != 0)
+    {
+        Bus_SessionBindLocked(pFileData, previous);
+        status = STATUS_NO_SUCH_DEVICE;
+    }
+
+    WdfWaitLockRelease(pFdoData->SessionIndexLock);
+
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "Serial %d isn't plugged in through this handle",
+            bind->SerialNo);
+        return status;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_BUSENUM,
+        "Session %d bound to serial %d (was %d)",
+        pFileData->Session.Id,
+        bind->SerialNo,
+        previous);
+
+    bind->PreviousSerialNo = previous;
+
+    *Transferred = sizeof(VIGEM_BIND_TARGET);
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Registers a newly opened session in the session index.
+// 
+VOID Bus_SessionIndexAdd(WDFDEVICE Device, PFDO_FILE_DATA FileData)
+{
+    PFDO_DEVICE_DATA pFdoData = FdoGetData(Device);
+
+    WdfWaitLockAcquire(pFdoData->SessionIndexLock, NULL);
+
+    SessionIndexAdd(&pFdoData->Sessions, &FileData->Session);
+
+    WdfWaitLockRelease(pFdoData->SessionIndexLock);
+}
+
+//
+// Links a created PDO into the device list of the session that plugged it in.
+// 
+// If that session got closed in the meantime its unplug-all already ran
+// without this PDO, so it gets unplugged here instead.
+// 
+VOID Bus_SessionIndexInsertPdo(WDFDEVICE Device, WDFDEVICE Pdo)
+{
+    PFDO_DEVICE_DATA        pFdoData = FdoGetData(Device);
+    PPDO_DEVICE_DATA        pdoData = PdoGetData(Pdo);
+    PSESSION_INDEX_SESSION  session;
+    PFDO_FILE_DATA          pFileData;
+    BOOLEAN                 linked = FALSE;
+
+    WdfWaitLockAcquire(pFdoData->SessionIndexLock, NULL);
+
+    session = SessionIndexFind(&pFdoData->Sessions, pdoData->SessionId);
+
+    if (session != NULL)
+    {
+        pFileData = CONTAINING_RECORD(session, FDO_FILE_DATA, Session);
+
+        InsertTailList(&session->Devices, &pdoData->SessionEntry);
+
+        //
+        // Single-pad feeders get the bound fast path without asking for it.
+        // Only a created PDO qualifies, a plug-in failing before this point
+        // leaves no binding behind.
+        // 
+        if (pFileData->BoundSerialNo == 0)
+        {
+            pFileData->BoundSerialNo = pdoData->SerialNo;
+        }
+
+        // Bound by serial before the PDO existed, or just now
+        if (pFileData->BoundSerialNo == pdoData->SerialNo)
+        {
+            Bus_SessionSetBoundPdoLocked(pFileData, Pdo);
+        }
+
+        linked = TRUE;
+    }
+
+    WdfWaitLockRelease(pFdoData->SessionIndexLock);
+
+    if (!linked)
+    {
+        TraceEvents(TRACE_LEVEL_WARNING,
+            TRACE_BUSENUM,
+            "Session %d of serial %d is gone, unplugging",
+            pdoData->SessionId,
+            pdoData->SerialNo);
+
+        Bus_PdoIndexRemove(Device, Pdo);
+
+        Bus_ReportPdoMissing(Device, pdoData->SerialNo);
+    }
+}
+
+//
+// Unlinks a PDO from its session's device list.
+// 
+VOID Bus_SessionIndexRemovePdo(WDFDEVICE Device, WDFDEVICE Pdo)
+{
+    PFDO_DEVICE_DATA        pFdoData = FdoGetData(Device);
+    PPDO_DEVICE_DATA        pdoData = PdoGetData(Pdo);
+    PSESSION_INDEX_SESSION  session;
+    PFDO_FILE_DATA          pFileData;
+
+    // Never initialized if PDO creation failed early
+    if (pdoData->SessionEntry.Flink == NULL)
+    {
+        return;
+    }
+
+    WdfWaitLockAcquire(pFdoData->SessionIndexLock, NULL);
+
+    RemoveEntryList(&pdoData->SessionEntry);
+    InitializeListHead(&pdoData->SessionEntry);
+
+    //
+    // Drop a handle binding before the PDO goes away; a closed session
+    // already dropped its own
+    // 
+    session = SessionIndexFind(&pFdoData->Sessions, pdoData->SessionId);
+
+    if (session != NULL)
+    {
+        pFileData = CONTAINING_RECORD(session, FDO_FILE_DATA, Session);
+
+        if (pFileData->BoundPdo == Pdo)
+        {
+            Bus_SessionBindLocked(pFileData, 0);
+        }
+    }
+
+    WdfWaitLockRelease(pFdoData->SessionIndexLock);
+}
+
+//
+// Unplugs every PDO owned by a session.
+// 
+// If Close is set the session leaves the index as well and its PDOs
+// stop referring to it.
+// 
+VOID Bus_SessionUnplugAll(WDFDEVICE Device, PFDO_FILE_DATA FileData, BOOLEAN Close)
+{
+    PFDO_DEVICE_DATA    pFdoData = FdoGetData(Device);
+    PLIST_ENTRY         entry;
+    PLIST_ENTRY         next;
+    PPDO_DEVICE_DATA    pdoData;
+
+    // Session never made it into the index
+    if (FileData->Session.Link.Flink == NULL)
+    {
+        return;
+    }
+
+    WdfWaitLockAcquire(pFdoData->SessionIndexLock, NULL);
+
+    for (entry = FileData->Session.Devices.Flink; entry != &FileData->Session.Devices; entry = next)
+    {
+        next = entry->Flink;
+        pdoData = CONTAINING_RECORD(entry, PDO_DEVICE_DATA, SessionEntry);
+
+        //
+        // Holding the session lock keeps the PDO from finishing cleanup
+        // 
+        Bus_PdoIndexRemove(Device, (WDFDEVICE)WdfObjectContextGetObject(pdoData));
+
+        Bus_ReportPdoMissing(Device, pdoData->SerialNo);
+
+        if (Close)
+        {
+            RemoveEntryList(entry);
+            InitializeListHead(entry);
+        }
+    }
+
+    if (Close)
+    {
+        Bus_SessionBindLocked(FileData, 0);
+
+        SessionIndexRemove(&FileData->Session);
+    }
+
+    WdfWaitLockRelease(pFdoData->SessionIndexLock);
+}
+
+//
+// Picks the lowest free serial and marks it used.
+// 
+// Returns 0 if all serials the bus hands out are taken.
+// 
+ULONG Bus_SerialAllocate(PFDO_DEVICE_DATA FdoData)
+{
+    return SerialAllocatorAllocate(&FdoData->Serials);
+}
+
+//
+// Marks a caller-chosen serial used so the allocator won't hand it out.
+// 
+// Returns TRUE if this call took the serial; serials outside the bitmap
+// and serials already marked are left alone.
+// 
+BOOLEAN Bus_SerialReserve(PFDO_DEVICE_DATA FdoData, ULONG Serial)
+{
+    return SerialAllocatorReserve(&FdoData->Serials, Serial);
+}
+
+//
+// Returns a serial to the allocator.
+// 
+VOID Bus_SerialRelease(PFDO_DEVICE_DATA FdoData, ULONG Serial)
+{
+    SerialAllocatorRelease(&FdoData->Serials, Serial);
+}
+
+C_ASSERT(ORC_REQUEST_MAX_AGE_TICKS < PLUGIN_TABLE_WHEEL_SLOTS);
+
+//
+// Looks up a pending plugin request by serial.
+// 
+// Caller must hold PendingPluginRequestsLock.
+// 
+PFDO_PLUGIN_REQUEST_DATA Bus_PluginRequestFind(PFDO_DEVICE_DATA FdoData, ULONG Serial)
+{
+    PPLUGIN_TABLE_ENTRY         entry;
+
+    entry = PluginTableFind(&FdoData->PendingPlugins, Serial);
+
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+
+    return CONTAINING_RECORD(entry, FDO_PLUGIN_REQUEST_DATA, PendingEntry);
+}
+
+//
+// Tracks a pending plugin request and schedules its expiry after
+// ORC_REQUEST_MAX_AGE on the wheel.
+// 
+// Caller must hold PendingPluginRequestsLock.
+// 
+VOID Bus_PluginRequestLink(PFDO_DEVICE_DATA FdoData, PFDO_PLUGIN_REQUEST_DATA RequestData)
+{
+    PluginTableLink(&FdoData->PendingPlugins,
+        &RequestData->PendingEntry,
+        RequestData->PendingEntry.Serial,
+        ORC_REQUEST_MAX_AGE_TICKS);
+}
+
+//
+// Accounts a stage result of a pending plugin request in the statistics.
+// 
+// Caller must hold PendingPluginRequestsLock.
+// 
+VOID Bus_PluginStatsRecordStage(
+    PFDO_DEVICE_DATA FdoData,
+    PFDO_PLUGIN_REQUEST_DATA RequestData,
+    VIGEM_PDO_STAGE Stage,
+    NTSTATUS Status,
+    LARGE_INTEGER Now
+)
+{
+    PVIGEM_PLUGIN_TARGET_STATS  stats;
+    ULONG64                     elapsed;
+
+    if ((ULONG)RequestData->TargetType >= VIGEM_PLUGIN_STATS_TARGET_TYPES
+        || (ULONG)Stage >= VIGEM_PLUGIN_STATS_STAGES)
+    {
+        return;
+    }
+
+    stats = &FdoData->PluginStats.Targets[RequestData->TargetType];
+
+    if (!NT_SUCCESS(Status))
+    {
+        stats->Failures[Stage]++;
+        return;
+    }
+
+    elapsed = (ULONG64)(Now.QuadPart - RequestData->Timestamp.QuadPart) * 1000000
+        / (ULONG64)RequestData->Frequency.QuadPart;
+
+    stats->Latency[Stage][LatencyBucketIndex(elapsed)]++;
+}
+
+//
+// Accounts a plugin request that expired without a final stage result.
+// 
+// Caller must hold PendingPluginRequestsLock.
+// 
+VOID Bus_PluginStatsRecordTimeout(PFDO_DEVICE_DATA FdoData, PFDO_PLUGIN_REQUEST_DATA RequestData)
+{
+    if ((ULONG)RequestData->TargetType < VIGEM_PLUGIN_STATS_TARGET_TYPES)
+    {
+        FdoData->PluginStats.Targets[RequestData->TargetType].Timeouts++;
+    }
+}
+
+//
+// Returns a snapshot of the plugin latency statistics.
+// 
+NTSTATUS Bus_GetPluginStats(WDFDEVICE Device, WDFREQUEST Request, size_t* Transferred)
+{
+    NTSTATUS            status;
+    PFDO_DEVICE_DATA    pFdoData = FdoGetData(Device);
+    PVIGEM_PLUGIN_STATS stats;
+    size_t              length = 0;
+
+    *Transferred = 0;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIGEM_PLUGIN_STATS), (PVOID)&stats, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    if (stats->Size != sizeof(VIGEM_PLUGIN_STATS))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIGEM_PLUGIN_STATS), (PVOID)&stats, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    WdfSpinLockAcquire(pFdoData->PendingPluginRequestsLock);
+
+    RtlCopyMemory(stats, &pFdoData->PluginStats, sizeof(VIGEM_PLUGIN_STATS));
+
+    WdfSpinLockRelease(pFdoData->PendingPluginRequestsLock);
+
+    stats->Size = sizeof(VIGEM_PLUGIN_STATS);
+
+    *Transferred = sizeof(VIGEM_PLUGIN_STATS);
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Accounts a framework object to the bus and, if given, the PDO it got created for.
+// 
+// The object stays accounted until its memory is released, so objects outliving
+// their PDO keep showing up in the bus totals.
+// 
+VOID Bus_TrackObject(WDFDEVICE Device, WDFDEVICE Pdo, WDFOBJECT Object, VIGEM_RESOURCE_TYPE Type)
+{
+    NTSTATUS                status;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    PTRACKED_OBJECT_DATA    pTrackedData = NULL;
+
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, TRACKED_OBJECT_DATA);
+    attributes.EvtDestroyCallback = Bus_EvtTrackedObjectDestroy;
+
+    status = WdfObjectAllocateContext(Object, &attributes, (PVOID)&pTrackedData);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_WARNING,
+            TRACE_BUSENUM,
+            "WdfObjectAllocateContext failed with status %!STATUS!, object 0x%p not accounted",
+            status,
+            Object);
+        return;
+    }
+
+    pTrackedData->Device = Device;
+    pTrackedData->Pdo = Pdo;
+    pTrackedData->Type = Type;
+
+    InterlockedIncrement(&FdoGetData(Device)->LiveObjects[Type]);
+
+    if (Pdo != NULL)
+    {
+        // Keeps the PDO context valid until this object is gone
+        WdfObjectReference(Pdo);
+
+        InterlockedIncrement(&PdoGetData(Pdo)->LiveObjects[Type]);
+    }
+}
+
+//
+// Removes a destroyed framework object from the accounting.
+// 
+VOID Bus_EvtTrackedObjectDestroy(WDFOBJECT Object)
+{
+    PTRACKED_OBJECT_DATA pTrackedData = TrackedObjectGetData(Object);
+
+    if (pTrackedData->Pdo != NULL)
+    {
+        InterlockedDecrement(&PdoGetData(pTrackedData->Pdo)->LiveObjects[pTrackedData->Type]);
+
+        WdfObjectDereference(pTrackedData->Pdo);
+    }
+
+    InterlockedDecrement(&FdoGetData(pTrackedData->Device)->LiveObjects[pTrackedData->Type]);
+}
+
+//
+// Returns a snapshot of the live object counters.
+// 
+NTSTATUS Bus_GetResourceStats(WDFDEVICE Device, WDFREQUEST Request, size_t* Transferred)
+{
+    NTSTATUS                status;
+    PFDO_DEVICE_DATA        pFdoData = FdoGetData(Device);
+    PVIGEM_RESOURCE_STATS   stats;
+    WDFDEVICE               hChild = NULL;
+    ULONG                   serial;
+    ULONG                   i;
+    size_t                  length = 0;
+
+    *Transferred = 0;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIGEM_RESOURCE_STATS), (PVOID)&stats, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    if (stats->Size != sizeof(VIGEM_RESOURCE_STATS))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    serial = stats->SerialNo;
+
+    if (serial != 0)
+    {
+        hChild = Bus_GetPdo(Device, serial);
+
+        if (hChild == NULL)
+        {
+            return STATUS_NO_SUCH_DEVICE;
+        }
+    }
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIGEM_RESOURCE_STATS), (PVOID)&stats, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+            status);
+
+        if (hChild != NULL)
+        {
+            Bus_PutPdo(hChild);
+        }
+        return status;
+    }
+
+    RtlZeroMemory(stats, sizeof(VIGEM_RESOURCE_STATS));
+
+    stats->Size = sizeof(VIGEM_RESOURCE_STATS);
+    stats->SerialNo = serial;
+    stats->BusInterfaces = ReadNoFence(&pFdoData->LiveInterfaces);
+
+    for (i = 0; i < VIGEM_RESOURCE_TYPES; i++)
+    {
+        stats->BusObjects[i] = ReadNoFence(&pFdoData->LiveObjects[i]);
+
+        if (hChild != NULL)
+        {
+            stats->DeviceObjects[i] = ReadNoFence(&PdoGetData(hChild)->LiveObjects[i]);
+        }
+    }
+
+    if (hChild != NULL)
+    {
+        Bus_PutPdo(hChild);
+    }
+
+    *Transferred = sizeof(VIGEM_RESOURCE_STATS);
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Stops tracking a pending plugin request.
+// 
+// Caller must hold PendingPluginRequestsLock.
+// 
+VOID Bus_PluginRequestUnlink(PFDO_DEVICE_DATA FdoData, PFDO_PLUGIN_REQUEST_DATA RequestData)
+{
+    PluginTableUnlink(&FdoData->PendingPlugins, &RequestData->PendingEntry);
+}
+
+NTSTATUS Bus_SubmitReport(WDFDEVICE Device, ULONG SerialNo, PVOID Report, BOOLEAN FromInterface, PVIGEM_REPORT_DISPOSITION Disposition)
+{
+    NTSTATUS                    status;
+    WDFDEVICE                   hChild;
+    PPDO_DEVICE_DATA            pdoData;
+
+
+    TraceHot(TRACE_BUSENUM, "%!FUNC! Entry");
+
+    hChild = Bus_GetPdo(Device, SerialNo);
+
+    // Validate child
+    if (hChild == NULL)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "Bus_GetPdo: PDO with serial %d not found",
+            SerialNo);
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    // Check common context
+    pdoData = PdoGetData(hChild);
+    if (pdoData == NULL)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "PdoGetData failed");
+        status = STATUS_INVALID_PARAMETER;
+    }
+    // Check if caller owns this PDO
+    else if (!FromInterface && !IS_OWNER(pdoData))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "PDO & Request ownership mismatch: %d != %d",
+            pdoData->OwnerProcessId,
+            CURRENT_PROCESS_ID());
+        status = STATUS_ACCESS_DENIED;
+    }
+    else
+    {
+        status = Bus_SubmitReportToPdo(hChild, Report, NULL, Disposition);
+    }
+
+    Bus_PutPdo(hChild);
+
+    return status;
+}
+
+//
+// Bus_SubmitReport for user-mode requests, short-cut through the handle binding.
+// 
+NTSTATUS Bus_SubmitRequestReport(WDFDEVICE Device, WDFREQUEST Request, ULONG SerialNo, PVOID Report, PVIGEM_REPORT_DISPOSITION Disposition)
+{
+    NTSTATUS                    status;
+    WDFDEVICE                   hChild;
+
+    hChild = Bus_GetBoundPdo(Request, SerialNo);
+
+    if (hChild == NULL)
+    {
+        return Bus_SubmitReport(Device, SerialNo, Report, FALSE, Disposition);
+    }
+
+    status = Bus_SubmitReportToPdo(hChild, Report, NULL, Disposition);
+
+    Bus_PutPdo(hChild);
+
+    return status;
+}
+
+//
+// Caches a report on an already validated PDO and hands it to a pending IN URB.
+// 
+NTSTATUS Bus_SubmitReportToPdo(WDFDEVICE Pdo, PVOID Report, const UCHAR* MergeMask, PVIGEM_REPORT_DISPOSITION Disposition)
+{
+    return Bus_SubmitReportToPdoEx(Pdo, Report, MergeMask, NULL, Disposition);
+}
+
+//
+// Bus_SubmitReportToPdo with DS4 motion and touch data going along with the report.
+// 
+NTSTATUS Bus_SubmitReportToPdoEx(
+    WDFDEVICE Pdo,
+    PVOID Report,
+    const UCHAR* MergeMask,
+    const VIGEM_GAMEPAD_STATE* Motion,
+    PVIGEM_REPORT_DISPOSITION Disposition
+)
+{
+    NTSTATUS                    status = STATUS_SUCCESS;
+    WDFDEVICE                   hChild = Pdo;
+    PPDO_DEVICE_DATA            pdoData = PdoGetData(Pdo);
+    WDFQUEUE                    queue;
+    VIGEM_REPORT_DISPOSITION    disposition = ViGEmReportDeduped;
+    VIGEM_TARGET_REPORT         report;
+    BOOLEAN                     queued = FALSE;
+    union
+    {
+        XUSB_SUBMIT_REPORT Xusb;
+        DS4_SUBMIT_REPORT Ds4;
+        XGIP_SUBMIT_REPORT Xgip;
+    } submit;
+
+    //
+    // Run the report through the configured transform on a private copy,
+    // the submitted one may live in the caller's memory
+    // 
+    if (ReadPointerNoFence((PVOID volatile*)&pdoData->Transform) != NULL
+        && pdoData->Ops->UnwrapReport(Report, &report))
+    {
+        WdfSpinLockAcquire(pdoData->TransformLock);
+
+        if (pdoData->Transform != NULL)
+        {
+            Transform_Apply(pdoData->Transform, (PUCHAR)&report);
+        }
+
+        WdfSpinLockRelease(pdoData->TransformLock);
+
+        pdoData->Ops->WrapReport(&submit, pdoData->SerialNo, &report);
+        Report = &submit;
+    }
+
+    //
+    // With a FIFO the report queues up behind the ones not delivered yet
+    // instead of replacing the cache; deltas would merge with whichever of
+    // them happens to be cached, so they're refused and count as dropped
+    // 
+    if (ReadPointerNoFence((PVOID volatile*)&pdoData->ReportFifo) != NULL
+        && pdoData->Ops->UnwrapReport(Report, &report))
+    {
+        if (MergeMask != NULL)
+        {
+            InterlockedIncrementNoFence64(&PdoGetReportCounters(pdoData)->Submitted);
+
+            status = STATUS_INVALID_DEVICE_STATE;
+            disposition = ViGEmReportDropped;
+            goto endCountReport;
+        }
+
+        status = ReportFifo_Submit(hChild, &report, Motion);
+
+        // Unless it got disabled meanwhile
+        queued = NT_SUCCESS(status) || status == STATUS_DEVICE_BUSY;
+    }
+
+    if (queued)
+    {
+        InterlockedIncrementNoFence64(&PdoGetReportCounters(pdoData)->Submitted);
+
+        // Refused by a full FIFO
+        if (status == STATUS_DEVICE_BUSY)
+        {
+            status = STATUS_SUCCESS;
+            disposition = ViGEmReportDropped;
+            goto endCountReport;
+        }
+
+        queue = pdoData->Ops->GetInRequestQueue(hChild);
+    }
+    else
+    {
+        // Motion data lives outside of the bare report, it goes out with the next delivery
+        if (Motion != NULL && pdoData->TargetType == DualShock4Wired)
+        {
+            Ds4_CacheMotion(hChild, Motion);
+        }
+
+        // Update the report cache, don't waste pending IRP if there's nothing to deliver
+        status = pdoData->Ops->CacheReport(hChild, Report, MergeMask, &queue);
+
+        // Duplicates count too, they tell the axes came to rest
+        if (NT_SUCCESS(status) && ReadNoFence(&pdoData->InterpolationMode) != ViGEmInterpolationOff)
+        {
+            Bus_InterpolationRecord(hChild, Report);
+        }
+    }
+
+    if (!NT_SUCCESS(status) || queue == NULL)
+    {
+        goto endSubmitReport;
+    }
+
+    TraceHot(TRACE_BUSENUM,
+        "Received new report, processing");
+
+    // A previous report still waiting for its URB is lost now, unless it's queued
+    disposition = ReportMailboxSubmit(&pdoData->ReportPending, &BusMailboxOps, hChild, queue, queued);
+
+    TraceHot(TRACE_BUSENUM,
+        "Report %s",
+        disposition == ViGEmReportDelivered ? "delivered to pending IRP" : "cached for next IN request");
+
+    // The leader's own report goes out first, then the (merged) copies for its group
+    if (ReadNoFence(&pdoData->MirrorCount) != 0)
+    {
+        Bus_MirrorFanOut(hChild, Report);
+    }
+
+endCountReport:
+
+    // Deduped reports got counted on the spot
+    InterlockedIncrementNoFence64(&PdoGetReportCounters(pdoData)->Dispositions[disposition]);
+
+endSubmitReport:
+
+    if (Disposition != NULL)
+    {
+        *Disposition = disposition;
+    }
+
+    TraceHot(TRACE_BUSENUM, "%!FUNC! Exit with status %!STATUS!", status);
+
+    return status;
+}
+
+
+//
+// Submits a bare report, laid out according to the PDO's target type.
+// 
+NTSTATUS Bus_SubmitTargetReportToPdo(WDFDEVICE Pdo, PVIGEM_TARGET_REPORT Report, PVIGEM_REPORT_DISPOSITION Disposition)
+{
+    PPDO_DEVICE_DATA            pdoData = PdoGetData(Pdo);
+    union
+    {
+        XUSB_SUBMIT_REPORT Xusb;
+        DS4_SUBMIT_REPORT Ds4;
+        XGIP_SUBMIT_REPORT Xgip;
+    } submit;
+
+    pdoData->Ops->WrapReport(&submit, pdoData->SerialNo, Report);
+
+    return Bus_SubmitReportToPdo(Pdo, &submit, NULL, Disposition);
+}
+
+//
+// Submits a report accepted by a mirror group leader to all group members.
+// 
+VOID Bus_MirrorFanOut(WDFDEVICE Pdo, PVOID Report)
+{
+    PPDO_DEVICE_DATA            pdoData = PdoGetData(Pdo);
+    WDFDEVICE                   hMember;
+    PPDO_DEVICE_DATA            memberData;
+    VIGEM_TARGET_REPORT         source;
+    VIGEM_TARGET_REPORT         translated;
+    ULONG                       members[VIGEM_MIRROR_MAX_MEMBERS];
+    ULONG                       count;
+    ULONG                       i;
+    LONG                        sequence;
+
+    if (!pdoData->Ops->UnwrapReport(Report, &source))
+    {
+        return;
+    }
+
+    do
+    {
+        sequence = SeqLockReadBegin(&pdoData->MirrorMembersLock);
+
+        count = min((ULONG)pdoData->MirrorCount, VIGEM_MIRROR_MAX_MEMBERS);
+        RtlCopyMemory(members, pdoData->MirrorMembers, count * sizeof(ULONG));
+
+    } while (SeqLockReadRetry(&pdoData->MirrorMembersLock, sequence));
+
+    for (i = 0; i < count; i++)
+    {
+        hMember = Bus_GetPdo(WdfPdoGetParent(Pdo), members[i]);
+
+        if (hMember == NULL)
+        {
+            continue;
+        }
+
+        memberData = PdoGetData(hMember);
+
+        if (NT_SUCCESS(Translate_Report(pdoData->TargetType, &source, memberData->TargetType, &translated)))
+        {
+            (void)Bus_SubmitTargetReportToPdo(hMember, &translated, NULL);
+        }
+
+        Bus_PutPdo(hMember);
+    }
+}
+
+//
+// Drops a member from a leader's group.
+// 
+// Caller must hold MirrorLock.
+// 
+VOID Bus_MirrorRemoveMember(PPDO_DEVICE_DATA Leader, ULONG MemberSerialNo)
+{
+    ULONG   i;
+    KIRQL   irql;
+
+    for (i = 0; i < (ULONG)Leader->MirrorCount; i++)
+    {
+        if (Leader->MirrorMembers[i] != MemberSerialNo)
+        {
+            continue;
+        }
+
+        SeqLockWriteBegin(&Leader->MirrorMembersLock, &irql);
+
+        Leader->MirrorMembers[i] = Leader->MirrorMembers[Leader->MirrorCount - 1];
+        Leader->MirrorCount--;
+
+        SeqLockWriteEnd(&Leader->MirrorMembersLock, irql);
+
+        break;
+    }
+}
+
+//
+// Takes a PDO that's going away out of any mirror group.
+// 
+// Runs from Bus_PdoIndexRemove before the PDO leaves the index. Every PDO
+// does, so under MirrorLock a partner still in a group is still indexed
+// and both sides of each link get cleared. A released PDO can't join a
+// group again.
+// 
+VOID Bus_MirrorRelease(WDFDEVICE Device, WDFDEVICE Pdo)
+{
+    PFDO_DEVICE_DATA            pFdoData = FdoGetData(Device);
+    PPDO_DEVICE_DATA            pdoData = PdoGetData(Pdo);
+    WDFDEVICE                   hOther;
+    ULONG                       count;
+    ULONG                       i;
+    KIRQL                       irql;
+
+    PAGED_CODE();
+
+    WdfWaitLockAcquire(pFdoData->MirrorLock, NULL);
+
+    pdoData->MirrorReleased = TRUE;
+
+    if (pdoData->MirrorLeader != 0)
+    {
+        hOther = Bus_GetPdo(Device, pdoData->MirrorLeader);
+
+        if (hOther != NULL)
+        {
+            Bus_MirrorRemoveMember(PdoGetData(hOther), pdoData->SerialNo);
+            Bus_PutPdo(hOther);
+        }
+
+        pdoData->MirrorLeader = 0;
+    }
+
+    count = (ULONG)pdoData->MirrorCount;
+
+    if (count != 0)
+    {
+        // No new fan-out picks up a member from here on
+        SeqLockWriteBegin(&pdoData->MirrorMembersLock, &irql);
+        pdoData->MirrorCount = 0;
+        SeqLockWriteEnd(&pdoData->MirrorMembersLock, irql);
+
+        for (i = 0; i < count; i++)
+        {
+            hOther = Bus_GetPdo(Device, pdoData->MirrorMembers[i]);
+
+            if (hOther != NULL)
+            {
+                PdoGetData(hOther)->MirrorLeader = 0;
+                Bus_PutPdo(hOther);
+            }
+        }
+    }
+
+    WdfWaitLockRelease(pFdoData->MirrorLock);
+}
+
+//
+// Attaches a PDO to or detaches it from a mirror group.
+// 
+NTSTATUS Bus_Mirror(WDFDEVICE Device, WDFREQUEST Request, size_t* Transferred)
+{
+    NTSTATUS                    status;
+    PFDO_DEVICE_DATA            pFdoData = FdoGetData(Device);
+    PVIGEM_MIRROR               mirror;
+    WDFDEVICE                   hLeader;
+    WDFDEVICE                   hMember;
+    PPDO_DEVICE_DATA            leaderData;
+    PPDO_DEVICE_DATA            memberData;
+    size_t                      length = 0;
+    KIRQL                       irql;
+
+    PAGED_CODE();
+
+    *Transferred = 0;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIGEM_MIRROR), (PVOID)&mirror, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    if (mirror->Size != sizeof(VIGEM_MIRROR)
+        || (ULONG)mirror->Operation > ViGEmMirrorDetach
+        || mirror->LeaderSerialNo == mirror->MemberSerialNo)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    hLeader = Bus_GetPdo(Device, mirror->LeaderSerialNo);
+    hMember = Bus_GetPdo(Device, mirror->MemberSerialNo);
+
+    if (hLeader == NULL || hMember == NULL)
+    {
+        status = STATUS_NO_SUCH_DEVICE;
+        goto mirrorEnd;
+    }
+
+    leaderData = PdoGetData(hLeader);
+    memberData = PdoGetData(hMember);
+
+    if (!IS_OWNER(leaderData) || !IS_OWNER(memberData))
+    {
+        status = STATUS_ACCESS_DENIED;
+        goto mirrorEnd;
+    }
+
+    WdfWaitLockAcquire(pFdoData->MirrorLock, NULL);
+
+    switch (mirror->Operation)
+    {
+    case ViGEmMirrorAttach:
+
+        // Unplugged already, its partners couldn't find it to unlink
+        if (leaderData->MirrorReleased || memberData->MirrorReleased)
+        {
+            status = STATUS_NO_SUCH_DEVICE;
+            break;
+        }
+
+        if (memberData->MirrorLeader == leaderData->SerialNo)
+        {
+            status = STATUS_SUCCESS;
+            break;
+        }
+
+        // No chains, every PDO is either a leader, a member or neither
+        if (memberData->MirrorLeader != 0
+            || memberData->MirrorCount != 0
+            || leaderData->MirrorLeader != 0)
+        {
+            status = STATUS_INVALID_DEVICE_STATE;
+            break;
+        }
+
+        if (!Translate_IsSupported(leaderData->TargetType, memberData->TargetType))
+        {
+            status = STATUS_NOT_SUPPORTED;
+            break;
+        }
+
+        if (leaderData->MirrorCount >= VIGEM_MIRROR_MAX_MEMBERS)
+        {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        SeqLockWriteBegin(&leaderData->MirrorMembersLock, &irql);
+
+        leaderData->MirrorMembers[leaderData->MirrorCount] = memberData->SerialNo;
+        leaderData->MirrorCount++;
+
+        SeqLockWriteEnd(&leaderData->MirrorMembersLock, irql);
+
+        memberData->MirrorLeader = leaderData->SerialNo;
+
+        TraceEvents(TRACE_LEVEL_INFORMATION,
+            TRACE_BUSENUM,
+            "PDO with serial %d now mirrors serial %d",
+            memberData->SerialNo, leaderData->SerialNo);
+
+        status = STATUS_SUCCESS;
+        break;
+
+    case ViGEmMirrorDetach:
+
+        if (memberData->MirrorLeader != leaderData->SerialNo)
+        {
+            status = STATUS_NOT_FOUND;
+            break;
+        }
+
+        Bus_MirrorRemoveMember(leaderData, memberData->SerialNo);
+
+        memberData->MirrorLeader = 0;
+
+        status = STATUS_SUCCESS;
+        break;
+    }
+
+    WdfWaitLockRelease(pFdoData->MirrorLock);
+
+mirrorEnd:
+
+    if (hLeader != NULL)
+    {
+        Bus_PutPdo(hLeader);
+    }
+
+    if (hMember != NULL)
+    {
+        Bus_PutPdo(hMember);
+    }
+
+    return status;
+}
+
+//
+// Updates the fields of a PDO's report selected by a delta submission.
+// 
+// The delta gets unpacked into a full report plus a byte mask of the fields
+// it carries; the rest is filled in from the cache while it's locked for
+// writing, so producers updating disjoint fields don't overwrite each other.
+// 
+NTSTATUS Bus_SubmitDelta(WDFDEVICE Device, WDFREQUEST Request, size_t* Transferred)
+{
+    NTSTATUS                    status;
+    PVIGEM_SUBMIT_DELTA         delta;
+    WDFDEVICE                   hChild;
+    PPDO_DEVICE_DATA            pdoData;
+    const VIGEM_TARGET_OPS*     ops;
+    VIGEM_TARGET_REPORT         report;
+    UCHAR                       mergeMask[sizeof(VIGEM_TARGET_REPORT)];
+    VIGEM_REPORT_DISPOSITION    disposition;
+    size_t                      length = 0;
+    ULONG                       valuesLength;
+    ULONG                       consumed = 0;
+    ULONG                       field;
+    union
+    {
+        XUSB_SUBMIT_REPORT Xusb;
+        DS4_SUBMIT_REPORT Ds4;
+        XGIP_SUBMIT_REPORT Xgip;
+    } submit;
+
+    *Transferred = 0;
+
+    status = WdfRequestRetrieveInputBuffer(Request, FIELD_OFFSET(VIGEM_SUBMIT_DELTA, Values), (PVOID)&delta, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    if (delta->Size != sizeof(VIGEM_SUBMIT_DELTA) || length > VIGEM_SUBMIT_DELTA_SIZE(sizeof(VIGEM_TARGET_REPORT)))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    valuesLength = (ULONG)(length - FIELD_OFFSET(VIGEM_SUBMIT_DELTA, Values));
+
+    status = Bus_GetRequestPdo(Device, Request, delta->SerialNo, &hChild);
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    pdoData = PdoGetData(hChild);
+
+    ops = pdoData->Ops;
+
+    if (delta->FieldMask == 0 || (delta->FieldMask >> ops->FieldCount) != 0)
+    {
+        status = STATUS_INVALID_PARAMETER;
+        goto deltaEnd;
+    }
+
+    RtlZeroMemory(&report, sizeof(report));
+    RtlZeroMemory(mergeMask, sizeof(mergeMask));
+
+    for (field = 0; field < ops->FieldCount; field++)
+    {
+        if (!(delta->FieldMask & VIGEM_FIELD_BIT(field)))
+        {
+            continue;
+        }
+
+        if (consumed + ops->Fields[field].Length > valuesLength)
+        {
+            status = STATUS_INVALID_PARAMETER;
+            goto deltaEnd;
+        }
+
+        RtlCopyMemory((PUCHAR)&report + ops->Fields[field].Offset, delta->Values + consumed, ops->Fields[field].Length);
+        RtlFillMemory(mergeMask + ops->Fields[field].Offset, ops->Fields[field].Length, 0xFF);
+
+        consumed += ops->Fields[field].Length;
+    }
+
+    if (consumed != valuesLength)
+    {
+        status = STATUS_INVALID_PARAMETER;
+        goto deltaEnd;
+    }
+
+    ops->WrapReport(&submit, pdoData->SerialNo, &report);
+
+    status = Bus_SubmitReportToPdo(hChild, &submit, mergeMask, &disposition);
+
+    if (NT_SUCCESS(status))
+    {
+        Bus_ReturnDisposition(Request, disposition, Transferred);
+    }
+
+deltaEnd:
+
+    Bus_PutPdo(hChild);
+
+    return status;
+}
+
+//
+// Encodes a canonical gamepad state into the native report of a PDO and submits it.
+// 
+NTSTATUS Bus_SubmitGamepadState(WDFDEVICE Device, WDFREQUEST Request, size_t* Transferred)
+{
+    NTSTATUS                        status;
+    PVIGEM_SUBMIT_GAMEPAD_STATE     submit;
+    WDFDEVICE                       hChild;
+    PPDO_DEVICE_DATA                pdoData;
+    VIGEM_TARGET_REPORT             report;
+    VIGEM_REPORT_DISPOSITION        disposition;
+    BOOLEAN                         motion;
+    size_t                          length = 0;
+    union
+    {
+        XUSB_SUBMIT_REPORT Xusb;
+        DS4_SUBMIT_REPORT Ds4;
+        XGIP_SUBMIT_REPORT Xgip;
+    } wrapped;
+
+    *Transferred = 0;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIGEM_SUBMIT_GAMEPAD_STATE), (PVOID)&submit, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    if (submit->Size != sizeof(VIGEM_SUBMIT_GAMEPAD_STATE) || length != sizeof(VIGEM_SUBMIT_GAMEPAD_STATE))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    status = Bus_GetRequestPdo(Device, Request, submit->SerialNo, &hChild);
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    pdoData = PdoGetData(hChild);
+
+    status = Translate_EncodeGamepad(&submit->State, pdoData->TargetType, &report);
+
+    if (!NT_SUCCESS(status))
+    {
+        goto submitEnd;
+    }
+
+    pdoData->Ops->WrapReport(&wrapped, pdoData->SerialNo, &report);
+
+    //
+    // Motion and touch live outside of DS4_REPORT and only mean something to DS4
+    // 
+    motion = pdoData->TargetType == DualShock4Wired
+        && (submit->State.Flags & (VIGEM_GAMEPAD_FLAG_MOTION | VIGEM_GAMEPAD_FLAG_TOUCH));
+
+    status = Bus_SubmitReportToPdoEx(hChild, &wrapped, NULL, motion ? &submit->State : NULL, &disposition);
+
+    if (NT_SUCCESS(status))
+    {
+        Bus_ReturnDisposition(Request, disposition, Transferred);
+    }
+
+submitEnd:
+
+    Bus_PutPdo(hChild);
+
+    return status;
+}
+
+//
+// Counts a submitted report and tells whether it should be dropped as duplicate
+// of the cached one, according to the PDO's policy.
+// 
+BOOLEAN Bus_DropDuplicateReport(PPDO_DEVICE_DATA PdoData, const VOID* Cached, const VOID* Submitted, const UCHAR* IgnoreMask, ULONG Length)
+{
+    PPDO_REPORT_COUNTERS counters = PdoGetReportCounters(PdoData);
+
+    //
+    // Reports leaving a FIFO got counted when submitted, and each of them
+    // is a sample of its own
+    // 
+    if (ReadPointerNoFence((PVOID volatile*)&PdoData->ReportFifo) != NULL)
+    {
+        return FALSE;
+    }
+
+    InterlockedIncrementNoFence64(&counters->Submitted);
+
+    if (!ReportEqualMasked(Cached, Submitted, IgnoreMask, Length))
+    {
+        return FALSE;
+    }
+
+    InterlockedIncrementNoFence64(&counters->Duplicates);
+
+    if (PdoData->DedupePolicy == ViGEmDedupeRefresh)
+    {
+        return FALSE;
+    }
+
+    InterlockedIncrementNoFence64(&counters->Dispositions[ViGEmReportDeduped]);
+
+    return TRUE;
+}
+
+//
+// Sums up the per-processor report counters of a PDO.
+// 
+VOID Bus_SumReportCounters(PPDO_DEVICE_DATA PdoData, PULONG64 Submitted, PULONG64 Duplicates, PULONG64 Dispositions)
+{
+    ULONG cpu;
+    ULONG index;
+
+    *Submitted = 0;
+    *Duplicates = 0;
+    RtlZeroMemory(Dispositions, VIGEM_REPORT_DISPOSITIONS * sizeof(ULONG64));
+
+    for (cpu = 0; cpu < PdoData->ReportCountersCount; cpu++)
+    {
+        *Submitted += (ULONG64)ReadNoFence64(&PdoData->ReportCounters[cpu].Submitted);
+        *Duplicates += (ULONG64)ReadNoFence64(&PdoData->ReportCounters[cpu].Duplicates);
+
+        for (index = 0; index < VIGEM_REPORT_DISPOSITIONS; index++)
+        {
+            Dispositions[index] += (ULONG64)ReadNoFence64(&PdoData->ReportCounters[cpu].Dispositions[index]);
+        }
+    }
+}
+
+//
+// Hands the disposition of a submitted report back to callers that asked for it
+// by supplying an output buffer; legacy callers don't and are left alone.
+// 
+VOID Bus_ReturnDisposition(WDFREQUEST Request, VIGEM_REPORT_DISPOSITION Disposition, size_t* Transferred)
+{
+    PVIGEM_REPORT_DISPOSITION buffer;
+
+    if (NT_SUCCESS(WdfRequestRetrieveOutputBuffer(Request, sizeof(VIGEM_REPORT_DISPOSITION), (PVOID)&buffer, NULL)))
+    {
+        *buffer = Disposition;
+        *Transferred = sizeof(VIGEM_REPORT_DISPOSITION);
+    }
+}
+
+//
+// Returns the delivery counters of a PDO.
+// 
+NTSTATUS Bus_GetReportStats(WDFDEVICE Device, WDFREQUEST Request, size_t* Transferred)
+{
+    NTSTATUS                status;
+    PVIGEM_REPORT_STATS     stats;
+    WDFDEVICE               hChild;
+    ULONG64                 duplicates;
+    size_t                  length = 0;
+
+    *Transferred = 0;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIGEM_REPORT_STATS), (PVOID)&stats, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    if (stats->Size != sizeof(VIGEM_REPORT_STATS))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    hChild = Bus_GetPdo(Device, stats->SerialNo);
+
+    if (hChild == NULL)
+    {
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIGEM_REPORT_STATS), (PVOID)&stats, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+            status);
+        goto statsEnd;
+    }
+
+    Bus_SumReportCounters(PdoGetData(hChild), &stats->Submitted, &duplicates, stats->Dispositions);
+
+    *Transferred = sizeof(VIGEM_REPORT_STATS);
+
+    status = STATUS_SUCCESS;
+
+statsEnd:
+
+    Bus_PutPdo(hChild);
+
+    return status;
+}
+
+//
+// Sets the duplicate report policy of a PDO and returns its dedupe counters.
+// 
+NTSTATUS Bus_ReportDedupe(WDFDEVICE Device, WDFREQUEST Request, size_t* Transferred)
+{
+    NTSTATUS                status;
+    PVIGEM_REPORT_DEDUPE    dedupe;
+    WDFDEVICE               hChild;
+    PPDO_DEVICE_DATA        pdoData;
+    ULONG64                 dispositions[VIGEM_REPORT_DISPOSITIONS];
+    size_t                  length = 0;
+
+    *Transferred = 0;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIGEM_REPORT_DEDUPE), (PVOID)&dedupe, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    if (dedupe->Size != sizeof(VIGEM_REPORT_DEDUPE) || (ULONG)dedupe->Policy > ViGEmDedupeRefresh)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    hChild = Bus_GetPdo(Device, dedupe->SerialNo);
+
+    if (hChild == NULL)
+    {
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    pdoData = PdoGetData(hChild);
+
+    if (!IS_OWNER(pdoData))
+    {
+        status = STATUS_ACCESS_DENIED;
+        goto dedupeEnd;
+    }
+
+    if (dedupe->Policy != ViGEmDedupeQuery)
+    {
+        pdoData->DedupePolicy = dedupe->Policy;
+    }
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIGEM_REPORT_DEDUPE), (PVOID)&dedupe, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+            status);
+        goto dedupeEnd;
+    }
 
-    TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_BUSENUM, "%!FUNC! Entry");
-
-    hChild = Bus_GetPdo(Device, SerialNo);
+    dedupe->Policy = pdoData->DedupePolicy;
+    Bus_SumReportCounters(pdoData, &dedupe->Submitted, &dedupe->Duplicates, dispositions);
+
+    *Transferred = sizeof(VIGEM_REPORT_DEDUPE);
+
+    status = STATUS_SUCCESS;
+
+dedupeEnd:
+
+    Bus_PutPdo(hChild);
+
+    return status;
+}
+
+//
+// Claims the state table row of a freshly created PDO.
+// 
+VOID Bus_StateTableAdd(WDFDEVICE Device, WDFDEVICE Pdo)
+{
+    PSTATE_TABLE        table = FdoGetData(Device)->StateTable;
+    PPDO_DEVICE_DATA    pdoData = PdoGetData(Pdo);
+    ULONG               serial = pdoData->SerialNo;
+    KIRQL               irql;
+
+    //
+    // Serials outside the allocator range have no row
+    // 
+    if (table == NULL || serial == 0 || serial >= STATE_TABLE_ROWS)
+    {
+        return;
+    }
+
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+    StateTableClaim(table, serial, (UCHAR)pdoData->TargetType, pdoData->SessionId);
+    KeLowerIrql(irql);
+
+    pdoData->StateTable = table;
+}
+
+//
+// Releases the state table row of a PDO.
+// 
+VOID Bus_StateTableRemove(WDFDEVICE Pdo)
+{
+    PPDO_DEVICE_DATA    pdoData = PdoGetData(Pdo);
+    PSTATE_TABLE        table = pdoData->StateTable;
+    KIRQL               irql;
+
+    if (table == NULL)
+    {
+        return;
+    }
+
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+    StateTableRelease(table, pdoData->SerialNo);
+    KeLowerIrql(irql);
+
+    pdoData->StateTable = NULL;
+}
+
+//
+// Mirrors a freshly cached report into the bus state table.
+// 
+VOID Bus_StateTableStore(PPDO_DEVICE_DATA PdoData, const VOID* Report)
+{
+    PSTATE_TABLE        table = PdoData->StateTable;
+    KIRQL               irql;
+
+    if (table == NULL)
+    {
+        return;
+    }
+
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+    StateTableStore(table, PdoData->SerialNo, Report, PdoData->Ops->ReportSize, KeQueryInterruptTime());
+    KeLowerIrql(irql);
+}
+
+//
+// Copies the current state of every PDO, each entry consistent on its own.
+// 
+// Total is always reported so callers can grow their buffer and retry.
+// 
+NTSTATUS Bus_GetStateSnapshot(WDFDEVICE Device, WDFREQUEST Request, size_t* Transferred)
+{
+    NTSTATUS                status;
+    PSTATE_TABLE            table = FdoGetData(Device)->StateTable;
+    PVIGEM_STATE_SNAPSHOT   snapshot;
+    size_t                  length = 0;
+    ULONG                   capacity;
+    KIRQL                   irql;
+
+    *Transferred = 0;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(ULONG), (PVOID)&snapshot, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    if (snapshot->Size != sizeof(VIGEM_STATE_SNAPSHOT))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    status = WdfRequestRetrieveOutputBuffer(Request,
+        FIELD_OFFSET(VIGEM_STATE_SNAPSHOT, Entries),
+        (PVOID)&snapshot,
+        &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    if (table == NULL)
+    {
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    capacity = (ULONG)((length - FIELD_OFFSET(VIGEM_STATE_SNAPSHOT, Entries)) / sizeof(VIGEM_STATE_SNAPSHOT_ENTRY));
+
+    //
+    // A row copy may hold off the PDO's writers, it must not get preempted
+    // 
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+
+    snapshot->Count = StateTableSnapshot(table, snapshot->Entries, capacity, &snapshot->Total);
+
+    KeLowerIrql(irql);
+
+    snapshot->Size = sizeof(VIGEM_STATE_SNAPSHOT);
+
+    *Transferred = VIGEM_STATE_SNAPSHOT_SIZE(snapshot->Count);
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Submits reports to multiple PDOs in one pass.
+// 
+// Every entry gets the same treatment as a single submission; the outcome is
+// reported per entry and the request itself only fails on malformed input.
+// 
+NTSTATUS Bus_SubmitReportBatch(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred)
+{
+    NTSTATUS                    status;
+    PVIGEM_SUBMIT_BATCH         batch;
+    PVIGEM_SUBMIT_BATCH_ENTRY   entry;
+    size_t                      length = 0;
+    size_t                      outLength = 0;
+    PVOID                       outBuffer;
+    WDFDEVICE                   hChild;
+    ULONG                       i;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_BUSENUM, "%!FUNC! Entry");
+
+    *Transferred = 0;
+
+    status = WdfRequestRetrieveInputBuffer(Request, VIGEM_SUBMIT_BATCH_SIZE(0), (PVOID)&batch, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    if (batch->Size != sizeof(VIGEM_SUBMIT_BATCH)
+        || batch->Count > VIGEM_SUBMIT_BATCH_MAX_ENTRIES
+        || length < VIGEM_SUBMIT_BATCH_SIZE(batch->Count))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "Malformed batch (size = %d, count = %d, length = %d)",
+            batch->Size, batch->Count, (int)length);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // Per-entry results are returned in place
+    status = WdfRequestRetrieveOutputBuffer(Request, VIGEM_SUBMIT_BATCH_SIZE(batch->Count), &outBuffer, &outLength);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    for (i = 0; i < batch->Count; i++)
+    {
+        entry = &batch->Entries[i];
+
+        // Same lookup and ownership check as a single submission
+        entry->Status = Bus_GetRequestPdo(Device, Request, entry->SerialNo, &hChild);
+
+        if (!NT_SUCCESS(entry->Status))
+        {
+            continue;
+        }
+
+        if (PdoGetData(hChild)->TargetType != entry->TargetType)
+        {
+            entry->Status = STATUS_INVALID_PARAMETER;
+        }
+        else
+        {
+            entry->Status = Bus_SubmitTargetReportToPdo(hChild, &entry->Report, &entry->Disposition);
+        }
+
+        Bus_PutPdo(hChild);
+    }
+
+    *Transferred = VIGEM_SUBMIT_BATCH_SIZE(batch->Count);
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_BUSENUM, "%!FUNC! Exit (%d entries)", batch->Count);
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Copies the cached input report of a PDO into an IN URB transfer buffer.
+// 
+VOID Bus_CopyReportCacheToUrb(WDFDEVICE Pdo, PURB Urb)
+{
+    PPDO_DEVICE_DATA    pdoData = PdoGetData(Pdo);
+    LONG                version;
+    LONG                mode;
+    BOOLEAN             fifo = ReadPointerNoFence((PVOID volatile*)&pdoData->ReportFifo) != NULL;
+
+    // Next queued report into the cache; held until it's copied
+    if (fifo)
+    {
+        WdfSpinLockAcquire(pdoData->ReportFifoPopLock);
+
+        ReportFifo_Pull(Pdo);
+    }
+
+    //
+    // Whatever gets copied is at least as new as this
+    // 
+    version = SeqLockReadBegin(&pdoData->ReportLock);
+
+    pdoData->Ops->CopyReportToUrb(Pdo, Urb);
+
+    mode = ReadNoFence(&pdoData->InterpolationMode);
+
+    if (mode != ViGEmInterpolationOff)
+    {
+        Bus_InterpolateUrb(Pdo, Urb, (VIGEM_INTERPOLATION_MODE)mode);
+    }
+
+    if (fifo)
+    {
+        WdfSpinLockRelease(pdoData->ReportFifoPopLock);
+    }
+
+    Bus_ReportDelivered(Pdo, version);
+}
+
+static LONG64 Bus_QueryDeliveryTime(VOID)
+{
+    return KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
+//
+// Records that the report cache at the given version went out to the host
+// and releases the submitters waiting for it, if there are any.
+// 
+VOID Bus_ReportDelivered(WDFDEVICE Pdo, LONG Version)
+{
+    PPDO_DEVICE_DATA    pdoData = PdoGetData(Pdo);
+
+    if (DeliveryTrackerDeliver(&pdoData->Delivery, Version, Bus_QueryDeliveryTime))
+    {
+        Bus_CompleteDeliveryWaiters(Pdo, 0, NULL);
+    }
+}
+
+//
+// Completes delivery waiters whose report went out, and those whose deadline
+// is at or before Now (pass 0 to skip expiry).
+// 
+// Optionally returns the earliest deadline among the remaining waiters.
+// 
+VOID Bus_CompleteDeliveryWaiters(WDFDEVICE Pdo, LONG64 Now, PLONG64 NextDeadline)
+{
+    NTSTATUS                status;
+    NTSTATUS                completion;
+    PPDO_DEVICE_DATA        pdoData = PdoGetData(Pdo);
+    WDFQUEUE                queue = pdoData->PendingDeliveryWaiters;
+    WDFREQUEST              previous = NULL;
+    WDFREQUEST              found;
+    WDFREQUEST              request;
+    PDELIVERY_WAIT_DATA     waitData;
+    PVIGEM_SUBMIT_AND_WAIT  wait;
+    LONG                    delivered = ReadAcquire(&pdoData->Delivery.DeliveredVersion);
+    LONG64                  earliest = MAXLONG64;
+
+    for (;;)
+    {
+        status = WdfIoQueueFindRequest(queue, previous, NULL, NULL, &found);
+
+        if (previous != NULL)
+        {
+            WdfObjectDereference(previous);
+            previous = NULL;
+        }
+
+        //
+        // The request we stood on got cancelled meanwhile, start over
+        // 
+        if (status == STATUS_NOT_FOUND)
+        {
+            earliest = MAXLONG64;
+            continue;
+        }
+
+        if (!NT_SUCCESS(status))
+        {
+            break;
+        }
+
+        waitData = DeliveryWaitGetData(found);
+
+        if ((LONG)(delivered - waitData->Version) >= 0)
+        {
+            completion = STATUS_SUCCESS;
+        }
+        else if (waitData->Deadline <= Now)
+        {
+            completion = STATUS_IO_TIMEOUT;
+        }
+        else
+        {
+            earliest = min(earliest, waitData->Deadline);
+            previous = found;
+            continue;
+        }
+
+        status = WdfIoQueueRetrieveFoundRequest(queue, found, &request);
+
+        WdfObjectDereference(found);
+
+        //
+        // The queue changed, start over
+        // 
+        earliest = MAXLONG64;
+
+        if (!NT_SUCCESS(status))
+        {
+            continue;
+        }
+
+        DeliveryTrackerWaitEnd(&pdoData->Delivery);
+
+        if (completion == STATUS_SUCCESS
+            && NT_SUCCESS(WdfRequestRetrieveOutputBuffer(request, sizeof(VIGEM_SUBMIT_AND_WAIT), (PVOID)&wait, NULL)))
+        {
+            wait->DeliveredAt = ReadNoFence64(&pdoData->Delivery.LastDeliveryTime);
+
+            WdfRequestCompleteWithInformation(request, completion, sizeof(VIGEM_SUBMIT_AND_WAIT));
+        }
+        else
+        {
+            WdfRequestComplete(request, completion);
+        }
+    }
+
+    if (NextDeadline != NULL)
+    {
+        *NextDeadline = earliest;
+    }
+}
+
+//
+// Completes a delivery waiter cancelled while parked.
+// 
+VOID Bus_EvtDeliveryWaiterCanceled(
+    _In_ WDFQUEUE Queue,
+    _In_ WDFREQUEST Request
+)
+{
+    DeliveryTrackerWaitEnd(&PdoGetData(WdfIoQueueGetDevice(Queue))->Delivery);
+
+    WdfRequestComplete(Request, STATUS_CANCELLED);
+}
+
+//
+// Makes sure the delivery wait timer fires no later than Deadline.
+// 
+VOID Bus_ArmDeliveryWaitTimer(WDFDEVICE Pdo, LONG64 Deadline)
+{
+    PPDO_DEVICE_DATA    pdoData = PdoGetData(Pdo);
+    LARGE_INTEGER       frequency;
+    LONG64              remaining;
+    LONG64              dueMs;
+
+    WdfSpinLockAcquire(pdoData->DeliveryWaitLock);
+
+    if (Deadline < pdoData->DeliveryWaitDeadline)
+    {
+        pdoData->DeliveryWaitDeadline = Deadline;
+
+        remaining = Deadline - KeQueryPerformanceCounter(&frequency).QuadPart;
+
+        //
+        // Round up, firing early would only re-arm for the rest
+        // 
+        dueMs = (remaining > 0)
+            ? (remaining / frequency.QuadPart) * 1000 + ((remaining % frequency.QuadPart) * 1000) / frequency.QuadPart + 1
+            : 1;
+
+        WdfTimerStart(pdoData->DeliveryWaitTimer, WDF_REL_TIMEOUT_IN_MS(dueMs));
+    }
+
+    WdfSpinLockRelease(pdoData->DeliveryWaitLock);
+}
+
+//
+// Times out delivery waiters whose deadline passed.
+// 
+VOID Bus_DeliveryWaitTimerFunc(
+    _In_ WDFTIMER Timer
+)
+{
+    WDFDEVICE           hChild = WdfTimerGetParentObject(Timer);
+    PPDO_DEVICE_DATA    pdoData = PdoGetData(hChild);
+    LONG64              next;
+
+    WdfSpinLockAcquire(pdoData->DeliveryWaitLock);
+    pdoData->DeliveryWaitDeadline = MAXLONG64;
+    WdfSpinLockRelease(pdoData->DeliveryWaitLock);
+
+    Bus_CompleteDeliveryWaiters(hChild, KeQueryPerformanceCounter(NULL).QuadPart, &next);
+
+    if (next != MAXLONG64)
+    {
+        Bus_ArmDeliveryWaitTimer(hChild, next);
+    }
+}
+
+//
+// Submits a report and keeps the request pending until an IN URB picked it up
+// or its deadline passed.
+// 
+NTSTATUS Bus_SubmitAndWait(WDFDEVICE Device, WDFREQUEST Request, size_t* Transferred)
+{
+    NTSTATUS                status;
+    PVIGEM_SUBMIT_AND_WAIT  wait;
+    WDFDEVICE               hChild;
+    PPDO_DEVICE_DATA        pdoData;
+    WDF_OBJECT_ATTRIBUTES   requestAttribs;
+    PDELIVERY_WAIT_DATA     waitData;
+    LARGE_INTEGER           frequency;
+    LARGE_INTEGER           now;
+    LONG                    version;
+    LONG64                  deadline = MAXLONG64;
+    size_t                  length = 0;
+    BOOLEAN                 counted = FALSE;
+
+    *Transferred = 0;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIGEM_SUBMIT_AND_WAIT), (PVOID)&wait, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    if (wait->Size != sizeof(VIGEM_SUBMIT_AND_WAIT))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
 
-    // Validate child
-    if (hChild == NULL)
+    //
+    // The delivery timestamp goes back in the same buffer
+    // 
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIGEM_SUBMIT_AND_WAIT), (PVOID)&wait, &length);
+    if (!NT_SUCCESS(status))
     {
         TraceEvents(TRACE_LEVEL_ERROR,
             TRACE_BUSENUM,
-            "Bus_GetPdo: PDO with serial %d not found",
-            SerialNo);
-        return STATUS_NO_SUCH_DEVICE;
+            "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    status = Bus_GetRequestPdo(Device, Request, wait->SerialNo, &hChild);
+    if (!NT_SUCCESS(status))
+    {
+        return status;
     }
 
-    // Check common context
     pdoData = PdoGetData(hChild);
-    if (pdoData == NULL)
+
+    //
+    // A FIFO queues the report behind ones not delivered yet, the cache
+    // sequence says nothing about when it reaches an IN URB
+    // 
+    if (ReadPointerNoFence((PVOID volatile*)&pdoData->ReportFifo) != NULL)
     {
-        TraceEvents(TRACE_LEVEL_ERROR,
-            TRACE_BUSENUM,
-            "PdoGetData failed");
-        return STATUS_INVALID_PARAMETER;
+        status = STATUS_NOT_SUPPORTED;
+        goto waitEnd;
     }
 
-    // Check if caller owns this PDO
-    if (!FromInterface && !IS_OWNER(pdoData))
+    //
+    // Counted in before the report goes out, so its delivery stops to
+    // release us
+    // 
+    DeliveryTrackerWaitBegin(&pdoData->Delivery);
+    counted = TRUE;
+
+    status = Bus_SubmitTargetReportToPdo(hChild, &wait->Report, &wait->Disposition);
+    if (!NT_SUCCESS(status))
     {
-        TraceEvents(TRACE_LEVEL_ERROR,
-            TRACE_BUSENUM,
-            "PDO & Request ownership mismatch: %d != %d",
-            pdoData->OwnerProcessId,
-            CURRENT_PROCESS_ID());
-        return STATUS_ACCESS_DENIED;
+        goto waitEnd;
     }
 
-    // Check if input is different from previous value
-    switch (pdoData->TargetType)
+    //
+    // The FIFO got attached while submitting and may hold the report
+    // 
+    if (ReadPointerNoFence((PVOID volatile*)&pdoData->ReportFifo) != NULL)
     {
-    case Xbox360Wired:
+        status = STATUS_NOT_SUPPORTED;
+        goto waitEnd;
+    }
 
-        changed = (RtlCompareMemory(&XusbGetData(hChild)->Packet.Report,
-            &((PXUSB_SUBMIT_REPORT)Report)->Report,
-            sizeof(XUSB_REPORT)) != sizeof(XUSB_REPORT));
+    //
+    // Last completed cache update, ours or a newer one; a dropped
+    // duplicate waits for the cache it matched
+    // 
+    version = ReadAcquire(&pdoData->ReportLock.Sequence) & ~1;
 
-        break;
-    case DualShock4Wired:
+    if (DeliveryTrackerIsDelivered(&pdoData->Delivery, version))
+    {
+        wait->DeliveredAt = ReadNoFence64(&pdoData->Delivery.LastDeliveryTime);
 
-        changed = TRUE;
+        *Transferred = sizeof(VIGEM_SUBMIT_AND_WAIT);
 
-        break;
-    case XboxOneWired:
+        status = STATUS_SUCCESS;
+        goto waitEnd;
+    }
 
-        // TODO: necessary?
-        changed = TRUE;
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&requestAttribs, DELIVERY_WAIT_DATA);
 
-        break;
-    default:
+    status = WdfObjectAllocateContext(Request, &requestAttribs, (PVOID)&waitData);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfObjectAllocateContext failed with status %!STATUS!",
+            status);
+        goto waitEnd;
+    }
 
-        changed = FALSE;
+    if (wait->TimeoutMs != 0)
+    {
+        now = KeQueryPerformanceCounter(&frequency);
 
-        break;
+        deadline = now.QuadPart
+            + (LONG64)(wait->TimeoutMs / 1000) * frequency.QuadPart
+            + (LONG64)(wait->TimeoutMs % 1000) * frequency.QuadPart / 1000;
     }
 
-    // Don't waste pending IRP if input hasn't changed
-    if (!changed)
+    waitData->Version = version;
+    waitData->Deadline = deadline;
+
+    status = WdfRequestForwardToIoQueue(Request, pdoData->PendingDeliveryWaiters);
+    if (!NT_SUCCESS(status))
     {
-        TraceEvents(TRACE_LEVEL_VERBOSE,
+        TraceEvents(TRACE_LEVEL_ERROR,
             TRACE_BUSENUM,
-            "Input report hasn't changed since last update, aborting with %!STATUS!",
+            "WdfRequestForwardToIoQueue failed with status %!STATUS!",
             status);
-        return status;
+        goto waitEnd;
     }
 
-    TraceEvents(TRACE_LEVEL_VERBOSE,
-        TRACE_BUSENUM,
-        "Received new report, processing");
+    //
+    // The request may already be gone from here on, only use copies
+    // 
+    if (deadline != MAXLONG64)
+    {
+        Bus_ArmDeliveryWaitTimer(hChild, deadline);
+    }
+
+    //
+    // An IN URB may have picked the report up before the request got parked
+    // 
+    Bus_CompleteDeliveryWaiters(hChild, 0, NULL);
+
+    status = STATUS_PENDING;
+
+waitEnd:
 
-    // Get pending USB request
-    switch (pdoData->TargetType)
+    // Parked waiters count themselves out once they leave the queue
+    if (counted && status != STATUS_PENDING)
     {
-    case Xbox360Wired:
+        DeliveryTrackerWaitEnd(&pdoData->Delivery);
+    }
 
-        status = WdfIoQueueRetrieveNextRequest(pdoData->PendingUsbInRequests, &usbRequest);
+    Bus_PutPdo(hChild);
 
-        break;
-    case DualShock4Wired:
+    return status;
+}
 
-        status = WdfIoQueueRetrieveNextRequest(pdoData->PendingUsbInRequests, &usbRequest);
+#pragma region Analog interpolation
 
-        break;
-    case XboxOneWired:
+//
+// Widens the analog axes of a report to SHORT.
+// 
+static VOID Bus_ReportAxesLoad(const VIGEM_TARGET_OPS* Ops, const UCHAR* Report, SHORT* Axes)
+{
+    ULONG   i;
+    SHORT   value;
 
-        // Request is control data
-        if (((PXGIP_SUBMIT_INTERRUPT)Report)->Size == sizeof(XGIP_SUBMIT_INTERRUPT))
+    for (i = 0; i < Ops->AxisCount; i++)
+    {
+        if (Ops->Axes[i].Type == ViGEmAxisUnsigned8)
         {
-            PXGIP_DEVICE_DATA xgip = XgipGetData(hChild);
-            PXGIP_SUBMIT_INTERRUPT interrupt = (PXGIP_SUBMIT_INTERRUPT)Report;
-            WDFMEMORY memory;
-            WDF_OBJECT_ATTRIBUTES memAttribs;
-            WDF_OBJECT_ATTRIBUTES_INIT(&memAttribs);
+            Axes[i] = Report[Ops->Axes[i].Offset];
+        }
+        else
+        {
+            RtlCopyMemory(&value, Report + Ops->Axes[i].Offset, sizeof(SHORT));
+            Axes[i] = value;
+        }
+    }
+}
 
-            memAttribs.ParentObject = hChild;
+//
+// Writes widened axes back into a report, clamped to each axis' range.
+// 
+static VOID Bus_ReportAxesStore(const VIGEM_TARGET_OPS* Ops, const SHORT* Axes, UCHAR* Report)
+{
+    ULONG   i;
+    SHORT   value;
 
-            // Allocate kernel memory
-            status = WdfMemoryCreate(&memAttribs, NonPagedPool, VIGEM_POOL_TAG,
-                interrupt->InterruptLength, &memory, NULL);
-            if (!NT_SUCCESS(status))
-            {
-                KdPrint((DRIVERNAME "WdfMemoryCreate failed with status 0x%X\n", status));
-                goto endSubmitReport;
-            }
+    for (i = 0; i < Ops->AxisCount; i++)
+    {
+        switch (Ops->Axes[i].Type)
+        {
+        case ViGEmAxisUnsigned8:
+            Report[Ops->Axes[i].Offset] = (UCHAR)max(min(Axes[i], MAXUCHAR), 0);
+            break;
+        case ViGEmAxisUnsigned10:
+            value = max(min(Axes[i], 0x3FF), 0);
+            RtlCopyMemory(Report + Ops->Axes[i].Offset, &value, sizeof(SHORT));
+            break;
+        default:
+            RtlCopyMemory(Report + Ops->Axes[i].Offset, &Axes[i], sizeof(SHORT));
+            break;
+        }
+    }
+}
 
-            // Copy interrupt buffer to memory object
-            status = WdfMemoryCopyFromBuffer(memory, 0, interrupt->Interrupt, interrupt->InterruptLength);
-            if (!NT_SUCCESS(status))
-            {
-                KdPrint((DRIVERNAME "WdfMemoryCopyFromBuffer failed with status 0x%X\n", status));
-                goto endSubmitReport;
-            }
+//
+// Adds a submitted report to the interpolation history of a PDO.
+// 
+VOID Bus_InterpolationRecord(WDFDEVICE Pdo, PVOID Report)
+{
+    PPDO_DEVICE_DATA    pdoData = PdoGetData(Pdo);
+    VIGEM_TARGET_REPORT report;
+    SHORT               axes[AXES_BLEND_LANES] = { 0 };
+    LONG64              now;
+    KIRQL               irql;
 
-            // Add memory object to collection
-            status = WdfCollectionAdd(xgip->XboxgipSysInitCollection, memory);
-            if (!NT_SUCCESS(status))
-            {
-                KdPrint((DRIVERNAME "WdfCollectionAdd failed with status 0x%X\n", status));
-                goto endSubmitReport;
-            }
+    if (!pdoData->Ops->UnwrapReport(Report, &report))
+    {
+        return;
+    }
 
-            // Check if all packets have been received
-            xgip->XboxgipSysInitReady =
-                WdfCollectionGetCount(xgip->XboxgipSysInitCollection) == XGIP_SYS_INIT_PACKETS;
+    Bus_ReportAxesLoad(pdoData->Ops, (const UCHAR*)&report, axes);
 
-            // If all packets are cached, start initialization timer
-            if (xgip->XboxgipSysInitReady)
-            {
-                WdfTimerStart(xgip->XboxgipSysInitTimer, XGIP_SYS_INIT_PERIOD);
-            }
+    now = KeQueryPerformanceCounter(NULL).QuadPart;
 
-            goto endSubmitReport;
-        }
+    SeqLockWriteBegin(&pdoData->InterpolationLock, &irql);
 
-        status = WdfIoQueueRetrieveNextRequest(XgipGetData(hChild)->PendingUsbInRequests, &usbRequest);
+    // The first report has nothing to move from
+    if (pdoData->InterpolationTime[1] == 0)
+    {
+        RtlCopyMemory(pdoData->InterpolationAxes[0], axes, sizeof(axes));
+        pdoData->InterpolationTime[0] = now;
+    }
+    else
+    {
+        RtlCopyMemory(pdoData->InterpolationAxes[0], pdoData->InterpolationAxes[1], sizeof(axes));
+        pdoData->InterpolationTime[0] = pdoData->InterpolationTime[1];
+    }
 
-        break;
-    default:
+    RtlCopyMemory(pdoData->InterpolationAxes[1], axes, sizeof(axes));
+    pdoData->InterpolationTime[1] = now;
 
-        status = STATUS_NOT_SUPPORTED;
+    SeqLockWriteEnd(&pdoData->InterpolationLock, irql);
+}
 
-        TraceEvents(TRACE_LEVEL_WARNING,
-            TRACE_BUSENUM,
-            "Unknown target type: %d (%!STATUS!)",
-            pdoData->TargetType,
-            status);
+//
+// Replaces the analog axes of a filled IN URB with values interpolated
+// from the last two submissions.
+// 
+VOID Bus_InterpolateUrb(WDFDEVICE Pdo, PURB Urb, VIGEM_INTERPOLATION_MODE Mode)
+{
+    PPDO_DEVICE_DATA    pdoData = PdoGetData(Pdo);
+    PUCHAR              buffer = (PUCHAR)Urb->UrbBulkOrInterruptTransfer.TransferBuffer;
+    SHORT               axes[2][AXES_BLEND_LANES];
+    SHORT               output[AXES_BLEND_LANES];
+    LONG64              time[2];
+    LARGE_INTEGER       now;
+    LARGE_INTEGER       frequency;
+    SHORT               weightPrevious;
+    SHORT               weightCurrent;
+    LONG                sequence;
+
+    if (buffer == NULL)
+    {
+        return;
+    }
 
-        goto endSubmitReport;
+    do
+    {
+        sequence = SeqLockReadBegin(&pdoData->InterpolationLock);
+
+        RtlCopyMemory(axes, pdoData->InterpolationAxes, sizeof(axes));
+        RtlCopyMemory(time, pdoData->InterpolationTime, sizeof(time));
+
+    } while (SeqLockReadRetry(&pdoData->InterpolationLock, sequence));
+
+    now = KeQueryPerformanceCounter(&frequency);
+
+    if (!AxesBlendWeights(Mode, time, now.QuadPart, frequency.QuadPart,
+        &weightPrevious, &weightCurrent))
+    {
+        return;
     }
 
-    if (status == STATUS_PENDING)
-        goto endSubmitReport;
-    else if (!NT_SUCCESS(status))
-        goto endSubmitReport;
+    AxesBlend(axes[0], axes[1], output, weightPrevious, weightCurrent);
 
-    TraceEvents(TRACE_LEVEL_VERBOSE,
-        TRACE_BUSENUM,
-        "Processing pending IRP");
+    Bus_ReportAxesStore(pdoData->Ops, output, buffer + pdoData->Ops->UrbReportOffset);
+}
+
+//
+// Completes a parked IN URB while the interpolated axes are still moving.
+// 
+VOID Bus_InterpolationTimerFunc(
+    _In_ WDFTIMER Timer
+)
+{
+    WDFDEVICE           hChild = WdfTimerGetParentObject(Timer);
+    PPDO_DEVICE_DATA    pdoData = PdoGetData(hChild);
+    LARGE_INTEGER       now;
+    LARGE_INTEGER       frequency;
+    LONG64              time[2];
+    LONG64              interval;
+    LONG                sequence;
+    LONG                mode;
+
+    mode = ReadNoFence(&pdoData->InterpolationMode);
+
+    if (mode == ViGEmInterpolationOff)
+    {
+        return;
+    }
+
+    do
+    {
+        sequence = SeqLockReadBegin(&pdoData->InterpolationLock);
 
-    // Get pending IRP
-    pendingIrp = WdfRequestWdmGetIrp(usbRequest);
+        RtlCopyMemory(time, pdoData->InterpolationTime, sizeof(time));
 
-    // Get USB request block
-    PURB urb = (PURB)URB_FROM_IRP(pendingIrp);
+    } while (SeqLockReadRetry(&pdoData->InterpolationLock, sequence));
 
-    // Get transfer buffer
-    PUCHAR Buffer = (PUCHAR)urb->UrbBulkOrInterruptTransfer.TransferBuffer;
+    now = KeQueryPerformanceCounter(&frequency);
+    interval = time[1] - time[0];
 
-    switch (pdoData->TargetType)
+    // One more tick past the end lands the axes on their final value
+    if (interval <= 0
+        || now.QuadPart - time[1] > interval * (mode == ViGEmInterpolationLinear ? 1 : 2)
+        + frequency.QuadPart * INTERPOLATION_PERIOD / 1000)
     {
-    case Xbox360Wired:
+        return;
+    }
+
+    ReportMailboxDeliver(&pdoData->ReportPending, &BusMailboxOps, hChild, pdoData->Ops->GetInRequestQueue(hChild));
+}
 
-        urb->UrbBulkOrInterruptTransfer.TransferBufferLength = sizeof(XUSB_INTERRUPT_IN_PACKET);
+//
+// Sets the interpolation mode of a PDO.
+// 
+NTSTATUS Bus_SetInterpolation(WDFDEVICE Device, WDFREQUEST Request, size_t* Transferred)
+{
+    NTSTATUS                    status;
+    PVIGEM_SET_INTERPOLATION    interpolation;
+    WDFDEVICE                   hChild;
+    PPDO_DEVICE_DATA            pdoData;
+    WDF_TIMER_CONFIG            timerConfig;
+    WDF_OBJECT_ATTRIBUTES       attributes;
+    WDFTIMER                    timer;
+    size_t                      length = 0;
+    KIRQL                       irql;
 
-        // Copy submitted report to cache
-        RtlCopyBytes(&XusbGetData(hChild)->Packet.Report, &((PXUSB_SUBMIT_REPORT)Report)->Report, sizeof(XUSB_REPORT));
-        // Copy cached report to URB transfer buffer
-        RtlCopyBytes(Buffer, &XusbGetData(hChild)->Packet, sizeof(XUSB_INTERRUPT_IN_PACKET));
+    *Transferred = 0;
 
-        break;
-    case DualShock4Wired:
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(VIGEM_SET_INTERPOLATION), (PVOID)&interpolation, &length);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSENUM,
+            "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+            status);
+        return status;
+    }
 
-        urb->UrbBulkOrInterruptTransfer.TransferBufferLength = DS4_REPORT_SIZE;
+    if (interpolation->Size != sizeof(VIGEM_SET_INTERPOLATION)
+        || (ULONG)interpolation->Mode > ViGEmInterpolationExtrapolate)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
 
-        /* Copy report to cache and transfer buffer
-         * Skip first byte as it contains the never changing report id */
-        RtlCopyBytes(Ds4GetData(hChild)->Report + 1, &((PDS4_SUBMIT_REPORT)Report)->Report, sizeof(DS4_REPORT));
+    hChild = Bus_GetPdo(Device, interpolation->SerialNo);
 
-        if (Buffer)
-            RtlCopyBytes(Buffer, Ds4GetData(hChild)->Report, DS4_REPORT_SIZE);
+    if (hChild == NULL)
+    {
+        return STATUS_NO_SUCH_DEVICE;
+    }
 
-        break;
-    case XboxOneWired:
+    pdoData = PdoGetData(hChild);
 
-        // Request is input report
-        if (((PXGIP_SUBMIT_REPORT)Report)->Size == sizeof(XGIP_SUBMIT_REPORT))
-        {
-            urb->UrbBulkOrInterruptTransfer.TransferBufferLength = XGIP_REPORT_SIZE;
+    if (!IS_OWNER(pdoData))
+    {
+        status = STATUS_ACCESS_DENIED;
+        goto interpolationEnd;
+    }
 
-            // Increase event counter on every call (can roll-over)
-            XgipGetData(hChild)->Report[2]++;
+    //
+    // XUSB and XGIP park IN URBs until a report arrives, so something else
+    // has to complete them in between; DS4 flushes on its own timer
+    // 
+    if (interpolation->Mode != ViGEmInterpolationOff
+        && pdoData->TargetType != DualShock4Wired
+        && pdoData->InterpolationTimer == NULL)
+    {
+        WDF_TIMER_CONFIG_INIT_PERIODIC(&timerConfig, Bus_InterpolationTimerFunc, INTERPOLATION_PERIOD);
+        WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+        attributes.ParentObject = hChild;
 
-            /* Copy report to cache and transfer buffer
-             * Skip first four bytes as they are not part of the report */
-            RtlCopyBytes(XgipGetData(hChild)->Report + 4, &((PXGIP_SUBMIT_REPORT)Report)->Report, sizeof(XGIP_REPORT));
-            RtlCopyBytes(Buffer, XgipGetData(hChild)->Report, XGIP_REPORT_SIZE);
+        status = WdfTimerCreate(&timerConfig, &attributes, &timer);
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_BUSENUM,
+                "WdfTimerCreate failed with status %!STATUS!",
+                status);
+            goto interpolationEnd;
+        }
 
-            break;
+        // Lost a race against a concurrent request
+        if (InterlockedCompareExchangePointer((PVOID volatile*)&pdoData->InterpolationTimer, timer, NULL) != NULL)
+        {
+            WdfObjectDelete(timer);
         }
+        else
+        {
+            Bus_TrackObject(Device, hChild, timer, ViGEmResourceTimer);
+        }
+    }
 
-        break;
-    default:
-        status = STATUS_INVALID_PARAMETER;
-        break;
+    // Start over so the first report after switching doesn't blend with stale data
+    SeqLockWriteBegin(&pdoData->InterpolationLock, &irql);
+    RtlZeroMemory(pdoData->InterpolationTime, sizeof(pdoData->InterpolationTime));
+    SeqLockWriteEnd(&pdoData->InterpolationLock, irql);
+
+    InterlockedExchange(&pdoData->InterpolationMode, interpolation->Mode);
+
+    if (pdoData->InterpolationTimer != NULL)
+    {
+        if (interpolation->Mode != ViGEmInterpolationOff)
+        {
+            WdfTimerStart(pdoData->InterpolationTimer, WDF_REL_TIMEOUT_IN_MS(INTERPOLATION_PERIOD));
+        }
+        else
+        {
+            WdfTimerStop(pdoData->InterpolationTimer, FALSE);
+        }
     }
 
-    // Complete pending request
-    WdfRequestComplete(usbRequest, status);
+    TraceEvents(TRACE_LEVEL_INFORMATION,
+        TRACE_BUSENUM,
+        "Interpolation mode of serial %d set to %d",
+        pdoData->SerialNo,
+        interpolation->Mode);
+
+    status = STATUS_SUCCESS;
 
-endSubmitReport:
+interpolationEnd:
+
+    Bus_PutPdo(hChild);
+
+    return status;
+}
+
+#pragma endregion
+
+//
+// Returns the common queue a PDO parks its input report IN URBs in.
+// 
+WDFQUEUE Bus_GetInRequestQueue(WDFDEVICE Pdo)
+{
+    return PdoGetData(Pdo)->PendingUsbInRequests;
+}
+
+//
+// Handles an IN URB asking for input data.
+// 
+// If the report cache holds an update no URB has seen yet the request is
+// completed right away, otherwise it's parked until the next submission.
+// 
+NTSTATUS Bus_QueueInRequest(WDFDEVICE Pdo, WDFQUEUE Queue, WDFREQUEST Request, PURB Urb)
+{
+    NTSTATUS            status;
+    PPDO_DEVICE_DATA    pdoData = PdoGetData(Pdo);
+
+    //
+    // Pick up whatever the feeder last published to a bound input slot
+    // 
+    InputSlot_Pull(Pdo);
 
-    TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_BUSENUM, "%!FUNC! Exit with status %!STATUS!", status);
+    /* This request is sent periodically and relies on data the "feeder"
+     * has to supply, so we queue this request and return with STATUS_PENDING.
+     * The request gets completed as soon as the "feeder" sent an update. */
+    status = ReportMailboxArrive(&pdoData->ReportPending, &BusMailboxOps, Pdo, Queue, Request);
+
+    if (status == STATUS_SUCCESS)
+    {
+        Bus_CopyReportCacheToUrb(Pdo, Urb);
+    }
 
     return status;
 }
 
+#pragma region Report mailbox
+
+static BOOLEAN Bus_MailboxRetrieve(PVOID Queue, PVOID* Request)
+{
+    return NT_SUCCESS(WdfIoQueueRetrieveNextRequest((WDFQUEUE)Queue, (WDFREQUEST*)Request));
+}
+
+static NTSTATUS Bus_MailboxPark(PVOID Queue, PVOID Request)
+{
+    return WdfRequestForwardToIoQueue((WDFREQUEST)Request, (WDFQUEUE)Queue);
+}
+
+static VOID Bus_MailboxComplete(PVOID Pdo, PVOID Request)
+{
+    Bus_CopyReportCacheToUrb((WDFDEVICE)Pdo, (PURB)URB_FROM_IRP(WdfRequestWdmGetIrp((WDFREQUEST)Request)));
+
+    WdfRequestComplete((WDFREQUEST)Request, STATUS_SUCCESS);
+}
+
+const REPORT_MAILBOX_OPS BusMailboxOps =
+{
+    .Retrieve = Bus_MailboxRetrieve,
+    .Park = Bus_MailboxPark,
+    .Complete = Bus_MailboxComplete,
+};
+
+#pragma endregion
@@ -36,15 +36,33 @@
 #include <initguid.h>
 #include "ViGEmBusDriver.h"
 #include <ViGEm/km/BusShared.h>
+#include "ViGEmBusSharedEx.h"
 #include "Queue.h"
 #include <usb.h>
 #include <usbbusif.h>
-#include "Context.h"
+#include "SeqLock.h"
+#include "ReportMailbox.h"
+#include "SerialIndex.h"
+#include "PluginTable.h"
+#include "SerialAllocator.h"
+#include "SessionIndex.h"
+#include "StateTable.h"
+#include "DeliveryTracker.h"
 #include "Util.h"
+#include "Context.h"
 #include "UsbPdo.h"
 #include "Xusb.h"
+#include "Ds4Core.h"
 #include "Ds4.h"
 #include "Xgip.h"
+#include "InputSlot.h"
+#include "PlaybackCore.h"
+#include "Playback.h"
+#include "Translate.h"
+#include "TransformCore.h"
+#include "Transform.h"
+#include "ReportFifoCore.h"
+#include "ReportFifo.h"
 
 
 #pragma region Macros
@@ -62,9 +80,12 @@
 #define MAX_HARDWARE_ID_LENGTH          0xFF
 
 #define ORC_PC_FREQUENCY_DIVIDER        1000
-#define ORC_TIMER_START_DELAY           500 // ms
-#define ORC_TIMER_PERIODIC_DUE_TIME     500 // ms
+#define ORC_TIMER_START_DELAY           100 // ms
+#define ORC_TIMER_PERIODIC_DUE_TIME     100 // ms
 #define ORC_REQUEST_MAX_AGE             500 // ms
+#define ORC_REQUEST_MAX_AGE_TICKS       ((ORC_REQUEST_MAX_AGE + ORC_TIMER_PERIODIC_DUE_TIME - 1) / ORC_TIMER_PERIODIC_DUE_TIME)
+
+#define INTERPOLATION_PERIOD            0x04 // ms
 
 #pragma endregion
 
@@ -89,6 +110,21 @@
 
 #pragma endregion
 
+#pragma region Globals
+
+//
+// Hot-path trace sampling, read from the driver parameters on load
+// 
+extern LONG TraceHotSampleRate;
+extern volatile LONG TraceHotSampleCount;
+
+//
+// Parks and completes IN URBs for the report mailbox
+// 
+extern const REPORT_MAILBOX_OPS BusMailboxOps;
+
+#pragma endregion
+
 
 #pragma region WDF callback prototypes
 
@@ -97,6 +133,7 @@ DRIVER_INITIALIZE DriverEntry;
 EVT_WDF_DRIVER_DEVICE_ADD Bus_EvtDeviceAdd;
 EVT_WDF_DEVICE_FILE_CREATE Bus_DeviceFileCreate;
 EVT_WDF_FILE_CLOSE Bus_FileClose;
+EVT_WDF_FILE_CLEANUP Bus_FileCleanup;
 
 EVT_WDF_CHILD_LIST_CREATE_DEVICE Bus_EvtDeviceListCreatePdo;
 
@@ -104,6 +141,8 @@ EVT_WDF_CHILD_LIST_IDENTIFICATION_DESCRIPTION_COMPARE Bus_EvtChildListIdentifica
 
 EVT_WDF_DEVICE_PREPARE_HARDWARE Pdo_EvtDevicePrepareHardware;
 
+EVT_WDF_DEVICE_CONTEXT_CLEANUP Pdo_EvtDeviceContextCleanup;
+
 EVT_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL Pdo_EvtIoInternalDeviceControl;
 
 EVT_WDF_TIMER Xgip_SysInitTimerFunc;
@@ -112,10 +151,23 @@ EVT_WDF_OBJECT_CONTEXT_CLEANUP Bus_EvtDriverContextCleanup;
 
 EVT_WDF_TIMER Bus_PlugInRequestCleanUpEvtTimerFunc;
 
+EVT_WDF_OBJECT_CONTEXT_DESTROY Bus_EvtTrackedObjectDestroy;
+
+EVT_WDF_TIMER Bus_DeliveryWaitTimerFunc;
+
+EVT_WDF_IO_QUEUE_IO_CANCELED_ON_QUEUE Bus_EvtDeliveryWaiterCanceled;
+
+EVT_WDF_TIMER Bus_InterpolationTimerFunc;
+
 #pragma endregion
 
 #pragma region Bus enumeration-specific functions
 
+VOID
+Bus_LoadTraceSettings(
+    _In_ WDFDRIVER Driver
+);
+
 NTSTATUS
 Bus_PlugInDevice(
     _In_ WDFDEVICE Device,
@@ -151,7 +203,8 @@ Bus_XgipSubmitReport(
     WDFDEVICE Device,
     ULONG SerialNo,
     PXGIP_SUBMIT_REPORT Report,
-    _In_ BOOLEAN FromInterface
+    _In_ BOOLEAN FromInterface,
+    _Out_opt_ PVIGEM_REPORT_DISPOSITION Disposition
 );
 
 NTSTATUS
@@ -159,7 +212,225 @@ Bus_SubmitReport(
     WDFDEVICE Device,
     ULONG SerialNo,
     PVOID Report,
-    _In_ BOOLEAN FromInterface
+    _In_ BOOLEAN FromInterface,
+    _Out_opt_ PVIGEM_REPORT_DISPOSITION Disposition
+);
+
+NTSTATUS
+Bus_SubmitRequestReport(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _In_ ULONG SerialNo,
+    _In_ PVOID Report,
+    _Out_opt_ PVIGEM_REPORT_DISPOSITION Disposition
+);
+
+NTSTATUS
+Bus_SubmitReportToPdo(
+    _In_ WDFDEVICE Pdo,
+    _In_ PVOID Report,
+    _In_opt_ const UCHAR* MergeMask,
+    _Out_opt_ PVIGEM_REPORT_DISPOSITION Disposition
+);
+
+NTSTATUS
+Bus_SubmitReportToPdoEx(
+    _In_ WDFDEVICE Pdo,
+    _In_ PVOID Report,
+    _In_opt_ const UCHAR* MergeMask,
+    _In_opt_ const VIGEM_GAMEPAD_STATE* Motion,
+    _Out_opt_ PVIGEM_REPORT_DISPOSITION Disposition
+);
+
+NTSTATUS
+Bus_SubmitTargetReportToPdo(
+    _In_ WDFDEVICE Pdo,
+    _In_ PVIGEM_TARGET_REPORT Report,
+    _Out_opt_ PVIGEM_REPORT_DISPOSITION Disposition
+);
+
+VOID
+Bus_ReturnDisposition(
+    _In_ WDFREQUEST Request,
+    _In_ VIGEM_REPORT_DISPOSITION Disposition,
+    _Inout_ size_t* Transferred
+);
+
+VOID
+Bus_MirrorFanOut(
+    _In_ WDFDEVICE Pdo,
+    _In_ PVOID Report
+);
+
+VOID
+Bus_MirrorRemoveMember(
+    _In_ PPDO_DEVICE_DATA Leader,
+    _In_ ULONG MemberSerialNo
+);
+
+VOID
+Bus_MirrorRelease(
+    _In_ WDFDEVICE Device,
+    _In_ WDFDEVICE Pdo
+);
+
+NTSTATUS
+Bus_Mirror(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred
+);
+
+NTSTATUS
+Bus_SubmitDelta(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred
+);
+
+NTSTATUS
+Bus_SubmitGamepadState(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred
+);
+
+NTSTATUS
+Bus_SubmitReportBatch(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred
+);
+
+VOID
+Bus_CopyReportCacheToUrb(
+    _In_ WDFDEVICE Pdo,
+    _In_ PURB Urb
+);
+
+VOID
+Bus_InterpolationRecord(
+    _In_ WDFDEVICE Pdo,
+    _In_ PVOID Report
+);
+
+VOID
+Bus_InterpolateUrb(
+    _In_ WDFDEVICE Pdo,
+    _In_ PURB Urb,
+    _In_ VIGEM_INTERPOLATION_MODE Mode
+);
+
+NTSTATUS
+Bus_SetInterpolation(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred
+);
+
+VOID
+Bus_ReportDelivered(
+    _In_ WDFDEVICE Pdo,
+    _In_ LONG Version
+);
+
+VOID
+Bus_CompleteDeliveryWaiters(
+    _In_ WDFDEVICE Pdo,
+    _In_ LONG64 Now,
+    _Out_opt_ PLONG64 NextDeadline
+);
+
+VOID
+Bus_ArmDeliveryWaitTimer(
+    _In_ WDFDEVICE Pdo,
+    _In_ LONG64 Deadline
+);
+
+NTSTATUS
+Bus_SubmitAndWait(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred
+);
+
+WDFQUEUE
+Bus_GetInRequestQueue(
+    _In_ WDFDEVICE Pdo
+);
+
+NTSTATUS
+Bus_QueueInRequest(
+    _In_ WDFDEVICE Pdo,
+    _In_ WDFQUEUE Queue,
+    _In_ WDFREQUEST Request,
+    _In_ PURB Urb
+);
+
+BOOLEAN
+Bus_DropDuplicateReport(
+    _In_ PPDO_DEVICE_DATA PdoData,
+    _In_ const VOID* Cached,
+    _In_ const VOID* Submitted,
+    _In_opt_ const UCHAR* IgnoreMask,
+    _In_ ULONG Length
+);
+
+VOID
+Bus_SumReportCounters(
+    _In_ PPDO_DEVICE_DATA PdoData,
+    _Out_ PULONG64 Submitted,
+    _Out_ PULONG64 Duplicates,
+    _Out_writes_(VIGEM_REPORT_DISPOSITIONS) PULONG64 Dispositions
+);
+
+NTSTATUS
+Bus_GetReportStats(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred
+);
+
+NTSTATUS
+Bus_ReportDedupe(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred
+);
+
+VOID
+Bus_StateTableAdd(
+    _In_ WDFDEVICE Device,
+    _In_ WDFDEVICE Pdo
+);
+
+VOID
+Bus_StateTableRemove(
+    _In_ WDFDEVICE Pdo
+);
+
+VOID
+Bus_StateTableStore(
+    _In_ PPDO_DEVICE_DATA PdoData,
+    _In_ const VOID* Report
+);
+
+NTSTATUS
+Bus_GetStateSnapshot(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred
+);
+
+const VIGEM_TARGET_OPS*
+Bus_GetTargetOps(
+    _In_ VIGEM_TARGET_TYPE TargetType
+);
+
+NTSTATUS
+Bus_ForwardNotification(
+    _In_ WDFDEVICE Pdo,
+    _In_ WDFREQUEST Request
 );
 
 WDFDEVICE 
@@ -167,6 +438,158 @@ Bus_GetPdo(
     IN WDFDEVICE Device, 
     IN ULONG SerialNo);
 
+WDFDEVICE
+Bus_GetBoundPdo(
+    _In_ WDFREQUEST Request,
+    _In_ ULONG SerialNo
+);
+
+NTSTATUS
+Bus_GetRequestPdo(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _In_ ULONG SerialNo,
+    _Out_ WDFDEVICE* Pdo
+);
+
+VOID
+Bus_PutPdo(
+    _In_ WDFDEVICE Pdo
+);
+
+VOID
+Bus_PdoIndexInsert(
+    _In_ WDFDEVICE Device,
+    _In_ WDFDEVICE Pdo
+);
+
+VOID
+Bus_PdoIndexRemove(
+    _In_ WDFDEVICE Device,
+    _In_ WDFDEVICE Pdo
+);
+
+NTSTATUS
+Bus_ReportPdoMissing(
+    _In_ WDFDEVICE Device,
+    _In_ ULONG SerialNo
+);
+
+VOID
+Bus_SessionIndexAdd(
+    _In_ WDFDEVICE Device,
+    _In_ PFDO_FILE_DATA FileData
+);
+
+VOID
+Bus_SessionIndexInsertPdo(
+    _In_ WDFDEVICE Device,
+    _In_ WDFDEVICE Pdo
+);
+
+VOID
+Bus_SessionIndexRemovePdo(
+    _In_ WDFDEVICE Device,
+    _In_ WDFDEVICE Pdo
+);
+
+VOID
+Bus_SessionUnplugAll(
+    _In_ WDFDEVICE Device,
+    _In_ PFDO_FILE_DATA FileData,
+    _In_ BOOLEAN Close
+);
+
+BOOLEAN
+Bus_SessionBindLocked(
+    _In_ PFDO_FILE_DATA FileData,
+    _In_ ULONG SerialNo
+);
+
+NTSTATUS
+Bus_BindTarget(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred
+);
+
+ULONG
+Bus_SerialAllocate(
+    _In_ PFDO_DEVICE_DATA FdoData
+);
+
+BOOLEAN
+Bus_SerialReserve(
+    _In_ PFDO_DEVICE_DATA FdoData,
+    _In_ ULONG Serial
+);
+
+VOID
+Bus_SerialRelease(
+    _In_ PFDO_DEVICE_DATA FdoData,
+    _In_ ULONG Serial
+);
+
+PFDO_PLUGIN_REQUEST_DATA
+Bus_PluginRequestFind(
+    _In_ PFDO_DEVICE_DATA FdoData,
+    _In_ ULONG Serial
+);
+
+VOID
+Bus_PluginRequestLink(
+    _In_ PFDO_DEVICE_DATA FdoData,
+    _In_ PFDO_PLUGIN_REQUEST_DATA RequestData
+);
+
+VOID
+Bus_PluginRequestUnlink(
+    _In_ PFDO_DEVICE_DATA FdoData,
+    _In_ PFDO_PLUGIN_REQUEST_DATA RequestData
+);
+
+VOID
+Bus_PdoIndexDrain(
+    _In_ WDFDEVICE Pdo
+);
+
+VOID
+Bus_PluginStatsRecordStage(
+    _In_ PFDO_DEVICE_DATA FdoData,
+    _In_ PFDO_PLUGIN_REQUEST_DATA RequestData,
+    _In_ VIGEM_PDO_STAGE Stage,
+    _In_ NTSTATUS Status,
+    _In_ LARGE_INTEGER Now
+);
+
+VOID
+Bus_PluginStatsRecordTimeout(
+    _In_ PFDO_DEVICE_DATA FdoData,
+    _In_ PFDO_PLUGIN_REQUEST_DATA RequestData
+);
+
+NTSTATUS
+Bus_GetPluginStats(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred
+);
+
+VOID
+Bus_TrackObject(
+    _In_ WDFDEVICE Device,
+    _In_opt_ WDFDEVICE Pdo,
+    _In_ WDFOBJECT Object,
+    _In_ VIGEM_RESOURCE_TYPE Type
+);
+
+NTSTATUS
+Bus_GetResourceStats(
+    _In_ WDFDEVICE Device,
+    _In_ WDFREQUEST Request,
+    _Out_ size_t* Transferred
+);
+
 VOID
 Bus_PdoStageResult(
     _In_ PINTERFACE InterfaceHeader,
@@ -94,6 +94,12 @@ NTSTATUS Bus_CreatePdo(
     WDF_OBJECT_ATTRIBUTES           attributes;
     WDF_IO_QUEUE_CONFIG             usbInQueueConfig;
     WDF_IO_QUEUE_CONFIG             notificationsQueueConfig;
+    WDF_IO_QUEUE_CONFIG             deliveryQueueConfig;
+    WDF_TIMER_CONFIG                deliveryTimerConfig;
+    WDFMEMORY                       countersMemory;
+    PVOID                           countersBuffer;
+    PFDO_DEVICE_DATA                pFdoData = FdoGetData(Device);
+    const VIGEM_TARGET_OPS*         ops;
 
     DECLARE_CONST_UNICODE_STRING(deviceLocation, L"Virtual Gamepad Emulation Bus");
     DECLARE_UNICODE_STRING_SIZE(buffer, MAX_INSTANCE_ID_LEN);
@@ -121,6 +127,8 @@ NTSTATUS Bus_CreatePdo(
             TRACE_BUSPDO,
             "WdfFdoQueryForInterface failed with status %!STATUS!",
             status);
+
+        Bus_SerialRelease(pFdoData, Description->SerialNo);
         return status;
     }
 
@@ -158,51 +166,10 @@ NTSTATUS Bus_CreatePdo(
 #pragma region Prepare PDO
 
     // set parameters matching desired target device
-    switch (Description->TargetType)
-    {
-        //
-        // A Xbox 360 device was requested
-        // 
-    case Xbox360Wired:
-
-        status = Xusb_PreparePdo(
-            DeviceInit,
-            Description->VendorId,
-            Description->ProductId,
-            &deviceId,
-            &deviceDescription);
-
-        if (!NT_SUCCESS(status))
-            goto endCreatePdo;
-
-        break;
-
-        //
-        // A Sony DualShock 4 device was requested
-        // 
-    case DualShock4Wired:
-
-        status = Ds4_PreparePdo(DeviceInit, &deviceId, &deviceDescription);
-
-        if (!NT_SUCCESS(status))
-            goto endCreatePdo;
-
-        break;
-
-        //
-        // A Xbox One device was requested
-        // 
-    case XboxOneWired:
-
-        status = Xgip_PreparePdo(DeviceInit, &deviceId, &deviceDescription);
-
-        if (!NT_SUCCESS(status))
-            goto endCreatePdo;
-
-        break;
-
-    default:
+    ops = Bus_GetTargetOps(Description->TargetType);
 
+    if (ops == NULL)
+    {
         status = STATUS_INVALID_PARAMETER;
 
         TraceEvents(TRACE_LEVEL_ERROR,
@@ -214,6 +181,11 @@ NTSTATUS Bus_CreatePdo(
         goto endCreatePdo;
     }
 
+    status = ops->PreparePdo(DeviceInit, Description, &deviceId, &deviceDescription);
+
+    if (!NT_SUCCESS(status))
+        goto endCreatePdo;
+
     // set device id
     status = WdfPdoInitAssignDeviceID(DeviceInit, &deviceId);
     if (!NT_SUCCESS(status))
@@ -282,6 +254,9 @@ NTSTATUS Bus_CreatePdo(
     // Add common device data context
     WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&pdoAttributes, PDO_DEVICE_DATA);
 
+    // Drops the PDO from the bus serial index once it's gone
+    pdoAttributes.EvtCleanupCallback = Pdo_EvtDeviceContextCleanup;
+
     status = WdfDeviceCreate(&DeviceInit, &pdoAttributes, &hChild);
     if (!NT_SUCCESS(status))
     {
@@ -297,76 +272,38 @@ NTSTATUS Bus_CreatePdo(
         "Created PDO 0x%p",
         hChild);
 
-    switch (Description->TargetType)
-    {
-        // Add XUSB-specific device data context
-    case Xbox360Wired:
-    {
-        PXUSB_DEVICE_DATA xusbData = NULL;
-        WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&pdoAttributes, XUSB_DEVICE_DATA);
+    //
+    // From here on context cleanup hands the serial back, whichever way
+    // this ends
+    // 
+    PdoGetData(hChild)->SerialNo = Description->SerialNo;
 
-        status = WdfObjectAllocateContext(hChild, &pdoAttributes, (PVOID)&xusbData);
-        if (!NT_SUCCESS(status))
-        {
-            TraceEvents(TRACE_LEVEL_ERROR,
-                TRACE_BUSPDO,
-                "WdfObjectAllocateContext failed with status %!STATUS!",
-                status);
-            goto endCreatePdo;
-        }
+    Bus_TrackObject(Device, NULL, hChild, ViGEmResourceDevice);
 
-        break;
-    }
-    case DualShock4Wired:
-    {
-        PDS4_DEVICE_DATA ds4Data = NULL;
-        WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&pdoAttributes, DS4_DEVICE_DATA);
+#pragma endregion
 
-        status = WdfObjectAllocateContext(hChild, &pdoAttributes, (PVOID)&ds4Data);
-        if (!NT_SUCCESS(status))
-        {
-            TraceEvents(TRACE_LEVEL_ERROR,
-                TRACE_BUSPDO,
-                "WdfObjectAllocateContext failed with status %!STATUS!",
-                status);
-            goto endCreatePdo;
-        }
+#pragma region Expose USB Interface
 
-        break;
-    }
-    case XboxOneWired:
+    //
+    // The interface is registered on the bus, so it is only created once instead
+    // of stacking up another framework interface object with every plugin
+    // 
+    if (InterlockedCompareExchange(&pFdoData->UsbInterfaceCreated, TRUE, FALSE) == FALSE)
     {
-        PXGIP_DEVICE_DATA xgipData = NULL;
-        WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&pdoAttributes, XGIP_DEVICE_DATA);
-
-        status = WdfObjectAllocateContext(hChild, &pdoAttributes, (PVOID)&xgipData);
+        status = WdfDeviceCreateDeviceInterface(Device, (LPGUID)&GUID_DEVINTERFACE_USB_DEVICE, NULL);
         if (!NT_SUCCESS(status))
         {
             TraceEvents(TRACE_LEVEL_ERROR,
                 TRACE_BUSPDO,
-                "WdfObjectAllocateContext failed with status %!STATUS!",
+                "WdfDeviceCreateDeviceInterface failed with status %!STATUS!",
                 status);
+
+            // Let the next plugin retry
+            InterlockedExchange(&pFdoData->UsbInterfaceCreated, FALSE);
             goto endCreatePdo;
         }
 
-        break;
-    }
-    default:
-        break;
-    }
-
-#pragma endregion
-
-#pragma region Expose USB Interface
-
-    status = WdfDeviceCreateDeviceInterface(Device, (LPGUID)&GUID_DEVINTERFACE_USB_DEVICE, NULL);
-    if (!NT_SUCCESS(status))
-    {
-        TraceEvents(TRACE_LEVEL_ERROR,
-            TRACE_BUSPDO,
-            "WdfDeviceCreateDeviceInterface failed with status %!STATUS!",
-            status);
-        goto endCreatePdo;
+        InterlockedIncrement(&pFdoData->LiveInterfaces);
     }
 
 #pragma endregion
@@ -377,9 +314,13 @@ NTSTATUS Bus_CreatePdo(
 
     pdoData->BusInterface = busInterface;
 
-    pdoData->SerialNo = Description->SerialNo;
+    InitializeListHead(&pdoData->SessionEntry);
+
     pdoData->TargetType = Description->TargetType;
+    pdoData->Ops = ops;
+    pdoData->DedupePolicy = ViGEmDedupeDrop;
     pdoData->OwnerProcessId = Description->OwnerProcessId;
+    pdoData->SessionId = Description->SessionId;
     pdoData->VendorId = Description->VendorId;
     pdoData->ProductId = Description->ProductId;
 
@@ -392,30 +333,8 @@ NTSTATUS Bus_CreatePdo(
         pdoData->VendorId,
         pdoData->ProductId);
 
-    // Initialize additional contexts (if available)
-    switch (Description->TargetType)
-    {
-    case Xbox360Wired:
-
-        status = Xusb_AssignPdoContext(hChild);
-
-        break;
-
-    case DualShock4Wired:
-
-        status = Ds4_AssignPdoContext(hChild, Description);
-
-        break;
-
-    case XboxOneWired:
-
-        status = Xgip_AssignPdoContext(hChild);
-
-        break;
-
-    default:
-        break;
-    }
+    // Initialize additional contexts
+    status = ops->AssignPdoContext(hChild, Description);
 
     if (!NT_SUCCESS(status))
     {
@@ -447,6 +366,8 @@ NTSTATUS Bus_CreatePdo(
         goto endCreatePdo;
     }
 
+    Bus_TrackObject(Device, hChild, pdoData->PendingUsbInRequests, ViGEmResourceQueue);
+
     // Create and assign queue for user-land notification requests
     WDF_IO_QUEUE_CONFIG_INIT(&notificationsQueueConfig, WdfIoQueueDispatchManual);
 
@@ -460,6 +381,104 @@ NTSTATUS Bus_CreatePdo(
         goto endCreatePdo;
     }
 
+    Bus_TrackObject(Device, hChild, pdoData->PendingNotificationRequests, ViGEmResourceQueue);
+
+    // Create and assign queue for submitters waiting on delivery, forwarded to from the bus
+    WDF_IO_QUEUE_CONFIG_INIT(&deliveryQueueConfig, WdfIoQueueDispatchManual);
+    deliveryQueueConfig.EvtIoCanceledOnQueue = Bus_EvtDeliveryWaiterCanceled;
+
+    status = WdfIoQueueCreate(Device, &deliveryQueueConfig, WDF_NO_OBJECT_ATTRIBUTES, &pdoData->PendingDeliveryWaiters);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSPDO,
+            "WdfIoQueueCreate (PendingDeliveryWaiters) failed with status %!STATUS!",
+            status);
+        goto endCreatePdo;
+    }
+
+    Bus_TrackObject(Device, hChild, pdoData->PendingDeliveryWaiters, ViGEmResourceQueue);
+
+    status = WdfSpinLockCreate(&attributes, &pdoData->DeliveryWaitLock);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSPDO,
+            "WdfSpinLockCreate (DeliveryWaitLock) failed with status %!STATUS!",
+            status);
+        goto endCreatePdo;
+    }
+
+    status = WdfSpinLockCreate(&attributes, &pdoData->TransformLock);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSPDO,
+            "WdfSpinLockCreate (TransformLock) failed with status %!STATUS!",
+            status);
+        goto endCreatePdo;
+    }
+
+    status = WdfSpinLockCreate(&attributes, &pdoData->ReportFifoPushLock);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSPDO,
+            "WdfSpinLockCreate (ReportFifoPushLock) failed with status %!STATUS!",
+            status);
+        goto endCreatePdo;
+    }
+
+    status = WdfSpinLockCreate(&attributes, &pdoData->ReportFifoPopLock);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSPDO,
+            "WdfSpinLockCreate (ReportFifoPopLock) failed with status %!STATUS!",
+            status);
+        goto endCreatePdo;
+    }
+
+    // Create timer expiring delivery waits, armed on demand
+    WDF_TIMER_CONFIG_INIT(&deliveryTimerConfig, Bus_DeliveryWaitTimerFunc);
+
+    status = WdfTimerCreate(&deliveryTimerConfig, &attributes, &pdoData->DeliveryWaitTimer);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSPDO,
+            "WdfTimerCreate (DeliveryWaitTimer) failed with status %!STATUS!",
+            status);
+        goto endCreatePdo;
+    }
+
+    Bus_TrackObject(Device, hChild, pdoData->DeliveryWaitTimer, ViGEmResourceTimer);
+
+    pdoData->DeliveryWaitDeadline = MAXLONG64;
+
+    // Create per-processor report counters, each block on its own cache line
+    pdoData->ReportCountersCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+
+    status = WdfMemoryCreate(&attributes,
+        NonPagedPoolNx,
+        VIGEM_POOL_TAG,
+        pdoData->ReportCountersCount * sizeof(PDO_REPORT_COUNTERS) + SYSTEM_CACHE_ALIGNMENT_SIZE,
+        &countersMemory,
+        &countersBuffer);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_BUSPDO,
+            "WdfMemoryCreate (ReportCounters) failed with status %!STATUS!",
+            status);
+        goto endCreatePdo;
+    }
+
+    Bus_TrackObject(Device, hChild, countersMemory, ViGEmResourceMemory);
+
+    pdoData->ReportCounters = (PPDO_REPORT_COUNTERS)ALIGN_UP_POINTER_BY(countersBuffer, SYSTEM_CACHE_ALIGNMENT_SIZE);
+    RtlZeroMemory(pdoData->ReportCounters, pdoData->ReportCountersCount * sizeof(PDO_REPORT_COUNTERS));
+
 #pragma endregion 
 
 #pragma region Default I/O queue setup
@@ -478,6 +497,8 @@ NTSTATUS Bus_CreatePdo(
         goto endCreatePdo;
     }
 
+    Bus_TrackObject(Device, hChild, defaultPdoQueue, ViGEmResourceQueue);
+
 #pragma endregion
 
 #pragma region PNP capabilities
@@ -514,7 +535,35 @@ NTSTATUS Bus_CreatePdo(
 
 #pragma endregion
 
+    //
+    // Give the PDO its row in the bus state table
+    // 
+    Bus_StateTableAdd(Device, hChild);
+
+    //
+    // PDO is fully set up, make it discoverable by serial
+    // 
+    Bus_PdoIndexInsert(Device, hChild);
+
+    //
+    // Let the owning session find it on close; driver-owned
+    // devices outlive the handle they were created through
+    // 
+    if (!Description->OwnerIsDriver)
+    {
+        Bus_SessionIndexInsertPdo(Device, hChild);
+    }
+
     endCreatePdo:
+
+                //
+                // Without a PDO there is no context cleanup to hand the serial back
+                // 
+                if (!NT_SUCCESS(status) && hChild == NULL)
+                {
+                    Bus_SerialRelease(pFdoData, Description->SerialNo);
+                }
+
                 TraceEvents(TRACE_LEVEL_INFORMATION,
                     TRACE_BUSPDO,
                     "BUS_PDO_REPORT_STAGE_RESULT Stage: ViGEmPdoCreate  [serial: %d, status: %!STATUS!]",
@@ -527,6 +576,60 @@ NTSTATUS Bus_CreatePdo(
                 return status;
 }
 
+//
+// Gets called when the PDO object is about to be deleted.
+// 
+VOID Pdo_EvtDeviceContextCleanup(
+    _In_ WDFOBJECT Device
+)
+{
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_BUSPDO, "%!FUNC! Entry");
+
+    Bus_PdoIndexRemove(WdfPdoGetParent((WDFDEVICE)Device), (WDFDEVICE)Device);
+
+    Bus_SessionIndexRemovePdo(WdfPdoGetParent((WDFDEVICE)Device), (WDFDEVICE)Device);
+
+    //
+    // Submissions that found the PDO through the index or a handle binding
+    // before it left both may still be using its queues and locks
+    // 
+    Bus_PdoIndexDrain((WDFDEVICE)Device);
+
+    //
+    // Free the row before the serial can be handed out again
+    // 
+    Bus_StateTableRemove((WDFDEVICE)Device);
+
+    Bus_SerialRelease(FdoGetData(WdfPdoGetParent((WDFDEVICE)Device)), PdoGetData((WDFDEVICE)Device)->SerialNo);
+
+    InputSlot_Release((WDFDEVICE)Device);
+
+    Playback_Release((WDFDEVICE)Device);
+
+    //
+    // The notification queue is parented to the bus (requests get forwarded to it
+    // from there) and would otherwise live on until the bus goes away
+    // 
+    if (PdoGetData((WDFDEVICE)Device)->PendingNotificationRequests != NULL)
+    {
+        WdfObjectDelete(PdoGetData((WDFDEVICE)Device)->PendingNotificationRequests);
+        PdoGetData((WDFDEVICE)Device)->PendingNotificationRequests = NULL;
+    }
+
+    if (PdoGetData((WDFDEVICE)Device)->DeliveryWaitTimer != NULL)
+    {
+        WdfTimerStop(PdoGetData((WDFDEVICE)Device)->DeliveryWaitTimer, TRUE);
+    }
+
+    if (PdoGetData((WDFDEVICE)Device)->PendingDeliveryWaiters != NULL)
+    {
+        WdfObjectDelete(PdoGetData((WDFDEVICE)Device)->PendingDeliveryWaiters);
+        PdoGetData((WDFDEVICE)Device)->PendingDeliveryWaiters = NULL;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_BUSPDO, "%!FUNC! Exit");
+}
+
 //
 // PDO power-up.
 // 
@@ -548,30 +651,8 @@ NTSTATUS Pdo_EvtDevicePrepareHardware(
 
     pdoData = PdoGetData(Device);
 
-    switch (pdoData->TargetType)
-    {
-        // Expose XUSB interfaces
-    case Xbox360Wired:
-
-        status = Xusb_PrepareHardware(Device);
-
-        break;
-
-    case DualShock4Wired:
-
-        status = Ds4_PrepareHardware(Device);
-
-        break;
-
-    case XboxOneWired:
-
-        status = Xgip_PrepareHardware(Device);
-
-        break;
-
-    default:
-        break;
-    }
+    // Expose target specific interfaces
+    status = pdoData->Ops->PrepareHardware(Device);
 
     TraceEvents(TRACE_LEVEL_INFORMATION,
         TRACE_BUSPDO,
@@ -610,7 +691,7 @@ VOID Pdo_EvtIoInternalDeviceControl(
     PUCHAR                  blobBuffer;
 
 
-    TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_BUSPDO, "%!FUNC! Entry");
+    TraceHot(TRACE_BUSPDO, "%!FUNC! Entry");
 
     hDevice = WdfIoQueueGetDevice(Queue);
     pdoData = PdoGetData(hDevice);
@@ -622,8 +703,7 @@ VOID Pdo_EvtIoInternalDeviceControl(
     {
     case IOCTL_INTERNAL_USB_SUBMIT_URB:
 
-        TraceEvents(TRACE_LEVEL_VERBOSE,
-            TRACE_BUSPDO,
+        TraceHot(TRACE_BUSPDO,
             ">> IOCTL_INTERNAL_USB_SUBMIT_URB");
 
         urb = (PURB)URB_FROM_IRP(irp);
@@ -687,8 +767,7 @@ VOID Pdo_EvtIoInternalDeviceControl(
 
         case URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER:
 
-            TraceEvents(TRACE_LEVEL_VERBOSE,
-                TRACE_BUSPDO,
+            TraceHot(TRACE_BUSPDO,
                 ">> >> URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER");
 
             status = UsbPdo_BulkOrInterruptTransfer(urb, hDevice, Request);
@@ -850,8 +929,7 @@ VOID Pdo_EvtIoInternalDeviceControl(
             break;
         }
 
-        TraceEvents(TRACE_LEVEL_VERBOSE,
-            TRACE_BUSPDO,
+        TraceHot(TRACE_BUSPDO,
             "<<");
 
         break;
@@ -907,6 +985,6 @@ VOID Pdo_EvtIoInternalDeviceControl(
         WdfRequestComplete(Request, status);
     }
 
-    TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_BUSPDO, "%!FUNC! Exit with status %!STATUS!", status);
+    TraceHot(TRACE_BUSPDO, "%!FUNC! Exit with status %!STATUS!", status);
 }
 
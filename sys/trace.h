@@ -41,7 +41,11 @@
         WPP_DEFINE_BIT(TRACE_BYTEARRAY)                                \
         WPP_DEFINE_BIT(TRACE_DRIVER)                                   \
         WPP_DEFINE_BIT(TRACE_DS4)                                      \
+        WPP_DEFINE_BIT(TRACE_INPUTSLOT)                                \
+        WPP_DEFINE_BIT(TRACE_PLAYBACK)                                 \
         WPP_DEFINE_BIT(TRACE_QUEUE)                                    \
+        WPP_DEFINE_BIT(TRACE_REPORTFIFO)                               \
+        WPP_DEFINE_BIT(TRACE_TRANSFORM)                                \
         WPP_DEFINE_BIT(TRACE_USBPDO)                                   \
         WPP_DEFINE_BIT(TRACE_UTIL)                                     \
         WPP_DEFINE_BIT(TRACE_XGIP)                                     \
@@ -61,6 +65,41 @@
 #define WPP_LEVEL_FLAGS_ENABLED(lvl, flags) \
            (WPP_LEVEL_ENABLED(flags) && WPP_CONTROL(WPP_BIT_ ## flags).Level >= lvl)
 
+//
+// Per-report and per-URB tracing (TraceHot) is compiled out entirely,
+// argument setup included, unless VIGEM_HOT_PATH_TRACING is non-zero.
+// 
+#ifndef VIGEM_HOT_PATH_TRACING
+#define VIGEM_HOT_PATH_TRACING 1
+#endif
+
+//
+// Only every TraceHotSampleRate-th enabled TraceHot call gets logged,
+// see Driver.c
+// 
+#define TRACE_HOT_SAMPLE()                                                  \
+    (TraceHotSampleRate <= 1 ||                                             \
+     ((ULONG)InterlockedIncrement(&TraceHotSampleCount)                     \
+        % (ULONG)TraceHotSampleRate) == 0)
+
+#define WPP_HOTLEVEL_FLAGS_LOGGER(lvl, flags)                               \
+    WPP_LEVEL_LOGGER(flags)
+
+#define WPP_HOTLEVEL_FLAGS_ENABLED(lvl, flags)                              \
+    (VIGEM_HOT_PATH_TRACING &&                                              \
+     WPP_LEVEL_FLAGS_ENABLED(lvl, flags) && TRACE_HOT_SAMPLE())
+
+#define WPP_RECORDER_HOTLEVEL_FLAGS_ARGS(lvl, flags)                        \
+    WPP_RECORDER_LEVEL_FLAGS_ARGS(lvl, flags)
+
+//
+// The in-flight recorder isn't sampled; it would share the sample counter
+// with the ETW check of the same call
+// 
+#define WPP_RECORDER_HOTLEVEL_FLAGS_FILTER(lvl, flags)                      \
+    (VIGEM_HOT_PATH_TRACING &&                                              \
+     WPP_RECORDER_LEVEL_FLAGS_FILTER(lvl, flags))
+
 //
 // This comment block is scanned by the trace preprocessor to define our
 // Trace function.
@@ -68,5 +107,6 @@
 // begin_wpp config
 // FUNC Trace{FLAG=MYDRIVER_ALL_INFO}(LEVEL, MSG, ...);
 // FUNC TraceEvents(LEVEL, FLAGS, MSG, ...);
+// FUNC TraceHot{HOTLEVEL=TRACE_LEVEL_VERBOSE}(FLAGS, MSG, ...);
 // end_wpp
 //
@@ -131,29 +131,7 @@ NTSTATUS UsbPdo_GetDeviceDescriptorType(PURB urb, PPDO_DEVICE_DATA pCommon)
 {
     PUSB_DEVICE_DESCRIPTOR pDescriptor = (PUSB_DEVICE_DESCRIPTOR)urb->UrbControlDescriptorRequest.TransferBuffer;
 
-    switch (pCommon->TargetType)
-    {
-    case Xbox360Wired:
-
-        Xusb_GetDeviceDescriptorType(pDescriptor, pCommon);
-
-        break;
-
-    case DualShock4Wired:
-
-        Ds4_GetDeviceDescriptorType(pDescriptor, pCommon);
-
-        break;
-
-    case XboxOneWired:
-
-        Xgip_GetDeviceDescriptorType(pDescriptor, pCommon);
-
-        break;
-
-    default:
-        return STATUS_UNSUCCESSFUL;
-    }
+    pCommon->Ops->GetDeviceDescriptorType(pDescriptor, pCommon);
 
     return STATUS_SUCCESS;
 }
@@ -170,59 +148,15 @@ NTSTATUS UsbPdo_GetConfigurationDescriptorType(PURB urb, PPDO_DEVICE_DATA pCommo
     {
         ULONG length = sizeof(USB_CONFIGURATION_DESCRIPTOR);
 
-        switch (pCommon->TargetType)
-        {
-        case Xbox360Wired:
-
-            Xusb_GetConfigurationDescriptorType(Buffer, length);
-
-            break;
-        case DualShock4Wired:
-
-            Ds4_GetConfigurationDescriptorType(Buffer, length);
-
-            break;
-        case XboxOneWired:
-
-            Xgip_GetConfigurationDescriptorType(Buffer, length);
-
-            break;
-        default:
-            return STATUS_UNSUCCESSFUL;
-        }
+        pCommon->Ops->GetConfigurationDescriptorType(Buffer, length);
     }
 
     ULONG length = urb->UrbControlDescriptorRequest.TransferBufferLength;
 
     // Second request can store the whole descriptor
-    switch (pCommon->TargetType)
+    if (length >= pCommon->Ops->DescriptorSize)
     {
-    case Xbox360Wired:
-
-        if (length >= XUSB_DESCRIPTOR_SIZE)
-        {
-            Xusb_GetConfigurationDescriptorType(Buffer, XUSB_DESCRIPTOR_SIZE);
-        }
-
-        break;
-    case DualShock4Wired:
-
-        if (length >= DS4_DESCRIPTOR_SIZE)
-        {
-            Ds4_GetConfigurationDescriptorType(Buffer, DS4_DESCRIPTOR_SIZE);
-        }
-
-        break;
-    case XboxOneWired:
-
-        if (length >= XGIP_DESCRIPTOR_SIZE)
-        {
-            Xgip_GetConfigurationDescriptorType(Buffer, XGIP_DESCRIPTOR_SIZE);
-        }
-
-        break;
-    default:
-        return STATUS_UNSUCCESSFUL;
+        pCommon->Ops->GetConfigurationDescriptorType(Buffer, pCommon->Ops->DescriptorSize);
     }
 
     return STATUS_SUCCESS;
@@ -352,54 +286,16 @@ NTSTATUS UsbPdo_SelectConfiguration(PURB urb, PPDO_DEVICE_DATA pCommon)
         return STATUS_SUCCESS;
     }
 
-    switch (pCommon->TargetType)
+    if (urb->UrbHeader.Length < pCommon->Ops->ConfigurationSize)
     {
-    case Xbox360Wired:
-
-        if (urb->UrbHeader.Length < XUSB_CONFIGURATION_SIZE)
-        {
-            TraceEvents(TRACE_LEVEL_WARNING,
-                TRACE_USBPDO,
-                ">> >> >> URB_FUNCTION_SELECT_CONFIGURATION: Invalid ConfigurationDescriptor");
-            return STATUS_INVALID_PARAMETER;
-        }
-
-        Xusb_SelectConfiguration(pInfo);
-
-        break;
-
-    case DualShock4Wired:
-
-        if (urb->UrbHeader.Length < DS4_CONFIGURATION_SIZE)
-        {
-            TraceEvents(TRACE_LEVEL_WARNING,
-                TRACE_USBPDO,
-                ">> >> >> URB_FUNCTION_SELECT_CONFIGURATION: Invalid ConfigurationDescriptor");
-            return STATUS_INVALID_PARAMETER;
-        }
-
-        Ds4_SelectConfiguration(pInfo);
-
-        break;
-
-    case XboxOneWired:
-
-        if (urb->UrbHeader.Length < XGIP_CONFIGURATION_SIZE)
-        {
-            TraceEvents(TRACE_LEVEL_WARNING,
-                TRACE_USBPDO,
-                ">> >> >> URB_FUNCTION_SELECT_CONFIGURATION: Invalid ConfigurationDescriptor");
-            return STATUS_INVALID_PARAMETER;
-        }
-
-        Xgip_SelectConfiguration(pInfo);
-
-        break;
-
-    default:
-        return STATUS_UNSUCCESSFUL;
+        TraceEvents(TRACE_LEVEL_WARNING,
+            TRACE_USBPDO,
+            ">> >> >> URB_FUNCTION_SELECT_CONFIGURATION: Invalid ConfigurationDescriptor");
+        return STATUS_INVALID_PARAMETER;
     }
 
+    pCommon->Ops->SelectConfiguration(pInfo);
+
     return STATUS_SUCCESS;
 }
 
@@ -513,11 +409,7 @@ NTSTATUS UsbPdo_SelectInterface(PURB urb, PPDO_DEVICE_DATA pCommon)
 // 
 NTSTATUS UsbPdo_BulkOrInterruptTransfer(PURB urb, WDFDEVICE Device, WDFREQUEST Request)
 {
-    struct _URB_BULK_OR_INTERRUPT_TRANSFER*     pTransfer = &urb->UrbBulkOrInterruptTransfer;
-    NTSTATUS                                    status;
     PPDO_DEVICE_DATA                            pdoData;
-    WDFREQUEST                                  notifyRequest;
-    PUCHAR                                      blobBuffer;
 
     pdoData = PdoGetData(Device);
 
@@ -529,307 +421,7 @@ NTSTATUS UsbPdo_BulkOrInterruptTransfer(PURB urb, WDFDEVICE Device, WDFREQUEST R
         return STATUS_INVALID_PARAMETER;
     }
 
-    switch (pdoData->TargetType)
-    {
-    case Xbox360Wired:
-    {
-        PXUSB_DEVICE_DATA xusb = XusbGetData(Device);
-
-        // Check context
-        if (xusb == NULL)
-        {
-            TraceEvents(TRACE_LEVEL_ERROR,
-                TRACE_USBPDO,
-                "No XUSB context found on device %p",
-                Device);
-
-            return STATUS_UNSUCCESSFUL;
-        }
-
-        // Data coming FROM us TO higher driver
-        if (pTransfer->TransferFlags & USBD_TRANSFER_DIRECTION_IN)
-        {
-            TraceEvents(TRACE_LEVEL_VERBOSE,
-                TRACE_USBPDO,
-                ">> >> >> Incoming request, queuing...");
-
-            blobBuffer = WdfMemoryGetBuffer(xusb->InterruptBlobStorage, NULL);
-
-            if (XUSB_IS_DATA_PIPE(pTransfer))
-            {
-                //
-                // Send "boot sequence" first, then the actual inputs
-                // 
-                switch (xusb->InterruptInitStage)
-                {
-                case 0:
-                    pTransfer->TransferBufferLength = XUSB_INIT_STAGE_SIZE;
-                    xusb->InterruptInitStage++;
-                    RtlCopyMemory(
-                        pTransfer->TransferBuffer, 
-                        &blobBuffer[XUSB_BLOB_00_OFFSET],
-                        XUSB_INIT_STAGE_SIZE
-                        );
-                    return STATUS_SUCCESS;
-                case 1:
-                    pTransfer->TransferBufferLength = XUSB_INIT_STAGE_SIZE;
-                    xusb->InterruptInitStage++;
-                    RtlCopyMemory(
-                        pTransfer->TransferBuffer, 
-                        &blobBuffer[XUSB_BLOB_01_OFFSET],
-                        XUSB_INIT_STAGE_SIZE
-                        );
-                    return STATUS_SUCCESS;
-                case 2:
-                    pTransfer->TransferBufferLength = XUSB_INIT_STAGE_SIZE;
-                    xusb->InterruptInitStage++;
-                    RtlCopyMemory(
-                        pTransfer->TransferBuffer, 
-                        &blobBuffer[XUSB_BLOB_02_OFFSET],
-                        XUSB_INIT_STAGE_SIZE
-                        );
-                    return STATUS_SUCCESS;
-                case 3:
-                    pTransfer->TransferBufferLength = XUSB_INIT_STAGE_SIZE;
-                    xusb->InterruptInitStage++;
-                    RtlCopyMemory(
-                        pTransfer->TransferBuffer, 
-                        &blobBuffer[XUSB_BLOB_03_OFFSET],
-                        XUSB_INIT_STAGE_SIZE
-                        );
-                    return STATUS_SUCCESS;
-                case 4:
-                    pTransfer->TransferBufferLength = sizeof(XUSB_INTERRUPT_IN_PACKET);
-                    xusb->InterruptInitStage++;
-                    RtlCopyMemory(
-                        pTransfer->TransferBuffer, 
-                        &blobBuffer[XUSB_BLOB_04_OFFSET],
-                        sizeof(XUSB_INTERRUPT_IN_PACKET)
-                        );
-                    return STATUS_SUCCESS;
-                case 5:
-                    pTransfer->TransferBufferLength = XUSB_INIT_STAGE_SIZE;
-                    xusb->InterruptInitStage++;
-                    RtlCopyMemory(
-                        pTransfer->TransferBuffer, 
-                        &blobBuffer[XUSB_BLOB_05_OFFSET],
-                        XUSB_INIT_STAGE_SIZE
-                        );
-                    return STATUS_SUCCESS;
-                default:
-                    /* This request is sent periodically and relies on data the "feeder"
-                    * has to supply, so we queue this request and return with STATUS_PENDING.
-                    * The request gets completed as soon as the "feeder" sent an update. */
-                    status = WdfRequestForwardToIoQueue(Request, pdoData->PendingUsbInRequests);
-
-                    return (NT_SUCCESS(status)) ? STATUS_PENDING : status;
-                }
-            }
-
-            if (XUSB_IS_CONTROL_PIPE(pTransfer))
-            {
-                if (!xusb->ReportedCapabilities && pTransfer->TransferBufferLength >= XUSB_INIT_STAGE_SIZE)
-                {
-                    RtlCopyMemory(
-                        pTransfer->TransferBuffer, 
-                        &blobBuffer[XUSB_BLOB_06_OFFSET],
-                        XUSB_INIT_STAGE_SIZE
-                        );
-
-                    xusb->ReportedCapabilities = TRUE;
-
-                    return STATUS_SUCCESS;
-                }
-
-                status = WdfRequestForwardToIoQueue(Request, xusb->HoldingUsbInRequests);
-
-                return (NT_SUCCESS(status)) ? STATUS_PENDING : status;
-            }
-        }
-
-        // Data coming FROM the higher driver TO us
-        TraceEvents(TRACE_LEVEL_VERBOSE,
-            TRACE_USBPDO,
-            ">> >> >> URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER: Handle %p, Flags %X, Length %d",
-            pTransfer->PipeHandle,
-            pTransfer->TransferFlags,
-            pTransfer->TransferBufferLength);
-
-        if (pTransfer->TransferBufferLength == XUSB_LEDSET_SIZE) // Led
-        {
-            PUCHAR Buffer = pTransfer->TransferBuffer;
-
-            TraceEvents(TRACE_LEVEL_VERBOSE,
-                TRACE_USBPDO,
-                "-- LED Buffer: %02X %02X %02X",
-                Buffer[0], Buffer[1], Buffer[2]);
-
-            // extract LED byte to get controller slot
-            if (Buffer[0] == 0x01 && Buffer[1] == 0x03 && Buffer[2] >= 0x02)
-            {
-                if (Buffer[2] == 0x02) xusb->LedNumber = 0;
-                if (Buffer[2] == 0x03) xusb->LedNumber = 1;
-                if (Buffer[2] == 0x04) xusb->LedNumber = 2;
-                if (Buffer[2] == 0x05) xusb->LedNumber = 3;
-
-                TraceEvents(TRACE_LEVEL_INFORMATION,
-                    TRACE_USBPDO,
-                    "-- LED Number: %d",
-                    xusb->LedNumber);
-                //
-                // Report back to FDO that we are ready to operate
-                // 
-                BUS_PDO_REPORT_STAGE_RESULT(
-                    pdoData->BusInterface, 
-                    ViGEmPdoInitFinished, 
-                    pdoData->SerialNo, 
-                    STATUS_SUCCESS
-                );
-            }
-        }
-
-        // Extract rumble (vibration) information
-        if (pTransfer->TransferBufferLength == XUSB_RUMBLE_SIZE)
-        {
-            PUCHAR Buffer = pTransfer->TransferBuffer;
-
-            TraceEvents(TRACE_LEVEL_VERBOSE,
-                TRACE_USBPDO,
-                "-- Rumble Buffer: %02X %02X %02X %02X %02X %02X %02X %02X",
-                Buffer[0],
-                Buffer[1],
-                Buffer[2],
-                Buffer[3],
-                Buffer[4],
-                Buffer[5],
-                Buffer[6],
-                Buffer[7]);
-
-            RtlCopyBytes(xusb->Rumble, Buffer, pTransfer->TransferBufferLength);
-        }
-
-        // Notify user-mode process that new data is available
-        status = WdfIoQueueRetrieveNextRequest(pdoData->PendingNotificationRequests, &notifyRequest);
-
-        if (NT_SUCCESS(status))
-        {
-            PXUSB_REQUEST_NOTIFICATION notify = NULL;
-
-            status = WdfRequestRetrieveOutputBuffer(notifyRequest, sizeof(XUSB_REQUEST_NOTIFICATION), (PVOID)&notify, NULL);
-
-            if (NT_SUCCESS(status))
-            {
-                // Assign values to output buffer
-                notify->Size = sizeof(XUSB_REQUEST_NOTIFICATION);
-                notify->SerialNo = pdoData->SerialNo;
-                notify->LedNumber = xusb->LedNumber;
-                notify->LargeMotor = xusb->Rumble[3];
-                notify->SmallMotor = xusb->Rumble[4];
-
-                WdfRequestCompleteWithInformation(notifyRequest, status, notify->Size);
-            }
-            else
-            {
-                TraceEvents(TRACE_LEVEL_ERROR,
-                    TRACE_USBPDO,
-                    "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
-                    status);
-            }
-        }
-        else
-        {
-            TraceEvents(TRACE_LEVEL_WARNING,
-                    TRACE_USBPDO,
-                    "!! [XUSB] WdfIoQueueRetrieveNextRequest failed with status %!STATUS!",
-                    status);
-        }
-
-        break;
-    }
-    case DualShock4Wired:
-    {
-        PDS4_DEVICE_DATA ds4Data = Ds4GetData(Device);
-
-        // Data coming FROM us TO higher driver
-        if (pTransfer->TransferFlags & USBD_TRANSFER_DIRECTION_IN
-            && pTransfer->PipeHandle == (USBD_PIPE_HANDLE)0xFFFF0084)
-        {
-            TraceEvents(TRACE_LEVEL_VERBOSE,
-                TRACE_USBPDO,
-                ">> >> >> Incoming request, queuing...");
-
-            /* This request is sent periodically and relies on data the "feeder"
-               has to supply, so we queue this request and return with STATUS_PENDING.
-               The request gets completed as soon as the "feeder" sent an update. */
-            status = WdfRequestForwardToIoQueue(Request, pdoData->PendingUsbInRequests);
-
-            return (NT_SUCCESS(status)) ? STATUS_PENDING : status;
-        }
-
-        // Store relevant bytes of buffer in PDO context
-        RtlCopyBytes(&ds4Data->OutputReport,
-            (PUCHAR)pTransfer->TransferBuffer + DS4_OUTPUT_BUFFER_OFFSET,
-            DS4_OUTPUT_BUFFER_LENGTH);
-
-        // Notify user-mode process that new data is available
-        status = WdfIoQueueRetrieveNextRequest(pdoData->PendingNotificationRequests, &notifyRequest);
-
-        if (NT_SUCCESS(status))
-        {
-            PDS4_REQUEST_NOTIFICATION notify = NULL;
-
-            status = WdfRequestRetrieveOutputBuffer(notifyRequest, sizeof(DS4_REQUEST_NOTIFICATION), (PVOID)&notify, NULL);
-
-            if (NT_SUCCESS(status))
-            {
-                // Assign values to output buffer
-                notify->Size = sizeof(DS4_REQUEST_NOTIFICATION);
-                notify->SerialNo = pdoData->SerialNo;
-                notify->Report = ds4Data->OutputReport;
-
-                WdfRequestCompleteWithInformation(notifyRequest, status, notify->Size);
-            }
-            else
-            {
-                TraceEvents(TRACE_LEVEL_ERROR,
-                    TRACE_USBPDO,
-                    "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
-                    status);
-            }
-        }
-
-        break;
-    }
-    case XboxOneWired:
-    {
-        PXGIP_DEVICE_DATA xgipData = XgipGetData(Device);
-
-        // Data coming FROM us TO higher driver
-        if (pTransfer->TransferFlags & USBD_TRANSFER_DIRECTION_IN)
-        {
-            KdPrint((DRIVERNAME ">> >> >> Incoming request, queuing..."));
-
-            /* This request is sent periodically and relies on data the "feeder"
-            has to supply, so we queue this request and return with STATUS_PENDING.
-            The request gets completed as soon as the "feeder" sent an update. */
-            status = WdfRequestForwardToIoQueue(Request, xgipData->PendingUsbInRequests);
-
-            return (NT_SUCCESS(status)) ? STATUS_PENDING : status;
-        }
-
-        // Data coming FROM the higher driver TO us
-        KdPrint((DRIVERNAME ">> >> >> URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER: Handle %p, Flags %X, Length %d",
-            pTransfer->PipeHandle,
-            pTransfer->TransferFlags,
-            pTransfer->TransferBufferLength));
-
-        break;
-    }
-    default:
-        break;
-    }
-
-    return STATUS_SUCCESS;
+    return pdoData->Ops->BulkOrInterruptTransfer(urb, Device, Request);
 }
 
 //
@@ -867,6 +459,8 @@ NTSTATUS UsbPdo_AbortPipe(WDFDEVICE Device)
     // Higher driver shutting down, emptying PDOs queues
     WdfIoQueuePurge(pdoData->PendingUsbInRequests, NULL, NULL);
     WdfIoQueuePurge(pdoData->PendingNotificationRequests, NULL, NULL);
+    WdfIoQueuePurge(pdoData->PendingDeliveryWaiters, NULL, NULL);
+    WdfTimerStop(pdoData->DeliveryWaitTimer, FALSE);
 
     return STATUS_SUCCESS;
 }
@@ -29,11 +29,13 @@
 #include <wdmguid.h>
 #include "xgip.tmh"
 
-NTSTATUS Xgip_PreparePdo(PWDFDEVICE_INIT DeviceInit, PUNICODE_STRING DeviceId, PUNICODE_STRING DeviceDescription)
+NTSTATUS Xgip_PreparePdo(PWDFDEVICE_INIT DeviceInit, PPDO_IDENTIFICATION_DESCRIPTION Description, PUNICODE_STRING DeviceId, PUNICODE_STRING DeviceDescription)
 {
     NTSTATUS status;
     UNICODE_STRING buffer;
 
+    UNREFERENCED_PARAMETER(Description);
+
     // prepare device description
     status = RtlUnicodeStringInit(DeviceDescription, L"Virtual Xbox One Controller");
     if (!NT_SUCCESS(status))
@@ -125,14 +127,26 @@ NTSTATUS Xgip_PrepareHardware(WDFDEVICE Device)
     return STATUS_SUCCESS;
 }
 
-NTSTATUS Xgip_AssignPdoContext(WDFDEVICE Device)
+NTSTATUS Xgip_AssignPdoContext(WDFDEVICE Device, PPDO_IDENTIFICATION_DESCRIPTION Description)
 {
     NTSTATUS status;
+    PXGIP_DEVICE_DATA xgip = NULL;
+    WDF_OBJECT_ATTRIBUTES attributes;
 
-    PXGIP_DEVICE_DATA xgip = XgipGetData(Device);
+    UNREFERENCED_PARAMETER(Description);
 
     TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_XGIP, "Initializing XGIP context...");
 
+    // Add XGIP-specific device data context
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, XGIP_DEVICE_DATA);
+
+    status = WdfObjectAllocateContext(Device, &attributes, (PVOID)&xgip);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_XGIP, "WdfObjectAllocateContext failed with status %!STATUS!", status);
+        return status;
+    }
+
     RtlZeroMemory(xgip, sizeof(XGIP_DEVICE_DATA));
 
     // Set fixed report id
@@ -152,6 +166,8 @@ NTSTATUS Xgip_AssignPdoContext(WDFDEVICE Device)
         return status;
     }
 
+    Bus_TrackObject(WdfPdoGetParent(Device), Device, xgip->PendingUsbInRequests, ViGEmResourceQueue);
+
     // Create and assign queue for user-land notification requests
     WDF_IO_QUEUE_CONFIG_INIT(&notificationsQueueConfig, WdfIoQueueDispatchManual);
 
@@ -162,6 +178,8 @@ NTSTATUS Xgip_AssignPdoContext(WDFDEVICE Device)
         return status;
     }
 
+    Bus_TrackObject(WdfPdoGetParent(Device), Device, xgip->PendingNotificationRequests, ViGEmResourceQueue);
+
     WDF_OBJECT_ATTRIBUTES collectionAttribs;
     WDF_OBJECT_ATTRIBUTES_INIT(&collectionAttribs);
 
@@ -174,6 +192,8 @@ NTSTATUS Xgip_AssignPdoContext(WDFDEVICE Device)
         return status;
     }
 
+    Bus_TrackObject(WdfPdoGetParent(Device), Device, xgip->XboxgipSysInitCollection, ViGEmResourceCollection);
+
     // Initialize periodic timer
     WDF_TIMER_CONFIG timerConfig;
     WDF_TIMER_CONFIG_INIT_PERIODIC(&timerConfig, Xgip_SysInitTimerFunc, XGIP_SYS_INIT_PERIOD);
@@ -193,6 +213,8 @@ NTSTATUS Xgip_AssignPdoContext(WDFDEVICE Device)
         return status;
     }
 
+    Bus_TrackObject(WdfPdoGetParent(Device), Device, xgip->XboxgipSysInitTimer, ViGEmResourceTimer);
+
     return STATUS_SUCCESS;
 }
 
@@ -407,3 +429,230 @@ VOID Xgip_SysInitTimerFunc(
     }
 }
 
+//
+// Dispatches interrupt transfers of the XGIP endpoints.
+// 
+NTSTATUS Xgip_BulkOrInterruptTransfer(PURB urb, WDFDEVICE Device, WDFREQUEST Request)
+{
+    struct _URB_BULK_OR_INTERRUPT_TRANSFER*     pTransfer = &urb->UrbBulkOrInterruptTransfer;
+    NTSTATUS                                    status;
+
+    PXGIP_DEVICE_DATA xgipData = XgipGetData(Device);
+
+    // Data coming FROM us TO higher driver
+    if (pTransfer->TransferFlags & USBD_TRANSFER_DIRECTION_IN)
+    {
+        KdPrint((DRIVERNAME ">> >> >> Incoming request, queuing..."));
+
+        // System initialization packets get served by Xgip_SysInitTimerFunc
+        if (WdfCollectionGetCount(xgipData->XboxgipSysInitCollection) > 0)
+        {
+            status = WdfRequestForwardToIoQueue(Request, xgipData->PendingUsbInRequests);
+
+            return (NT_SUCCESS(status)) ? STATUS_PENDING : status;
+        }
+
+        // Deliver latest cached report or wait for the "feeder"
+        return Bus_QueueInRequest(Device, xgipData->PendingUsbInRequests, Request, urb);
+    }
+
+    // Data coming FROM the higher driver TO us
+    KdPrint((DRIVERNAME ">> >> >> URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER: Handle %p, Flags %X, Length %d",
+        pTransfer->PipeHandle,
+        pTransfer->TransferFlags,
+        pTransfer->TransferBufferLength));
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Caches a submitted report or collects a system initialization packet.
+// 
+// The event counter in the cache only advances for reports that get delivered.
+// 
+NTSTATUS Xgip_CacheReport(WDFDEVICE Device, PVOID Report, const UCHAR* MergeMask, WDFQUEUE* Queue)
+{
+    NTSTATUS status;
+    PPDO_DEVICE_DATA pdoData = PdoGetData(Device);
+    PXGIP_DEVICE_DATA xgip = XgipGetData(Device);
+    KIRQL irql;
+
+    *Queue = NULL;
+
+    // Request is control data
+    if (((PXGIP_SUBMIT_INTERRUPT)Report)->Size == sizeof(XGIP_SUBMIT_INTERRUPT))
+    {
+        PXGIP_SUBMIT_INTERRUPT interrupt = (PXGIP_SUBMIT_INTERRUPT)Report;
+        WDFMEMORY memory;
+        WDF_OBJECT_ATTRIBUTES memAttribs;
+        WDF_OBJECT_ATTRIBUTES_INIT(&memAttribs);
+
+        memAttribs.ParentObject = Device;
+
+        // Allocate kernel memory
+        status = WdfMemoryCreate(&memAttribs, NonPagedPool, VIGEM_POOL_TAG,
+            interrupt->InterruptLength, &memory, NULL);
+        if (!NT_SUCCESS(status))
+        {
+            KdPrint((DRIVERNAME "WdfMemoryCreate failed with status 0x%X\n", status));
+            return status;
+        }
+
+        Bus_TrackObject(WdfPdoGetParent(Device), Device, memory, ViGEmResourceMemory);
+
+        // Copy interrupt buffer to memory object
+        status = WdfMemoryCopyFromBuffer(memory, 0, interrupt->Interrupt, interrupt->InterruptLength);
+        if (!NT_SUCCESS(status))
+        {
+            KdPrint((DRIVERNAME "WdfMemoryCopyFromBuffer failed with status 0x%X\n", status));
+            return status;
+        }
+
+        // Add memory object to collection
+        status = WdfCollectionAdd(xgip->XboxgipSysInitCollection, memory);
+        if (!NT_SUCCESS(status))
+        {
+            KdPrint((DRIVERNAME "WdfCollectionAdd failed with status 0x%X\n", status));
+            return status;
+        }
+
+        // Check if all packets have been received
+        xgip->XboxgipSysInitReady =
+            WdfCollectionGetCount(xgip->XboxgipSysInitCollection) == XGIP_SYS_INIT_PACKETS;
+
+        // If all packets are cached, start initialization timer
+        if (xgip->XboxgipSysInitReady)
+        {
+            WdfTimerStart(xgip->XboxgipSysInitTimer, XGIP_SYS_INIT_PERIOD);
+        }
+
+        return STATUS_SUCCESS;
+    }
+
+    SeqLockWriteBegin(&pdoData->ReportLock, &irql);
+
+    // Fill in the fields a delta submission left out
+    if (MergeMask != NULL)
+    {
+        ReportMergeMasked(&((PXGIP_SUBMIT_REPORT)Report)->Report, xgip->Report + 4, MergeMask, sizeof(XGIP_REPORT));
+    }
+
+    // Don't waste pending IRP if input hasn't changed
+    if (Bus_DropDuplicateReport(pdoData,
+        xgip->Report + 4,
+        &((PXGIP_SUBMIT_REPORT)Report)->Report,
+        NULL,
+        sizeof(XGIP_REPORT)))
+    {
+        SeqLockWriteAbort(&pdoData->ReportLock, irql);
+
+        TraceHot(TRACE_XGIP,
+            "Input report hasn't changed since last update");
+        return STATUS_SUCCESS;
+    }
+
+    // Increase event counter on every delivered report (can roll-over)
+    xgip->Report[2]++;
+
+    /* Copy report to cache
+     * Skip first four bytes as they are not part of the report */
+    RtlCopyBytes(xgip->Report + 4, &((PXGIP_SUBMIT_REPORT)Report)->Report, sizeof(XGIP_REPORT));
+
+    Bus_StateTableStore(pdoData, &((PXGIP_SUBMIT_REPORT)Report)->Report);
+
+    SeqLockWriteEnd(&pdoData->ReportLock, irql);
+
+    *Queue = xgip->PendingUsbInRequests;
+
+    return STATUS_SUCCESS;
+}
+
+VOID Xgip_WrapReport(PVOID Submit, ULONG SerialNo, PVIGEM_TARGET_REPORT Report)
+{
+    XGIP_SUBMIT_REPORT_INIT((PXGIP_SUBMIT_REPORT)Submit, SerialNo);
+    ((PXGIP_SUBMIT_REPORT)Submit)->Report = Report->Xgip;
+}
+
+BOOLEAN Xgip_UnwrapReport(PVOID Submit, PVIGEM_TARGET_REPORT Report)
+{
+    // Interrupt (control) data shares the submission path
+    if (((PXGIP_SUBMIT_INTERRUPT)Submit)->Size == sizeof(XGIP_SUBMIT_INTERRUPT))
+    {
+        return FALSE;
+    }
+
+    Report->Xgip = ((PXGIP_SUBMIT_REPORT)Submit)->Report;
+
+    return TRUE;
+}
+
+VOID Xgip_CopyReportToUrb(WDFDEVICE Device, PURB Urb)
+{
+    Urb->UrbBulkOrInterruptTransfer.TransferBufferLength = XGIP_REPORT_SIZE;
+
+    SeqLockReadCopy(&PdoGetData(Device)->ReportLock,
+        Urb->UrbBulkOrInterruptTransfer.TransferBuffer,
+        XgipGetData(Device)->Report,
+        XGIP_REPORT_SIZE);
+}
+
+WDFQUEUE Xgip_GetInRequestQueue(WDFDEVICE Device)
+{
+    // Kept next to the interrupt transfers it holds back
+    return XgipGetData(Device)->PendingUsbInRequests;
+}
+
+//
+// Input report fields, indexed by VIGEM_XGIP_FIELD
+// 
+static const VIGEM_REPORT_FIELD XgipReportFields[ViGEmXgipFields] =
+{
+    [ViGEmXgipButtons1] = VIGEM_REPORT_FIELD_OF(XGIP_REPORT, Buttons1),
+    [ViGEmXgipButtons2] = VIGEM_REPORT_FIELD_OF(XGIP_REPORT, Buttons2),
+    [ViGEmXgipLeftTrigger] = VIGEM_REPORT_FIELD_OF(XGIP_REPORT, LeftTrigger),
+    [ViGEmXgipRightTrigger] = VIGEM_REPORT_FIELD_OF(XGIP_REPORT, RightTrigger),
+    [ViGEmXgipThumbLX] = VIGEM_REPORT_FIELD_OF(XGIP_REPORT, ThumbLX),
+    [ViGEmXgipThumbLY] = VIGEM_REPORT_FIELD_OF(XGIP_REPORT, ThumbLY),
+    [ViGEmXgipThumbRX] = VIGEM_REPORT_FIELD_OF(XGIP_REPORT, ThumbRX),
+    [ViGEmXgipThumbRY] = VIGEM_REPORT_FIELD_OF(XGIP_REPORT, ThumbRY)
+};
+
+//
+// Analog axes of the input report
+// 
+static const VIGEM_REPORT_AXIS XgipReportAxes[] =
+{
+    VIGEM_REPORT_AXIS_OF(XGIP_REPORT, LeftTrigger, ViGEmAxisUnsigned10),
+    VIGEM_REPORT_AXIS_OF(XGIP_REPORT, RightTrigger, ViGEmAxisUnsigned10),
+    VIGEM_REPORT_AXIS_OF(XGIP_REPORT, ThumbLX, ViGEmAxisSigned16),
+    VIGEM_REPORT_AXIS_OF(XGIP_REPORT, ThumbLY, ViGEmAxisSigned16),
+    VIGEM_REPORT_AXIS_OF(XGIP_REPORT, ThumbRX, ViGEmAxisSigned16),
+    VIGEM_REPORT_AXIS_OF(XGIP_REPORT, ThumbRY, ViGEmAxisSigned16)
+};
+
+const VIGEM_TARGET_OPS XgipTargetOps =
+{
+    .TargetType = XboxOneWired,
+    .DescriptorSize = XGIP_DESCRIPTOR_SIZE,
+    .ConfigurationSize = XGIP_CONFIGURATION_SIZE,
+    .ReportSize = sizeof(XGIP_REPORT),
+    .Fields = XgipReportFields,
+    .FieldCount = ViGEmXgipFields,
+    .Axes = XgipReportAxes,
+    .AxisCount = ARRAYSIZE(XgipReportAxes),
+    .UrbReportOffset = 4,
+    .ButtonsOffset = FIELD_OFFSET(XGIP_REPORT, Buttons1),
+    .PreparePdo = Xgip_PreparePdo,
+    .AssignPdoContext = Xgip_AssignPdoContext,
+    .PrepareHardware = Xgip_PrepareHardware,
+    .GetDeviceDescriptorType = Xgip_GetDeviceDescriptorType,
+    .GetConfigurationDescriptorType = Xgip_GetConfigurationDescriptorType,
+    .SelectConfiguration = Xgip_SelectConfiguration,
+    .BulkOrInterruptTransfer = Xgip_BulkOrInterruptTransfer,
+    .CacheReport = Xgip_CacheReport,
+    .WrapReport = Xgip_WrapReport,
+    .UnwrapReport = Xgip_UnwrapReport,
+    .CopyReportToUrb = Xgip_CopyReportToUrb,
+    .GetInRequestQueue = Xgip_GetInRequestQueue,
+    .QueueNotification = NULL
+};
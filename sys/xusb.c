@@ -31,8 +31,7 @@
 
 NTSTATUS Xusb_PreparePdo(
     PWDFDEVICE_INIT DeviceInit,
-    USHORT VendorId,
-    USHORT ProductId,
+    PPDO_IDENTIFICATION_DESCRIPTION Description,
     PUNICODE_STRING DeviceId,
     PUNICODE_STRING DeviceDescription)
 {
@@ -51,7 +50,7 @@ NTSTATUS Xusb_PreparePdo(
     }
 
     // Set hardware ID
-    RtlUnicodeStringPrintf(&buffer, L"USB\\VID_%04X&PID_%04X", VendorId, ProductId);
+    RtlUnicodeStringPrintf(&buffer, L"USB\\VID_%04X&PID_%04X", Description->VendorId, Description->ProductId);
 
     RtlUnicodeStringCopy(DeviceId, &buffer);
 
@@ -217,18 +216,33 @@ NTSTATUS Xusb_PrepareHardware(WDFDEVICE Device)
     return STATUS_SUCCESS;
 }
 
-NTSTATUS Xusb_AssignPdoContext(WDFDEVICE Device)
+NTSTATUS Xusb_AssignPdoContext(WDFDEVICE Device, PPDO_IDENTIFICATION_DESCRIPTION Description)
 {
     NTSTATUS                status;
     WDF_OBJECT_ATTRIBUTES   attributes;
     PUCHAR                  blobBuffer;
 
-    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
-    attributes.ParentObject = Device;
+    PXUSB_DEVICE_DATA       xusb = NULL;
+
+    UNREFERENCED_PARAMETER(Description);
 
     TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_XUSB, "Initializing XUSB context...");
 
-    PXUSB_DEVICE_DATA xusb = XusbGetData(Device);
+    // Add XUSB-specific device data context
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, XUSB_DEVICE_DATA);
+
+    status = WdfObjectAllocateContext(Device, &attributes, (PVOID)&xusb);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_XUSB,
+            "WdfObjectAllocateContext failed with status %!STATUS!",
+            status);
+        return status;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = Device;
 
     RtlZeroMemory(xusb, sizeof(XUSB_DEVICE_DATA));
 
@@ -255,6 +269,8 @@ NTSTATUS Xusb_AssignPdoContext(WDFDEVICE Device)
         return status;
     }
 
+    Bus_TrackObject(WdfPdoGetParent(Device), Device, xusb->InterruptBlobStorage, ViGEmResourceMemory);
+
     // Fill blob storage
     COPY_BYTE_ARRAY(blobBuffer, P99_PROTECT({
         // 0
@@ -293,6 +309,8 @@ NTSTATUS Xusb_AssignPdoContext(WDFDEVICE Device)
         return status;
     }
 
+    Bus_TrackObject(WdfPdoGetParent(Device), Device, xusb->HoldingUsbInRequests, ViGEmResourceQueue);
+
     return STATUS_SUCCESS;
 }
 
@@ -605,7 +623,8 @@ NTSTATUS Xusb_GetUserIndex(WDFDEVICE Device, PXUSB_GET_USER_INDEX Request)
         TraceEvents(TRACE_LEVEL_ERROR,
             TRACE_XUSB,
             "PdoGetData failed");
-        return STATUS_INVALID_PARAMETER;
+        status = STATUS_INVALID_PARAMETER;
+        goto userIndexEnd;
     }
 
     // Check if caller owns this PDO
@@ -616,7 +635,8 @@ NTSTATUS Xusb_GetUserIndex(WDFDEVICE Device, PXUSB_GET_USER_INDEX Request)
             "PID mismatch: %d != %d",
             pdoData->OwnerProcessId,
             CURRENT_PROCESS_ID());
-        return STATUS_ACCESS_DENIED;
+        status = STATUS_ACCESS_DENIED;
+        goto userIndexEnd;
     }
 
     userIndex = XusbGetData(hChild)->LedNumber;
@@ -633,7 +653,351 @@ NTSTATUS Xusb_GetUserIndex(WDFDEVICE Device, PXUSB_GET_USER_INDEX Request)
         status = STATUS_INVALID_DEVICE_OBJECT_PARAMETER;
     }
 
+userIndexEnd:
+
+    Bus_PutPdo(hChild);
+
     TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_XUSB, "%!FUNC! Exit with status %!STATUS!", status);
 
     return status;
 }
+
+//
+// Dispatches interrupt transfers on the XUSB data and control pipes.
+// 
+NTSTATUS Xusb_BulkOrInterruptTransfer(PURB urb, WDFDEVICE Device, WDFREQUEST Request)
+{
+    struct _URB_BULK_OR_INTERRUPT_TRANSFER*     pTransfer = &urb->UrbBulkOrInterruptTransfer;
+    NTSTATUS                                    status;
+    PPDO_DEVICE_DATA                            pdoData = PdoGetData(Device);
+    WDFREQUEST                                  notifyRequest;
+    PUCHAR                                      blobBuffer;
+
+    PXUSB_DEVICE_DATA xusb = XusbGetData(Device);
+
+    // Check context
+    if (xusb == NULL)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR,
+            TRACE_XUSB,
+            "No XUSB context found on device %p",
+            Device);
+
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    // Data coming FROM us TO higher driver
+    if (pTransfer->TransferFlags & USBD_TRANSFER_DIRECTION_IN)
+    {
+        TraceHot(TRACE_XUSB,
+            ">> >> >> Incoming request, queuing...");
+
+        blobBuffer = WdfMemoryGetBuffer(xusb->InterruptBlobStorage, NULL);
+
+        if (XUSB_IS_DATA_PIPE(pTransfer))
+        {
+            //
+            // Send "boot sequence" first, then the actual inputs
+            // 
+            switch (xusb->InterruptInitStage)
+            {
+            case 0:
+                pTransfer->TransferBufferLength = XUSB_INIT_STAGE_SIZE;
+                xusb->InterruptInitStage++;
+                RtlCopyMemory(
+                    pTransfer->TransferBuffer, 
+                    &blobBuffer[XUSB_BLOB_00_OFFSET],
+                    XUSB_INIT_STAGE_SIZE
+                    );
+                return STATUS_SUCCESS;
+            case 1:
+                pTransfer->TransferBufferLength = XUSB_INIT_STAGE_SIZE;
+                xusb->InterruptInitStage++;
+                RtlCopyMemory(
+                    pTransfer->TransferBuffer, 
+                    &blobBuffer[XUSB_BLOB_01_OFFSET],
+                    XUSB_INIT_STAGE_SIZE
+                    );
+                return STATUS_SUCCESS;
+            case 2:
+                pTransfer->TransferBufferLength = XUSB_INIT_STAGE_SIZE;
+                xusb->InterruptInitStage++;
+                RtlCopyMemory(
+                    pTransfer->TransferBuffer, 
+                    &blobBuffer[XUSB_BLOB_02_OFFSET],
+                    XUSB_INIT_STAGE_SIZE
+                    );
+                return STATUS_SUCCESS;
+            case 3:
+                pTransfer->TransferBufferLength = XUSB_INIT_STAGE_SIZE;
+                xusb->InterruptInitStage++;
+                RtlCopyMemory(
+                    pTransfer->TransferBuffer, 
+                    &blobBuffer[XUSB_BLOB_03_OFFSET],
+                    XUSB_INIT_STAGE_SIZE
+                    );
+                return STATUS_SUCCESS;
+            case 4:
+                pTransfer->TransferBufferLength = sizeof(XUSB_INTERRUPT_IN_PACKET);
+                xusb->InterruptInitStage++;
+                RtlCopyMemory(
+                    pTransfer->TransferBuffer, 
+                    &blobBuffer[XUSB_BLOB_04_OFFSET],
+                    sizeof(XUSB_INTERRUPT_IN_PACKET)
+                    );
+                return STATUS_SUCCESS;
+            case 5:
+                pTransfer->TransferBufferLength = XUSB_INIT_STAGE_SIZE;
+                xusb->InterruptInitStage++;
+                RtlCopyMemory(
+                    pTransfer->TransferBuffer, 
+                    &blobBuffer[XUSB_BLOB_05_OFFSET],
+                    XUSB_INIT_STAGE_SIZE
+                    );
+                return STATUS_SUCCESS;
+            default:
+                // Deliver latest cached report or wait for the "feeder"
+                return Bus_QueueInRequest(Device, pdoData->PendingUsbInRequests, Request, urb);
+            }
+        }
+
+        if (XUSB_IS_CONTROL_PIPE(pTransfer))
+        {
+            if (!xusb->ReportedCapabilities && pTransfer->TransferBufferLength >= XUSB_INIT_STAGE_SIZE)
+            {
+                RtlCopyMemory(
+                    pTransfer->TransferBuffer, 
+                    &blobBuffer[XUSB_BLOB_06_OFFSET],
+                    XUSB_INIT_STAGE_SIZE
+                    );
+
+                xusb->ReportedCapabilities = TRUE;
+
+                return STATUS_SUCCESS;
+            }
+
+            status = WdfRequestForwardToIoQueue(Request, xusb->HoldingUsbInRequests);
+
+            return (NT_SUCCESS(status)) ? STATUS_PENDING : status;
+        }
+    }
+
+    // Data coming FROM the higher driver TO us
+    TraceHot(TRACE_XUSB,
+        ">> >> >> URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER: Handle %p, Flags %X, Length %d",
+        pTransfer->PipeHandle,
+        pTransfer->TransferFlags,
+        pTransfer->TransferBufferLength);
+
+    if (pTransfer->TransferBufferLength == XUSB_LEDSET_SIZE) // Led
+    {
+        PUCHAR Buffer = pTransfer->TransferBuffer;
+
+        TraceEvents(TRACE_LEVEL_VERBOSE,
+            TRACE_XUSB,
+            "-- LED Buffer: %02X %02X %02X",
+            Buffer[0], Buffer[1], Buffer[2]);
+
+        // extract LED byte to get controller slot
+        if (Buffer[0] == 0x01 && Buffer[1] == 0x03 && Buffer[2] >= 0x02)
+        {
+            if (Buffer[2] == 0x02) xusb->LedNumber = 0;
+            if (Buffer[2] == 0x03) xusb->LedNumber = 1;
+            if (Buffer[2] == 0x04) xusb->LedNumber = 2;
+            if (Buffer[2] == 0x05) xusb->LedNumber = 3;
+
+            TraceEvents(TRACE_LEVEL_INFORMATION,
+                TRACE_XUSB,
+                "-- LED Number: %d",
+                xusb->LedNumber);
+            //
+            // Report back to FDO that we are ready to operate
+            // 
+            BUS_PDO_REPORT_STAGE_RESULT(
+                pdoData->BusInterface, 
+                ViGEmPdoInitFinished, 
+                pdoData->SerialNo, 
+                STATUS_SUCCESS
+            );
+        }
+    }
+
+    // Extract rumble (vibration) information
+    if (pTransfer->TransferBufferLength == XUSB_RUMBLE_SIZE)
+    {
+        PUCHAR Buffer = pTransfer->TransferBuffer;
+
+        TraceHot(TRACE_XUSB,
+            "-- Rumble Buffer: %02X %02X %02X %02X %02X %02X %02X %02X",
+            Buffer[0],
+            Buffer[1],
+            Buffer[2],
+            Buffer[3],
+            Buffer[4],
+            Buffer[5],
+            Buffer[6],
+            Buffer[7]);
+
+        RtlCopyBytes(xusb->Rumble, Buffer, pTransfer->TransferBufferLength);
+    }
+
+    // Notify user-mode process that new data is available
+    status = WdfIoQueueRetrieveNextRequest(pdoData->PendingNotificationRequests, &notifyRequest);
+
+    if (NT_SUCCESS(status))
+    {
+        PXUSB_REQUEST_NOTIFICATION notify = NULL;
+
+        status = WdfRequestRetrieveOutputBuffer(notifyRequest, sizeof(XUSB_REQUEST_NOTIFICATION), (PVOID)&notify, NULL);
+
+        if (NT_SUCCESS(status))
+        {
+            // Assign values to output buffer
+            notify->Size = sizeof(XUSB_REQUEST_NOTIFICATION);
+            notify->SerialNo = pdoData->SerialNo;
+            notify->LedNumber = xusb->LedNumber;
+            notify->LargeMotor = xusb->Rumble[3];
+            notify->SmallMotor = xusb->Rumble[4];
+
+            WdfRequestCompleteWithInformation(notifyRequest, status, notify->Size);
+        }
+        else
+        {
+            TraceEvents(TRACE_LEVEL_ERROR,
+                TRACE_XUSB,
+                "WdfRequestRetrieveOutputBuffer failed with status %!STATUS!",
+                status);
+        }
+    }
+    else
+    {
+        TraceEvents(TRACE_LEVEL_WARNING,
+                TRACE_XUSB,
+                "!! [XUSB] WdfIoQueueRetrieveNextRequest failed with status %!STATUS!",
+                status);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Caches a submitted report, skipping it if the input hasn't changed.
+// 
+NTSTATUS Xusb_CacheReport(WDFDEVICE Device, PVOID Report, const UCHAR* MergeMask, WDFQUEUE* Queue)
+{
+    PPDO_DEVICE_DATA pdoData = PdoGetData(Device);
+    PXUSB_DEVICE_DATA xusb = XusbGetData(Device);
+    KIRQL irql;
+
+    *Queue = NULL;
+
+    SeqLockWriteBegin(&pdoData->ReportLock, &irql);
+
+    // Fill in the fields a delta submission left out
+    if (MergeMask != NULL)
+    {
+        ReportMergeMasked(&((PXUSB_SUBMIT_REPORT)Report)->Report, &xusb->Packet.Report, MergeMask, sizeof(XUSB_REPORT));
+    }
+
+    // Don't waste pending IRP if input hasn't changed
+    if (Bus_DropDuplicateReport(pdoData,
+        &xusb->Packet.Report,
+        &((PXUSB_SUBMIT_REPORT)Report)->Report,
+        NULL,
+        sizeof(XUSB_REPORT)))
+    {
+        SeqLockWriteAbort(&pdoData->ReportLock, irql);
+
+        TraceHot(TRACE_XUSB,
+            "Input report hasn't changed since last update");
+        return STATUS_SUCCESS;
+    }
+
+    // Copy submitted report to cache
+    RtlCopyBytes(&xusb->Packet.Report, &((PXUSB_SUBMIT_REPORT)Report)->Report, sizeof(XUSB_REPORT));
+
+    Bus_StateTableStore(pdoData, &((PXUSB_SUBMIT_REPORT)Report)->Report);
+
+    SeqLockWriteEnd(&pdoData->ReportLock, irql);
+
+    *Queue = pdoData->PendingUsbInRequests;
+
+    return STATUS_SUCCESS;
+}
+
+VOID Xusb_WrapReport(PVOID Submit, ULONG SerialNo, PVIGEM_TARGET_REPORT Report)
+{
+    XUSB_SUBMIT_REPORT_INIT((PXUSB_SUBMIT_REPORT)Submit, SerialNo);
+    ((PXUSB_SUBMIT_REPORT)Submit)->Report = Report->Xusb;
+}
+
+BOOLEAN Xusb_UnwrapReport(PVOID Submit, PVIGEM_TARGET_REPORT Report)
+{
+    Report->Xusb = ((PXUSB_SUBMIT_REPORT)Submit)->Report;
+
+    return TRUE;
+}
+
+VOID Xusb_CopyReportToUrb(WDFDEVICE Device, PURB Urb)
+{
+    Urb->UrbBulkOrInterruptTransfer.TransferBufferLength = sizeof(XUSB_INTERRUPT_IN_PACKET);
+
+    SeqLockReadCopy(&PdoGetData(Device)->ReportLock,
+        Urb->UrbBulkOrInterruptTransfer.TransferBuffer,
+        &XusbGetData(Device)->Packet,
+        sizeof(XUSB_INTERRUPT_IN_PACKET));
+}
+
+//
+// Input report fields, indexed by VIGEM_XUSB_FIELD
+// 
+static const VIGEM_REPORT_FIELD XusbReportFields[ViGEmXusbFields] =
+{
+    [ViGEmXusbButtons] = VIGEM_REPORT_FIELD_OF(XUSB_REPORT, wButtons),
+    [ViGEmXusbLeftTrigger] = VIGEM_REPORT_FIELD_OF(XUSB_REPORT, bLeftTrigger),
+    [ViGEmXusbRightTrigger] = VIGEM_REPORT_FIELD_OF(XUSB_REPORT, bRightTrigger),
+    [ViGEmXusbThumbLX] = VIGEM_REPORT_FIELD_OF(XUSB_REPORT, sThumbLX),
+    [ViGEmXusbThumbLY] = VIGEM_REPORT_FIELD_OF(XUSB_REPORT, sThumbLY),
+    [ViGEmXusbThumbRX] = VIGEM_REPORT_FIELD_OF(XUSB_REPORT, sThumbRX),
+    [ViGEmXusbThumbRY] = VIGEM_REPORT_FIELD_OF(XUSB_REPORT, sThumbRY)
+};
+
+//
+// Analog axes of the input report
+// 
+static const VIGEM_REPORT_AXIS XusbReportAxes[] =
+{
+    VIGEM_REPORT_AXIS_OF(XUSB_REPORT, bLeftTrigger, ViGEmAxisUnsigned8),
+    VIGEM_REPORT_AXIS_OF(XUSB_REPORT, bRightTrigger, ViGEmAxisUnsigned8),
+    VIGEM_REPORT_AXIS_OF(XUSB_REPORT, sThumbLX, ViGEmAxisSigned16),
+    VIGEM_REPORT_AXIS_OF(XUSB_REPORT, sThumbLY, ViGEmAxisSigned16),
+    VIGEM_REPORT_AXIS_OF(XUSB_REPORT, sThumbRX, ViGEmAxisSigned16),
+    VIGEM_REPORT_AXIS_OF(XUSB_REPORT, sThumbRY, ViGEmAxisSigned16)
+};
+
+const VIGEM_TARGET_OPS XusbTargetOps =
+{
+    .TargetType = Xbox360Wired,
+    .DescriptorSize = XUSB_DESCRIPTOR_SIZE,
+    .ConfigurationSize = XUSB_CONFIGURATION_SIZE,
+    .ReportSize = sizeof(XUSB_REPORT),
+    .Fields = XusbReportFields,
+    .FieldCount = ViGEmXusbFields,
+    .Axes = XusbReportAxes,
+    .AxisCount = ARRAYSIZE(XusbReportAxes),
+    .UrbReportOffset = FIELD_OFFSET(XUSB_INTERRUPT_IN_PACKET, Report),
+    .ButtonsOffset = FIELD_OFFSET(XUSB_REPORT, wButtons),
+    .PreparePdo = Xusb_PreparePdo,
+    .AssignPdoContext = Xusb_AssignPdoContext,
+    .PrepareHardware = Xusb_PrepareHardware,
+    .GetDeviceDescriptorType = Xusb_GetDeviceDescriptorType,
+    .GetConfigurationDescriptorType = Xusb_GetConfigurationDescriptorType,
+    .SelectConfiguration = Xusb_SelectConfiguration,
+    .BulkOrInterruptTransfer = Xusb_BulkOrInterruptTransfer,
+    .CacheReport = Xusb_CacheReport,
+    .WrapReport = Xusb_WrapReport,
+    .UnwrapReport = Xusb_UnwrapReport,
+    .CopyReportToUrb = Xusb_CopyReportToUrb,
+    .GetInRequestQueue = Bus_GetInRequestQueue,
+    .QueueNotification = Bus_ForwardNotification
+};
@@ -0,0 +1,109 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include <initguid.h>
+
+#include "Platform.h"
+#include "BusClient.h"
+
+#include <setupapi.h>
+#include <stdlib.h>
+
+HANDLE BusOpen(VOID)
+{
+    HDEVINFO                            deviceInfoSet;
+    SP_DEVICE_INTERFACE_DATA            interfaceData;
+    PSP_DEVICE_INTERFACE_DETAIL_DATA_A  detailData;
+    DWORD                               required = 0;
+    HANDLE                              bus = INVALID_HANDLE_VALUE;
+
+    deviceInfoSet = SetupDiGetClassDevsA(&GUID_DEVINTERFACE_BUSENUM_VIGEM, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (deviceInfoSet == INVALID_HANDLE_VALUE)
+    {
+        return INVALID_HANDLE_VALUE;
+    }
+
+    interfaceData.cbSize = sizeof(interfaceData);
+
+    if (SetupDiEnumDeviceInterfaces(deviceInfoSet, NULL, &GUID_DEVINTERFACE_BUSENUM_VIGEM, 0, &interfaceData))
+    {
+        SetupDiGetDeviceInterfaceDetailA(deviceInfoSet, &interfaceData, NULL, 0, &required, NULL);
+
+        detailData = malloc(required);
+
+        if (detailData != NULL)
+        {
+            detailData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA_A);
+
+            if (SetupDiGetDeviceInterfaceDetailA(deviceInfoSet, &interfaceData, detailData, required, NULL, NULL))
+            {
+                bus = CreateFileA(detailData->DevicePath,
+                    GENERIC_READ | GENERIC_WRITE,
+                    FILE_SHARE_READ | FILE_SHARE_WRITE,
+                    NULL,
+                    OPEN_EXISTING,
+                    FILE_ATTRIBUTE_NORMAL,
+                    NULL);
+            }
+
+            free(detailData);
+        }
+    }
+
+    SetupDiDestroyDeviceInfoList(deviceInfoSet);
+
+    return bus;
+}
+
+BOOLEAN BusPlugIn(HANDLE Bus, VIGEM_TARGET_TYPE TargetType, PULONG SerialNo)
+{
+    VIGEM_PLUGIN_TARGET plugIn;
+    DWORD               transferred = 0;
+
+    VIGEM_PLUGIN_TARGET_INIT(&plugIn, 0, TargetType);
+
+    if (!DeviceIoControl(Bus, IOCTL_VIGEM_PLUGIN_TARGET,
+        &plugIn, sizeof(plugIn), &plugIn, sizeof(plugIn), &transferred, NULL))
+    {
+        return FALSE;
+    }
+
+    *SerialNo = plugIn.SerialNo;
+
+    return TRUE;
+}
+
+BOOLEAN BusUnplug(HANDLE Bus, ULONG SerialNo)
+{
+    VIGEM_UNPLUG_TARGET unPlug;
+    DWORD               transferred = 0;
+
+    VIGEM_UNPLUG_TARGET_INIT(&unPlug, SerialNo);
+
+    return DeviceIoControl(Bus, IOCTL_VIGEM_UNPLUG_TARGET,
+        &unPlug, sizeof(unPlug), NULL, 0, &transferred, NULL) != FALSE;
+}
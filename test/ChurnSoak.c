@@ -0,0 +1,189 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+//
+// Plug/unplug soak against an installed bus driver (Windows only).
+// 
+// Plugs and unplugs targets VIGEM_CHURN_CYCLES times (default 100000) and
+// checks at every checkpoint that, once the removed devices are gone, the
+// live object and interface counts of IOCTL_VIGEM_GET_RESOURCE_STATS are
+// back where they started. Any object left behind per cycle shows up as a
+// growing count long before the kiosk runs out of pool.
+// 
+
+#include "Platform.h"
+#include "BusClient.h"
+#include "Test.h"
+
+#include <stdlib.h>
+
+#define CHURN_CYCLES_DEFAULT    100000
+#define CHURN_CHECKPOINT        1000
+
+//
+// Time removed devices get to finish tearing down at a checkpoint
+// 
+#define CHURN_SETTLE_MS         10000
+
+static BOOLEAN ChurnGetStats(HANDLE Bus, PVIGEM_RESOURCE_STATS Stats)
+{
+    DWORD transferred = 0;
+
+    VIGEM_RESOURCE_STATS_INIT(Stats, 0);
+
+    return DeviceIoControl(Bus, IOCTL_VIGEM_GET_RESOURCE_STATS,
+        Stats, sizeof(*Stats), Stats, sizeof(*Stats), &transferred, NULL) != FALSE;
+}
+
+static BOOLEAN ChurnStatsEqual(const VIGEM_RESOURCE_STATS* Left, const VIGEM_RESOURCE_STATS* Right)
+{
+    return memcmp(Left->BusObjects, Right->BusObjects, sizeof(Left->BusObjects)) == 0
+        && Left->BusInterfaces == Right->BusInterfaces;
+}
+
+//
+// Waits for the counts to come back to the baseline; returns the last reading
+// 
+static BOOLEAN ChurnSettle(HANDLE Bus, const VIGEM_RESOURCE_STATS* Baseline, PVIGEM_RESOURCE_STATS Stats)
+{
+    ULONG64 deadline = TestNow() + CHURN_SETTLE_MS * 1000000ULL;
+
+    do
+    {
+        if (!ChurnGetStats(Bus, Stats))
+        {
+            return FALSE;
+        }
+
+        if (ChurnStatsEqual(Baseline, Stats))
+        {
+            return TRUE;
+        }
+
+        Sleep(50);
+
+    } while (TestNow() < deadline);
+
+    return FALSE;
+}
+
+static VOID ChurnPrintStats(const char* Name, const VIGEM_RESOURCE_STATS* Stats)
+{
+    printf("    %-10s device %ld, queue %ld, timer %ld, memory %ld, collection %ld, interfaces %ld\n",
+        Name,
+        Stats->BusObjects[ViGEmResourceDevice],
+        Stats->BusObjects[ViGEmResourceQueue],
+        Stats->BusObjects[ViGEmResourceTimer],
+        Stats->BusObjects[ViGEmResourceMemory],
+        Stats->BusObjects[ViGEmResourceCollection],
+        Stats->BusInterfaces);
+}
+
+//
+// Plugs in a target with a bus-assigned serial and unplugs it again
+// 
+static BOOLEAN ChurnCycle(HANDLE Bus, VIGEM_TARGET_TYPE TargetType)
+{
+    ULONG serialNo;
+
+    return BusPlugIn(Bus, TargetType, &serialNo) && BusUnplug(Bus, serialNo);
+}
+
+static VOID Churn_CountsStayFlat(VOID)
+{
+    static const VIGEM_TARGET_TYPE types[] = { Xbox360Wired, DualShock4Wired };
+    VIGEM_RESOURCE_STATS baseline;
+    VIGEM_RESOURCE_STATS stats;
+    const char* value = getenv("VIGEM_CHURN_CYCLES");
+    ULONG cycles = (value != NULL) ? strtoul(value, NULL, 0) : CHURN_CYCLES_DEFAULT;
+    ULONG completed = 0;
+    ULONG64 start;
+    HANDLE bus;
+    ULONG i;
+
+    bus = BusOpen();
+    if (bus == INVALID_HANDLE_VALUE)
+    {
+        printf("    bus driver not found, skipped\n");
+        return;
+    }
+
+    TEST_CHECK(ChurnGetStats(bus, &baseline));
+
+    //
+    // The shared USB device interface is registered by the first plugin
+    // ever and stays; a warm-up cycle gets it out of the way
+    // 
+    TEST_CHECK(ChurnCycle(bus, Xbox360Wired));
+    TEST_CHECK(ChurnGetStats(bus, &stats));
+
+    baseline.BusInterfaces = stats.BusInterfaces;
+
+    TEST_CHECK(ChurnSettle(bus, &baseline, &stats));
+
+    ChurnPrintStats("baseline", &baseline);
+
+    start = TestNow();
+
+    for (i = 1; i <= cycles; i++)
+    {
+        if (!ChurnCycle(bus, types[i % RTL_NUMBER_OF(types)]))
+        {
+            TEST_CHECK_EQUAL(ERROR_SUCCESS, GetLastError());
+            break;
+        }
+
+        completed++;
+
+        if (i % CHURN_CHECKPOINT == 0 || i == cycles)
+        {
+            if (!ChurnSettle(bus, &baseline, &stats))
+            {
+                printf("    after %lu cycles:\n", i);
+                ChurnPrintStats("now", &stats);
+                TEST_CHECK(ChurnStatsEqual(&baseline, &stats));
+                break;
+            }
+        }
+    }
+
+    TestReport("plug + unplug cycle", TestNow() - start, completed);
+
+    CloseHandle(bus);
+}
+
+static const TEST_CASE Tests[] =
+{
+    TEST_CASE_OF(Churn_CountsStayFlat),
+};
+
+static const TEST_CASE Benchmarks[] =
+{
+    { NULL, NULL }
+};
+
+TEST_MAIN(Tests, Benchmarks)
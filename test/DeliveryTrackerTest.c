@@ -0,0 +1,242 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Platform.h"
+#include "DeliveryTracker.h"
+#include "Test.h"
+
+//
+// Simulated time in microseconds: a feeder submits every millisecond and the
+// host polls every 4 ms, as an XUSB pad at its default 250 Hz
+// 
+#define SIM_SUBMIT_US       1000
+#define SIM_POLL_US         4000
+#define SIM_DURATION_US     1000000
+
+static DELIVERY_TRACKER Tracker;
+
+static LONG64 SimNow;
+
+static ULONG SimTimeQueries;
+
+static LONG64 SimQueryTime(VOID)
+{
+    SimTimeQueries++;
+
+    return SimNow;
+}
+
+typedef struct _SIM_WAITER
+{
+    LONG Version;
+
+    LONG64 SubmittedAt;
+
+    //
+    // DeliveredAt handed back, -1 while still waiting
+    // 
+    LONG64 DeliveredAt;
+
+} SIM_WAITER, *PSIM_WAITER;
+
+//
+// Runs the feeder and the host; every WaitEvery-th submission waits for its
+// delivery (0 for none). Returns the number of waiters.
+// 
+static ULONG SimRun(PSIM_WAITER Waiters, ULONG Capacity, ULONG WaitEvery)
+{
+    LONG version = 0;
+    ULONG submitted = 0;
+    ULONG waiters = 0;
+    BOOLEAN waiting;
+    ULONG i;
+
+    RtlZeroMemory(&Tracker, sizeof(Tracker));
+    SimTimeQueries = 0;
+
+    for (SimNow = 0; SimNow < SIM_DURATION_US; SimNow += SIM_SUBMIT_US)
+    {
+        // The host polls first within a tick, a waiter submitting at a poll waits for the next
+        if (SimNow % SIM_POLL_US == 0
+            && DeliveryTrackerDeliver(&Tracker, version, SimQueryTime))
+        {
+            for (i = 0; i < waiters; i++)
+            {
+                if (Waiters[i].DeliveredAt < 0 && DeliveryTrackerIsDelivered(&Tracker, Waiters[i].Version))
+                {
+                    Waiters[i].DeliveredAt = ReadNoFence64(&Tracker.LastDeliveryTime);
+                    DeliveryTrackerWaitEnd(&Tracker);
+                }
+            }
+        }
+
+        submitted++;
+        waiting = (WaitEvery != 0 && submitted % WaitEvery == 0 && waiters < Capacity);
+
+        if (waiting)
+        {
+            DeliveryTrackerWaitBegin(&Tracker);
+        }
+
+        // The cache write
+        version += 2;
+
+        if (waiting)
+        {
+            Waiters[waiters].Version = version;
+            Waiters[waiters].SubmittedAt = SimNow;
+            Waiters[waiters].DeliveredAt = -1;
+            waiters++;
+        }
+    }
+
+    return waiters;
+}
+
+#pragma region Tests
+
+//
+// Polls without anyone waiting neither read the clock nor ask for a walk,
+// and still record how far delivery got
+// 
+static VOID DeliveryTracker_IdlePollsSkipTimeAndWalk(VOID)
+{
+    SimRun(NULL, 0, 0);
+
+    TEST_CHECK_EQUAL(0, SimTimeQueries);
+    TEST_CHECK_EQUAL(0, Tracker.LastDeliveryTime);
+    TEST_CHECK_EQUAL(0, Tracker.WaiterCount);
+    // The last poll picked up what got submitted before it
+    TEST_CHECK(DeliveryTrackerIsDelivered(&Tracker, 2 * ((SIM_DURATION_US - SIM_POLL_US) / SIM_SUBMIT_US)));
+    TEST_CHECK(!DeliveryTrackerIsDelivered(&Tracker, 2 * ((SIM_DURATION_US - SIM_POLL_US) / SIM_SUBMIT_US) + 2));
+}
+
+//
+// A waiter gets released by the first poll after its submission, stamped
+// with that poll's time, and only polls with a waiter around read the clock
+// 
+static VOID DeliveryTracker_PollReleasesWaiter(VOID)
+{
+    static SIM_WAITER waiters[SIM_DURATION_US / SIM_SUBMIT_US];
+    LONG64 expected;
+    ULONG released = 0;
+    ULONG count;
+    ULONG i;
+
+    count = SimRun(waiters, RTL_NUMBER_OF(waiters), 16);
+
+    TEST_CHECK(count > 0);
+
+    for (i = 0; i < count; i++)
+    {
+        expected = (waiters[i].SubmittedAt / SIM_POLL_US + 1) * SIM_POLL_US;
+
+        if (expected >= SIM_DURATION_US)
+        {
+            TEST_CHECK_EQUAL(-1, waiters[i].DeliveredAt);
+            continue;
+        }
+
+        TEST_CHECK_EQUAL(expected, waiters[i].DeliveredAt);
+        released++;
+    }
+
+    // One waiter at a time, 16 ms apart
+    TEST_CHECK_EQUAL(released, SimTimeQueries);
+    TEST_CHECK_EQUAL(count - released, Tracker.WaiterCount);
+}
+
+static VOID DeliveryTracker_OnlyMovesForward(VOID)
+{
+    RtlZeroMemory(&Tracker, sizeof(Tracker));
+
+    // Sequence numbers wrap
+    Tracker.DeliveredVersion = MAXLONG - 1;
+
+    DeliveryTrackerDeliver(&Tracker, (LONG)((ULONG)MAXLONG + 3), SimQueryTime);
+    DeliveryTrackerDeliver(&Tracker, (LONG)((ULONG)MAXLONG + 1), SimQueryTime);
+
+    TEST_CHECK_EQUAL((LONG)((ULONG)MAXLONG + 3), Tracker.DeliveredVersion);
+    TEST_CHECK(DeliveryTrackerIsDelivered(&Tracker, MAXLONG - 1));
+    TEST_CHECK(DeliveryTrackerIsDelivered(&Tracker, (LONG)((ULONG)MAXLONG + 3)));
+    TEST_CHECK(!DeliveryTrackerIsDelivered(&Tracker, (LONG)((ULONG)MAXLONG + 5)));
+}
+
+static const TEST_CASE Tests[] =
+{
+    TEST_CASE_OF(DeliveryTracker_IdlePollsSkipTimeAndWalk),
+    TEST_CASE_OF(DeliveryTracker_PollReleasesWaiter),
+    TEST_CASE_OF(DeliveryTracker_OnlyMovesForward),
+};
+
+#pragma endregion
+
+#pragma region Benchmarks
+
+#define BENCH_DELIVERIES    10000000
+
+static LONG64 BenchQueryTime(VOID)
+{
+    return (LONG64)TestNow();
+}
+
+static VOID Bench_Deliver(VOID)
+{
+    ULONG64 start;
+    LONG i;
+
+    RtlZeroMemory(&Tracker, sizeof(Tracker));
+
+    start = TestNow();
+
+    for (i = 0; i < BENCH_DELIVERIES; i++)
+    {
+        TestSink += DeliveryTrackerDeliver(&Tracker, 2 * i, BenchQueryTime);
+    }
+
+    TestReport("deliver, nobody waiting", TestNow() - start, BENCH_DELIVERIES);
+
+    DeliveryTrackerWaitBegin(&Tracker);
+
+    start = TestNow();
+
+    for (i = 0; i < BENCH_DELIVERIES; i++)
+    {
+        TestSink += DeliveryTrackerDeliver(&Tracker, 2 * i, BenchQueryTime);
+    }
+
+    TestReport("deliver, one waiting", TestNow() - start, BENCH_DELIVERIES);
+}
+
+static const TEST_CASE Benchmarks[] =
+{
+    TEST_CASE_OF(Bench_Deliver),
+};
+
+#pragma endregion
+
+TEST_MAIN(Tests, Benchmarks)
@@ -0,0 +1,243 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+//
+// Benchmarks against an installed bus driver (Windows only).
+// 
+// Covers what the host benchmarks can't, the cost of getting requests
+// through the I/O manager and the bus dispatch. There are no tests, run it
+// with "bench".
+// 
+
+#include "Platform.h"
+#include "BusClient.h"
+#include "Test.h"
+
+#include <stdlib.h>
+
+#define BENCH_TARGETS       16
+#define BENCH_ROUNDS        20000
+
+typedef struct _BENCH_BUS
+{
+    HANDLE Handle;
+
+    ULONG SerialNos[BENCH_TARGETS];
+
+    ULONG Count;
+
+} BENCH_BUS, *PBENCH_BUS;
+
+//
+// Opens the bus and plugs in Count targets; FALSE if there is no bus
+// 
+static BOOLEAN BenchPlugIn(PBENCH_BUS Bus, VIGEM_TARGET_TYPE TargetType, ULONG Count)
+{
+    Bus->Count = 0;
+    Bus->Handle = BusOpen();
+
+    if (Bus->Handle == INVALID_HANDLE_VALUE)
+    {
+        printf("    bus driver not found, skipped\n");
+        return FALSE;
+    }
+
+    while (Bus->Count < Count)
+    {
+        if (!BusPlugIn(Bus->Handle, TargetType, &Bus->SerialNos[Bus->Count]))
+        {
+            TEST_CHECK_EQUAL(ERROR_SUCCESS, GetLastError());
+            break;
+        }
+
+        Bus->Count++;
+    }
+
+    return TRUE;
+}
+
+static VOID BenchUnplug(PBENCH_BUS Bus)
+{
+    ULONG i;
+
+    for (i = 0; i < Bus->Count; i++)
+    {
+        BusUnplug(Bus->Handle, Bus->SerialNos[i]);
+    }
+
+    CloseHandle(Bus->Handle);
+}
+
+//
+// One IOCTL_XUSB_SUBMIT_REPORT per target against one
+// IOCTL_VIGEM_SUBMIT_REPORT_BATCH for all of them; the difference per
+// report is the request overhead a batch saves
+// 
+static VOID BenchSubmitBatch(VOID)
+{
+    static const ULONG counts[] = { 1, 4, BENCH_TARGETS };
+    XUSB_SUBMIT_REPORT  submit;
+    PVIGEM_SUBMIT_BATCH batch;
+    BENCH_BUS           bus;
+    DWORD               transferred;
+    char                name[64];
+    ULONG64             start;
+    ULONG               round;
+    ULONG               c;
+    ULONG               i;
+
+    if (!BenchPlugIn(&bus, Xbox360Wired, BENCH_TARGETS))
+    {
+        return;
+    }
+
+    batch = malloc(VIGEM_SUBMIT_BATCH_SIZE(BENCH_TARGETS));
+
+    for (c = 0; c < RTL_NUMBER_OF(counts) && counts[c] <= bus.Count && batch != NULL; c++)
+    {
+        // Every round changes the report so nothing gets deduplicated
+        start = TestNow();
+
+        for (round = 0; round < BENCH_ROUNDS; round++)
+        {
+            for (i = 0; i < counts[c]; i++)
+            {
+                XUSB_SUBMIT_REPORT_INIT(&submit, bus.SerialNos[i]);
+                submit.Report.bLeftTrigger = (BYTE)round;
+
+                DeviceIoControl(bus.Handle, IOCTL_XUSB_SUBMIT_REPORT,
+                    &submit, sizeof(submit), NULL, 0, &transferred, NULL);
+            }
+        }
+
+        snprintf(name, sizeof(name), "single submit, %lu targets", counts[c]);
+        TestReport(name, TestNow() - start, (ULONG64)BENCH_ROUNDS * counts[c]);
+
+        VIGEM_SUBMIT_BATCH_INIT(batch, counts[c]);
+
+        for (i = 0; i < counts[c]; i++)
+        {
+            batch->Entries[i].SerialNo = bus.SerialNos[i];
+            batch->Entries[i].TargetType = Xbox360Wired;
+        }
+
+        start = TestNow();
+
+        for (round = 0; round < BENCH_ROUNDS; round++)
+        {
+            for (i = 0; i < counts[c]; i++)
+            {
+                batch->Entries[i].Report.Xusb.bLeftTrigger = (BYTE)round;
+            }
+
+            DeviceIoControl(bus.Handle, IOCTL_VIGEM_SUBMIT_REPORT_BATCH,
+                batch, (DWORD)VIGEM_SUBMIT_BATCH_SIZE(counts[c]),
+                batch, (DWORD)VIGEM_SUBMIT_BATCH_SIZE(counts[c]), &transferred, NULL);
+        }
+
+        snprintf(name, sizeof(name), "batch submit, %lu targets", counts[c]);
+        TestReport(name, TestNow() - start, (ULONG64)BENCH_ROUNDS * counts[c]);
+
+        TEST_CHECK_EQUAL(STATUS_SUCCESS, batch->Entries[0].Status);
+    }
+
+    free(batch);
+
+    BenchUnplug(&bus);
+}
+
+//
+// One submit IOCTL per report to a single target of each type that has
+// one; the bus looks the target up and dispatches on its type on every
+// call.
+// 
+// Run it against driver builds from either side of a change to the submit
+// path for a before and after comparison.
+// 
+static VOID BenchSubmitPerTarget(VOID)
+{
+    XUSB_SUBMIT_REPORT  xusb;
+    DS4_SUBMIT_REPORT   ds4;
+    BENCH_BUS           bus;
+    DWORD               transferred;
+    ULONG64             start;
+    ULONG               round;
+
+    if (!BenchPlugIn(&bus, Xbox360Wired, 1) || bus.Count == 0)
+    {
+        return;
+    }
+
+    start = TestNow();
+
+    // Every round changes the report so nothing gets deduplicated
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        XUSB_SUBMIT_REPORT_INIT(&xusb, bus.SerialNos[0]);
+        xusb.Report.bLeftTrigger = (BYTE)round;
+
+        DeviceIoControl(bus.Handle, IOCTL_XUSB_SUBMIT_REPORT,
+            &xusb, sizeof(xusb), NULL, 0, &transferred, NULL);
+    }
+
+    TestReport("XUSB submit", TestNow() - start, BENCH_ROUNDS);
+
+    BenchUnplug(&bus);
+
+    if (!BenchPlugIn(&bus, DualShock4Wired, 1) || bus.Count == 0)
+    {
+        return;
+    }
+
+    start = TestNow();
+
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        DS4_SUBMIT_REPORT_INIT(&ds4, bus.SerialNos[0]);
+        ds4.Report.bTriggerL = (BYTE)round;
+
+        DeviceIoControl(bus.Handle, IOCTL_DS4_SUBMIT_REPORT,
+            &ds4, sizeof(ds4), NULL, 0, &transferred, NULL);
+    }
+
+    TestReport("DS4 submit", TestNow() - start, BENCH_ROUNDS);
+
+    BenchUnplug(&bus);
+}
+
+static const TEST_CASE Tests[] =
+{
+    { NULL, NULL }
+};
+
+static const TEST_CASE Benchmarks[] =
+{
+    TEST_CASE_OF(BenchSubmitBatch),
+    TEST_CASE_OF(BenchSubmitPerTarget),
+};
+
+TEST_MAIN(Tests, Benchmarks)
@@ -0,0 +1,257 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "Platform.h"
+#include "Ds4Core.h"
+#include "Test.h"
+
+#define TEST_DS4_REPORT_SIZE    0x40
+
+#pragma region Tests
+
+static VOID Stamp_FrameCounterWraps(VOID)
+{
+    UCHAR   report[TEST_DS4_REPORT_SIZE] = { 0 };
+    ULONG   frame;
+    UCHAR   low;
+
+    // The low bits of the byte are the PS and touchpad click buttons
+    for (low = 0; low < 4; low++)
+    {
+        for (frame = 0; frame < 200; frame++)
+        {
+            report[DS4_REPORT_SPECIAL_OFFSET] = (UCHAR)(0xFC | low);
+
+            Ds4_StampReport(report, frame, 0);
+
+            TEST_CHECK_EQUAL(((frame % 64) << 2) | low, report[DS4_REPORT_SPECIAL_OFFSET]);
+        }
+    }
+
+    // Counter runs on past 32 bits without disturbing the buttons
+    report[DS4_REPORT_SPECIAL_OFFSET] = 0x02;
+    Ds4_StampReport(report, MAXULONG, 0);
+    TEST_CHECK_EQUAL(0xFE, report[DS4_REPORT_SPECIAL_OFFSET]);
+}
+
+static VOID Stamp_LeavesOtherBytesAlone(VOID)
+{
+    UCHAR   report[TEST_DS4_REPORT_SIZE];
+    UCHAR   stamped[TEST_DS4_REPORT_SIZE];
+    ULONG64 state = 0x9E3779B97F4A7C15ULL;
+    ULONG   round;
+    ULONG   i;
+
+    for (round = 0; round < 10000; round++)
+    {
+        for (i = 0; i < sizeof(report); i++)
+        {
+            report[i] = (UCHAR)TestRandom(&state);
+        }
+
+        memcpy(stamped, report, sizeof(report));
+
+        Ds4_StampReport(stamped, (ULONG)TestRandom(&state), TestRandom(&state) >> 8);
+
+        for (i = 0; i < sizeof(report); i++)
+        {
+            if (i == DS4_REPORT_SPECIAL_OFFSET)
+            {
+                TEST_CHECK_EQUAL(report[i] & ~DS4_REPORT_FRAME_COUNTER_MASK & 0xFF,
+                    stamped[i] & ~DS4_REPORT_FRAME_COUNTER_MASK & 0xFF);
+            }
+            else if (i != DS4_REPORT_TIMESTAMP_OFFSET && i != DS4_REPORT_TIMESTAMP_OFFSET + 1)
+            {
+                TEST_CHECK_EQUAL(report[i], stamped[i]);
+            }
+        }
+    }
+}
+
+static ULONG StampedTimestamp(ULONG64 Microseconds)
+{
+    UCHAR report[TEST_DS4_REPORT_SIZE] = { 0 };
+
+    Ds4_StampReport(report, 0, Microseconds);
+
+    // Little-endian, like every other multi-byte field of the report
+    return report[DS4_REPORT_TIMESTAMP_OFFSET] | ((ULONG)report[DS4_REPORT_TIMESTAMP_OFFSET + 1] << 8);
+}
+
+static VOID Stamp_TimestampUnits(VOID)
+{
+    ULONG64 now;
+    ULONG   previous;
+    ULONG   current;
+    ULONG   delta;
+    ULONG   i;
+
+    // 16/3 us per unit
+    TEST_CHECK_EQUAL(0, StampedTimestamp(0));
+    TEST_CHECK_EQUAL(0, StampedTimestamp(5));
+    TEST_CHECK_EQUAL(1, StampedTimestamp(6));
+    TEST_CHECK_EQUAL(3, StampedTimestamp(16));
+    TEST_CHECK_EQUAL(0x1234, StampedTimestamp(0x1234ULL * 16 / 3 + 1));
+
+    // Wraps after 65536 units, about 350 ms
+    TEST_CHECK_EQUAL(0xFFFF, StampedTimestamp(349525));
+    TEST_CHECK_EQUAL(0, StampedTimestamp(349526));
+
+    //
+    // At the 5 ms flush period every report advances the timestamp by 937
+    // or 938 units, across wraps and a long uptime
+    // 
+    now = 40ULL * 24 * 3600 * 1000000;
+    previous = StampedTimestamp(now);
+
+    for (i = 0; i < 10000; i++)
+    {
+        now += 5000;
+        current = StampedTimestamp(now);
+        delta = (current - previous) & 0xFFFF;
+
+        TEST_CHECK(delta == 937 || delta == 938);
+
+        previous = current;
+    }
+}
+
+static VOID Counter_ToMicroseconds(VOID)
+{
+    static const LONG64 frequencies[] = { 10000000, 3579545, 2400000000LL, 1 };
+    LONG64              counter;
+    LONG64              frequency;
+    ULONG64             state = 0xD1B54A32D192ED03ULL;
+    ULONG64             seconds;
+    ULONG64             remainder;
+    ULONG64             previous;
+    ULONG64             current;
+    ULONG               f;
+    ULONG               i;
+
+    for (f = 0; f < RTL_NUMBER_OF(frequencies); f++)
+    {
+        frequency = frequencies[f];
+
+        TEST_CHECK_EQUAL(0, Ds4_CounterToMicroseconds(0, frequency));
+        TEST_CHECK_EQUAL(1000000, Ds4_CounterToMicroseconds(frequency, frequency));
+
+        // Up to a year of uptime, where counter * 10^6 no longer fits
+        for (i = 0; i < 100000; i++)
+        {
+            seconds = TestRandom(&state) % (365 * 24 * 3600);
+            remainder = TestRandom(&state) % (ULONG64)frequency;
+            counter = (LONG64)(seconds * (ULONG64)frequency + remainder);
+
+            TEST_CHECK_EQUAL(seconds * 1000000 + remainder * 1000000 / (ULONG64)frequency,
+                Ds4_CounterToMicroseconds(counter, frequency));
+        }
+
+        // Never goes backwards across a whole second
+        counter = frequency * 1000000;
+        previous = Ds4_CounterToMicroseconds(counter - 1, frequency);
+
+        for (i = 0; i < 1000; i++)
+        {
+            current = Ds4_CounterToMicroseconds(counter + i, frequency);
+            TEST_CHECK(current >= previous);
+            previous = current;
+        }
+    }
+}
+
+static const TEST_CASE Tests[] =
+{
+    TEST_CASE_OF(Stamp_FrameCounterWraps),
+    TEST_CASE_OF(Stamp_LeavesOtherBytesAlone),
+    TEST_CASE_OF(Stamp_TimestampUnits),
+    TEST_CASE_OF(Counter_ToMicroseconds),
+};
+
+#pragma endregion
+
+#pragma region Benchmarks
+
+typedef VOID(*STAMP_ROUTINE)(PUCHAR Buffer, ULONG Frame, LONG64 Counter, LONG64 Frequency);
+
+//
+// Everything Ds4_CopyReportToUrb adds to a delivery
+// 
+static VOID StampDelivery(PUCHAR Buffer, ULONG Frame, LONG64 Counter, LONG64 Frequency)
+{
+    Ds4_StampReport(Buffer, Frame, Ds4_CounterToMicroseconds(Counter, Frequency));
+}
+
+static VOID CopyOnly(PUCHAR Buffer, ULONG Frame, LONG64 Counter, LONG64 Frequency)
+{
+    UNREFERENCED_PARAMETER(Buffer);
+    UNREFERENCED_PARAMETER(Frame);
+    UNREFERENCED_PARAMETER(Counter);
+    UNREFERENCED_PARAMETER(Frequency);
+}
+
+static VOID BenchStampRoutine(const char* Name, STAMP_ROUTINE Routine)
+{
+    static UCHAR cache[TEST_DS4_REPORT_SIZE];
+    static UCHAR urb[TEST_DS4_REPORT_SIZE];
+    // Called through a pointer like the kernel's out-of-line call
+    STAMP_ROUTINE volatile routine = Routine;
+    ULONG64 sum = 0;
+    ULONG64 start;
+    ULONG i;
+
+    start = TestNow();
+
+    for (i = 0; i < 20000000; i++)
+    {
+        memcpy(urb, cache, sizeof(urb));
+        routine(urb, i, 1000000000LL + i * 50000LL, 10000000);
+        sum += urb[DS4_REPORT_TIMESTAMP_OFFSET];
+    }
+
+    TestReport(Name, TestNow() - start, i);
+
+    TestSink = sum;
+}
+
+static VOID Bench_StampDelivery(VOID)
+{
+    BenchStampRoutine("report copy", CopyOnly);
+    BenchStampRoutine("report copy + stamp", StampDelivery);
+}
+
+static const TEST_CASE Benchmarks[] =
+{
+    TEST_CASE_OF(Bench_StampDelivery),
+};
+
+#pragma endregion
+
+TEST_MAIN(Tests, Benchmarks)
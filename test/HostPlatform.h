@@ -0,0 +1,477 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+//
+// Host stand-ins for the kernel definitions used by the code sys/Platform.h
+// covers. Interlocked operations are full barriers like their kernel
+// counterparts, the rest maps to the C runtime.
+// 
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+
+#define WIN32_NO_STATUS
+#include <windows.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+#include <winioctl.h>
+
+typedef LONG NTSTATUS;
+
+#define NT_SUCCESS(_status_)            (((NTSTATUS)(_status_)) >= 0)
+#define KeMemoryBarrier()               MemoryBarrier()
+
+#else
+
+#include <sched.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+#pragma region Types
+
+#define VOID                            void
+#define CONST                           const
+
+typedef char                            CHAR;
+typedef unsigned char                   UCHAR, BYTE, BOOLEAN;
+typedef int16_t                         SHORT;
+typedef uint16_t                        USHORT, WORD;
+typedef int32_t                         LONG, INT;
+typedef uint32_t                        ULONG, DWORD, UINT;
+typedef int64_t                         LONG64, LONGLONG;
+typedef uint64_t                        ULONG64, ULONGLONG;
+typedef uintptr_t                       ULONG_PTR, DWORD_PTR;
+typedef size_t                          SIZE_T;
+typedef LONG                            NTSTATUS;
+
+typedef VOID*                           PVOID;
+typedef CHAR*                           PCHAR;
+typedef UCHAR*                          PUCHAR;
+typedef BOOLEAN*                        PBOOLEAN;
+typedef SHORT*                          PSHORT;
+typedef USHORT*                         PUSHORT;
+typedef LONG*                           PLONG;
+typedef ULONG*                          PULONG;
+typedef LONG64*                         PLONG64;
+typedef ULONG64*                        PULONG64;
+
+typedef struct _GUID
+{
+    ULONG Data1;
+    USHORT Data2;
+    USHORT Data3;
+    UCHAR Data4[8];
+} GUID;
+
+#define TRUE                            1
+#define FALSE                           0
+
+#define MAXSHORT                        0x7fff
+#define MINSHORT                        0x8000
+#define MAXLONG                         0x7fffffff
+#define MAXULONG                        0xffffffff
+#define MAXLONG64                       ((LONG64)(MAXULONG64 >> 1))
+#define MAXULONG64                      ((ULONG64)~((ULONG64)0))
+
+#pragma endregion
+
+#pragma region Compiler
+
+#define FORCEINLINE                     static inline __attribute__((always_inline))
+#define DECLSPEC_ALIGN(_x_)             __attribute__((aligned(_x_)))
+#define DECLSPEC_CACHEALIGN             DECLSPEC_ALIGN(64)
+#define DECLSPEC_NOINLINE               __attribute__((noinline))
+#define UNALIGNED
+#define ANYSIZE_ARRAY                   1
+
+#define FIELD_OFFSET(_type_, _field_)   ((LONG)offsetof(_type_, _field_))
+#define RTL_FIELD_SIZE(_type_, _field_) (sizeof(((_type_*)0)->_field_))
+#define RTL_SIZEOF_THROUGH_FIELD(_type_, _field_) \
+    (FIELD_OFFSET(_type_, _field_) + RTL_FIELD_SIZE(_type_, _field_))
+#define RTL_NUMBER_OF(_a_)              (sizeof(_a_) / sizeof((_a_)[0]))
+#define ARRAYSIZE(_a_)                  RTL_NUMBER_OF(_a_)
+#define CONTAINING_RECORD(_address_, _type_, _field_) \
+    ((_type_*)((PUCHAR)(_address_) - offsetof(_type_, _field_)))
+#define C_ASSERT(_e_)                   _Static_assert(_e_, #_e_)
+#define UNREFERENCED_PARAMETER(_p_)     ((void)(_p_))
+
+#ifndef min
+#define min(_a_, _b_)                   (((_a_) < (_b_)) ? (_a_) : (_b_))
+#endif
+#ifndef max
+#define max(_a_, _b_)                   (((_a_) > (_b_)) ? (_a_) : (_b_))
+#endif
+
+#define DEFINE_GUID(_name_, ...)        extern const GUID _name_
+
+FORCEINLINE BOOLEAN BitScanForward(PULONG Index, ULONG Mask)
+{
+    if (Mask == 0)
+    {
+        return FALSE;
+    }
+
+    *Index = (ULONG)__builtin_ctz(Mask);
+
+    return TRUE;
+}
+
+#pragma endregion
+
+#pragma region Memory
+
+#define RtlCopyMemory(_d_, _s_, _l_)    memcpy((_d_), (_s_), (_l_))
+#define RtlMoveMemory(_d_, _s_, _l_)    memmove((_d_), (_s_), (_l_))
+#define RtlFillMemory(_d_, _l_, _f_)    memset((_d_), (_f_), (_l_))
+#define RtlZeroMemory(_d_, _l_)         memset((_d_), 0, (_l_))
+#define RtlCopyBytes                    RtlCopyMemory
+#define RtlEqualMemory(_a_, _b_, _l_)   (memcmp((_a_), (_b_), (_l_)) == 0)
+
+#pragma endregion
+
+#pragma region Interlocked
+
+#define InterlockedIncrement(_t_)                   __atomic_add_fetch((_t_), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(_t_)                   __atomic_sub_fetch((_t_), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchange(_t_, _v_)               __atomic_exchange_n((_t_), (_v_), __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd(_t_, _v_)            __atomic_fetch_add((_t_), (_v_), __ATOMIC_SEQ_CST)
+#define InterlockedOr(_t_, _v_)                     __atomic_fetch_or((_t_), (_v_), __ATOMIC_SEQ_CST)
+#define InterlockedAnd(_t_, _v_)                    __atomic_fetch_and((_t_), (_v_), __ATOMIC_SEQ_CST)
+#define InterlockedCompareExchange(_t_, _v_, _c_)   __sync_val_compare_and_swap((_t_), (_c_), (_v_))
+
+#define InterlockedIncrement64                      InterlockedIncrement
+#define InterlockedDecrement64                      InterlockedDecrement
+#define InterlockedExchange64                       InterlockedExchange
+#define InterlockedExchangeAdd64                    InterlockedExchangeAdd
+#define InterlockedOr64                             InterlockedOr
+#define InterlockedAnd64                            InterlockedAnd
+#define InterlockedCompareExchange64                InterlockedCompareExchange
+#define InterlockedExchangePointer                  InterlockedExchange
+#define InterlockedCompareExchangePointer           InterlockedCompareExchange
+
+#define InterlockedIncrementNoFence(_t_)            __atomic_add_fetch((_t_), 1, __ATOMIC_RELAXED)
+#define InterlockedIncrementNoFence64               InterlockedIncrementNoFence
+#define InterlockedExchangeAddNoFence64(_t_, _v_)   __atomic_fetch_add((_t_), (_v_), __ATOMIC_RELAXED)
+
+#define ReadAcquire(_s_)                            __atomic_load_n((_s_), __ATOMIC_ACQUIRE)
+#define ReadNoFence(_s_)                            __atomic_load_n((_s_), __ATOMIC_RELAXED)
+#define WriteRelease(_d_, _v_)                      __atomic_store_n((_d_), (_v_), __ATOMIC_RELEASE)
+#define WriteNoFence(_d_, _v_)                      __atomic_store_n((_d_), (_v_), __ATOMIC_RELAXED)
+#define ReadAcquire64                               ReadAcquire
+#define ReadNoFence64                               ReadNoFence
+#define WriteRelease64                              WriteRelease
+#define WriteNoFence64                              WriteNoFence
+#define ReadPointerAcquire                          ReadAcquire
+#define ReadPointerNoFence                          ReadNoFence
+#define WritePointerRelease                         WriteRelease
+
+#define KeMemoryBarrier()                           __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define MemoryBarrier()                             __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#if defined(__x86_64__)
+#define YieldProcessor()                            _mm_pause()
+#else
+#define YieldProcessor()                            sched_yield()
+#endif
+
+#pragma endregion
+
+#pragma region Status codes
+
+#define NT_SUCCESS(_status_)                        (((NTSTATUS)(_status_)) >= 0)
+
+#define STATUS_SUCCESS                              ((NTSTATUS)0x00000000L)
+#define STATUS_PENDING                              ((NTSTATUS)0x00000103L)
+#define STATUS_NOT_IMPLEMENTED                      ((NTSTATUS)0xC0000002L)
+#define STATUS_INVALID_PARAMETER                    ((NTSTATUS)0xC000000DL)
+#define STATUS_NO_SUCH_DEVICE                       ((NTSTATUS)0xC000000EL)
+#define STATUS_INVALID_DEVICE_REQUEST               ((NTSTATUS)0xC0000010L)
+#define STATUS_ACCESS_DENIED                        ((NTSTATUS)0xC0000022L)
+#define STATUS_BUFFER_TOO_SMALL                     ((NTSTATUS)0xC0000023L)
+#define STATUS_INSUFFICIENT_RESOURCES               ((NTSTATUS)0xC000009AL)
+#define STATUS_NOT_SUPPORTED                        ((NTSTATUS)0xC00000BBL)
+#define STATUS_INVALID_DEVICE_STATE                 ((NTSTATUS)0xC0000184L)
+#define STATUS_DEVICE_BUSY                          ((NTSTATUS)0x80000011L)
+#define STATUS_IO_TIMEOUT                           ((NTSTATUS)0xC00000B5L)
+#define STATUS_INVALID_BUFFER_SIZE                  ((NTSTATUS)0xC0000206L)
+
+#pragma endregion
+
+#pragma region I/O control codes
+
+#define CTL_CODE(_type_, _function_, _method_, _access_) \
+    (((_type_) << 16) | ((_access_) << 14) | ((_function_) << 2) | (_method_))
+
+#define FILE_DEVICE_BUS_EXTENDER                    0x0000002a
+#define METHOD_BUFFERED                             0
+#define METHOD_IN_DIRECT                            1
+#define METHOD_OUT_DIRECT                           2
+#define METHOD_NEITHER                              3
+#define FILE_ANY_ACCESS                             0
+#define FILE_READ_DATA                              0x0001
+#define FILE_WRITE_DATA                             0x0002
+#define FILE_READ_ACCESS                            FILE_READ_DATA
+#define FILE_WRITE_ACCESS                           FILE_WRITE_DATA
+
+#pragma endregion
+
+#endif
+
+//
+// Code annotations the kernel build checks, meaningless here
+// 
+#if !defined(_MSC_VER)
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Inout_opt_
+#define _In_reads_(_n_)
+#define _In_reads_bytes_(_n_)
+#define _Out_writes_(_n_)
+#define _Out_writes_bytes_(_n_)
+#define _Inout_updates_bytes_(_n_)
+#define _IRQL_requires_max_(_l_)
+#define _IRQL_raises_(_l_)
+#define _IRQL_saves_
+#define _IRQL_restores_
+#define _Must_inspect_result_
+#endif
+
+#define PAGED_CODE()
+
+//
+// The x64 kernel build takes the SSE2 paths; VIGEM_HOST_SCALAR checks the
+// portable fallbacks instead
+// 
+#if defined(__x86_64__) && !defined(_M_AMD64) && !defined(VIGEM_HOST_SCALAR)
+#define _M_AMD64 1
+#endif
+
+#pragma region Synchronization
+
+//
+// Spin locks and rundown references behave like the kernel's, minus the
+// IRQL: nothing gets raised and waits spin instead of blocking.
+// 
+typedef UCHAR KIRQL, *PKIRQL;
+
+#define PASSIVE_LEVEL                               0
+#define DISPATCH_LEVEL                              2
+
+//
+// Reader/writer spin lock; the top bit marks the owner, the rest counts sharers
+// 
+typedef volatile LONG EX_SPIN_LOCK, *PEX_SPIN_LOCK;
+
+#define EX_SPIN_LOCK_OWNER                          ((LONG)0x80000000)
+
+FORCEINLINE KIRQL ExAcquireSpinLockShared(PEX_SPIN_LOCK Lock)
+{
+    LONG value;
+
+    for (;;)
+    {
+        value = ReadNoFence(Lock);
+
+        if ((value & EX_SPIN_LOCK_OWNER) == 0
+            && InterlockedCompareExchange(Lock, value + 1, value) == value)
+        {
+            return PASSIVE_LEVEL;
+        }
+
+        YieldProcessor();
+    }
+}
+
+FORCEINLINE VOID ExReleaseSpinLockShared(PEX_SPIN_LOCK Lock, KIRQL OldIrql)
+{
+    UNREFERENCED_PARAMETER(OldIrql);
+
+    InterlockedDecrement(Lock);
+}
+
+FORCEINLINE KIRQL ExAcquireSpinLockExclusive(PEX_SPIN_LOCK Lock)
+{
+    LONG value;
+
+    //
+    // Claim ownership first so no new sharer gets in, then wait the
+    // current ones out
+    // 
+    for (;;)
+    {
+        value = ReadNoFence(Lock);
+
+        if ((value & EX_SPIN_LOCK_OWNER) == 0
+            && InterlockedCompareExchange(Lock, value | EX_SPIN_LOCK_OWNER, value) == value)
+        {
+            break;
+        }
+
+        YieldProcessor();
+    }
+
+    while (ReadAcquire(Lock) != EX_SPIN_LOCK_OWNER)
+    {
+        YieldProcessor();
+    }
+
+    return PASSIVE_LEVEL;
+}
+
+FORCEINLINE VOID ExReleaseSpinLockExclusive(PEX_SPIN_LOCK Lock, KIRQL OldIrql)
+{
+    UNREFERENCED_PARAMETER(OldIrql);
+
+    WriteRelease(Lock, 0);
+}
+
+//
+// Rundown reference; bit 0 marks it run down, each holder adds 2
+// 
+typedef struct _EX_RUNDOWN_REF
+{
+    volatile LONG Count;
+
+} EX_RUNDOWN_REF, *PEX_RUNDOWN_REF;
+
+FORCEINLINE VOID ExInitializeRundownProtection(PEX_RUNDOWN_REF RunRef)
+{
+    WriteRelease(&RunRef->Count, 0);
+}
+
+FORCEINLINE BOOLEAN ExAcquireRundownProtection(PEX_RUNDOWN_REF RunRef)
+{
+    LONG value;
+
+    for (;;)
+    {
+        value = ReadNoFence(&RunRef->Count);
+
+        if (value & 1)
+        {
+            return FALSE;
+        }
+
+        if (InterlockedCompareExchange(&RunRef->Count, value + 2, value) == value)
+        {
+            return TRUE;
+        }
+    }
+}
+
+FORCEINLINE VOID ExReleaseRundownProtection(PEX_RUNDOWN_REF RunRef)
+{
+    InterlockedExchangeAdd(&RunRef->Count, -2);
+}
+
+FORCEINLINE VOID ExWaitForRundownProtectionRelease(PEX_RUNDOWN_REF RunRef)
+{
+    InterlockedOr(&RunRef->Count, 1);
+
+    while (ReadAcquire(&RunRef->Count) != 1)
+    {
+        YieldProcessor();
+    }
+}
+
+#pragma endregion
+
+#pragma region Lists
+
+//
+// Doubly linked lists as the kernel has them; user mode only gets the type
+// 
+#if !defined(_MSC_VER)
+typedef struct _LIST_ENTRY
+{
+    struct _LIST_ENTRY* Flink;
+    struct _LIST_ENTRY* Blink;
+
+} LIST_ENTRY, *PLIST_ENTRY;
+#endif
+
+FORCEINLINE VOID InitializeListHead(PLIST_ENTRY ListHead)
+{
+    ListHead->Flink = ListHead->Blink = ListHead;
+}
+
+FORCEINLINE BOOLEAN IsListEmpty(const LIST_ENTRY* ListHead)
+{
+    return ListHead->Flink == ListHead;
+}
+
+FORCEINLINE BOOLEAN RemoveEntryList(PLIST_ENTRY Entry)
+{
+    PLIST_ENTRY flink = Entry->Flink;
+    PLIST_ENTRY blink = Entry->Blink;
+
+    blink->Flink = flink;
+    flink->Blink = blink;
+
+    return flink == blink;
+}
+
+FORCEINLINE PLIST_ENTRY RemoveHeadList(PLIST_ENTRY ListHead)
+{
+    PLIST_ENTRY entry = ListHead->Flink;
+
+    RemoveEntryList(entry);
+
+    return entry;
+}
+
+FORCEINLINE VOID InsertTailList(PLIST_ENTRY ListHead, PLIST_ENTRY Entry)
+{
+    PLIST_ENTRY blink = ListHead->Blink;
+
+    Entry->Flink = ListHead;
+    Entry->Blink = blink;
+    blink->Flink = Entry;
+    ListHead->Blink = Entry;
+}
+
+FORCEINLINE VOID InsertHeadList(PLIST_ENTRY ListHead, PLIST_ENTRY Entry)
+{
+    PLIST_ENTRY flink = ListHead->Flink;
+
+    Entry->Flink = flink;
+    Entry->Blink = ListHead;
+    flink->Blink = Entry;
+    ListHead->Flink = Entry;
+}
+
+#pragma endregion
@@ -0,0 +1,385 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Platform.h"
+#include "Test.h"
+
+//
+// Hammers the shared memory input slot protocol of ViGEmBusSharedEx.h.
+// 
+// Writers fill the whole report with one word tagged with their id and a
+// running count; a reader must only ever see all words equal, and the
+// count of each writer must never go backwards.
+// 
+
+#define SLOT_WORDS          (sizeof(VIGEM_TARGET_REPORT) / sizeof(ULONG))
+#define SLOT_WRITERS        2
+#define SLOT_READERS        2
+#define SLOT_WRITES         200000
+
+//
+// Writers go on past SLOT_WRITES until the readers together picked up this
+// many reports, unless the time budget runs out first
+// 
+#define SLOT_MIN_READS      200000
+#define SLOT_BUDGET_NS      10000000000ULL
+
+//
+// Pause between two writes of one writer; a feeder back-to-back writing
+// keeps the slot busy and readers would mostly give up
+// 
+#define SLOT_WRITE_PAUSE    32
+
+C_ASSERT(SLOT_WORDS >= 2);
+
+typedef union _SLOT_REPORT
+{
+    VIGEM_TARGET_REPORT Report;
+
+    ULONG Words[SLOT_WORDS];
+
+} SLOT_REPORT, *PSLOT_REPORT;
+
+typedef struct _SLOT_STRESS
+{
+    VIGEM_INPUT_SLOT Slot;
+
+    volatile LONG WritersDone;
+
+    ULONG Writer;
+
+    ULONG64 Deadline;
+
+    //
+    // Reports each writer published
+    // 
+    ULONG Writes[SLOT_WRITERS];
+
+    //
+    // Per reader results
+    // 
+    volatile ULONG64 Reads[SLOT_READERS];
+
+    ULONG64 Torn[SLOT_READERS];
+
+    ULONG64 Backwards[SLOT_READERS];
+
+} SLOT_STRESS, *PSLOT_STRESS;
+
+typedef struct _SLOT_THREAD
+{
+    PSLOT_STRESS Stress;
+
+    ULONG Id;
+
+} SLOT_THREAD, *PSLOT_THREAD;
+
+static VOID SlotFill(PSLOT_REPORT Report, ULONG Value)
+{
+    ULONG i;
+
+    for (i = 0; i < SLOT_WORDS; i++)
+    {
+        Report->Words[i] = Value;
+    }
+}
+
+static ULONG64 SlotReads(PSLOT_STRESS Stress)
+{
+    ULONG64 reads = 0;
+    ULONG i;
+
+    for (i = 0; i < SLOT_READERS; i++)
+    {
+        reads += Stress->Reads[i];
+    }
+
+    return reads;
+}
+
+static VOID SlotWriter(PVOID Context)
+{
+    PSLOT_THREAD thread = Context;
+    PSLOT_STRESS stress = thread->Stress;
+    SLOT_REPORT report;
+    BOOLEAN shared = TestProcessorCount() < 2;
+    ULONG i;
+    ULONG j;
+
+    // The count has 24 bits next to the writer id
+    for (i = 1; i < 0x1000000; i++)
+    {
+        if (i > SLOT_WRITES
+            && (SlotReads(stress) >= SLOT_MIN_READS || TestNow() > stress->Deadline))
+        {
+            break;
+        }
+
+        SlotFill(&report, (thread->Id << 24) | i);
+
+        VIGEM_INPUT_SLOT_WRITE(&stress->Slot, &report.Report, sizeof(report.Report));
+
+        stress->Writes[thread->Id] = i;
+
+        //
+        // Sharing one processor readers would only get to run once per
+        // time slice and see hardly any of the writes; they yield back
+        // once they have seen it
+        // 
+        if (shared)
+        {
+            TestThreadYield();
+            continue;
+        }
+
+        for (j = 0; j < SLOT_WRITE_PAUSE; j++)
+        {
+            YieldProcessor();
+        }
+    }
+
+    InterlockedIncrement(&stress->WritersDone);
+}
+
+static VOID SlotReader(PVOID Context)
+{
+    PSLOT_THREAD thread = Context;
+    PSLOT_STRESS stress = thread->Stress;
+    SLOT_REPORT report;
+    ULONG last[SLOT_WRITERS] = { 0 };
+    LONG sequence = 0;
+    BOOLEAN shared = TestProcessorCount() < 2;
+    ULONG writer;
+    ULONG i;
+
+    while (ReadAcquire(&stress->WritersDone) < SLOT_WRITERS)
+    {
+        if (!VIGEM_INPUT_SLOT_READ(&stress->Slot, &report.Report, sizeof(report.Report), &sequence))
+        {
+            // Nothing new before a writer got to run
+            if (shared)
+            {
+                TestThreadYield();
+            }
+
+            continue;
+        }
+
+        stress->Reads[thread->Id]++;
+
+        for (i = 1; i < SLOT_WORDS; i++)
+        {
+            if (report.Words[i] != report.Words[0])
+            {
+                stress->Torn[thread->Id]++;
+                break;
+            }
+        }
+
+        writer = report.Words[0] >> 24;
+
+        if (writer < SLOT_WRITERS)
+        {
+            if ((report.Words[0] & 0xFFFFFF) < last[writer])
+            {
+                stress->Backwards[thread->Id]++;
+            }
+
+            last[writer] = report.Words[0] & 0xFFFFFF;
+        }
+    }
+}
+
+static VOID InputSlot_ReadSeesEachWriteOnce(VOID)
+{
+    static VIGEM_INPUT_SLOT slot;
+    SLOT_REPORT report;
+    LONG sequence = 0;
+
+    RtlZeroMemory(&slot, sizeof(slot));
+
+    TEST_CHECK(!VIGEM_INPUT_SLOT_READ(&slot, &report.Report, sizeof(report.Report), &sequence));
+
+    SlotFill(&report, 0x1234);
+    VIGEM_INPUT_SLOT_WRITE(&slot, &report.Report, sizeof(report.Report));
+
+    SlotFill(&report, 0);
+    TEST_CHECK(VIGEM_INPUT_SLOT_READ(&slot, &report.Report, sizeof(report.Report), &sequence));
+    TEST_CHECK_EQUAL(0x1234, report.Words[SLOT_WORDS - 1]);
+    TEST_CHECK_EQUAL(2, sequence);
+
+    TEST_CHECK(!VIGEM_INPUT_SLOT_READ(&slot, &report.Report, sizeof(report.Report), &sequence));
+}
+
+static VOID InputSlot_ReadGivesUpOnBusyWriter(VOID)
+{
+    static VIGEM_INPUT_SLOT slot;
+    SLOT_REPORT report;
+    LONG sequence = 0;
+
+    RtlZeroMemory(&slot, sizeof(slot));
+
+    // Writer stalled half-way through
+    slot.Sequence = 3;
+
+    TEST_CHECK(!VIGEM_INPUT_SLOT_READ(&slot, &report.Report, sizeof(report.Report), &sequence));
+    TEST_CHECK_EQUAL(0, sequence);
+}
+
+static VOID InputSlot_NoTornReads(VOID)
+{
+    static SLOT_STRESS stress;
+    SLOT_THREAD writers[SLOT_WRITERS];
+    SLOT_THREAD readers[SLOT_READERS];
+    TEST_THREAD threads[SLOT_WRITERS + SLOT_READERS];
+    ULONG64 writes = 0;
+    ULONG64 reads;
+    ULONG i;
+
+    RtlZeroMemory(&stress, sizeof(stress));
+
+    stress.Deadline = TestNow() + SLOT_BUDGET_NS;
+
+    for (i = 0; i < SLOT_READERS; i++)
+    {
+        readers[i].Stress = &stress;
+        readers[i].Id = i;
+        TestThreadStart(&threads[SLOT_WRITERS + i], SlotReader, &readers[i]);
+    }
+
+    for (i = 0; i < SLOT_WRITERS; i++)
+    {
+        writers[i].Stress = &stress;
+        writers[i].Id = i;
+        TestThreadStart(&threads[i], SlotWriter, &writers[i]);
+    }
+
+    for (i = 0; i < SLOT_WRITERS + SLOT_READERS; i++)
+    {
+        TestThreadJoin(&threads[i]);
+    }
+
+    for (i = 0; i < SLOT_READERS; i++)
+    {
+        TEST_CHECK_EQUAL(0, stress.Torn[i]);
+        TEST_CHECK_EQUAL(0, stress.Backwards[i]);
+    }
+
+    for (i = 0; i < SLOT_WRITERS; i++)
+    {
+        writes += stress.Writes[i];
+    }
+
+    reads = SlotReads(&stress);
+
+    // Every write bumps the sequence by two
+    TEST_CHECK_EQUAL(writes * 2, stress.Slot.Sequence);
+    TEST_CHECK(reads >= SLOT_MIN_READS);
+
+    printf("    %llu consistent reads\n", (unsigned long long)reads);
+}
+
+static VOID Bench_WriteRead(VOID)
+{
+    static VIGEM_INPUT_SLOT slot;
+    SLOT_REPORT report;
+    LONG sequence = 0;
+    ULONG64 start;
+    ULONG i;
+
+    RtlZeroMemory(&slot, sizeof(slot));
+    SlotFill(&report, 1);
+
+    start = TestNow();
+
+    for (i = 0; i < 10000000; i++)
+    {
+        report.Words[0] = i;
+        VIGEM_INPUT_SLOT_WRITE(&slot, &report.Report, sizeof(report.Report));
+        TestSink += VIGEM_INPUT_SLOT_READ(&slot, &report.Report, sizeof(report.Report), &sequence);
+    }
+
+    TestReport("write + read, uncontended", TestNow() - start, i);
+}
+
+static VOID Bench_ReadUnderWriter(VOID)
+{
+    static SLOT_STRESS stress;
+    SLOT_THREAD writer;
+    TEST_THREAD thread;
+    SLOT_REPORT report;
+    LONG sequence = 0;
+    ULONG64 attempts = 0;
+    ULONG64 reads = 0;
+    ULONG64 start;
+
+    // The reader spins, sharing a processor the writer hardly gets to run
+    if (TestProcessorCount() < 2)
+    {
+        printf("    %-44s skipped, needs two processors\n", "read, concurrent writer");
+        return;
+    }
+
+    RtlZeroMemory(&stress, sizeof(stress));
+
+    // Only one writer; pretend the other one is done already
+    stress.WritersDone = SLOT_WRITERS - 1;
+    writer.Stress = &stress;
+    writer.Id = 0;
+
+    TestThreadStart(&thread, SlotWriter, &writer);
+
+    start = TestNow();
+
+    while (ReadAcquire(&stress.WritersDone) < SLOT_WRITERS)
+    {
+        reads += VIGEM_INPUT_SLOT_READ(&stress.Slot, &report.Report, sizeof(report.Report), &sequence);
+        attempts++;
+    }
+
+    TestReport("read, concurrent writer", TestNow() - start, attempts);
+
+    TestThreadJoin(&thread);
+
+    printf("    %llu of %llu reads got a new report\n",
+        (unsigned long long)reads, (unsigned long long)attempts);
+}
+
+static const TEST_CASE Tests[] =
+{
+    TEST_CASE_OF(InputSlot_ReadSeesEachWriteOnce),
+    TEST_CASE_OF(InputSlot_ReadGivesUpOnBusyWriter),
+    TEST_CASE_OF(InputSlot_NoTornReads),
+};
+
+static const TEST_CASE Benchmarks[] =
+{
+    TEST_CASE_OF(Bench_WriteRead),
+    TEST_CASE_OF(Bench_ReadUnderWriter),
+};
+
+TEST_MAIN(Tests, Benchmarks)
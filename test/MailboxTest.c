@@ -0,0 +1,417 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Platform.h"
+#include "Test.h"
+
+//
+// Checks the latest-value mailbox handshake between submitters and IN URBs
+// (sys/ReportMailbox.h) by running every interleaving of its steps.
+// 
+// Each actor runs the driver's own ReportMailboxSubmit/Arrive on a fiber.
+// Every access to shared state, the flag as well as the simulated parked
+// queue and report cache, first yields to a scheduler which picks the actor
+// to go on. Exploring all choices replays the handshake in every order its
+// atomic steps can take.
+// 
+
+static VOID ModelYield(VOID);
+
+static LONG ModelExchange(volatile LONG* Target, LONG Value)
+{
+    LONG previous;
+
+    ModelYield();
+
+    previous = *Target;
+    *Target = Value;
+
+    return previous;
+}
+
+static LONG ModelRead(volatile LONG* Source)
+{
+    ModelYield();
+
+    return *Source;
+}
+
+#undef InterlockedExchange
+#define InterlockedExchange     ModelExchange
+#undef ReadNoFence
+#define ReadNoFence             ModelRead
+
+#include "ReportMailbox.h"
+
+#define MODEL_ACTORS        3
+#define MODEL_OPERATIONS    2
+#define MODEL_URBS          4
+#define MODEL_DECISIONS     128
+
+typedef enum _MODEL_OPERATION
+{
+    ModelSubmit,
+    ModelArrive
+
+} MODEL_OPERATION;
+
+typedef struct _MODEL_ACTOR
+{
+    ULONG OperationCount;
+
+    MODEL_OPERATION Operations[MODEL_OPERATIONS];
+
+    //
+    // Report value to submit or URB to send, per operation
+    // 
+    LONG Arguments[MODEL_OPERATIONS];
+
+    TEST_FIBER Fiber;
+
+} MODEL_ACTOR, *PMODEL_ACTOR;
+
+typedef struct _MODEL
+{
+    volatile LONG ReportPending;
+
+    LONG Cache;
+
+    LONG Parked[MODEL_URBS];
+
+    ULONG ParkedCount;
+
+    //
+    // Report value each URB got completed with, 0 while outstanding
+    // 
+    LONG Delivered[MODEL_URBS];
+
+    ULONG ActorCount;
+
+    MODEL_ACTOR Actors[MODEL_ACTORS];
+
+} MODEL, *PMODEL;
+
+//
+// Scheduler choices of the run being replayed, and how many actors could
+// have gone on at each of them
+// 
+typedef struct _MODEL_SCHEDULE
+{
+    ULONG Choices[MODEL_DECISIONS];
+
+    ULONG Options[MODEL_DECISIONS];
+
+    ULONG Length;
+
+} MODEL_SCHEDULE, *PMODEL_SCHEDULE;
+
+static MODEL Model;
+
+static ULONG64 ModelInterleavings;
+
+static VOID ModelYield(VOID)
+{
+    TestFiberYield();
+}
+
+#pragma region Simulated queue and cache
+
+static BOOLEAN ModelRetrieve(PVOID Queue, PVOID* Request)
+{
+    PMODEL model = Queue;
+    ULONG i;
+
+    ModelYield();
+
+    if (model->ParkedCount == 0)
+    {
+        return FALSE;
+    }
+
+    *Request = (PVOID)(ULONG_PTR)model->Parked[0];
+
+    for (i = 1; i < model->ParkedCount; i++)
+    {
+        model->Parked[i - 1] = model->Parked[i];
+    }
+
+    model->ParkedCount--;
+
+    return TRUE;
+}
+
+static NTSTATUS ModelPark(PVOID Queue, PVOID Request)
+{
+    PMODEL model = Queue;
+
+    ModelYield();
+
+    model->Parked[model->ParkedCount++] = (LONG)(ULONG_PTR)Request;
+
+    return STATUS_SUCCESS;
+}
+
+static VOID ModelDeliver(PMODEL Model, LONG Urb)
+{
+    ModelYield();
+
+    // Bus_CopyReportCacheToUrb copies whatever is cached at this point
+    TEST_CHECK(Model->Delivered[Urb] == 0);
+
+    Model->Delivered[Urb] = Model->Cache;
+}
+
+static VOID ModelComplete(PVOID Pdo, PVOID Request)
+{
+    ModelDeliver(Pdo, (LONG)(ULONG_PTR)Request);
+}
+
+static const REPORT_MAILBOX_OPS ModelOps =
+{
+    .Retrieve = ModelRetrieve,
+    .Park = ModelPark,
+    .Complete = ModelComplete,
+};
+
+#pragma endregion
+
+//
+// What Bus_SubmitReportToPdoEx and Bus_QueueInRequest do around the handshake
+// 
+static VOID ModelActor(PVOID Context)
+{
+    PMODEL_ACTOR actor = Context;
+    ULONG i;
+
+    for (i = 0; i < actor->OperationCount; i++)
+    {
+        if (actor->Operations[i] == ModelSubmit)
+        {
+            // CacheReport
+            ModelYield();
+            Model.Cache = actor->Arguments[i];
+
+            ReportMailboxSubmit(&Model.ReportPending, &ModelOps, &Model, &Model, FALSE);
+        }
+        else if (ReportMailboxArrive(&Model.ReportPending, &ModelOps, &Model, &Model,
+            (PVOID)(ULONG_PTR)actor->Arguments[i]) == STATUS_SUCCESS)
+        {
+            ModelDeliver(&Model, actor->Arguments[i]);
+        }
+    }
+}
+
+//
+// Once everybody is done the latest report must have reached a URB, or
+// still be flagged with no URB left waiting for it
+// 
+static VOID ModelCheckFinal(const MODEL* Model)
+{
+    BOOLEAN delivered = FALSE;
+    ULONG i;
+
+    for (i = 0; i < MODEL_URBS; i++)
+    {
+        delivered |= (Model->Delivered[i] == Model->Cache);
+    }
+
+    if (Model->ReportPending)
+    {
+        TEST_CHECK_EQUAL(0, Model->ParkedCount);
+    }
+    else
+    {
+        TEST_CHECK(delivered);
+    }
+
+    ModelInterleavings++;
+}
+
+//
+// Runs the actors from Initial along Schedule, choosing the first runnable
+// actor past its recorded choices
+// 
+static VOID ModelRun(const MODEL* Initial, PMODEL_SCHEDULE Schedule)
+{
+    ULONG runnable[MODEL_ACTORS];
+    ULONG count;
+    ULONG decision;
+    ULONG i;
+
+    Model = *Initial;
+
+    for (i = 0; i < Model.ActorCount; i++)
+    {
+        TestFiberCreate(&Model.Actors[i].Fiber, ModelActor, &Model.Actors[i]);
+    }
+
+    for (decision = 0; ; decision++)
+    {
+        count = 0;
+
+        for (i = 0; i < Model.ActorCount; i++)
+        {
+            if (!Model.Actors[i].Fiber.Finished)
+            {
+                runnable[count++] = i;
+            }
+        }
+
+        if (count == 0)
+        {
+            break;
+        }
+
+        if (decision == MODEL_DECISIONS)
+        {
+            TEST_CHECK(decision < MODEL_DECISIONS);
+            break;
+        }
+
+        if (decision >= Schedule->Length)
+        {
+            Schedule->Choices[decision] = 0;
+        }
+
+        Schedule->Options[decision] = count;
+
+        TestFiberRun(&Model.Actors[runnable[Schedule->Choices[decision]]].Fiber);
+    }
+
+    Schedule->Length = decision;
+
+    for (i = 0; i < Model.ActorCount; i++)
+    {
+        TestFiberDelete(&Model.Actors[i].Fiber);
+    }
+
+    ModelCheckFinal(&Model);
+}
+
+//
+// Replays the model once for every sequence of scheduler choices
+// 
+static VOID ModelExplore(const MODEL* Initial)
+{
+    MODEL_SCHEDULE schedule = { 0 };
+    ULONG i;
+
+    for (;;)
+    {
+        ModelRun(Initial, &schedule);
+
+        // Move on to the next choice at the deepest decision that has one left
+        for (i = schedule.Length; i > 0; i--)
+        {
+            if (schedule.Choices[i - 1] + 1 < schedule.Options[i - 1])
+            {
+                break;
+            }
+        }
+
+        if (i == 0)
+        {
+            break;
+        }
+
+        schedule.Choices[i - 1]++;
+        schedule.Length = i;
+    }
+}
+
+static VOID ModelAddActor(PMODEL Model, MODEL_OPERATION First, LONG FirstArgument, ULONG Count, MODEL_OPERATION Second, LONG SecondArgument)
+{
+    PMODEL_ACTOR actor = &Model->Actors[Model->ActorCount++];
+
+    actor->OperationCount = Count;
+    actor->Operations[0] = First;
+    actor->Arguments[0] = FirstArgument;
+    actor->Operations[1] = Second;
+    actor->Arguments[1] = SecondArgument;
+}
+
+static VOID Mailbox_FeederAndHostInterleaved(VOID)
+{
+    MODEL model = { 0 };
+
+    ModelAddActor(&model, ModelSubmit, 1, 2, ModelSubmit, 2);
+    ModelAddActor(&model, ModelArrive, 1, 2, ModelArrive, 2);
+
+    ModelInterleavings = 0;
+    ModelExplore(&model);
+
+    printf("    %llu interleavings\n", (unsigned long long)ModelInterleavings);
+}
+
+static VOID Mailbox_ConcurrentSubmitters(VOID)
+{
+    MODEL model = { 0 };
+
+    ModelAddActor(&model, ModelSubmit, 1, 1, ModelSubmit, 0);
+    ModelAddActor(&model, ModelSubmit, 2, 1, ModelSubmit, 0);
+    ModelAddActor(&model, ModelArrive, 1, 1, ModelArrive, 0);
+
+    ModelExplore(&model);
+}
+
+static VOID Mailbox_ConcurrentUrbs(VOID)
+{
+    MODEL model = { 0 };
+
+    ModelAddActor(&model, ModelSubmit, 1, 1, ModelSubmit, 0);
+    ModelAddActor(&model, ModelArrive, 1, 1, ModelArrive, 0);
+    ModelAddActor(&model, ModelArrive, 2, 1, ModelArrive, 0);
+
+    ModelExplore(&model);
+}
+
+static VOID Mailbox_UrbParkedBeforehand(VOID)
+{
+    MODEL model = { 0 };
+
+    model.Parked[model.ParkedCount++] = 3;
+
+    ModelAddActor(&model, ModelSubmit, 1, 2, ModelSubmit, 2);
+    ModelAddActor(&model, ModelArrive, 1, 1, ModelArrive, 0);
+
+    ModelExplore(&model);
+}
+
+static const TEST_CASE Tests[] =
+{
+    TEST_CASE_OF(Mailbox_FeederAndHostInterleaved),
+    TEST_CASE_OF(Mailbox_ConcurrentSubmitters),
+    TEST_CASE_OF(Mailbox_ConcurrentUrbs),
+    TEST_CASE_OF(Mailbox_UrbParkedBeforehand),
+};
+
+static const TEST_CASE Benchmarks[] =
+{
+    { NULL, NULL }
+};
+
+TEST_MAIN(Tests, Benchmarks)
@@ -0,0 +1,568 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include <stdlib.h>
+
+#include "Platform.h"
+#include "PlaybackCore.h"
+#include "Test.h"
+
+//
+// The scheduler is driven by a virtual clock here. Simulate below mirrors
+// Playback_EvtTimerFunc and Playback_Arm: every tick plays what is due
+// within the early window, up to a burst, and re-arms for the next entry.
+// The simulated timer fires up to a given lateness after the requested
+// time, like a system timer at 1 ms resolution does.
+// 
+
+#define TEST_REPORT_SIZE    sizeof(XUSB_REPORT)
+
+#pragma region Timelines
+
+typedef struct _TEST_TIMELINE
+{
+    PUCHAR Buffer;
+
+    size_t Length;
+
+} TEST_TIMELINE, *PTEST_TIMELINE;
+
+static VOID TimelineBuild(PTEST_TIMELINE Timeline, const ULONG* Due, ULONG Count, ULONG64 DurationUs)
+{
+    PVIGEM_TIMELINE_HEADER  header;
+    PUCHAR                  entry;
+    ULONG                   i;
+
+    Timeline->Length = (size_t)VIGEM_TIMELINE_SIZE(TEST_REPORT_SIZE, Count);
+    Timeline->Buffer = calloc(1, Timeline->Length);
+
+    header = (PVIGEM_TIMELINE_HEADER)Timeline->Buffer;
+    header->Magic = VIGEM_TIMELINE_MAGIC;
+    header->Version = VIGEM_TIMELINE_VERSION;
+    header->ReportSize = (USHORT)TEST_REPORT_SIZE;
+    header->TargetType = Xbox360Wired;
+    header->EntryCount = Count;
+    header->DurationUs = DurationUs;
+
+    entry = (PUCHAR)(header + 1);
+
+    for (i = 0; i < Count; i++)
+    {
+        RtlCopyMemory(entry, &Due[i], sizeof(ULONG));
+        // Tag the report with its index
+        RtlCopyMemory(entry + sizeof(ULONG), &i, sizeof(ULONG));
+        entry += VIGEM_TIMELINE_ENTRY_SIZE(TEST_REPORT_SIZE);
+    }
+}
+
+static NTSTATUS TimelineParse(const TEST_TIMELINE* Timeline, PPLAYBACK_TIMELINE Parsed)
+{
+    return Playback_ParseTimeline(Timeline->Buffer, Timeline->Length,
+        Xbox360Wired, (ULONG)TEST_REPORT_SIZE, Parsed);
+}
+
+//
+// Increasing due times with random gaps of up to MaxGap, some of them zero
+// 
+static PULONG RandomDueTimes(ULONG Count, ULONG MaxGap, PULONG64 State)
+{
+    PULONG  due = malloc(Count * sizeof(ULONG));
+    ULONG   now = 0;
+    ULONG   i;
+
+    for (i = 0; i < Count; i++)
+    {
+        due[i] = now;
+        now += (TestRandom(State) % 8 == 0) ? 0 : (ULONG)(TestRandom(State) % MaxGap) + 1;
+    }
+
+    return due;
+}
+
+#pragma endregion
+
+#pragma region Simulation
+
+typedef struct _SIM_PLAY
+{
+    ULONG Entry;
+
+    LONG64 Scheduled;
+
+    LONG64 PlayedAt;
+
+} SIM_PLAY, *PSIM_PLAY;
+
+typedef struct _SIM_RESULT
+{
+    PSIM_PLAY Plays;
+
+    ULONG Played;
+
+    LONG64 JitterMin;
+
+    LONG64 JitterMax;
+
+    //
+    // Largest number of entries a single tick played
+    //
+    ULONG LargestBurst;
+
+    PLAYBACK_CURSOR Cursor;
+
+} SIM_RESULT, *PSIM_RESULT;
+
+//
+// Runs a playback from Start until it finishes or the clock passes StopAt.
+// 
+// Every timer expiry is late by a random amount of up to MaxLatenessUs; a
+// non-zero StallAt delays the first expiry at or after it to StallUntil.
+// 
+static VOID Simulate(
+    const PLAYBACK_TIMELINE* Timeline,
+    BOOLEAN Loop,
+    LONG64 Start,
+    LONG64 StopAt,
+    ULONG MaxLatenessUs,
+    LONG64 StallAt,
+    LONG64 StallUntil,
+    ULONG MaxPlays,
+    PSIM_RESULT Result)
+{
+    ULONG64 state = 0xD1B54A32D192ED03ULL;
+    LONG64  now = Start;
+    LONG64  due;
+    LONG64  scheduled;
+    LONG64  jitter;
+    ULONG   entry;
+    ULONG   burst;
+
+    RtlZeroMemory(Result, sizeof(SIM_RESULT));
+    Result->Plays = malloc(MaxPlays * sizeof(SIM_PLAY));
+    Result->JitterMin = MAXLONG64;
+    Result->JitterMax = -MAXLONG64;
+
+    Playback_CursorInit(&Result->Cursor, now, Loop);
+
+    // Playback_Control arms for the first entry right away
+    if (!Playback_NextDueTime(Timeline, &Result->Cursor, &due))
+    {
+        return;
+    }
+
+    for (;;)
+    {
+        // Playback_Arm, then the timer fires somewhat late
+        now += max(due - now - PLAYBACK_EARLY_WINDOW_US, 1);
+        now += MaxLatenessUs ? (LONG64)(TestRandom(&state) % (MaxLatenessUs + 1)) : 0;
+
+        if (StallAt && now >= StallAt)
+        {
+            now = max(now, StallUntil);
+            StallAt = 0;
+        }
+
+        if (now > StopAt)
+        {
+            break;
+        }
+
+        for (burst = 0; burst < PLAYBACK_MAX_BURST; burst++)
+        {
+            if (!Playback_NextDue(Timeline, &Result->Cursor, now + PLAYBACK_EARLY_WINDOW_US, &entry, &scheduled))
+            {
+                break;
+            }
+
+            if (Result->Played == MaxPlays)
+            {
+                return;
+            }
+
+            jitter = now - scheduled;
+
+            Result->Plays[Result->Played].Entry = entry;
+            Result->Plays[Result->Played].Scheduled = scheduled;
+            Result->Plays[Result->Played].PlayedAt = now;
+            Result->Played++;
+            Result->JitterMin = min(Result->JitterMin, jitter);
+            Result->JitterMax = max(Result->JitterMax, jitter);
+        }
+
+        Result->LargestBurst = max(Result->LargestBurst, burst);
+
+        if (!Playback_NextDueTime(Timeline, &Result->Cursor, &due))
+        {
+            break;
+        }
+    }
+}
+
+#pragma endregion
+
+#pragma region Tests
+
+static VOID Parse_AcceptsTimeline(VOID)
+{
+    static const ULONG  due[] = { 0, 0, 1000, 2500, 2500, 9000 };
+    TEST_TIMELINE       timeline;
+    PLAYBACK_TIMELINE   parsed;
+    ULONG               tag;
+
+    TimelineBuild(&timeline, due, RTL_NUMBER_OF(due), 9000);
+
+    TEST_CHECK_EQUAL(STATUS_SUCCESS, TimelineParse(&timeline, &parsed));
+    TEST_CHECK_EQUAL(RTL_NUMBER_OF(due), parsed.EntryCount);
+    TEST_CHECK_EQUAL(VIGEM_TIMELINE_ENTRY_SIZE(TEST_REPORT_SIZE), parsed.EntrySize);
+    TEST_CHECK_EQUAL(TEST_REPORT_SIZE, parsed.ReportSize);
+    TEST_CHECK_EQUAL(9000, parsed.DurationUs);
+    TEST_CHECK(parsed.Entries == timeline.Buffer + sizeof(VIGEM_TIMELINE_HEADER));
+
+    RtlCopyMemory(&tag, parsed.Entries + 4 * parsed.EntrySize + sizeof(ULONG), sizeof(ULONG));
+    TEST_CHECK_EQUAL(4, tag);
+
+    free(timeline.Buffer);
+}
+
+static VOID Parse_RejectsMalformed(VOID)
+{
+    static const ULONG      due[] = { 0, 100, 200 };
+    TEST_TIMELINE           timeline;
+    PLAYBACK_TIMELINE       parsed;
+    PVIGEM_TIMELINE_HEADER  header;
+    ULONG                   value;
+
+    TimelineBuild(&timeline, due, RTL_NUMBER_OF(due), 200);
+    header = (PVIGEM_TIMELINE_HEADER)timeline.Buffer;
+
+    TEST_CHECK_EQUAL(STATUS_SUCCESS, TimelineParse(&timeline, &parsed));
+
+    TEST_CHECK_EQUAL(STATUS_INVALID_BUFFER_SIZE,
+        Playback_ParseTimeline(timeline.Buffer, sizeof(VIGEM_TIMELINE_HEADER) - 1, Xbox360Wired, (ULONG)TEST_REPORT_SIZE, &parsed));
+    TEST_CHECK_EQUAL(STATUS_INVALID_BUFFER_SIZE,
+        Playback_ParseTimeline(timeline.Buffer, timeline.Length - 1, Xbox360Wired, (ULONG)TEST_REPORT_SIZE, &parsed));
+    TEST_CHECK_EQUAL(STATUS_INVALID_PARAMETER,
+        Playback_ParseTimeline(timeline.Buffer, timeline.Length, DualShock4Wired, (ULONG)TEST_REPORT_SIZE, &parsed));
+    TEST_CHECK_EQUAL(STATUS_INVALID_PARAMETER,
+        Playback_ParseTimeline(timeline.Buffer, timeline.Length, Xbox360Wired, (ULONG)TEST_REPORT_SIZE + 1, &parsed));
+
+    header->Magic ^= 1;
+    TEST_CHECK_EQUAL(STATUS_INVALID_PARAMETER, TimelineParse(&timeline, &parsed));
+    header->Magic ^= 1;
+
+    header->Version++;
+    TEST_CHECK_EQUAL(STATUS_INVALID_PARAMETER, TimelineParse(&timeline, &parsed));
+    header->Version--;
+
+    header->EntryCount = 0;
+    TEST_CHECK_EQUAL(STATUS_INVALID_BUFFER_SIZE, TimelineParse(&timeline, &parsed));
+    header->EntryCount = RTL_NUMBER_OF(due) + 1;
+    TEST_CHECK_EQUAL(STATUS_INVALID_BUFFER_SIZE, TimelineParse(&timeline, &parsed));
+    header->EntryCount = RTL_NUMBER_OF(due);
+
+    // Last entry past the end of a pass
+    header->DurationUs = 199;
+    TEST_CHECK_EQUAL(STATUS_INVALID_PARAMETER, TimelineParse(&timeline, &parsed));
+    header->DurationUs = 200;
+
+    // Due times going backwards
+    value = 99;
+    RtlCopyMemory(timeline.Buffer + sizeof(VIGEM_TIMELINE_HEADER) + 2 * VIGEM_TIMELINE_ENTRY_SIZE(TEST_REPORT_SIZE),
+        &value, sizeof(ULONG));
+    TEST_CHECK_EQUAL(STATUS_INVALID_PARAMETER, TimelineParse(&timeline, &parsed));
+
+    free(timeline.Buffer);
+}
+
+static VOID Schedule_EarlyWindowEdge(VOID)
+{
+    static const ULONG  due[] = { 1000, 2000 };
+    TEST_TIMELINE       timeline;
+    PLAYBACK_TIMELINE   parsed;
+    PLAYBACK_CURSOR     cursor;
+    ULONG               entry;
+    LONG64              scheduled;
+    LONG64              next;
+
+    TimelineBuild(&timeline, due, RTL_NUMBER_OF(due), 2000);
+    TEST_CHECK_EQUAL(STATUS_SUCCESS, TimelineParse(&timeline, &parsed));
+
+    Playback_CursorInit(&cursor, 50000, FALSE);
+
+    TEST_CHECK(Playback_NextDueTime(&parsed, &cursor, &next));
+    TEST_CHECK_EQUAL(51000, next);
+
+    // One microsecond short of due leaves the entry on the cursor
+    TEST_CHECK(!Playback_NextDue(&parsed, &cursor, 50999, &entry, &scheduled));
+    TEST_CHECK_EQUAL(0, cursor.Index);
+
+    TEST_CHECK(Playback_NextDue(&parsed, &cursor, 51000, &entry, &scheduled));
+    TEST_CHECK_EQUAL(0, entry);
+    TEST_CHECK_EQUAL(51000, scheduled);
+
+    TEST_CHECK(Playback_NextDue(&parsed, &cursor, 60000, &entry, &scheduled));
+    TEST_CHECK_EQUAL(1, entry);
+    TEST_CHECK_EQUAL(52000, scheduled);
+
+    // A single pass is through after its last entry
+    TEST_CHECK(!Playback_NextDue(&parsed, &cursor, 60000, &entry, &scheduled));
+    TEST_CHECK(!Playback_NextDueTime(&parsed, &cursor, &next));
+    TEST_CHECK_EQUAL(0, cursor.Loops);
+
+    free(timeline.Buffer);
+}
+
+static VOID Schedule_PlaysEveryEntryOnceInOrder(VOID)
+{
+    const ULONG         count = 5000;
+    ULONG64             state = 0x9E3779B97F4A7C15ULL;
+    PULONG              due = RandomDueTimes(count, 4000, &state);
+    TEST_TIMELINE       timeline;
+    PLAYBACK_TIMELINE   parsed;
+    SIM_RESULT          result;
+    ULONG               lateness;
+    ULONG               i;
+
+    TimelineBuild(&timeline, due, count, due[count - 1]);
+    TEST_CHECK_EQUAL(STATUS_SUCCESS, TimelineParse(&timeline, &parsed));
+
+    for (lateness = 0; lateness <= 2000; lateness += 500)
+    {
+        Simulate(&parsed, FALSE, 1000000, MAXLONG64, lateness, 0, 0, count, &result);
+
+        TEST_CHECK_EQUAL(count, result.Played);
+
+        for (i = 0; i < result.Played; i++)
+        {
+            TEST_CHECK_EQUAL(i, result.Plays[i].Entry);
+            TEST_CHECK_EQUAL(1000000 + due[i], result.Plays[i].Scheduled);
+        }
+
+        // Never earlier than the window, never later than the timer is;
+        // the first tick is armed the minimum of 1us out
+        TEST_CHECK(result.JitterMin >= -PLAYBACK_EARLY_WINDOW_US);
+        TEST_CHECK(result.JitterMax <= (LONG64)lateness + 1);
+
+        // With an on-time timer everything past the first tick plays
+        // exactly one window early
+        if (lateness == 0)
+        {
+            for (i = 0; i < result.Played; i++)
+            {
+                if (due[i] > PLAYBACK_EARLY_WINDOW_US + 1)
+                {
+                    TEST_CHECK_EQUAL(-PLAYBACK_EARLY_WINDOW_US, result.Plays[i].PlayedAt - result.Plays[i].Scheduled);
+                }
+            }
+        }
+
+        free(result.Plays);
+    }
+
+    free(timeline.Buffer);
+    free(due);
+}
+
+static VOID Schedule_LoopsWithoutDrift(VOID)
+{
+    static const ULONG  due[] = { 0, 4000, 8000, 8000, 15000, 16000 };
+    const ULONG         passes = 100;
+    const ULONG64       duration = 16000;
+    TEST_TIMELINE       timeline;
+    PLAYBACK_TIMELINE   parsed;
+    SIM_RESULT          result;
+    ULONG               count = RTL_NUMBER_OF(due);
+    ULONG               i;
+
+    TimelineBuild(&timeline, due, count, duration);
+    TEST_CHECK_EQUAL(STATUS_SUCCESS, TimelineParse(&timeline, &parsed));
+
+    Simulate(&parsed, TRUE, 0, MAXLONG64, 1500, 0, 0, count * passes, &result);
+
+    TEST_CHECK_EQUAL(count * passes, result.Played);
+
+    // Every pass starts exactly one duration after the previous one, late
+    // expiries don't push the following passes back
+    for (i = 0; i < result.Played; i++)
+    {
+        TEST_CHECK_EQUAL(i % count, result.Plays[i].Entry);
+        TEST_CHECK_EQUAL((LONG64)(i / count) * duration + due[i % count], result.Plays[i].Scheduled);
+    }
+
+    TEST_CHECK_EQUAL(passes, result.Cursor.Loops);
+    TEST_CHECK_EQUAL((LONG64)passes * duration, result.Cursor.Origin);
+    TEST_CHECK(result.JitterMax <= 1500);
+
+    free(result.Plays);
+    free(timeline.Buffer);
+}
+
+static VOID Schedule_CatchesUpAfterStall(VOID)
+{
+    const ULONG         count = 1000;
+    const ULONG         gap = 100;
+    const LONG64        stallAt = 20000;
+    const LONG64        stallUntil = 70000;
+    PULONG              due = malloc(count * sizeof(ULONG));
+    TEST_TIMELINE       timeline;
+    PLAYBACK_TIMELINE   parsed;
+    SIM_RESULT          result;
+    ULONG               behind = 0;
+    ULONG               i;
+
+    for (i = 0; i < count; i++)
+    {
+        due[i] = i * gap;
+    }
+
+    TimelineBuild(&timeline, due, count, due[count - 1]);
+    TEST_CHECK_EQUAL(STATUS_SUCCESS, TimelineParse(&timeline, &parsed));
+
+    Simulate(&parsed, FALSE, 0, MAXLONG64, 0, stallAt, stallUntil, count, &result);
+
+    // Nothing gets skipped or reordered to catch up
+    TEST_CHECK_EQUAL(count, result.Played);
+
+    for (i = 0; i < result.Played; i++)
+    {
+        TEST_CHECK_EQUAL(i, result.Plays[i].Entry);
+
+        if (result.Plays[i].PlayedAt - result.Plays[i].Scheduled > 0)
+        {
+            behind++;
+        }
+    }
+
+    // The backlog drains in bursts, a microsecond apart
+    TEST_CHECK_EQUAL(PLAYBACK_MAX_BURST, result.LargestBurst);
+    TEST_CHECK(behind >= (stallUntil - stallAt - PLAYBACK_EARLY_WINDOW_US) / gap);
+    TEST_CHECK(result.JitterMax <= stallUntil - stallAt + PLAYBACK_EARLY_WINDOW_US);
+
+    // and the playback is back on schedule afterwards
+    TEST_CHECK_EQUAL(-PLAYBACK_EARLY_WINDOW_US, result.Plays[count - 1].PlayedAt - result.Plays[count - 1].Scheduled);
+
+    free(result.Plays);
+    free(timeline.Buffer);
+    free(due);
+}
+
+static const TEST_CASE Tests[] =
+{
+    TEST_CASE_OF(Parse_AcceptsTimeline),
+    TEST_CASE_OF(Parse_RejectsMalformed),
+    TEST_CASE_OF(Schedule_EarlyWindowEdge),
+    TEST_CASE_OF(Schedule_PlaysEveryEntryOnceInOrder),
+    TEST_CASE_OF(Schedule_LoopsWithoutDrift),
+    TEST_CASE_OF(Schedule_CatchesUpAfterStall),
+};
+
+#pragma endregion
+
+#pragma region Benchmarks
+
+#define BENCH_ENTRIES   4096
+#define BENCH_PASSES    256
+
+static VOID Bench_NextDue(VOID)
+{
+    PULONG              due = malloc(BENCH_ENTRIES * sizeof(ULONG));
+    TEST_TIMELINE       timeline;
+    PLAYBACK_TIMELINE   parsed;
+    PLAYBACK_CURSOR     cursor;
+    ULONG64             start;
+    ULONG64             sum = 0;
+    ULONG64             plays = (ULONG64)BENCH_ENTRIES * BENCH_PASSES;
+    ULONG64             i;
+    ULONG               entry;
+    LONG64              scheduled;
+
+    for (i = 0; i < BENCH_ENTRIES; i++)
+    {
+        due[i] = (ULONG)i * 1000;
+    }
+
+    TimelineBuild(&timeline, due, BENCH_ENTRIES, (ULONG64)BENCH_ENTRIES * 1000);
+    (void)TimelineParse(&timeline, &parsed);
+
+    Playback_CursorInit(&cursor, 0, TRUE);
+
+    start = TestNow();
+
+    for (i = 0; i < plays; i++)
+    {
+        if (Playback_NextDue(&parsed, &cursor, (LONG64)i * 1000, &entry, &scheduled))
+        {
+            sum += entry;
+        }
+    }
+
+    TestReport("next due entry", TestNow() - start, plays);
+
+    TestSink = sum;
+
+    free(timeline.Buffer);
+    free(due);
+}
+
+static VOID Bench_ParseTimeline(VOID)
+{
+    const ULONG         count = 0x10000;
+    const ULONG         rounds = 64;
+    ULONG64             state = 0x9E3779B97F4A7C15ULL;
+    PULONG              due = RandomDueTimes(count, 4000, &state);
+    TEST_TIMELINE       timeline;
+    PLAYBACK_TIMELINE   parsed;
+    ULONG64             start;
+    ULONG64             sum = 0;
+    ULONG               i;
+
+    TimelineBuild(&timeline, due, count, due[count - 1]);
+
+    start = TestNow();
+
+    for (i = 0; i < rounds; i++)
+    {
+        sum += (ULONG64)TimelineParse(&timeline, &parsed) + parsed.EntryCount;
+    }
+
+    TestReport("timeline parse, per entry", TestNow() - start, (ULONG64)count * rounds);
+
+    TestSink = sum;
+
+    free(timeline.Buffer);
+    free(due);
+}
+
+static const TEST_CASE Benchmarks[] =
+{
+    TEST_CASE_OF(Bench_NextDue),
+    TEST_CASE_OF(Bench_ParseTimeline),
+};
+
+#pragma endregion
+
+TEST_MAIN(Tests, Benchmarks)
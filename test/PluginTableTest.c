@@ -0,0 +1,418 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Platform.h"
+#include "PluginTable.h"
+#include "Test.h"
+
+#include <stdlib.h>
+
+//
+// Lifetime of a request in wheel ticks, as ORC_REQUEST_MAX_AGE_TICKS works
+// out with the bus defaults (500 ms at 100 ms per tick)
+// 
+#define TABLE_TICKS         5
+
+C_ASSERT(TABLE_TICKS < PLUGIN_TABLE_WHEEL_SLOTS);
+
+//
+// Stands in for a plugin request context
+// 
+typedef struct _TEST_REQUEST
+{
+    UCHAR Padding[0x20];
+
+    PLUGIN_TABLE_ENTRY PendingEntry;
+
+    //
+    // Link in the flat list the benchmark compares against
+    // 
+    LIST_ENTRY ListEntry;
+
+} TEST_REQUEST, *PTEST_REQUEST;
+
+static PLUGIN_TABLE Table;
+
+//
+// Advances the wheel once and returns how many requests expired, storing
+// their serials in expiry order
+// 
+static ULONG TableAdvance(PULONG Serials, ULONG Capacity)
+{
+    LIST_ENTRY expired;
+    PPLUGIN_TABLE_ENTRY request;
+    ULONG count = 0;
+
+    InitializeListHead(&expired);
+
+    PluginTableAdvance(&Table, &expired);
+
+    while (!IsListEmpty(&expired))
+    {
+        request = CONTAINING_RECORD(RemoveHeadList(&expired), PLUGIN_TABLE_ENTRY, WheelEntry);
+
+        if (count < Capacity)
+        {
+            Serials[count] = request->Serial;
+        }
+
+        count++;
+    }
+
+    return count;
+}
+
+#pragma region Tests
+
+static VOID PluginTable_FindsLinkedSerials(VOID)
+{
+    static TEST_REQUEST requests[1000];
+    ULONG i;
+
+    PluginTableInit(&Table);
+
+    for (i = 0; i < RTL_NUMBER_OF(requests); i++)
+    {
+        PluginTableLink(&Table, &requests[i].PendingEntry, i + 1, TABLE_TICKS);
+    }
+
+    TEST_CHECK_EQUAL(RTL_NUMBER_OF(requests), Table.Count);
+
+    for (i = 0; i < RTL_NUMBER_OF(requests); i++)
+    {
+        TEST_CHECK(PluginTableFind(&Table, i + 1) == &requests[i].PendingEntry);
+    }
+
+    TEST_CHECK(PluginTableFind(&Table, 0) == NULL);
+    TEST_CHECK(PluginTableFind(&Table, RTL_NUMBER_OF(requests) + 1) == NULL);
+
+    // Completed requests are gone, their bucket neighbours stay
+    for (i = 0; i < RTL_NUMBER_OF(requests); i += 2)
+    {
+        PluginTableUnlink(&Table, &requests[i].PendingEntry);
+    }
+
+    for (i = 0; i < RTL_NUMBER_OF(requests); i++)
+    {
+        TEST_CHECK(PluginTableFind(&Table, i + 1) == ((i % 2) ? &requests[i].PendingEntry : NULL));
+    }
+
+    TEST_CHECK_EQUAL(RTL_NUMBER_OF(requests) / 2, Table.Count);
+}
+
+//
+// A request expires on the (Ticks + 1)th advance after it got linked, never
+// earlier, wherever the wheel stands and across the tick counter wrapping
+// 
+static VOID PluginTable_ExpiresAfterItsTicks(VOID)
+{
+    static const ULONG starts[] = { 0, 3, MAXULONG - 2 };
+    TEST_REQUEST request;
+    ULONG serial;
+    ULONG ticks;
+    ULONG s;
+    ULONG i;
+
+    for (s = 0; s < RTL_NUMBER_OF(starts); s++)
+    {
+        for (ticks = 0; ticks < PLUGIN_TABLE_WHEEL_SLOTS; ticks++)
+        {
+            PluginTableInit(&Table);
+            Table.Tick = starts[s];
+
+            PluginTableLink(&Table, &request.PendingEntry, 7, ticks);
+
+            for (i = 0; i < ticks; i++)
+            {
+                TEST_CHECK_EQUAL(0, TableAdvance(&serial, 1));
+            }
+
+            TEST_CHECK_EQUAL(1, TableAdvance(&serial, 1));
+            TEST_CHECK_EQUAL(7, serial);
+            TEST_CHECK_EQUAL(0, Table.Count);
+            TEST_CHECK(PluginTableFind(&Table, 7) == NULL);
+
+            // Nothing comes around again once the wheel turned over
+            for (i = 0; i < 2 * PLUGIN_TABLE_WHEEL_SLOTS; i++)
+            {
+                TEST_CHECK_EQUAL(0, TableAdvance(&serial, 1));
+            }
+        }
+    }
+}
+
+//
+// Requests time out in the order they got linked: by tick first, then first
+// come first served within one tick. Requests completed before their tick
+// never time out.
+// 
+static VOID PluginTable_TimeoutOrder(VOID)
+{
+    static TEST_REQUEST requests[3 * 4];
+    ULONG serials[RTL_NUMBER_OF(requests)];
+    ULONG expected;
+    ULONG count;
+    ULONG tick;
+    ULONG i;
+
+    PluginTableInit(&Table);
+
+    // Four requests each on three successive ticks, serials counting down
+    for (tick = 0; tick < 3; tick++)
+    {
+        for (i = 0; i < 4; i++)
+        {
+            PluginTableLink(&Table,
+                &requests[tick * 4 + i].PendingEntry,
+                RTL_NUMBER_OF(requests) - (tick * 4 + i),
+                TABLE_TICKS);
+        }
+
+        if (tick < 2)
+        {
+            TEST_CHECK_EQUAL(0, TableAdvance(serials, RTL_NUMBER_OF(serials)));
+        }
+    }
+
+    // The second request of every tick completes just in time
+    for (tick = 0; tick < 3; tick++)
+    {
+        PluginTableUnlink(&Table, &requests[tick * 4 + 1].PendingEntry);
+    }
+
+    // First generation is due TABLE_TICKS + 1 advances after it got linked, two are done
+    for (i = 2; i < TABLE_TICKS; i++)
+    {
+        TEST_CHECK_EQUAL(0, TableAdvance(serials, RTL_NUMBER_OF(serials)));
+    }
+
+    for (tick = 0; tick < 3; tick++)
+    {
+        count = TableAdvance(serials, RTL_NUMBER_OF(serials));
+
+        TEST_CHECK_EQUAL(3, count);
+
+        for (i = 0, expected = 0; i < count; i++, expected++)
+        {
+            if (expected == 1)
+            {
+                expected++;
+            }
+
+            TEST_CHECK_EQUAL(RTL_NUMBER_OF(requests) - (tick * 4 + expected), serials[i]);
+        }
+    }
+
+    TEST_CHECK_EQUAL(0, Table.Count);
+}
+
+static const TEST_CASE Tests[] =
+{
+    TEST_CASE_OF(PluginTable_FindsLinkedSerials),
+    TEST_CASE_OF(PluginTable_ExpiresAfterItsTicks),
+    TEST_CASE_OF(PluginTable_TimeoutOrder),
+};
+
+#pragma endregion
+
+#pragma region Benchmarks
+
+#define BENCH_PLUGINS       1000
+#define BENCH_ROUNDS        1000
+
+//
+// Stage results reported per plugin (create, prepare hardware, init finished)
+// 
+#define BENCH_STAGES        3
+
+static PTEST_REQUEST ListFind(PLIST_ENTRY List, ULONG Serial)
+{
+    PLIST_ENTRY entry;
+    PTEST_REQUEST request;
+
+    for (entry = List->Flink; entry != List; entry = entry->Flink)
+    {
+        request = CONTAINING_RECORD(entry, TEST_REQUEST, ListEntry);
+
+        if (request->PendingEntry.Serial == Serial)
+        {
+            return request;
+        }
+    }
+
+    return NULL;
+}
+
+//
+// BENCH_PLUGINS plugins in flight at once, each looked up for every stage
+// result and completed by the last one, in random order
+// 
+static VOID Bench_ConcurrentPlugins(VOID)
+{
+    PTEST_REQUEST   requests = calloc(BENCH_PLUGINS, sizeof(TEST_REQUEST));
+    ULONG           order[BENCH_PLUGINS];
+    ULONG64         state = 0x9E3779B97F4A7C15ULL;
+    ULONG64         start;
+    ULONG64         sum = 0;
+    LIST_ENTRY      list;
+    PTEST_REQUEST   request;
+    ULONG           round;
+    ULONG           stage;
+    ULONG           swap;
+    ULONG           i;
+    ULONG           j;
+
+    for (i = 0; i < BENCH_PLUGINS; i++)
+    {
+        order[i] = i + 1;
+    }
+
+    for (i = BENCH_PLUGINS - 1; i > 0; i--)
+    {
+        j = (ULONG)(TestRandom(&state) % (i + 1));
+        swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+
+    PluginTableInit(&Table);
+
+    start = TestNow();
+
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        for (i = 0; i < BENCH_PLUGINS; i++)
+        {
+            PluginTableLink(&Table, &requests[i].PendingEntry, i + 1, TABLE_TICKS);
+        }
+
+        for (stage = 0; stage < BENCH_STAGES; stage++)
+        {
+            for (i = 0; i < BENCH_PLUGINS; i++)
+            {
+                request = CONTAINING_RECORD(PluginTableFind(&Table, order[i]), TEST_REQUEST, PendingEntry);
+                sum += (ULONG_PTR)request;
+
+                if (stage == BENCH_STAGES - 1)
+                {
+                    PluginTableUnlink(&Table, &request->PendingEntry);
+                }
+            }
+        }
+    }
+
+    TestReport("table, 1000 pending, per plugin", TestNow() - start, (ULONG64)BENCH_ROUNDS * BENCH_PLUGINS);
+
+    //
+    // One list of everything pending, as the table was before it got hashed
+    // 
+    start = TestNow();
+
+    for (round = 0; round < BENCH_ROUNDS / 10; round++)
+    {
+        InitializeListHead(&list);
+
+        for (i = 0; i < BENCH_PLUGINS; i++)
+        {
+            requests[i].PendingEntry.Serial = i + 1;
+            InsertTailList(&list, &requests[i].ListEntry);
+        }
+
+        for (stage = 0; stage < BENCH_STAGES; stage++)
+        {
+            for (i = 0; i < BENCH_PLUGINS; i++)
+            {
+                request = ListFind(&list, order[i]);
+                sum += (ULONG_PTR)request;
+
+                if (stage == BENCH_STAGES - 1)
+                {
+                    RemoveEntryList(&request->ListEntry);
+                }
+            }
+        }
+    }
+
+    TestReport("flat list, 1000 pending, per plugin", TestNow() - start, (ULONG64)BENCH_ROUNDS / 10 * BENCH_PLUGINS);
+
+    TestSink = sum;
+
+    free(requests);
+}
+
+//
+// BENCH_PLUGINS plugins linked over successive ticks that all time out; the
+// wheel only visits the requests due
+// 
+static VOID Bench_Expiry(VOID)
+{
+    PTEST_REQUEST   requests = calloc(BENCH_PLUGINS, sizeof(TEST_REQUEST));
+    ULONG64         start;
+    ULONG64         expired = 0;
+    ULONG           serial;
+    ULONG           round;
+    ULONG           i;
+
+    PluginTableInit(&Table);
+
+    start = TestNow();
+
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        for (i = 0; i < BENCH_PLUGINS; i++)
+        {
+            PluginTableLink(&Table, &requests[i].PendingEntry, i + 1, TABLE_TICKS);
+
+            // A timer tick every hundred plugins
+            if (i % 100 == 99)
+            {
+                expired += TableAdvance(&serial, 1);
+            }
+        }
+
+        while (Table.Count != 0)
+        {
+            expired += TableAdvance(&serial, 1);
+        }
+    }
+
+    TestReport("link + time out, per plugin", TestNow() - start, expired);
+
+    TEST_CHECK_EQUAL((ULONG64)BENCH_ROUNDS * BENCH_PLUGINS, expired);
+
+    free(requests);
+}
+
+static const TEST_CASE Benchmarks[] =
+{
+    TEST_CASE_OF(Bench_ConcurrentPlugins),
+    TEST_CASE_OF(Bench_Expiry),
+};
+
+#pragma endregion
+
+TEST_MAIN(Tests, Benchmarks)
@@ -0,0 +1,451 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Platform.h"
+#include "ReportFifoCore.h"
+#include "Test.h"
+
+//
+// Small ring so the stress runs spend most of their time full
+// 
+#define FIFO_CAPACITY       16
+#define FIFO_STRESS_PUSHES  1000000
+
+//
+// Storage for a ring with its samples, aligned like the pool allocation
+// 
+typedef union _FIFO_STORAGE
+{
+    REPORT_FIFO Fifo;
+
+    UCHAR Bytes[REPORT_FIFO_SIZE(VIGEM_REPORT_FIFO_MAX_CAPACITY)];
+
+} FIFO_STORAGE, *PFIFO_STORAGE;
+
+static PREPORT_FIFO FifoInit(PFIFO_STORAGE Storage, ULONG Capacity, VIGEM_REPORT_FIFO_POLICY Policy)
+{
+    RtlZeroMemory(Storage, REPORT_FIFO_SIZE(Capacity));
+
+    Storage->Fifo.Mask = Capacity - 1;
+    Storage->Fifo.Policy = Policy;
+
+    return &Storage->Fifo;
+}
+
+//
+// Every byte of a sample derives from its sequence number, a copy that
+// mixes two samples doesn't verify
+// 
+static VOID SampleFill(PREPORT_FIFO_SAMPLE Sample, ULONG64 Sequence)
+{
+    PUCHAR bytes = (PUCHAR)&Sample->Report;
+    ULONG i;
+
+    Sample->Time = (LONG64)Sequence;
+
+    for (i = 0; i < sizeof(Sample->Report); i++)
+    {
+        bytes[i] = (UCHAR)(Sequence * 31 + i);
+    }
+
+    bytes = (PUCHAR)&Sample->Motion;
+
+    for (i = 0; i < sizeof(Sample->Motion); i++)
+    {
+        bytes[i] = (UCHAR)(Sequence * 17 + i);
+    }
+}
+
+static BOOLEAN SampleVerify(const REPORT_FIFO_SAMPLE* Sample)
+{
+    REPORT_FIFO_SAMPLE expected;
+
+    SampleFill(&expected, (ULONG64)Sample->Time);
+
+    return memcmp(&expected, Sample, sizeof(expected)) == 0;
+}
+
+static ULONG FifoDepth(PREPORT_FIFO Fifo)
+{
+    return (ULONG)Fifo->Tail - (ULONG)Fifo->Head;
+}
+
+static VOID Fifo_PopsInOrder(VOID)
+{
+    static FIFO_STORAGE storage;
+    PREPORT_FIFO fifo = FifoInit(&storage, 4, ViGEmReportFifoDropOldest);
+    REPORT_FIFO_SAMPLE sample;
+    ULONG i;
+
+    TEST_CHECK(!ReportFifo_Pop(fifo, &sample));
+
+    for (i = 1; i <= 3; i++)
+    {
+        SampleFill(&sample, i);
+        TEST_CHECK(ReportFifo_Push(fifo, &sample));
+    }
+
+    for (i = 1; i <= 3; i++)
+    {
+        TEST_CHECK(ReportFifo_Pop(fifo, &sample));
+        TEST_CHECK_EQUAL(i, sample.Time);
+        TEST_CHECK(SampleVerify(&sample));
+    }
+
+    TEST_CHECK(!ReportFifo_Pop(fifo, &sample));
+    TEST_CHECK_EQUAL(3, fifo->Queued);
+    TEST_CHECK_EQUAL(3, fifo->Delivered);
+    TEST_CHECK_EQUAL(3, fifo->HighWater);
+}
+
+static VOID Fifo_FullDropsOldest(VOID)
+{
+    static FIFO_STORAGE storage;
+    PREPORT_FIFO fifo = FifoInit(&storage, 4, ViGEmReportFifoDropOldest);
+    REPORT_FIFO_SAMPLE sample;
+    ULONG i;
+
+    for (i = 1; i <= 6; i++)
+    {
+        SampleFill(&sample, i);
+        TEST_CHECK(ReportFifo_Push(fifo, &sample));
+    }
+
+    TEST_CHECK_EQUAL(2, fifo->Evicted);
+    TEST_CHECK_EQUAL(0, fifo->Refused);
+    TEST_CHECK_EQUAL(4, fifo->HighWater);
+
+    // The newest four survive
+    for (i = 3; i <= 6; i++)
+    {
+        TEST_CHECK(ReportFifo_Pop(fifo, &sample));
+        TEST_CHECK_EQUAL(i, sample.Time);
+    }
+
+    TEST_CHECK(!ReportFifo_Pop(fifo, &sample));
+}
+
+static VOID Fifo_FullRefusesNewest(VOID)
+{
+    static FIFO_STORAGE storage;
+    PREPORT_FIFO fifo = FifoInit(&storage, 4, ViGEmReportFifoDropNewest);
+    REPORT_FIFO_SAMPLE sample;
+    ULONG i;
+
+    for (i = 1; i <= 6; i++)
+    {
+        SampleFill(&sample, i);
+        TEST_CHECK_EQUAL(i <= 4, ReportFifo_Push(fifo, &sample));
+    }
+
+    TEST_CHECK_EQUAL(4, fifo->Queued);
+    TEST_CHECK_EQUAL(2, fifo->Refused);
+    TEST_CHECK_EQUAL(0, fifo->Evicted);
+
+    // The oldest four stay
+    for (i = 1; i <= 4; i++)
+    {
+        TEST_CHECK(ReportFifo_Pop(fifo, &sample));
+        TEST_CHECK_EQUAL(i, sample.Time);
+    }
+
+    TEST_CHECK(!ReportFifo_Pop(fifo, &sample));
+}
+
+static VOID Fifo_IndicesWrap(VOID)
+{
+    static FIFO_STORAGE storage;
+    PREPORT_FIFO fifo = FifoInit(&storage, 4, ViGEmReportFifoDropOldest);
+    REPORT_FIFO_SAMPLE sample;
+    ULONG i;
+
+    // Free-running indices a few samples short of wrapping
+    fifo->Head = fifo->Tail = (LONG)0xFFFFFFFE;
+
+    for (i = 1; i <= 8; i++)
+    {
+        SampleFill(&sample, i);
+        TEST_CHECK(ReportFifo_Push(fifo, &sample));
+        TEST_CHECK(FifoDepth(fifo) <= 4);
+    }
+
+    for (i = 5; i <= 8; i++)
+    {
+        TEST_CHECK(ReportFifo_Pop(fifo, &sample));
+        TEST_CHECK_EQUAL(i, sample.Time);
+    }
+
+    TEST_CHECK(!ReportFifo_Pop(fifo, &sample));
+    TEST_CHECK_EQUAL(4, fifo->Evicted);
+}
+
+#pragma region Producer/consumer stress
+
+typedef struct _FIFO_STRESS
+{
+    PREPORT_FIFO Fifo;
+
+    ULONG64 Pushes;
+
+    //
+    // Set by the producer once it pushed its last sample
+    // 
+    volatile LONG ProducerDone;
+
+    ULONG64 Accepted;
+
+    ULONG64 Popped;
+
+    ULONG64 Torn;
+
+    ULONG64 Backwards;
+
+} FIFO_STRESS, *PFIFO_STRESS;
+
+static VOID FifoProducer(PVOID Context)
+{
+    PFIFO_STRESS stress = Context;
+    REPORT_FIFO_SAMPLE sample;
+    ULONG64 i;
+
+    for (i = 1; i <= stress->Pushes; i++)
+    {
+        SampleFill(&sample, i);
+
+        if (ReportFifo_Push(stress->Fifo, &sample))
+        {
+            stress->Accepted++;
+        }
+    }
+
+    WriteRelease(&stress->ProducerDone, 1);
+}
+
+static VOID FifoConsumer(PVOID Context)
+{
+    PFIFO_STRESS stress = Context;
+    REPORT_FIFO_SAMPLE sample;
+    LONG64 last = 0;
+    BOOLEAN done;
+
+    for (;;)
+    {
+        // Read before popping, an empty ring after the last push is final
+        done = ReadAcquire(&stress->ProducerDone) != 0;
+
+        if (!ReportFifo_Pop(stress->Fifo, &sample))
+        {
+            if (done)
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        stress->Popped++;
+
+        if (!SampleVerify(&sample))
+        {
+            stress->Torn++;
+        }
+
+        if (sample.Time <= last)
+        {
+            stress->Backwards++;
+        }
+
+        last = sample.Time;
+    }
+}
+
+static VOID FifoStress(VIGEM_REPORT_FIFO_POLICY Policy)
+{
+    static FIFO_STORAGE storage;
+    FIFO_STRESS stress = { 0 };
+    TEST_THREAD producer;
+    TEST_THREAD consumer;
+
+    stress.Fifo = FifoInit(&storage, FIFO_CAPACITY, Policy);
+    stress.Pushes = FIFO_STRESS_PUSHES;
+
+    TestThreadStart(&consumer, FifoConsumer, &stress);
+    TestThreadStart(&producer, FifoProducer, &stress);
+
+    TestThreadJoin(&producer);
+    TestThreadJoin(&consumer);
+
+    TEST_CHECK_EQUAL(0, stress.Torn);
+    TEST_CHECK_EQUAL(0, stress.Backwards);
+    TEST_CHECK_EQUAL(0, FifoDepth(stress.Fifo));
+    TEST_CHECK(stress.Fifo->HighWater <= FIFO_CAPACITY);
+
+    // Every push is accounted for exactly once
+    TEST_CHECK_EQUAL(stress.Accepted, stress.Fifo->Queued);
+    TEST_CHECK_EQUAL(FIFO_STRESS_PUSHES, stress.Fifo->Queued + stress.Fifo->Refused);
+    TEST_CHECK_EQUAL(stress.Popped, stress.Fifo->Delivered);
+    TEST_CHECK_EQUAL(stress.Fifo->Queued, stress.Fifo->Delivered + stress.Fifo->Evicted);
+
+    printf("    %llu delivered, %llu evicted, %llu refused\n",
+        (unsigned long long)stress.Fifo->Delivered,
+        (unsigned long long)stress.Fifo->Evicted,
+        (unsigned long long)stress.Fifo->Refused);
+}
+
+static VOID Fifo_StressDropOldest(VOID)
+{
+    FifoStress(ViGEmReportFifoDropOldest);
+}
+
+static VOID Fifo_StressDropNewest(VOID)
+{
+    FifoStress(ViGEmReportFifoDropNewest);
+}
+
+#pragma endregion
+
+#pragma region Benchmarks
+
+#define BENCH_SAMPLES       10000000
+
+static VOID Bench_PushPopUncontended(VOID)
+{
+    static FIFO_STORAGE storage;
+    PREPORT_FIFO fifo = FifoInit(&storage, FIFO_CAPACITY, ViGEmReportFifoDropOldest);
+    REPORT_FIFO_SAMPLE sample;
+    ULONG64 start;
+    ULONG i;
+
+    SampleFill(&sample, 1);
+
+    start = TestNow();
+
+    for (i = 0; i < BENCH_SAMPLES; i++)
+    {
+        ReportFifo_Push(fifo, &sample);
+        ReportFifo_Pop(fifo, &sample);
+    }
+
+    TestReport("push + pop, one thread", TestNow() - start, i);
+
+    TestSink = (ULONG64)sample.Time;
+}
+
+//
+// Producer that retries refused samples, so every one of them crosses
+// 
+static VOID FifoLosslessProducer(PVOID Context)
+{
+    PFIFO_STRESS stress = Context;
+    REPORT_FIFO_SAMPLE sample;
+    ULONG64 i;
+
+    SampleFill(&sample, 1);
+
+    for (i = 1; i <= stress->Pushes; i++)
+    {
+        sample.Time = (LONG64)i;
+
+        while (!ReportFifo_Push(stress->Fifo, &sample))
+        {
+        }
+    }
+
+    WriteRelease(&stress->ProducerDone, 1);
+}
+
+static VOID FifoThroughput(const char* Name, ULONG Capacity)
+{
+    static FIFO_STORAGE storage;
+    FIFO_STRESS stress = { 0 };
+    TEST_THREAD producer;
+    REPORT_FIFO_SAMPLE sample;
+    ULONG64 popped = 0;
+    ULONG64 start;
+
+    //
+    // Both sides spin, on a single processor every hand-off would wait
+    // out a scheduler quantum
+    // 
+    if (TestProcessorCount() < 2)
+    {
+        printf("    %-44s skipped, needs two processors\n", Name);
+        return;
+    }
+
+    stress.Fifo = FifoInit(&storage, Capacity, ViGEmReportFifoDropNewest);
+    stress.Pushes = BENCH_SAMPLES;
+
+    start = TestNow();
+
+    TestThreadStart(&producer, FifoLosslessProducer, &stress);
+
+    while (popped < BENCH_SAMPLES)
+    {
+        if (ReportFifo_Pop(stress.Fifo, &sample))
+        {
+            popped++;
+        }
+    }
+
+    TestReport(Name, TestNow() - start, popped);
+
+    TestThreadJoin(&producer);
+
+    TestSink = (ULONG64)sample.Time;
+}
+
+static VOID Bench_ThroughputSmallRing(VOID)
+{
+    FifoThroughput("producer -> consumer, 16 samples", FIFO_CAPACITY);
+}
+
+static VOID Bench_ThroughputLargeRing(VOID)
+{
+    FifoThroughput("producer -> consumer, 1024 samples", VIGEM_REPORT_FIFO_MAX_CAPACITY);
+}
+
+#pragma endregion
+
+static const TEST_CASE Tests[] =
+{
+    TEST_CASE_OF(Fifo_PopsInOrder),
+    TEST_CASE_OF(Fifo_FullDropsOldest),
+    TEST_CASE_OF(Fifo_FullRefusesNewest),
+    TEST_CASE_OF(Fifo_IndicesWrap),
+    TEST_CASE_OF(Fifo_StressDropOldest),
+    TEST_CASE_OF(Fifo_StressDropNewest),
+};
+
+static const TEST_CASE Benchmarks[] =
+{
+    TEST_CASE_OF(Bench_PushPopUncontended),
+    TEST_CASE_OF(Bench_ThroughputSmallRing),
+    TEST_CASE_OF(Bench_ThroughputLargeRing),
+};
+
+TEST_MAIN(Tests, Benchmarks)
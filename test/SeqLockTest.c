@@ -0,0 +1,318 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Platform.h"
+#include "SeqLock.h"
+#include "Test.h"
+
+//
+// Guarded block the size of a report cache; writers fill every word with
+// one value tagged with their id and a running count
+// 
+#define SEQ_WORDS           8
+#define SEQ_WRITERS         2
+#define SEQ_READERS         2
+#define SEQ_WRITES          200000
+
+typedef struct _SEQ_SHARED
+{
+    SEQLOCK Lock;
+
+    ULONG64 Words[SEQ_WORDS];
+
+    //
+    // Bumped non-atomically inside the write section
+    // 
+    ULONG64 Writes;
+
+    volatile LONG WritersDone;
+
+    ULONG64 Reads[SEQ_READERS];
+
+    ULONG64 Torn[SEQ_READERS];
+
+    ULONG64 Backwards[SEQ_READERS];
+
+} SEQ_SHARED, *PSEQ_SHARED;
+
+typedef struct _SEQ_THREAD
+{
+    PSEQ_SHARED Shared;
+
+    ULONG Id;
+
+} SEQ_THREAD, *PSEQ_THREAD;
+
+static VOID SeqWriter(PVOID Context)
+{
+    PSEQ_THREAD thread = Context;
+    PSEQ_SHARED shared = thread->Shared;
+    ULONG64 value;
+    ULONG i;
+    ULONG j;
+
+    for (i = 1; i <= SEQ_WRITES; i++)
+    {
+        SeqLockWriteAcquire(&shared->Lock);
+
+        // Every eighth write finds nothing to change, like a duplicate report
+        if (i % 8 == 0)
+        {
+            SeqLockWriteCancel(&shared->Lock);
+            continue;
+        }
+
+        value = ((ULONG64)thread->Id << 32) | i;
+
+        for (j = 0; j < SEQ_WORDS; j++)
+        {
+            shared->Words[j] = value;
+        }
+
+        shared->Writes++;
+
+        SeqLockWriteRelease(&shared->Lock);
+    }
+
+    InterlockedIncrement(&shared->WritersDone);
+}
+
+static VOID SeqReader(PVOID Context)
+{
+    PSEQ_THREAD thread = Context;
+    PSEQ_SHARED shared = thread->Shared;
+    ULONG64 words[SEQ_WORDS];
+    ULONG64 last[SEQ_WRITERS] = { 0 };
+    ULONG writer;
+    ULONG j;
+
+    while (ReadAcquire(&shared->WritersDone) < SEQ_WRITERS)
+    {
+        SeqLockReadCopy(&shared->Lock, words, shared->Words, sizeof(words));
+
+        shared->Reads[thread->Id]++;
+
+        for (j = 1; j < SEQ_WORDS; j++)
+        {
+            if (words[j] != words[0])
+            {
+                shared->Torn[thread->Id]++;
+                break;
+            }
+        }
+
+        writer = (ULONG)(words[0] >> 32);
+
+        if (writer < SEQ_WRITERS)
+        {
+            if ((ULONG)words[0] < last[writer])
+            {
+                shared->Backwards[thread->Id]++;
+            }
+
+            last[writer] = (ULONG)words[0];
+        }
+    }
+}
+
+static VOID SeqLock_WriteMovesSequenceByTwo(VOID)
+{
+    SEQLOCK lock = { 0 };
+    LONG sequence;
+
+    sequence = SeqLockReadBegin(&lock);
+    TEST_CHECK_EQUAL(0, sequence);
+    TEST_CHECK(!SeqLockReadRetry(&lock, sequence));
+
+    SeqLockWriteAcquire(&lock);
+    TEST_CHECK_EQUAL(1, lock.Sequence);
+    SeqLockWriteRelease(&lock);
+
+    TEST_CHECK_EQUAL(2, lock.Sequence);
+    TEST_CHECK(SeqLockReadRetry(&lock, sequence));
+}
+
+static VOID SeqLock_CancelSparesReaders(VOID)
+{
+    SEQLOCK lock = { 0 };
+    LONG sequence;
+
+    sequence = SeqLockReadBegin(&lock);
+
+    SeqLockWriteAcquire(&lock);
+    SeqLockWriteCancel(&lock);
+
+    // Nothing changed, a read spanning the cancelled write stays valid
+    TEST_CHECK_EQUAL(0, lock.Sequence);
+    TEST_CHECK(!SeqLockReadRetry(&lock, sequence));
+}
+
+static VOID SeqLock_Torture(VOID)
+{
+    static SEQ_SHARED shared;
+    SEQ_THREAD writers[SEQ_WRITERS];
+    SEQ_THREAD readers[SEQ_READERS];
+    TEST_THREAD threads[SEQ_WRITERS + SEQ_READERS];
+    ULONG64 reads = 0;
+    ULONG i;
+
+    RtlZeroMemory(&shared, sizeof(shared));
+
+    for (i = 0; i < SEQ_READERS; i++)
+    {
+        readers[i].Shared = &shared;
+        readers[i].Id = i;
+        TestThreadStart(&threads[SEQ_WRITERS + i], SeqReader, &readers[i]);
+    }
+
+    for (i = 0; i < SEQ_WRITERS; i++)
+    {
+        writers[i].Shared = &shared;
+        writers[i].Id = i;
+        TestThreadStart(&threads[i], SeqWriter, &writers[i]);
+    }
+
+    for (i = 0; i < SEQ_WRITERS + SEQ_READERS; i++)
+    {
+        TestThreadJoin(&threads[i]);
+    }
+
+    for (i = 0; i < SEQ_READERS; i++)
+    {
+        TEST_CHECK_EQUAL(0, shared.Torn[i]);
+        TEST_CHECK_EQUAL(0, shared.Backwards[i]);
+        reads += shared.Reads[i];
+    }
+
+    // Writers excluded each other, no increment got lost
+    TEST_CHECK_EQUAL(SEQ_WRITERS * (SEQ_WRITES - SEQ_WRITES / 8), shared.Writes);
+    TEST_CHECK_EQUAL(SEQ_WRITERS * (SEQ_WRITES - SEQ_WRITES / 8) * 2, shared.Lock.Sequence);
+
+    printf("    %llu consistent reads\n", (unsigned long long)reads);
+}
+
+static VOID Bench_WriteUncontended(VOID)
+{
+    static SEQ_SHARED shared;
+    ULONG64 start;
+    ULONG i;
+    ULONG j;
+
+    RtlZeroMemory(&shared, sizeof(shared));
+
+    start = TestNow();
+
+    for (i = 0; i < 20000000; i++)
+    {
+        SeqLockWriteAcquire(&shared.Lock);
+
+        for (j = 0; j < SEQ_WORDS; j++)
+        {
+            shared.Words[j] = i;
+        }
+
+        SeqLockWriteRelease(&shared.Lock);
+    }
+
+    TestReport("write, uncontended", TestNow() - start, i);
+}
+
+static VOID Bench_ReadUncontended(VOID)
+{
+    static SEQ_SHARED shared;
+    ULONG64 words[SEQ_WORDS];
+    ULONG64 sum = 0;
+    ULONG64 start;
+    ULONG i;
+
+    RtlZeroMemory(&shared, sizeof(shared));
+
+    start = TestNow();
+
+    for (i = 0; i < 20000000; i++)
+    {
+        SeqLockReadCopy(&shared.Lock, words, shared.Words, sizeof(words));
+        sum += words[i % SEQ_WORDS];
+    }
+
+    TestReport("read copy, uncontended", TestNow() - start, i);
+
+    TestSink = sum;
+}
+
+static VOID Bench_ReadUnderWriters(VOID)
+{
+    static SEQ_SHARED shared;
+    SEQ_THREAD writers[SEQ_WRITERS];
+    TEST_THREAD threads[SEQ_WRITERS];
+    ULONG64 words[SEQ_WORDS] = { 0 };
+    ULONG64 reads = 0;
+    ULONG64 start;
+    ULONG i;
+
+    RtlZeroMemory(&shared, sizeof(shared));
+
+    for (i = 0; i < SEQ_WRITERS; i++)
+    {
+        writers[i].Shared = &shared;
+        writers[i].Id = i;
+        TestThreadStart(&threads[i], SeqWriter, &writers[i]);
+    }
+
+    start = TestNow();
+
+    while (ReadAcquire(&shared.WritersDone) < SEQ_WRITERS)
+    {
+        SeqLockReadCopy(&shared.Lock, words, shared.Words, sizeof(words));
+        reads++;
+    }
+
+    TestReport("read copy, two writers", TestNow() - start, reads);
+
+    for (i = 0; i < SEQ_WRITERS; i++)
+    {
+        TestThreadJoin(&threads[i]);
+    }
+
+    TestSink = words[0];
+}
+
+static const TEST_CASE Tests[] =
+{
+    TEST_CASE_OF(SeqLock_WriteMovesSequenceByTwo),
+    TEST_CASE_OF(SeqLock_CancelSparesReaders),
+    TEST_CASE_OF(SeqLock_Torture),
+};
+
+static const TEST_CASE Benchmarks[] =
+{
+    TEST_CASE_OF(Bench_WriteUncontended),
+    TEST_CASE_OF(Bench_ReadUncontended),
+    TEST_CASE_OF(Bench_ReadUnderWriters),
+};
+
+TEST_MAIN(Tests, Benchmarks)
@@ -0,0 +1,339 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Platform.h"
+#include "SerialAllocator.h"
+#include "Test.h"
+
+static SERIAL_ALLOCATOR Allocator;
+
+#pragma region Tests
+
+static VOID SerialAllocator_HandsOutLowestFree(VOID)
+{
+    ULONG i;
+
+    SerialAllocatorInit(&Allocator);
+
+    for (i = 1; i < 100; i++)
+    {
+        TEST_CHECK_EQUAL(i, SerialAllocatorAllocate(&Allocator));
+    }
+
+    SerialAllocatorRelease(&Allocator, 40);
+    SerialAllocatorRelease(&Allocator, 7);
+
+    TEST_CHECK_EQUAL(7, SerialAllocatorAllocate(&Allocator));
+    TEST_CHECK_EQUAL(40, SerialAllocatorAllocate(&Allocator));
+    TEST_CHECK_EQUAL(100, SerialAllocatorAllocate(&Allocator));
+
+    // Serial 0 never comes back, whatever gets released
+    SerialAllocatorRelease(&Allocator, 0);
+    SerialAllocatorRelease(&Allocator, SERIAL_ALLOCATOR_SERIALS);
+
+    TEST_CHECK_EQUAL(101, SerialAllocatorAllocate(&Allocator));
+}
+
+static VOID SerialAllocator_SkipsReservedSerials(VOID)
+{
+    SerialAllocatorInit(&Allocator);
+
+    TEST_CHECK(SerialAllocatorReserve(&Allocator, 1));
+    TEST_CHECK(SerialAllocatorReserve(&Allocator, 3));
+    TEST_CHECK(!SerialAllocatorReserve(&Allocator, 3));
+    TEST_CHECK(!SerialAllocatorReserve(&Allocator, 0));
+    TEST_CHECK(!SerialAllocatorReserve(&Allocator, SERIAL_ALLOCATOR_SERIALS));
+
+    TEST_CHECK_EQUAL(2, SerialAllocatorAllocate(&Allocator));
+    TEST_CHECK_EQUAL(4, SerialAllocatorAllocate(&Allocator));
+
+    TEST_CHECK(!SerialAllocatorReserve(&Allocator, 2));
+
+    SerialAllocatorRelease(&Allocator, 3);
+
+    TEST_CHECK(SerialAllocatorReserve(&Allocator, 3));
+}
+
+static VOID SerialAllocator_Exhausts(VOID)
+{
+    ULONG i;
+
+    SerialAllocatorInit(&Allocator);
+
+    for (i = 1; i < SERIAL_ALLOCATOR_SERIALS; i++)
+    {
+        TEST_CHECK_EQUAL(i, SerialAllocatorAllocate(&Allocator));
+    }
+
+    TEST_CHECK_EQUAL(0, SerialAllocatorAllocate(&Allocator));
+    TEST_CHECK_EQUAL(0, SerialAllocatorAllocate(&Allocator));
+
+    SerialAllocatorRelease(&Allocator, SERIAL_ALLOCATOR_SERIALS - 1);
+
+    TEST_CHECK_EQUAL(SERIAL_ALLOCATOR_SERIALS - 1, SerialAllocatorAllocate(&Allocator));
+    TEST_CHECK_EQUAL(0, SerialAllocatorAllocate(&Allocator));
+}
+
+//
+// Random plugins and unplugs, checked against a plain array of the
+// serials in use: allocation always gets the lowest free one
+// 
+static VOID SerialAllocator_Churn(VOID)
+{
+    static BOOLEAN used[SERIAL_ALLOCATOR_SERIALS];
+    ULONG64 state = 0x9E3779B97F4A7C15ULL;
+    ULONG serial;
+    ULONG lowest;
+    ULONG i;
+
+    SerialAllocatorInit(&Allocator);
+    RtlZeroMemory(used, sizeof(used));
+
+    used[0] = TRUE;
+
+    for (i = 0; i < 1000000; i++)
+    {
+        serial = (ULONG)(TestRandom(&state) % SERIAL_ALLOCATOR_SERIALS);
+
+        // Mostly full most of the time; every fourth step unplugs
+        if (TestRandom(&state) % 4 == 0)
+        {
+            SerialAllocatorRelease(&Allocator, serial);
+            used[serial] = serial == 0;
+            continue;
+        }
+
+        for (lowest = 1; lowest < SERIAL_ALLOCATOR_SERIALS && used[lowest]; lowest++)
+        {
+        }
+
+        if (lowest == SERIAL_ALLOCATOR_SERIALS)
+        {
+            lowest = 0;
+        }
+
+        TEST_CHECK_EQUAL(lowest, SerialAllocatorAllocate(&Allocator));
+
+        used[lowest] = TRUE;
+    }
+}
+
+#define CHURN_THREADS       2
+#define CHURN_CYCLES        200000
+
+typedef struct _CHURN_SHARED
+{
+    //
+    // Thread holding each serial, -1 if none
+    // 
+    volatile LONG Owner[SERIAL_ALLOCATOR_SERIALS];
+
+    ULONG64 Collisions;
+
+} CHURN_SHARED, *PCHURN_SHARED;
+
+typedef struct _CHURN_THREAD
+{
+    PCHURN_SHARED Shared;
+
+    LONG Id;
+
+} CHURN_THREAD, *PCHURN_THREAD;
+
+static VOID ChurnThread(PVOID Context)
+{
+    PCHURN_THREAD thread = Context;
+    PCHURN_SHARED shared = thread->Shared;
+    ULONG held[16] = { 0 };
+    ULONG i;
+    ULONG slot;
+
+    for (i = 0; i < CHURN_CYCLES; i++)
+    {
+        slot = i % RTL_NUMBER_OF(held);
+
+        if (held[slot] != 0)
+        {
+            InterlockedExchange(&shared->Owner[held[slot]], -1);
+            SerialAllocatorRelease(&Allocator, held[slot]);
+        }
+
+        held[slot] = SerialAllocatorAllocate(&Allocator);
+
+        if (held[slot] == 0
+            || InterlockedCompareExchange(&shared->Owner[held[slot]], thread->Id, -1) != -1)
+        {
+            InterlockedIncrement64((volatile LONG64*)&shared->Collisions);
+            held[slot] = 0;
+        }
+    }
+
+    for (slot = 0; slot < RTL_NUMBER_OF(held); slot++)
+    {
+        if (held[slot] != 0)
+        {
+            InterlockedExchange(&shared->Owner[held[slot]], -1);
+            SerialAllocatorRelease(&Allocator, held[slot]);
+        }
+    }
+}
+
+//
+// Concurrent plugins and unplugs never get the same serial twice, and all
+// of them are free again at the end
+// 
+static VOID SerialAllocator_ConcurrentChurn(VOID)
+{
+    static CHURN_SHARED shared;
+    CHURN_THREAD threads[CHURN_THREADS];
+    TEST_THREAD handles[CHURN_THREADS];
+    ULONG i;
+
+    SerialAllocatorInit(&Allocator);
+
+    for (i = 0; i < SERIAL_ALLOCATOR_SERIALS; i++)
+    {
+        shared.Owner[i] = -1;
+    }
+
+    shared.Collisions = 0;
+
+    for (i = 0; i < CHURN_THREADS; i++)
+    {
+        threads[i].Shared = &shared;
+        threads[i].Id = (LONG)i;
+        TestThreadStart(&handles[i], ChurnThread, &threads[i]);
+    }
+
+    for (i = 0; i < CHURN_THREADS; i++)
+    {
+        TestThreadJoin(&handles[i]);
+    }
+
+    TEST_CHECK_EQUAL(0, shared.Collisions);
+
+    for (i = 1; i < SERIAL_ALLOCATOR_SERIALS; i++)
+    {
+        TEST_CHECK_EQUAL(i, SerialAllocatorAllocate(&Allocator));
+    }
+}
+
+static const TEST_CASE Tests[] =
+{
+    TEST_CASE_OF(SerialAllocator_HandsOutLowestFree),
+    TEST_CASE_OF(SerialAllocator_SkipsReservedSerials),
+    TEST_CASE_OF(SerialAllocator_Exhausts),
+    TEST_CASE_OF(SerialAllocator_Churn),
+    TEST_CASE_OF(SerialAllocator_ConcurrentChurn),
+};
+
+#pragma endregion
+
+#pragma region Benchmarks
+
+#define BENCH_CYCLES        1000000
+
+typedef ULONG(*SERIAL_ALLOCATE_ROUTINE)(PSERIAL_ALLOCATOR Allocator);
+
+//
+// What clients did before the bus assigned serials: try to plug in serial
+// 1, 2, ... until one is free, each try taking the lock once
+// 
+static ULONG ProbeAllocate(PSERIAL_ALLOCATOR Allocator)
+{
+    ULONG serial;
+
+    for (serial = 1; serial < SERIAL_ALLOCATOR_SERIALS; serial++)
+    {
+        if (SerialAllocatorReserve(Allocator, serial))
+        {
+            return serial;
+        }
+    }
+
+    return 0;
+}
+
+static ULONG BitmapAllocate(PSERIAL_ALLOCATOR Allocator)
+{
+    return SerialAllocatorAllocate(Allocator);
+}
+
+//
+// Unplugs and plugs in one device at a time with Count plugged in, picking
+// the device at random
+// 
+static VOID BenchChurn(const char* Name, SERIAL_ALLOCATE_ROUTINE volatile Allocate, ULONG Count)
+{
+    static ULONG serials[SERIAL_ALLOCATOR_SERIALS];
+    ULONG64 state = 0x9E3779B97F4A7C15ULL;
+    ULONG64 start;
+    ULONG victim;
+    ULONG i;
+    char name[64];
+
+    SerialAllocatorInit(&Allocator);
+
+    for (i = 0; i < Count; i++)
+    {
+        serials[i] = SerialAllocatorAllocate(&Allocator);
+    }
+
+    start = TestNow();
+
+    for (i = 0; i < BENCH_CYCLES; i++)
+    {
+        victim = (ULONG)(TestRandom(&state) % Count);
+
+        SerialAllocatorRelease(&Allocator, serials[victim]);
+        serials[victim] = Allocate(&Allocator);
+    }
+
+    snprintf(name, sizeof(name), "%s, %lu plugged in", Name, (unsigned long)Count);
+    TestReport(name, TestNow() - start, BENCH_CYCLES);
+}
+
+static VOID Bench_Churn(VOID)
+{
+    static const ULONG counts[] = { 1, 16, 256, SERIAL_ALLOCATOR_SERIALS - 1 };
+    ULONG c;
+
+    for (c = 0; c < RTL_NUMBER_OF(counts); c++)
+    {
+        BenchChurn("bitmap", BitmapAllocate, counts[c]);
+        BenchChurn("probe loop", ProbeAllocate, counts[c]);
+    }
+}
+
+static const TEST_CASE Benchmarks[] =
+{
+    TEST_CASE_OF(Bench_Churn),
+};
+
+#pragma endregion
+
+TEST_MAIN(Tests, Benchmarks)
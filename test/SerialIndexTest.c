@@ -0,0 +1,358 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Platform.h"
+#include "SerialIndex.h"
+#include "Test.h"
+
+#include <stdlib.h>
+
+//
+// Stands in for a PDO context, the index entry sits somewhere inside
+// 
+typedef struct _TEST_PDO
+{
+    ULONG SerialNo;
+
+    UCHAR Padding[0x40];
+
+    SERIAL_INDEX_ENTRY IndexEntry;
+
+    struct _TEST_PDO* ListNext;
+
+} TEST_PDO, *PTEST_PDO;
+
+static SERIAL_INDEX Index;
+
+static VOID IndexFill(PTEST_PDO Pdos, ULONG Count)
+{
+    ULONG i;
+
+    RtlZeroMemory(&Index, sizeof(Index));
+
+    for (i = 0; i < Count; i++)
+    {
+        Pdos[i].SerialNo = i + 1;
+        SerialIndexInsert(&Index, &Pdos[i].IndexEntry, Pdos[i].SerialNo);
+    }
+}
+
+static VOID SerialIndex_FindsEveryInsertedSerial(VOID)
+{
+    static TEST_PDO pdos[4096];
+    ULONG i;
+
+    IndexFill(pdos, RTL_NUMBER_OF(pdos));
+
+    for (i = 0; i < RTL_NUMBER_OF(pdos); i++)
+    {
+        TEST_CHECK(SerialIndexFind(&Index, i + 1) == &pdos[i].IndexEntry);
+    }
+
+    TEST_CHECK(SerialIndexFind(&Index, 0) == NULL);
+    TEST_CHECK(SerialIndexFind(&Index, RTL_NUMBER_OF(pdos) + 1) == NULL);
+    TEST_CHECK(SerialIndexFind(&Index, SERIAL_INDEX_BUCKETS * 0x100 + 1) == NULL);
+}
+
+static VOID SerialIndex_RemoveUnlinksOnlyTheEntry(VOID)
+{
+    static TEST_PDO pdos[SERIAL_INDEX_BUCKETS * 3];
+    ULONG i;
+
+    IndexFill(pdos, RTL_NUMBER_OF(pdos));
+
+    // Serials 1, 1 + BUCKETS and 1 + 2 * BUCKETS share a bucket; take out the middle one
+    TEST_CHECK(SerialIndexRemove(&Index, &pdos[SERIAL_INDEX_BUCKETS].IndexEntry));
+    TEST_CHECK(pdos[SERIAL_INDEX_BUCKETS].IndexEntry.Next == NULL);
+
+    TEST_CHECK(SerialIndexFind(&Index, SERIAL_INDEX_BUCKETS + 1) == NULL);
+    TEST_CHECK(SerialIndexFind(&Index, 1) == &pdos[0].IndexEntry);
+    TEST_CHECK(SerialIndexFind(&Index, 2 * SERIAL_INDEX_BUCKETS + 1) == &pdos[2 * SERIAL_INDEX_BUCKETS].IndexEntry);
+
+    // Removal is idempotent, unplug and cleanup both remove
+    TEST_CHECK(!SerialIndexRemove(&Index, &pdos[SERIAL_INDEX_BUCKETS].IndexEntry));
+
+    for (i = 0; i < RTL_NUMBER_OF(pdos); i++)
+    {
+        SerialIndexRemove(&Index, &pdos[i].IndexEntry);
+    }
+
+    for (i = 0; i < SERIAL_INDEX_BUCKETS; i++)
+    {
+        TEST_CHECK(Index.Buckets[i] == NULL);
+    }
+}
+
+static VOID SerialIndex_NeverInsertedEntryIsNotFound(VOID)
+{
+    TEST_PDO pdo;
+
+    RtlZeroMemory(&Index, sizeof(Index));
+    RtlZeroMemory(&pdo, sizeof(pdo));
+
+    // A PDO that failed creation before getting indexed still runs cleanup
+    TEST_CHECK(!SerialIndexRemove(&Index, &pdo.IndexEntry));
+}
+
+static VOID SerialIndex_AcquireHoldsOffDrain(VOID)
+{
+    TEST_PDO pdo;
+
+    RtlZeroMemory(&Index, sizeof(Index));
+    RtlZeroMemory(&pdo, sizeof(pdo));
+
+    SerialIndexPublish(&Index, &pdo.IndexEntry, 7);
+
+    TEST_CHECK(SerialIndexAcquire(&Index, 7) == &pdo.IndexEntry);
+    TEST_CHECK(SerialIndexAcquire(&Index, 8) == NULL);
+    TEST_CHECK_EQUAL(2, pdo.IndexEntry.Rundown.Count);
+
+    SerialIndexRelease(&pdo.IndexEntry);
+
+    // Withdrawn, then drained by cleanup: no lookup gets it from here on
+    TEST_CHECK(SerialIndexWithdraw(&Index, &pdo.IndexEntry));
+    TEST_CHECK(!SerialIndexWithdraw(&Index, &pdo.IndexEntry));
+    SerialIndexDrain(&pdo.IndexEntry);
+
+    TEST_CHECK(SerialIndexAcquire(&Index, 7) == NULL);
+    TEST_CHECK(!ExAcquireRundownProtection(&pdo.IndexEntry.Rundown));
+    TEST_CHECK(Index.Lock == 0);
+}
+
+static const TEST_CASE Tests[] =
+{
+    TEST_CASE_OF(SerialIndex_FindsEveryInsertedSerial),
+    TEST_CASE_OF(SerialIndex_RemoveUnlinksOnlyTheEntry),
+    TEST_CASE_OF(SerialIndex_NeverInsertedEntryIsNotFound),
+    TEST_CASE_OF(SerialIndex_AcquireHoldsOffDrain),
+};
+
+#pragma region Benchmarks
+
+#define BENCH_LOOKUPS       0x400000
+
+//
+// What WdfChildListRetrievePdo does: call the compare callback on every child
+// 
+typedef BOOLEAN(*LIST_COMPARE)(const TEST_PDO* Pdo, ULONG SerialNo);
+
+static BOOLEAN ListCompare(const TEST_PDO* Pdo, ULONG SerialNo)
+{
+    return Pdo->SerialNo == SerialNo;
+}
+
+static LIST_COMPARE volatile ListCompareCallback = ListCompare;
+
+static PTEST_PDO ListFind(PTEST_PDO Head, ULONG SerialNo)
+{
+    PTEST_PDO pdo;
+
+    for (pdo = Head; pdo != NULL; pdo = pdo->ListNext)
+    {
+        if (ListCompareCallback(pdo, SerialNo))
+        {
+            break;
+        }
+    }
+
+    return pdo;
+}
+
+//
+// Stands in for the per-handle file object data
+// 
+typedef struct _TEST_HANDLE
+{
+    EX_SPIN_LOCK BoundPdoLock;
+
+    PTEST_PDO BoundPdo;
+
+} TEST_HANDLE, *PTEST_HANDLE;
+
+//
+// What Bus_GetRequestPdo runs: the binding if it matches, else the index
+// 
+static PSERIAL_INDEX_ENTRY HandleAcquire(PTEST_HANDLE Handle, ULONG SerialNo)
+{
+    PSERIAL_INDEX_ENTRY entry = NULL;
+    PTEST_PDO           pdo;
+    KIRQL               irql;
+
+    irql = ExAcquireSpinLockShared(&Handle->BoundPdoLock);
+
+    pdo = Handle->BoundPdo;
+
+    if (pdo != NULL
+        && pdo->SerialNo == SerialNo
+        && ExAcquireRundownProtection(&pdo->IndexEntry.Rundown))
+    {
+        entry = &pdo->IndexEntry;
+    }
+
+    ExReleaseSpinLockShared(&Handle->BoundPdoLock, irql);
+
+    if (entry == NULL)
+    {
+        entry = SerialIndexAcquire(&Index, SerialNo);
+    }
+
+    return entry;
+}
+
+static VOID BenchHandleLookup(PTEST_HANDLE Handle, ULONG SerialNo, ULONG Count, const char* Kind)
+{
+    PSERIAL_INDEX_ENTRY entry;
+    ULONG64             start;
+    ULONG64             sum = 0;
+    ULONG               i;
+    char                name[64];
+
+    start = TestNow();
+
+    for (i = 0; i < BENCH_LOOKUPS; i++)
+    {
+        entry = HandleAcquire(Handle, SerialNo);
+        sum += (ULONG_PTR)entry;
+        SerialIndexRelease(entry);
+    }
+
+    snprintf(name, sizeof(name), "%s handle, %lu PDOs", Kind, (unsigned long)Count);
+    TestReport(name, TestNow() - start, BENCH_LOOKUPS);
+
+    TestSink += sum;
+}
+
+static VOID BenchLookup(ULONG Count)
+{
+    PTEST_PDO           pdos = calloc(Count, sizeof(TEST_PDO));
+    TEST_HANDLE         handle;
+    PULONG              serials = malloc(BENCH_LOOKUPS * sizeof(ULONG));
+    PSERIAL_INDEX_ENTRY entry;
+    ULONG64             state = 0x9E3779B97F4A7C15ULL;
+    ULONG64             start;
+    ULONG64             sum = 0;
+    ULONG               lookups;
+    ULONG               i;
+    char                name[64];
+
+    IndexFill(pdos, Count);
+
+    for (i = 0; i < Count; i++)
+    {
+        ExInitializeRundownProtection(&pdos[i].IndexEntry.Rundown);
+    }
+
+    for (i = 0; i + 1 < Count; i++)
+    {
+        pdos[i].ListNext = &pdos[i + 1];
+    }
+
+    for (i = 0; i < BENCH_LOOKUPS; i++)
+    {
+        serials[i] = (ULONG)(TestRandom(&state) % Count) + 1;
+    }
+
+    start = TestNow();
+
+    for (i = 0; i < BENCH_LOOKUPS; i++)
+    {
+        sum += (ULONG_PTR)SerialIndexFind(&Index, serials[i]);
+    }
+
+    snprintf(name, sizeof(name), "index, %lu PDOs", (unsigned long)Count);
+    TestReport(name, TestNow() - start, BENCH_LOOKUPS);
+
+    //
+    // What Bus_GetPdo and Bus_PutPdo run: shared lock, find, rundown
+    // 
+    start = TestNow();
+
+    for (i = 0; i < BENCH_LOOKUPS; i++)
+    {
+        entry = SerialIndexAcquire(&Index, serials[i]);
+        sum += (ULONG_PTR)entry;
+        SerialIndexRelease(entry);
+    }
+
+    snprintf(name, sizeof(name), "acquire + release, %lu PDOs", (unsigned long)Count);
+    TestReport(name, TestNow() - start, BENCH_LOOKUPS);
+
+    //
+    // A feeder addresses the one pad it plugged in, through its own handle
+    // 
+    RtlZeroMemory(&handle, sizeof(handle));
+
+    BenchHandleLookup(&handle, Count, Count, "unbound");
+
+    handle.BoundPdo = &pdos[Count - 1];
+
+    BenchHandleLookup(&handle, Count, Count, "bound");
+
+    // The linear walk gets fewer rounds at 4096, it's slow enough
+    lookups = BENCH_LOOKUPS / max(Count / 64, 1);
+
+    start = TestNow();
+
+    for (i = 0; i < lookups; i++)
+    {
+        sum += (ULONG_PTR)ListFind(&pdos[0], serials[i]);
+    }
+
+    snprintf(name, sizeof(name), "child list walk, %lu PDOs", (unsigned long)Count);
+    TestReport(name, TestNow() - start, lookups);
+
+    TestSink = sum;
+
+    free(serials);
+    free(pdos);
+}
+
+static VOID Bench_Lookup1(VOID)
+{
+    BenchLookup(1);
+}
+
+static VOID Bench_Lookup64(VOID)
+{
+    BenchLookup(64);
+}
+
+static VOID Bench_Lookup4096(VOID)
+{
+    BenchLookup(4096);
+}
+
+static const TEST_CASE Benchmarks[] =
+{
+    TEST_CASE_OF(Bench_Lookup1),
+    TEST_CASE_OF(Bench_Lookup64),
+    TEST_CASE_OF(Bench_Lookup4096),
+};
+
+#pragma endregion
+
+TEST_MAIN(Tests, Benchmarks)
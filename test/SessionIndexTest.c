@@ -0,0 +1,295 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Platform.h"
+#include "SessionIndex.h"
+#include "Test.h"
+
+//
+// Feeders sharing the bus and pads each of them plugs in
+// 
+#define TEST_SESSIONS       8
+#define TEST_PADS           64
+
+//
+// Stands in for a file object context
+// 
+typedef struct _TEST_FILE
+{
+    UCHAR Padding[0x10];
+
+    SESSION_INDEX_SESSION Session;
+
+} TEST_FILE, *PTEST_FILE;
+
+//
+// Stands in for a PDO context
+// 
+typedef struct _TEST_PDO
+{
+    UCHAR Padding[0x40];
+
+    //
+    // Link in the device list of the owning session
+    // 
+    LIST_ENTRY SessionEntry;
+
+    //
+    // Link in the list of all children the bus walked before
+    // 
+    LIST_ENTRY ChildEntry;
+
+    LONG SessionId;
+
+    ULONG SerialNo;
+
+} TEST_PDO, *PTEST_PDO;
+
+static SESSION_INDEX Index;
+
+static TEST_FILE Files[TEST_SESSIONS];
+
+static TEST_PDO Pdos[TEST_SESSIONS * TEST_PADS];
+
+static LIST_ENTRY Children;
+
+//
+// Opens TEST_SESSIONS sessions with IDs counting up from FirstId and plugs
+// in TEST_PADS PDOs through each, interleaved as feeders would
+// 
+static VOID IndexFill(LONG FirstId)
+{
+    PSESSION_INDEX_SESSION session;
+    ULONG s;
+    ULONG i;
+
+    SessionIndexInit(&Index);
+    InitializeListHead(&Children);
+
+    for (s = 0; s < TEST_SESSIONS; s++)
+    {
+        Files[s].Session.Id = FirstId + (LONG)s;
+        SessionIndexAdd(&Index, &Files[s].Session);
+    }
+
+    for (i = 0; i < RTL_NUMBER_OF(Pdos); i++)
+    {
+        Pdos[i].SessionId = FirstId + (LONG)(i % TEST_SESSIONS);
+        Pdos[i].SerialNo = i + 1;
+
+        session = SessionIndexFind(&Index, Pdos[i].SessionId);
+        InsertTailList(&session->Devices, &Pdos[i].SessionEntry);
+        InsertTailList(&Children, &Pdos[i].ChildEntry);
+    }
+}
+
+#pragma region Tests
+
+static VOID SessionIndex_FindsAddedSessions(VOID)
+{
+    static TEST_FILE files[3 * SESSION_INDEX_BUCKETS];
+    ULONG i;
+
+    SessionIndexInit(&Index);
+
+    // Three sessions in every bucket
+    for (i = 0; i < RTL_NUMBER_OF(files); i++)
+    {
+        files[i].Session.Id = 100 + (LONG)i;
+        SessionIndexAdd(&Index, &files[i].Session);
+
+        TEST_CHECK(IsListEmpty(&files[i].Session.Devices));
+    }
+
+    for (i = 0; i < RTL_NUMBER_OF(files); i++)
+    {
+        TEST_CHECK(SessionIndexFind(&Index, 100 + (LONG)i) == &files[i].Session);
+    }
+
+    TEST_CHECK(SessionIndexFind(&Index, 99) == NULL);
+    TEST_CHECK(SessionIndexFind(&Index, 100 + RTL_NUMBER_OF(files)) == NULL);
+
+    // Closed sessions are gone, their bucket neighbours stay
+    for (i = 0; i < RTL_NUMBER_OF(files); i += 2)
+    {
+        SessionIndexRemove(&files[i].Session);
+    }
+
+    for (i = 0; i < RTL_NUMBER_OF(files); i++)
+    {
+        TEST_CHECK(SessionIndexFind(&Index, 100 + (LONG)i) == ((i % 2) ? &files[i].Session : NULL));
+    }
+}
+
+//
+// Every session lists exactly the PDOs plugged in through it, in plugin
+// order, and unplugging one leaves the others alone
+// 
+static VOID SessionIndex_ListsOwnDevices(VOID)
+{
+    PSESSION_INDEX_SESSION session;
+    PLIST_ENTRY entry;
+    PTEST_PDO pdo;
+    ULONG count;
+    ULONG s;
+
+    IndexFill(100);
+
+    RemoveEntryList(&Pdos[TEST_SESSIONS].SessionEntry);
+
+    for (s = 0; s < TEST_SESSIONS; s++)
+    {
+        session = SessionIndexFind(&Index, 100 + (LONG)s);
+        count = 0;
+
+        for (entry = session->Devices.Flink; entry != &session->Devices; entry = entry->Flink)
+        {
+            pdo = CONTAINING_RECORD(entry, TEST_PDO, SessionEntry);
+
+            // The unplugged one
+            if (s == 0 && count == 1)
+            {
+                count++;
+            }
+
+            TEST_CHECK_EQUAL(session->Id, pdo->SessionId);
+            TEST_CHECK_EQUAL(count * TEST_SESSIONS + s + 1, pdo->SerialNo);
+
+            count++;
+        }
+
+        TEST_CHECK_EQUAL(TEST_PADS, count);
+    }
+}
+
+static const TEST_CASE Tests[] =
+{
+    TEST_CASE_OF(SessionIndex_FindsAddedSessions),
+    TEST_CASE_OF(SessionIndex_ListsOwnDevices),
+};
+
+#pragma endregion
+
+#pragma region Benchmarks
+
+#define BENCH_ROUNDS        100000
+
+//
+// Collects the serials one session would unplug on close, from its own
+// list and from a walk over every child comparing session IDs
+// 
+static VOID Bench_CloseSession(VOID)
+{
+    PSESSION_INDEX_SESSION session;
+    ULONG64 state = 0x9E3779B97F4A7C15ULL;
+    ULONG64 start;
+    ULONG64 sum = 0;
+    PLIST_ENTRY entry;
+    PTEST_PDO pdo;
+    LONG id;
+    ULONG round;
+
+    IndexFill(100);
+
+    start = TestNow();
+
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        session = SessionIndexFind(&Index, 100 + (LONG)(TestRandom(&state) % TEST_SESSIONS));
+
+        for (entry = session->Devices.Flink; entry != &session->Devices; entry = entry->Flink)
+        {
+            sum += CONTAINING_RECORD(entry, TEST_PDO, SessionEntry)->SerialNo;
+        }
+    }
+
+    TestReport("session list, 8 x 64 pads, per close", TestNow() - start, BENCH_ROUNDS);
+
+    start = TestNow();
+
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        id = 100 + (LONG)(TestRandom(&state) % TEST_SESSIONS);
+
+        for (entry = Children.Flink; entry != &Children; entry = entry->Flink)
+        {
+            pdo = CONTAINING_RECORD(entry, TEST_PDO, ChildEntry);
+
+            if (pdo->SessionId == id)
+            {
+                sum += pdo->SerialNo;
+            }
+        }
+    }
+
+    TestReport("child walk, 8 x 64 pads, per close", TestNow() - start, BENCH_ROUNDS);
+
+    TestSink += sum;
+}
+
+//
+// Unplugs and plugs a random pad back in, finding its session each way as
+// PDO cleanup and creation do
+// 
+static VOID Bench_PdoChurn(VOID)
+{
+    PSESSION_INDEX_SESSION session;
+    ULONG64 state = 0x9E3779B97F4A7C15ULL;
+    ULONG64 start;
+    ULONG64 sum = 0;
+    PTEST_PDO pdo;
+    ULONG round;
+
+    IndexFill(100);
+
+    start = TestNow();
+
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        pdo = &Pdos[TestRandom(&state) % RTL_NUMBER_OF(Pdos)];
+
+        RemoveEntryList(&pdo->SessionEntry);
+        sum += (ULONG_PTR)SessionIndexFind(&Index, pdo->SessionId);
+
+        session = SessionIndexFind(&Index, pdo->SessionId);
+        InsertTailList(&session->Devices, &pdo->SessionEntry);
+    }
+
+    TestReport("index, 8 x 64 pads, per unplug and plugin", TestNow() - start, BENCH_ROUNDS);
+
+    TestSink += sum;
+}
+
+static const TEST_CASE Benchmarks[] =
+{
+    TEST_CASE_OF(Bench_CloseSession),
+    TEST_CASE_OF(Bench_PdoChurn),
+};
+
+#pragma endregion
+
+TEST_MAIN(Tests, Benchmarks)
@@ -0,0 +1,329 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Platform.h"
+#include "SeqLock.h"
+#include "SerialAllocator.h"
+#include "StateTable.h"
+#include "Test.h"
+
+static STATE_TABLE Table;
+
+//
+// Fills a report with the low byte of Count, the row's timestamp gets Count
+// as well, so a reader can tell a torn row
+// 
+static VOID TableStoreTagged(ULONG Serial, ULONG64 Count)
+{
+    VIGEM_TARGET_REPORT report;
+
+    RtlFillMemory(&report, sizeof(report), (UCHAR)Count);
+
+    StateTableStore(&Table, Serial, &report, sizeof(report), Count);
+}
+
+static BOOLEAN EntryIsTorn(const VIGEM_STATE_SNAPSHOT_ENTRY* Entry)
+{
+    const UCHAR* bytes = (const UCHAR*)&Entry->Report;
+    ULONG i;
+
+    for (i = 0; i < sizeof(Entry->Report); i++)
+    {
+        if (bytes[i] != (UCHAR)Entry->Timestamp)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+#pragma region Tests
+
+static VOID StateTable_SnapshotsRowsInUse(VOID)
+{
+    VIGEM_STATE_SNAPSHOT_ENTRY entries[4];
+    XUSB_REPORT xusb = { 0 };
+    ULONG total;
+
+    StateTableInit(&Table);
+
+    TEST_CHECK_EQUAL(0, StateTableSnapshot(&Table, entries, RTL_NUMBER_OF(entries), &total));
+    TEST_CHECK_EQUAL(0, total);
+
+    StateTableClaim(&Table, 9, XboxOneWired, 102);
+    StateTableClaim(&Table, 3, Xbox360Wired, 100);
+    StateTableClaim(&Table, 5, DualShock4Wired, 101);
+
+    xusb.wButtons = 0x1234;
+    xusb.bLeftTrigger = 0x56;
+    StateTableStore(&Table, 3, &xusb, sizeof(xusb), 777);
+
+    TEST_CHECK_EQUAL(3, StateTableSnapshot(&Table, entries, RTL_NUMBER_OF(entries), &total));
+    TEST_CHECK_EQUAL(3, total);
+
+    TEST_CHECK_EQUAL(3, entries[0].SerialNo);
+    TEST_CHECK_EQUAL(Xbox360Wired, entries[0].TargetType);
+    TEST_CHECK_EQUAL(100, entries[0].SessionId);
+    TEST_CHECK_EQUAL(777, entries[0].Timestamp);
+    TEST_CHECK_EQUAL(0x1234, entries[0].Report.Xusb.wButtons);
+    TEST_CHECK_EQUAL(0x56, entries[0].Report.Xusb.bLeftTrigger);
+
+    TEST_CHECK_EQUAL(5, entries[1].SerialNo);
+    TEST_CHECK_EQUAL(DualShock4Wired, entries[1].TargetType);
+    TEST_CHECK_EQUAL(0, entries[1].Timestamp);
+
+    TEST_CHECK_EQUAL(9, entries[2].SerialNo);
+    TEST_CHECK_EQUAL(XboxOneWired, entries[2].TargetType);
+    TEST_CHECK_EQUAL(102, entries[2].SessionId);
+
+    // Rows past the buffer still count
+    TEST_CHECK_EQUAL(1, StateTableSnapshot(&Table, entries, 1, &total));
+    TEST_CHECK_EQUAL(3, total);
+    TEST_CHECK_EQUAL(0, StateTableSnapshot(&Table, entries, 0, &total));
+    TEST_CHECK_EQUAL(3, total);
+
+    StateTableRelease(&Table, 5);
+
+    TEST_CHECK_EQUAL(2, StateTableSnapshot(&Table, entries, RTL_NUMBER_OF(entries), &total));
+    TEST_CHECK_EQUAL(2, total);
+    TEST_CHECK_EQUAL(3, entries[0].SerialNo);
+    TEST_CHECK_EQUAL(9, entries[1].SerialNo);
+}
+
+//
+// A reused row starts out without the previous PDO's report
+// 
+static VOID StateTable_ClaimClearsRow(VOID)
+{
+    VIGEM_STATE_SNAPSHOT_ENTRY entry;
+    const UCHAR* bytes = (const UCHAR*)&entry.Report;
+    ULONG i;
+
+    StateTableInit(&Table);
+
+    StateTableClaim(&Table, STATE_TABLE_ROWS - 1, DualShock4Wired, 100);
+    TableStoreTagged(STATE_TABLE_ROWS - 1, 0xAB);
+    StateTableRelease(&Table, STATE_TABLE_ROWS - 1);
+
+    TEST_CHECK(!StateTableRead(&Table, STATE_TABLE_ROWS - 1, &entry));
+
+    StateTableClaim(&Table, STATE_TABLE_ROWS - 1, Xbox360Wired, 101);
+
+    TEST_CHECK(StateTableRead(&Table, STATE_TABLE_ROWS - 1, &entry));
+    TEST_CHECK_EQUAL(Xbox360Wired, entry.TargetType);
+    TEST_CHECK_EQUAL(101, entry.SessionId);
+    TEST_CHECK_EQUAL(0, entry.Timestamp);
+
+    for (i = 0; i < sizeof(entry.Report); i++)
+    {
+        TEST_CHECK_EQUAL(0, bytes[i]);
+    }
+}
+
+#define TABLE_WRITERS       2
+#define TABLE_ROWS_EACH     4
+#define TABLE_WRITES        200000
+#define TABLE_MIN_READS     2000
+
+typedef struct _TABLE_SHARED
+{
+    volatile LONG WritersDone;
+
+    ULONG64 Snapshots;
+
+    ULONG64 Torn;
+
+    ULONG64 Backwards;
+
+} TABLE_SHARED, *PTABLE_SHARED;
+
+typedef struct _TABLE_WRITER
+{
+    PTABLE_SHARED Shared;
+
+    ULONG FirstSerial;
+
+} TABLE_WRITER, *PTABLE_WRITER;
+
+static VOID TableWriter(PVOID Context)
+{
+    PTABLE_WRITER writer = Context;
+    ULONG64 count;
+    ULONG row;
+
+    for (count = 1; count <= TABLE_WRITES; count++)
+    {
+        for (row = 0; row < TABLE_ROWS_EACH; row++)
+        {
+            TableStoreTagged(writer->FirstSerial + row, count);
+        }
+
+        // Lets the reader in when writers and reader share a processor
+        if (count % 256 == 0)
+        {
+            TestThreadYield();
+        }
+    }
+
+    InterlockedIncrement(&writer->Shared->WritersDone);
+}
+
+//
+// Two writers keep storing to their own rows while a reader takes
+// snapshots: every entry is whole and no row's count goes backwards
+// 
+static VOID StateTable_ConcurrentWriters(VOID)
+{
+    static TABLE_SHARED shared;
+    VIGEM_STATE_SNAPSHOT_ENTRY entries[TABLE_WRITERS * TABLE_ROWS_EACH];
+    ULONG64 last[RTL_NUMBER_OF(entries)] = { 0 };
+    TABLE_WRITER writers[TABLE_WRITERS];
+    TEST_THREAD threads[TABLE_WRITERS];
+    ULONG total;
+    ULONG count;
+    ULONG i;
+
+    StateTableInit(&Table);
+    RtlZeroMemory(&shared, sizeof(shared));
+
+    for (i = 0; i < RTL_NUMBER_OF(entries); i++)
+    {
+        StateTableClaim(&Table, i + 1, Xbox360Wired, 100);
+    }
+
+    for (i = 0; i < TABLE_WRITERS; i++)
+    {
+        writers[i].Shared = &shared;
+        writers[i].FirstSerial = 1 + i * TABLE_ROWS_EACH;
+        TestThreadStart(&threads[i], TableWriter, &writers[i]);
+    }
+
+    while (ReadAcquire(&shared.WritersDone) < TABLE_WRITERS || shared.Snapshots < TABLE_MIN_READS)
+    {
+        count = StateTableSnapshot(&Table, entries, RTL_NUMBER_OF(entries), &total);
+
+        TEST_CHECK_EQUAL(RTL_NUMBER_OF(entries), count);
+        TEST_CHECK_EQUAL(RTL_NUMBER_OF(entries), total);
+
+        for (i = 0; i < count; i++)
+        {
+            shared.Torn += EntryIsTorn(&entries[i]);
+            shared.Backwards += (entries[i].Timestamp < last[i]);
+            last[i] = entries[i].Timestamp;
+        }
+
+        shared.Snapshots++;
+
+        TestThreadYield();
+    }
+
+    for (i = 0; i < TABLE_WRITERS; i++)
+    {
+        TestThreadJoin(&threads[i]);
+    }
+
+    TEST_CHECK_EQUAL(0, shared.Torn);
+    TEST_CHECK_EQUAL(0, shared.Backwards);
+    TEST_CHECK(shared.Snapshots >= TABLE_MIN_READS);
+
+    StateTableSnapshot(&Table, entries, RTL_NUMBER_OF(entries), &total);
+
+    for (i = 0; i < RTL_NUMBER_OF(entries); i++)
+    {
+        TEST_CHECK_EQUAL(TABLE_WRITES, entries[i].Timestamp);
+    }
+}
+
+static const TEST_CASE Tests[] =
+{
+    TEST_CASE_OF(StateTable_SnapshotsRowsInUse),
+    TEST_CASE_OF(StateTable_ClaimClearsRow),
+    TEST_CASE_OF(StateTable_ConcurrentWriters),
+};
+
+#pragma endregion
+
+#pragma region Benchmarks
+
+#define BENCH_ROWS          64
+#define BENCH_STORES        10000000
+#define BENCH_SNAPSHOTS     100000
+
+static VOID Bench_Store(VOID)
+{
+    XUSB_REPORT report = { 0 };
+    ULONG64 start;
+    ULONG i;
+
+    StateTableInit(&Table);
+    StateTableClaim(&Table, 1, Xbox360Wired, 100);
+
+    start = TestNow();
+
+    for (i = 0; i < BENCH_STORES; i++)
+    {
+        report.bLeftTrigger = (BYTE)i;
+        StateTableStore(&Table, 1, &report, sizeof(report), i);
+    }
+
+    TestReport("store, one row", TestNow() - start, BENCH_STORES);
+}
+
+static VOID Bench_Snapshot(VOID)
+{
+    static VIGEM_STATE_SNAPSHOT_ENTRY entries[BENCH_ROWS];
+    ULONG64 start;
+    ULONG total;
+    ULONG i;
+
+    StateTableInit(&Table);
+
+    for (i = 0; i < BENCH_ROWS; i++)
+    {
+        StateTableClaim(&Table, i + 1, Xbox360Wired, 100);
+    }
+
+    start = TestNow();
+
+    for (i = 0; i < BENCH_SNAPSHOTS; i++)
+    {
+        TestSink += StateTableSnapshot(&Table, entries, BENCH_ROWS, &total);
+    }
+
+    TestReport("snapshot, 64 rows, per row", TestNow() - start, (ULONG64)BENCH_SNAPSHOTS * BENCH_ROWS);
+}
+
+static const TEST_CASE Benchmarks[] =
+{
+    TEST_CASE_OF(Bench_Store),
+    TEST_CASE_OF(Bench_Snapshot),
+};
+
+#pragma endregion
+
+TEST_MAIN(Tests, Benchmarks)
@@ -0,0 +1,383 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Platform.h"
+#include "Test.h"
+
+#include <stdlib.h>
+
+#if defined(_MSC_VER)
+#include <process.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
+static ULONG TestFailures;
+
+volatile ULONG64 TestSink;
+
+VOID TestFail(const char* File, int Line, const char* Condition)
+{
+    fprintf(stderr, "%s(%d): check failed: %s\n", File, Line, Condition);
+    TestFailures++;
+}
+
+VOID TestFailEqual(const char* File, int Line, const char* Expression, LONG64 Expected, LONG64 Actual)
+{
+    fprintf(stderr, "%s(%d): %s is %lld, expected %lld\n",
+        File, Line, Expression, (long long)Actual, (long long)Expected);
+    TestFailures++;
+}
+
+int TestMain(
+    int argc,
+    char** argv,
+    const TEST_CASE* Tests,
+    size_t TestCount,
+    const TEST_CASE* Benchmarks,
+    size_t BenchmarkCount)
+{
+    const TEST_CASE*    cases = Tests;
+    size_t              count = TestCount;
+    BOOLEAN             bench = FALSE;
+    size_t              i;
+    ULONG               failures;
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        cases = Benchmarks;
+        count = BenchmarkCount;
+        bench = TRUE;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (cases[i].Routine == NULL)
+        {
+            continue;
+        }
+
+        failures = TestFailures;
+
+        if (bench)
+        {
+            printf("%s\n", cases[i].Name);
+        }
+
+        cases[i].Routine();
+
+        if (!bench || failures != TestFailures)
+        {
+            printf("%-48s %s\n", cases[i].Name, failures == TestFailures ? "ok" : "FAILED");
+        }
+
+        fflush(stdout);
+    }
+
+    return (int)min(TestFailures, 0x7F);
+}
+
+ULONG64 TestNow(VOID)
+{
+#if defined(_MSC_VER)
+    LARGE_INTEGER counter, frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+
+    return (ULONG64)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (ULONG64)now.tv_sec * 1000000000ULL + (ULONG64)now.tv_nsec;
+#endif
+}
+
+VOID TestReport(const char* Name, ULONG64 Elapsed, ULONG64 Operations)
+{
+    printf("    %-44s %10.2f ns/op\n", Name, (double)Elapsed / (double)max(Operations, 1));
+}
+
+#pragma region Threads
+
+#if defined(_MSC_VER)
+
+static unsigned __stdcall TestThreadEntry(void* Context)
+{
+    PTEST_THREAD thread = (PTEST_THREAD)Context;
+
+    thread->Routine(thread->Context);
+
+    return 0;
+}
+
+VOID TestThreadStart(PTEST_THREAD Thread, TEST_THREAD_ROUTINE Routine, PVOID Context)
+{
+    Thread->Routine = Routine;
+    Thread->Context = Context;
+    Thread->Handle = (PVOID)_beginthreadex(NULL, 0, TestThreadEntry, Thread, 0, NULL);
+
+    if (Thread->Handle == NULL)
+    {
+        abort();
+    }
+}
+
+VOID TestThreadJoin(PTEST_THREAD Thread)
+{
+    WaitForSingleObject((HANDLE)Thread->Handle, INFINITE);
+    CloseHandle((HANDLE)Thread->Handle);
+}
+
+VOID TestThreadYield(VOID)
+{
+    SwitchToThread();
+}
+
+ULONG TestProcessorCount(VOID)
+{
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+
+    return info.dwNumberOfProcessors;
+}
+
+#else
+
+static void* TestThreadEntry(void* Context)
+{
+    PTEST_THREAD thread = (PTEST_THREAD)Context;
+
+    thread->Routine(thread->Context);
+
+    return NULL;
+}
+
+VOID TestThreadStart(PTEST_THREAD Thread, TEST_THREAD_ROUTINE Routine, PVOID Context)
+{
+    pthread_t* handle = malloc(sizeof(pthread_t));
+
+    Thread->Routine = Routine;
+    Thread->Context = Context;
+    Thread->Handle = handle;
+
+    if (handle == NULL || pthread_create(handle, NULL, TestThreadEntry, Thread) != 0)
+    {
+        abort();
+    }
+}
+
+VOID TestThreadJoin(PTEST_THREAD Thread)
+{
+    pthread_join(*(pthread_t*)Thread->Handle, NULL);
+    free(Thread->Handle);
+}
+
+VOID TestThreadYield(VOID)
+{
+    sched_yield();
+}
+
+ULONG TestProcessorCount(VOID)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return count > 0 ? (ULONG)count : 1;
+}
+
+#endif
+
+#pragma endregion
+
+#pragma region Fibers
+
+static PTEST_FIBER TestFiberCurrent;
+
+#if defined(_MSC_VER)
+
+typedef struct _TEST_FIBER_STATE
+{
+    PVOID Fiber;
+
+    PVOID Caller;
+
+} TEST_FIBER_STATE, *PTEST_FIBER_STATE;
+
+static VOID CALLBACK TestFiberEntry(PVOID Parameter)
+{
+    PTEST_FIBER fiber = (PTEST_FIBER)Parameter;
+
+    fiber->Routine(fiber->Context);
+    fiber->Finished = TRUE;
+
+    // A fiber routine must not return
+    for (;;)
+    {
+        SwitchToFiber(((PTEST_FIBER_STATE)fiber->Handle)->Caller);
+    }
+}
+
+VOID TestFiberCreate(PTEST_FIBER Fiber, TEST_THREAD_ROUTINE Routine, PVOID Context)
+{
+    PTEST_FIBER_STATE state = calloc(1, sizeof(TEST_FIBER_STATE));
+
+    Fiber->Routine = Routine;
+    Fiber->Context = Context;
+    Fiber->Finished = FALSE;
+    Fiber->Handle = state;
+
+    if (state == NULL || (state->Fiber = CreateFiber(0, TestFiberEntry, Fiber)) == NULL)
+    {
+        abort();
+    }
+}
+
+VOID TestFiberDelete(PTEST_FIBER Fiber)
+{
+    PTEST_FIBER_STATE state = (PTEST_FIBER_STATE)Fiber->Handle;
+
+    DeleteFiber(state->Fiber);
+    free(state);
+}
+
+BOOLEAN TestFiberRun(PTEST_FIBER Fiber)
+{
+    PTEST_FIBER_STATE state = (PTEST_FIBER_STATE)Fiber->Handle;
+    PTEST_FIBER previous = TestFiberCurrent;
+
+    if (Fiber->Finished)
+    {
+        return FALSE;
+    }
+
+    if (!IsThreadAFiber())
+    {
+        ConvertThreadToFiber(NULL);
+    }
+
+    state->Caller = GetCurrentFiber();
+
+    TestFiberCurrent = Fiber;
+    SwitchToFiber(state->Fiber);
+    TestFiberCurrent = previous;
+
+    return !Fiber->Finished;
+}
+
+VOID TestFiberYield(VOID)
+{
+    SwitchToFiber(((PTEST_FIBER_STATE)TestFiberCurrent->Handle)->Caller);
+}
+
+#else
+
+#define TEST_FIBER_STACK    0x10000
+
+typedef struct _TEST_FIBER_STATE
+{
+    ucontext_t Fiber;
+
+    ucontext_t Caller;
+
+    PVOID Stack;
+
+} TEST_FIBER_STATE, *PTEST_FIBER_STATE;
+
+static void TestFiberEntry(void)
+{
+    PTEST_FIBER fiber = TestFiberCurrent;
+
+    fiber->Routine(fiber->Context);
+    fiber->Finished = TRUE;
+
+    // Returns to the caller through uc_link
+}
+
+VOID TestFiberCreate(PTEST_FIBER Fiber, TEST_THREAD_ROUTINE Routine, PVOID Context)
+{
+    PTEST_FIBER_STATE state = calloc(1, sizeof(TEST_FIBER_STATE));
+
+    Fiber->Routine = Routine;
+    Fiber->Context = Context;
+    Fiber->Finished = FALSE;
+    Fiber->Handle = state;
+
+    if (state == NULL
+        || (state->Stack = malloc(TEST_FIBER_STACK)) == NULL
+        || getcontext(&state->Fiber) != 0)
+    {
+        abort();
+    }
+
+    state->Fiber.uc_stack.ss_sp = state->Stack;
+    state->Fiber.uc_stack.ss_size = TEST_FIBER_STACK;
+    state->Fiber.uc_link = &state->Caller;
+
+    makecontext(&state->Fiber, TestFiberEntry, 0);
+}
+
+VOID TestFiberDelete(PTEST_FIBER Fiber)
+{
+    PTEST_FIBER_STATE state = (PTEST_FIBER_STATE)Fiber->Handle;
+
+    free(state->Stack);
+    free(state);
+}
+
+BOOLEAN TestFiberRun(PTEST_FIBER Fiber)
+{
+    PTEST_FIBER_STATE state = (PTEST_FIBER_STATE)Fiber->Handle;
+    PTEST_FIBER previous = TestFiberCurrent;
+
+    if (Fiber->Finished)
+    {
+        return FALSE;
+    }
+
+    TestFiberCurrent = Fiber;
+    swapcontext(&state->Caller, &state->Fiber);
+    TestFiberCurrent = previous;
+
+    return !Fiber->Finished;
+}
+
+VOID TestFiberYield(VOID)
+{
+    PTEST_FIBER_STATE state = (PTEST_FIBER_STATE)TestFiberCurrent->Handle;
+
+    swapcontext(&state->Fiber, &state->Caller);
+}
+
+#endif
+
+#pragma endregion
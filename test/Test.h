@@ -0,0 +1,181 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <stdio.h>
+
+//
+// Minimal test runner shared by the host tests.
+// 
+// Every test program runs its tests when started without arguments and
+// its benchmarks when started with "bench"; the exit code is the number
+// of failed checks.
+// 
+
+typedef VOID(*TEST_ROUTINE)(VOID);
+
+typedef struct _TEST_CASE
+{
+    const char* Name;
+
+    TEST_ROUTINE Routine;
+
+} TEST_CASE, *PTEST_CASE;
+
+#define TEST_CASE_OF(_routine_)         { #_routine_, _routine_ }
+
+//
+// Records a failed check and carries on
+// 
+#define TEST_CHECK(_condition_)                                             \
+    do {                                                                    \
+        if (!(_condition_))                                                 \
+            TestFail(__FILE__, __LINE__, #_condition_);                     \
+    } while (0)
+
+#define TEST_CHECK_EQUAL(_expected_, _actual_)                              \
+    do {                                                                    \
+        LONG64 expected_ = (LONG64)(_expected_);                            \
+        LONG64 actual_ = (LONG64)(_actual_);                                \
+        if (expected_ != actual_)                                           \
+            TestFailEqual(__FILE__, __LINE__, #_actual_, expected_, actual_); \
+    } while (0)
+
+VOID TestFail(const char* File, int Line, const char* Condition);
+
+VOID TestFailEqual(const char* File, int Line, const char* Expression, LONG64 Expected, LONG64 Actual);
+
+int TestMain(
+    int argc,
+    char** argv,
+    const TEST_CASE* Tests,
+    size_t TestCount,
+    const TEST_CASE* Benchmarks,
+    size_t BenchmarkCount
+);
+
+#define TEST_MAIN(_tests_, _benchmarks_)                                    \
+    int main(int argc, char** argv)                                         \
+    {                                                                       \
+        return TestMain(argc, argv, _tests_, RTL_NUMBER_OF(_tests_),        \
+            _benchmarks_, RTL_NUMBER_OF(_benchmarks_));                     \
+    }
+
+//
+// Monotonic clock in nanoseconds
+// 
+ULONG64 TestNow(VOID);
+
+//
+// Keeps a computed value alive so benchmarks can't be optimized away
+// 
+extern volatile ULONG64 TestSink;
+
+//
+// Prints a benchmark result as time per operation
+// 
+VOID TestReport(const char* Name, ULONG64 Elapsed, ULONG64 Operations);
+
+//
+// Small deterministic pseudo random generator (xorshift64*)
+// 
+FORCEINLINE ULONG64 TestRandom(PULONG64 State)
+{
+    ULONG64 x = *State;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *State = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+#pragma region Threads
+
+typedef VOID(*TEST_THREAD_ROUTINE)(PVOID Context);
+
+typedef struct _TEST_THREAD
+{
+    PVOID Handle;
+
+    TEST_THREAD_ROUTINE Routine;
+
+    PVOID Context;
+
+} TEST_THREAD, *PTEST_THREAD;
+
+VOID TestThreadStart(PTEST_THREAD Thread, TEST_THREAD_ROUTINE Routine, PVOID Context);
+
+VOID TestThreadJoin(PTEST_THREAD Thread);
+
+//
+// Gives up the rest of the time slice to another ready thread
+// 
+VOID TestThreadYield(VOID);
+
+//
+// Number of processors available to the test
+// 
+ULONG TestProcessorCount(VOID);
+
+#pragma endregion
+
+#pragma region Fibers
+
+//
+// Cooperative routines for checking interleavings deterministically; a fiber
+// runs inside TestFiberRun until it calls TestFiberYield or returns.
+// 
+typedef struct _TEST_FIBER
+{
+    PVOID Handle;
+
+    TEST_THREAD_ROUTINE Routine;
+
+    PVOID Context;
+
+    BOOLEAN Finished;
+
+} TEST_FIBER, *PTEST_FIBER;
+
+VOID TestFiberCreate(PTEST_FIBER Fiber, TEST_THREAD_ROUTINE Routine, PVOID Context);
+
+VOID TestFiberDelete(PTEST_FIBER Fiber);
+
+//
+// Runs the fiber up to its next yield, FALSE once it returned
+// 
+BOOLEAN TestFiberRun(PTEST_FIBER Fiber);
+
+//
+// Switches from the running fiber back to its TestFiberRun caller
+// 
+VOID TestFiberYield(VOID);
+
+#pragma endregion
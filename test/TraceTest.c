@@ -0,0 +1,273 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Platform.h"
+#include "Test.h"
+
+#ifndef TRACE_LEVEL_VERBOSE
+#define TRACE_LEVEL_VERBOSE     5
+#endif
+
+#pragma region WPP stand-ins
+
+//
+// The trace preprocessor doesn't run here. The control block and the
+// logging calls it would generate are stood in for, the enable conditions
+// are the ones from trace.h.
+// 
+#include "trace.h"
+
+#define WPP_DEFINE_CONTROL_GUID(_name_, _guid_, _bits_) _bits_
+#define WPP_DEFINE_BIT(_name_)  WPP_BIT_ ## _name_,
+
+enum { WPP_CONTROL_GUIDS WPP_BIT_COUNT };
+
+typedef struct _TRACE_CONTROL
+{
+    //
+    // Flags enabled by the ETW session, one bit per WPP_BIT_*
+    // 
+    ULONG Flags;
+
+    UCHAR Level;
+
+    //
+    // In-flight recorder keeps verbose messages too
+    // 
+    BOOLEAN AutoLogVerboseEnabled;
+
+} TRACE_CONTROL;
+
+static TRACE_CONTROL TraceControl;
+
+#define WPP_CONTROL(_bit_)      TraceControl
+#define WPP_LEVEL_ENABLED(_flags_) \
+    ((TraceControl.Flags & (1UL << WPP_BIT_ ## _flags_)) != 0)
+#define WPP_RECORDER_LEVEL_FLAGS_FILTER(_lvl_, _flags_) \
+    ((_lvl_) < TRACE_LEVEL_VERBOSE || TraceControl.AutoLogVerboseEnabled)
+
+LONG TraceHotSampleRate = 1;
+volatile LONG TraceHotSampleCount = 0;
+
+static ULONG64 TraceEtwMessages;
+static ULONG64 TraceRecorderMessages;
+
+//
+// Where the generated code hands the message to ETW or the recorder; takes
+// the arguments of the rumble trace in xusb.c. The cost of the write itself
+// comes on top in the driver and isn't measured here.
+// 
+static DECLSPEC_NOINLINE VOID TraceWrite(PULONG64 Messages, const char* Format, const UCHAR* Bytes)
+{
+    ULONG64 packed;
+
+    memcpy(&packed, Bytes, sizeof(packed));
+
+    (*Messages)++;
+    TestSink ^= packed ^ (ULONG_PTR)Format;
+}
+
+//
+// What WPP makes of a TraceHot call: an ETW and a recorder write, each
+// behind its own enable condition
+// 
+#define TraceHot(_flags_, _msg_, _bytes_)                                   \
+    do {                                                                    \
+        if (WPP_HOTLEVEL_FLAGS_ENABLED(TRACE_LEVEL_VERBOSE, _flags_))       \
+            TraceWrite(&TraceEtwMessages, _msg_, _bytes_);                  \
+        if (WPP_RECORDER_HOTLEVEL_FLAGS_FILTER(TRACE_LEVEL_VERBOSE, _flags_)) \
+            TraceWrite(&TraceRecorderMessages, _msg_, _bytes_);             \
+    } while (0)
+
+#pragma endregion
+
+#pragma region Call sites
+
+typedef ULONG(*TRACE_SITE)(const UCHAR* Buffer);
+
+//
+// A rumble report passing through, once per hot-path build flavour;
+// trace.h reads VIGEM_HOT_PATH_TRACING where TraceHot expands
+// 
+#undef VIGEM_HOT_PATH_TRACING
+#define VIGEM_HOT_PATH_TRACING 0
+
+static DECLSPEC_NOINLINE ULONG TraceSiteCompiledOut(const UCHAR* Buffer)
+{
+    TraceHot(TRACE_XUSB, "-- Rumble Buffer: %02X %02X %02X %02X %02X %02X %02X %02X", Buffer);
+
+    return Buffer[3] + Buffer[4];
+}
+
+#undef VIGEM_HOT_PATH_TRACING
+#define VIGEM_HOT_PATH_TRACING 1
+
+static DECLSPEC_NOINLINE ULONG TraceSiteCompiledIn(const UCHAR* Buffer)
+{
+    TraceHot(TRACE_XUSB, "-- Rumble Buffer: %02X %02X %02X %02X %02X %02X %02X %02X", Buffer);
+
+    return Buffer[3] + Buffer[4];
+}
+
+static VOID TraceSetup(ULONG Flags, UCHAR Level, BOOLEAN RecorderVerbose, LONG SampleRate)
+{
+    TraceControl.Flags = Flags;
+    TraceControl.Level = Level;
+    TraceControl.AutoLogVerboseEnabled = RecorderVerbose;
+
+    TraceHotSampleRate = SampleRate;
+    TraceHotSampleCount = 0;
+
+    TraceEtwMessages = 0;
+    TraceRecorderMessages = 0;
+}
+
+static VOID TraceRun(TRACE_SITE Site, ULONG Calls)
+{
+    static const UCHAR rumble[8] = { 0x00, 0x08, 0x00, 0x40, 0x80, 0x00, 0x00, 0x00 };
+    ULONG i;
+
+    for (i = 0; i < Calls; i++)
+    {
+        TestSink += Site(rumble);
+    }
+}
+
+#pragma endregion
+
+#define XUSB_VERBOSE    (1UL << WPP_BIT_TRACE_XUSB)
+
+static VOID Trace_CompiledOutNeverLogs(VOID)
+{
+    TraceSetup(XUSB_VERBOSE, TRACE_LEVEL_VERBOSE, TRUE, 1);
+
+    TraceRun(TraceSiteCompiledOut, 100);
+
+    TEST_CHECK_EQUAL(0, TraceEtwMessages);
+    TEST_CHECK_EQUAL(0, TraceRecorderMessages);
+    TEST_CHECK_EQUAL(0, TraceHotSampleCount);
+}
+
+static VOID Trace_FullLogsEveryCall(VOID)
+{
+    TraceSetup(XUSB_VERBOSE, TRACE_LEVEL_VERBOSE, FALSE, 1);
+
+    TraceRun(TraceSiteCompiledIn, 100);
+
+    TEST_CHECK_EQUAL(100, TraceEtwMessages);
+    TEST_CHECK_EQUAL(0, TraceRecorderMessages);
+}
+
+static VOID Trace_SampledLogsOneInN(VOID)
+{
+    TraceSetup(XUSB_VERBOSE, TRACE_LEVEL_VERBOSE, FALSE, 16);
+
+    TraceRun(TraceSiteCompiledIn, 1000);
+
+    TEST_CHECK_EQUAL(1000 / 16, TraceEtwMessages);
+    TEST_CHECK_EQUAL(1000, TraceHotSampleCount);
+}
+
+static VOID Trace_DisabledSkipsSampleCounter(VOID)
+{
+    // Session without the flag
+    TraceSetup(1UL << WPP_BIT_TRACE_BUSENUM, TRACE_LEVEL_VERBOSE, FALSE, 16);
+    TraceRun(TraceSiteCompiledIn, 100);
+
+    TEST_CHECK_EQUAL(0, TraceEtwMessages);
+    TEST_CHECK_EQUAL(0, TraceHotSampleCount);
+
+    // Flag enabled below verbose
+    TraceSetup(XUSB_VERBOSE, TRACE_LEVEL_VERBOSE - 1, FALSE, 16);
+    TraceRun(TraceSiteCompiledIn, 100);
+
+    TEST_CHECK_EQUAL(0, TraceEtwMessages);
+    TEST_CHECK_EQUAL(0, TraceHotSampleCount);
+}
+
+static VOID Trace_RecorderIsNotSampled(VOID)
+{
+    TraceSetup(XUSB_VERBOSE, TRACE_LEVEL_VERBOSE, TRUE, 16);
+
+    TraceRun(TraceSiteCompiledIn, 1000);
+
+    TEST_CHECK_EQUAL(1000 / 16, TraceEtwMessages);
+    TEST_CHECK_EQUAL(1000, TraceRecorderMessages);
+}
+
+#define BENCH_CALLS     50000000
+
+static VOID TraceBench(const char* Name, TRACE_SITE Site)
+{
+    volatile TRACE_SITE site = Site;
+    ULONG64 start;
+
+    start = TestNow();
+
+    TraceRun(site, BENCH_CALLS);
+
+    TestReport(Name, TestNow() - start, BENCH_CALLS);
+}
+
+static VOID Bench_TraceOff(VOID)
+{
+    TraceSetup(XUSB_VERBOSE, TRACE_LEVEL_VERBOSE, FALSE, 1);
+    TraceBench("off, compiled out", TraceSiteCompiledOut);
+
+    TraceSetup(0, 0, FALSE, 1);
+    TraceBench("compiled in, no session", TraceSiteCompiledIn);
+}
+
+static VOID Bench_TraceSampled(VOID)
+{
+    TraceSetup(XUSB_VERBOSE, TRACE_LEVEL_VERBOSE, FALSE, 64);
+    TraceBench("verbose session, 1 in 64", TraceSiteCompiledIn);
+}
+
+static VOID Bench_TraceFull(VOID)
+{
+    TraceSetup(XUSB_VERBOSE, TRACE_LEVEL_VERBOSE, FALSE, 1);
+    TraceBench("verbose session, every call", TraceSiteCompiledIn);
+}
+
+static const TEST_CASE Tests[] =
+{
+    TEST_CASE_OF(Trace_CompiledOutNeverLogs),
+    TEST_CASE_OF(Trace_FullLogsEveryCall),
+    TEST_CASE_OF(Trace_SampledLogsOneInN),
+    TEST_CASE_OF(Trace_DisabledSkipsSampleCounter),
+    TEST_CASE_OF(Trace_RecorderIsNotSampled),
+};
+
+static const TEST_CASE Benchmarks[] =
+{
+    TEST_CASE_OF(Bench_TraceOff),
+    TEST_CASE_OF(Bench_TraceSampled),
+    TEST_CASE_OF(Bench_TraceFull),
+};
+
+TEST_MAIN(Tests, Benchmarks)
@@ -0,0 +1,439 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "Platform.h"
+#include "Util.h"
+#include "TransformCore.h"
+#include "Test.h"
+
+#pragma region Transforms
+
+static UCHAR TriggerCurve[0x100];
+static USHORT StickDeadzone[0x10000];
+static USHORT StickInvert[0x10000];
+
+//
+// Trigger dead zone of 16 scaled back to full range, stick dead zone of
+// 4000 and an inverted axis
+// 
+static VOID TablesInit(VOID)
+{
+    ULONG i;
+    SHORT value;
+
+    for (i = 0; i < 0x100; i++)
+    {
+        TriggerCurve[i] = (UCHAR)(i < 16 ? 0 : (i - 16) * 255 / 239);
+    }
+
+    for (i = 0; i < 0x10000; i++)
+    {
+        value = (SHORT)i;
+
+        StickDeadzone[i] = (USHORT)((value > -4000 && value < 4000) ? 0 : value);
+        StickInvert[i] = (USHORT)~value;
+    }
+}
+
+static VOID TransformAddTable(PTRANSFORM Transform, ULONG Offset, BOOLEAN Wide, const VOID* Table)
+{
+    PTRANSFORM_TABLE table = &Transform->Tables[Transform->TableCount++];
+
+    table->Offset = (USHORT)Offset;
+    table->Wide = Wide;
+    table->Table = Table;
+}
+
+static VOID TransformSetButtons(PTRANSFORM Transform, ULONG Offset, const UCHAR* ButtonMap)
+{
+    memset(Transform->ButtonsLow, 0, sizeof(Transform->ButtonsLow));
+    memset(Transform->ButtonsHigh, 0, sizeof(Transform->ButtonsHigh));
+
+    Transform->ButtonsOffset = (USHORT)Offset;
+    Transform->RemapButtons = TRUE;
+
+    Transform_CompileButtons(Transform, ButtonMap);
+}
+
+//
+// What a feeder calibrating an XUSB pad sets up: both triggers and the left
+// stick get their dead zones, the right stick's Y axis is inverted, its X
+// axis left alone; A and B trade places and BACK moves onto GUIDE
+// 
+static PTRANSFORM XusbTransform(VOID)
+{
+    PTRANSFORM  transform = calloc(1, sizeof(TRANSFORM));
+    UCHAR       map[VIGEM_TRANSFORM_BUTTONS];
+    ULONG       i;
+
+    TablesInit();
+
+    TransformAddTable(transform, FIELD_OFFSET(XUSB_REPORT, bLeftTrigger), FALSE, TriggerCurve);
+    TransformAddTable(transform, FIELD_OFFSET(XUSB_REPORT, bRightTrigger), FALSE, TriggerCurve);
+    TransformAddTable(transform, FIELD_OFFSET(XUSB_REPORT, sThumbLX), TRUE, StickDeadzone);
+    TransformAddTable(transform, FIELD_OFFSET(XUSB_REPORT, sThumbLY), TRUE, StickDeadzone);
+    TransformAddTable(transform, FIELD_OFFSET(XUSB_REPORT, sThumbRY), TRUE, StickInvert);
+
+    for (i = 0; i < VIGEM_TRANSFORM_BUTTONS; i++)
+    {
+        map[i] = (UCHAR)i;
+    }
+
+    map[12] = 13;                               // A <- B
+    map[13] = 12;                               // B <- A
+    map[5] = VIGEM_TRANSFORM_BUTTON_NONE;       // BACK
+    map[10] = 5;                                // GUIDE <- BACK
+
+    TransformSetButtons(transform, FIELD_OFFSET(XUSB_REPORT, wButtons), map);
+
+    return transform;
+}
+
+#pragma endregion
+
+#pragma region Tests
+
+typedef struct _XUSB_GOLDEN
+{
+    XUSB_REPORT Input;
+
+    XUSB_REPORT Output;
+
+} XUSB_GOLDEN;
+
+//
+// Worked out by hand from the transform above
+// 
+static const XUSB_GOLDEN XusbGolden[] =
+{
+    {
+        { 0, 0, 0, 0, 0, 0, 0 },
+        { 0, 0, 0, 0, 0, 0, -1 },
+    },
+    {
+        { XUSB_GAMEPAD_A | XUSB_GAMEPAD_BACK | XUSB_GAMEPAD_GUIDE | XUSB_GAMEPAD_DPAD_UP, 15, 16, 3999, -4000, 1234, 32767 },
+        { XUSB_GAMEPAD_B | XUSB_GAMEPAD_GUIDE | XUSB_GAMEPAD_DPAD_UP, 0, 0, 0, -4000, 1234, -32768 },
+    },
+    {
+        { XUSB_GAMEPAD_B | XUSB_GAMEPAD_X | XUSB_GAMEPAD_Y, 255, 128, -32768, -3999, -1, -32768 },
+        { XUSB_GAMEPAD_A | XUSB_GAMEPAD_X | XUSB_GAMEPAD_Y, 255, 119, -32768, 0, -1, 32767 },
+    },
+    {
+        { 0xFFFF, 17, 254, 4000, 32767, -32768, -2 },
+        { 0xFFDF, 1, 253, 4000, 32767, -32768, 1 },
+    },
+};
+
+static VOID Apply_XusbGolden(VOID)
+{
+    PTRANSFORM  transform = XusbTransform();
+    XUSB_REPORT report;
+    ULONG       i;
+
+    for (i = 0; i < RTL_NUMBER_OF(XusbGolden); i++)
+    {
+        report = XusbGolden[i].Input;
+
+        Transform_Apply(transform, (PUCHAR)&report);
+
+        TEST_CHECK_EQUAL(XusbGolden[i].Output.wButtons, report.wButtons);
+        TEST_CHECK_EQUAL(XusbGolden[i].Output.bLeftTrigger, report.bLeftTrigger);
+        TEST_CHECK_EQUAL(XusbGolden[i].Output.bRightTrigger, report.bRightTrigger);
+        TEST_CHECK_EQUAL(XusbGolden[i].Output.sThumbLX, report.sThumbLX);
+        TEST_CHECK_EQUAL(XusbGolden[i].Output.sThumbLY, report.sThumbLY);
+        TEST_CHECK_EQUAL(XusbGolden[i].Output.sThumbRX, report.sThumbRX);
+        TEST_CHECK_EQUAL(XusbGolden[i].Output.sThumbRY, report.sThumbRY);
+    }
+
+    free(transform);
+}
+
+static VOID Apply_IdentityLeavesReport(VOID)
+{
+    static UCHAR    identity8[0x100];
+    static USHORT   identity16[0x10000];
+    PTRANSFORM      transform = calloc(1, sizeof(TRANSFORM));
+    UCHAR           map[VIGEM_TRANSFORM_BUTTONS];
+    UCHAR           report[0x40];
+    UCHAR           original[0x40];
+    ULONG64         state = 0x9E3779B97F4A7C15ULL;
+    ULONG           round;
+    ULONG           i;
+
+    for (i = 0; i < 0x10000; i++)
+    {
+        identity16[i] = (USHORT)i;
+        identity8[i & 0xFF] = (UCHAR)i;
+    }
+
+    for (i = 0; i < VIGEM_TRANSFORM_BUTTONS; i++)
+    {
+        map[i] = (UCHAR)i;
+    }
+
+    // Odd offsets too, DS4 axes aren't aligned
+    for (i = 0; i < AXES_BLEND_LANES; i++)
+    {
+        TransformAddTable(transform, 1 + i * 3, (i & 1) != 0, (i & 1) ? (const VOID*)identity16 : identity8);
+    }
+
+    TransformSetButtons(transform, 0x31, map);
+
+    for (round = 0; round < 10000; round++)
+    {
+        for (i = 0; i < sizeof(report); i++)
+        {
+            report[i] = (UCHAR)TestRandom(&state);
+        }
+
+        memcpy(original, report, sizeof(report));
+
+        Transform_Apply(transform, report);
+
+        TEST_CHECK(memcmp(original, report, sizeof(report)) == 0);
+    }
+
+    free(transform);
+}
+
+static VOID Apply_TablesTouchOnlyTheirField(VOID)
+{
+    static UCHAR    table8[0x100];
+    static USHORT   table16[0x10000];
+    PTRANSFORM      transform = calloc(1, sizeof(TRANSFORM));
+    UCHAR           report[0x40];
+    UCHAR           expected[0x40];
+    ULONG64         state = 0xD1B54A32D192ED03ULL;
+    USHORT          value;
+    ULONG           round;
+    ULONG           i;
+
+    for (i = 0; i < 0x10000; i++)
+    {
+        table16[i] = (USHORT)TestRandom(&state);
+        table8[i & 0xFF] = (UCHAR)TestRandom(&state);
+    }
+
+    // The DS4 shape: four 8-bit sticks and two triggers
+    TransformAddTable(transform, 1, FALSE, table8);
+    TransformAddTable(transform, 2, FALSE, table8);
+    TransformAddTable(transform, 3, FALSE, table8);
+    TransformAddTable(transform, 4, FALSE, table8);
+    TransformAddTable(transform, 8, FALSE, table8);
+    TransformAddTable(transform, 9, FALSE, table8);
+    TransformAddTable(transform, 0x0D, TRUE, table16);
+
+    for (round = 0; round < 10000; round++)
+    {
+        for (i = 0; i < sizeof(report); i++)
+        {
+            report[i] = (UCHAR)TestRandom(&state);
+        }
+
+        memcpy(expected, report, sizeof(report));
+
+        for (i = 0; i < 6; i++)
+        {
+            ULONG offset = transform->Tables[i].Offset;
+
+            expected[offset] = table8[expected[offset]];
+        }
+
+        value = (USHORT)(expected[0x0D] | (expected[0x0E] << 8));
+        value = table16[value];
+        expected[0x0D] = (UCHAR)value;
+        expected[0x0E] = (UCHAR)(value >> 8);
+
+        Transform_Apply(transform, report);
+
+        TEST_CHECK(memcmp(expected, report, sizeof(report)) == 0);
+    }
+
+    free(transform);
+}
+
+static VOID Buttons_MatchReference(VOID)
+{
+    PTRANSFORM  transform = calloc(1, sizeof(TRANSFORM));
+    UCHAR       map[VIGEM_TRANSFORM_BUTTONS];
+    ULONG64     state = 0x2545F4914F6CDD1DULL;
+    USHORT      buttons;
+    USHORT      expected;
+    ULONG       round;
+    ULONG       word;
+    ULONG       i;
+
+    for (round = 0; round < 32; round++)
+    {
+        // Any map: duplicates, drops and all
+        for (i = 0; i < VIGEM_TRANSFORM_BUTTONS; i++)
+        {
+            map[i] = (TestRandom(&state) % 5 == 0)
+                ? VIGEM_TRANSFORM_BUTTON_NONE
+                : (UCHAR)(TestRandom(&state) % VIGEM_TRANSFORM_BUTTONS);
+        }
+
+        TransformSetButtons(transform, 0, map);
+
+        for (word = 0; word < 0x10000; word++)
+        {
+            expected = 0;
+
+            for (i = 0; i < VIGEM_TRANSFORM_BUTTONS; i++)
+            {
+                if (map[i] != VIGEM_TRANSFORM_BUTTON_NONE && (word & (1 << map[i])))
+                {
+                    expected |= (USHORT)(1 << i);
+                }
+            }
+
+            buttons = (USHORT)word;
+
+            Transform_Apply(transform, (PUCHAR)&buttons);
+
+            TEST_CHECK_EQUAL(expected, buttons);
+        }
+    }
+
+    free(transform);
+}
+
+static const TEST_CASE Tests[] =
+{
+    TEST_CASE_OF(Apply_XusbGolden),
+    TEST_CASE_OF(Apply_IdentityLeavesReport),
+    TEST_CASE_OF(Apply_TablesTouchOnlyTheirField),
+    TEST_CASE_OF(Buttons_MatchReference),
+};
+
+#pragma endregion
+
+#pragma region Benchmarks
+
+#define BENCH_REPORTS   0x1000
+
+typedef VOID(*APPLY_ROUTINE)(const TRANSFORM* Transform, PUCHAR Report);
+
+static VOID ApplyNone(const TRANSFORM* Transform, PUCHAR Report)
+{
+    UNREFERENCED_PARAMETER(Transform);
+    UNREFERENCED_PARAMETER(Report);
+}
+
+//
+// Reports either sweep the sticks slowly, like a feeder at 1 kHz does, or
+// jump around at random all over the 128 KiB wide tables
+// 
+static VOID BenchApply(const char* Name, APPLY_ROUTINE Routine, const TRANSFORM* Transform, BOOLEAN Random)
+{
+    static XUSB_REPORT  reports[BENCH_REPORTS];
+    // Called through a pointer like the kernel's out-of-line call
+    APPLY_ROUTINE volatile routine = Routine;
+    XUSB_REPORT         report;
+    ULONG64             state = 1;
+    ULONG64             sum = 0;
+    ULONG64             start;
+    ULONG               i;
+
+    for (i = 0; i < BENCH_REPORTS; i++)
+    {
+        reports[i].wButtons = (USHORT)TestRandom(&state);
+        reports[i].bLeftTrigger = (BYTE)(Random ? TestRandom(&state) : i);
+        reports[i].bRightTrigger = (BYTE)(Random ? TestRandom(&state) : i);
+        reports[i].sThumbLX = (SHORT)(Random ? TestRandom(&state) : i * 16);
+        reports[i].sThumbLY = (SHORT)(Random ? TestRandom(&state) : i * 16);
+        reports[i].sThumbRX = (SHORT)(Random ? TestRandom(&state) : i * -16);
+        reports[i].sThumbRY = (SHORT)(Random ? TestRandom(&state) : i * -16);
+    }
+
+    start = TestNow();
+
+    for (i = 0; i < 20000000; i++)
+    {
+        report = reports[i & (BENCH_REPORTS - 1)];
+        routine(Transform, (PUCHAR)&report);
+        sum += (USHORT)report.sThumbRY + report.wButtons;
+    }
+
+    TestReport(Name, TestNow() - start, i);
+
+    TestSink = sum;
+}
+
+static VOID Bench_TransformApply(VOID)
+{
+    PTRANSFORM transform = XusbTransform();
+
+    BenchApply("XUSB, report copy only", ApplyNone, transform, FALSE);
+    BenchApply("XUSB, 5 tables + buttons, sweeping", Transform_Apply, transform, FALSE);
+    BenchApply("XUSB, 5 tables + buttons, random", Transform_Apply, transform, TRUE);
+
+    transform->TableCount = 0;
+
+    BenchApply("XUSB, buttons only", Transform_Apply, transform, TRUE);
+
+    free(transform);
+}
+
+static VOID Bench_CompileButtons(VOID)
+{
+    PTRANSFORM  transform = calloc(1, sizeof(TRANSFORM));
+    UCHAR       map[VIGEM_TRANSFORM_BUTTONS];
+    ULONG64     start;
+    ULONG       i;
+
+    for (i = 0; i < VIGEM_TRANSFORM_BUTTONS; i++)
+    {
+        map[i] = (UCHAR)(VIGEM_TRANSFORM_BUTTONS - 1 - i);
+    }
+
+    start = TestNow();
+
+    for (i = 0; i < 10000; i++)
+    {
+        TransformSetButtons(transform, 0, map);
+    }
+
+    TestReport("button map compile", TestNow() - start, i);
+
+    TestSink = transform->ButtonsLow[0x5A];
+
+    free(transform);
+}
+
+static const TEST_CASE Benchmarks[] =
+{
+    TEST_CASE_OF(Bench_TransformApply),
+    TEST_CASE_OF(Bench_CompileButtons),
+};
+
+#pragma endregion
+
+TEST_MAIN(Tests, Benchmarks)
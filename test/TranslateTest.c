@@ -0,0 +1,473 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include <string.h>
+
+#include "Platform.h"
+#include "Translate.h"
+#include "SeqLock.h"
+#include "SerialIndex.h"
+#include "Test.h"
+
+static const VIGEM_TARGET_TYPE TranslateTypes[] = { Xbox360Wired, DualShock4Wired, XboxOneWired };
+
+#pragma region References
+
+//
+// What a native report looks like after going through the canonical state:
+// bits the type doesn't define are dropped, a DS4 hat outside of the eight
+// directions is released and the DS4 trigger buttons follow the triggers
+// 
+static VOID NormalizeNative(VIGEM_TARGET_TYPE Type, PVIGEM_TARGET_REPORT Report)
+{
+    USHORT hat;
+
+    switch (Type)
+    {
+    case Xbox360Wired:
+        Report->Xusb.wButtons &= (USHORT)~0x0800;
+        break;
+    case DualShock4Wired:
+        hat = Report->Ds4.wButtons & 0x0F;
+
+        Report->Ds4.wButtons = (USHORT)((Report->Ds4.wButtons & 0xF3F0)
+            | (hat > DS4_BUTTON_DPAD_NORTHWEST ? DS4_BUTTON_DPAD_NONE : hat)
+            | (Report->Ds4.bTriggerL != 0 ? DS4_BUTTON_TRIGGER_LEFT : 0)
+            | (Report->Ds4.bTriggerR != 0 ? DS4_BUTTON_TRIGGER_RIGHT : 0));
+        Report->Ds4.bSpecial &= DS4_SPECIAL_BUTTON_PS | DS4_SPECIAL_BUTTON_TOUCHPAD;
+        break;
+    case XboxOneWired:
+        Report->Xgip.Buttons1 &= 0xFC;
+        Report->Xgip.LeftTrigger &= 0x3FF;
+        Report->Xgip.RightTrigger &= 0x3FF;
+        break;
+    default:
+        break;
+    }
+}
+
+static VOID RandomNative(VIGEM_TARGET_TYPE Type, PULONG64 State, PVIGEM_TARGET_REPORT Report)
+{
+    size_t  size = Type == Xbox360Wired ? sizeof(XUSB_REPORT)
+        : Type == DualShock4Wired ? RTL_SIZEOF_THROUGH_FIELD(DS4_REPORT, bTriggerR)
+        : sizeof(XGIP_REPORT);
+    size_t  i;
+
+    // Anything goes in the native bytes, the rest of the union (and the
+    // DS4 tail padding) stays zero
+    RtlZeroMemory(Report, sizeof(VIGEM_TARGET_REPORT));
+
+    for (i = 0; i < size; i++)
+    {
+        ((PUCHAR)Report)[i] = (UCHAR)TestRandom(State);
+    }
+}
+
+//
+// Opposing D-Pad directions cancel out on a hat
+// 
+static USHORT CancelOpposingDpad(USHORT Buttons)
+{
+    if ((Buttons & (XUSB_GAMEPAD_DPAD_UP | XUSB_GAMEPAD_DPAD_DOWN)) == (XUSB_GAMEPAD_DPAD_UP | XUSB_GAMEPAD_DPAD_DOWN))
+    {
+        Buttons &= (USHORT)~(XUSB_GAMEPAD_DPAD_UP | XUSB_GAMEPAD_DPAD_DOWN);
+    }
+
+    if ((Buttons & (XUSB_GAMEPAD_DPAD_LEFT | XUSB_GAMEPAD_DPAD_RIGHT)) == (XUSB_GAMEPAD_DPAD_LEFT | XUSB_GAMEPAD_DPAD_RIGHT))
+    {
+        Buttons &= (USHORT)~(XUSB_GAMEPAD_DPAD_LEFT | XUSB_GAMEPAD_DPAD_RIGHT);
+    }
+
+    return Buttons;
+}
+
+#pragma endregion
+
+#pragma region Tests
+
+static VOID RoundTrip_NativeFuzz(VOID)
+{
+    VIGEM_TARGET_REPORT report;
+    VIGEM_TARGET_REPORT expected;
+    VIGEM_TARGET_REPORT encoded;
+    VIGEM_GAMEPAD_STATE state;
+    ULONG64             seed = 0x9E3779B97F4A7C15ULL;
+    ULONG               round;
+    ULONG               t;
+
+    for (t = 0; t < RTL_NUMBER_OF(TranslateTypes); t++)
+    {
+        for (round = 0; round < 200000; round++)
+        {
+            RandomNative(TranslateTypes[t], &seed, &report);
+
+            expected = report;
+            NormalizeNative(TranslateTypes[t], &expected);
+
+            TEST_CHECK_EQUAL(STATUS_SUCCESS, Translate_DecodeGamepad(TranslateTypes[t], &report, &state));
+            TEST_CHECK_EQUAL(STATUS_SUCCESS, Translate_EncodeGamepad(&state, TranslateTypes[t], &encoded));
+
+            TEST_CHECK(memcmp(&expected, &encoded, sizeof(VIGEM_TARGET_REPORT)) == 0);
+        }
+    }
+}
+
+static VOID RoundTrip_CanonicalFuzz(VOID)
+{
+    VIGEM_GAMEPAD_STATE state;
+    VIGEM_GAMEPAD_STATE decoded;
+    VIGEM_TARGET_REPORT encoded;
+    VIGEM_TARGET_REPORT again;
+    ULONG64             seed = 0xD1B54A32D192ED03ULL;
+    ULONG               round;
+    ULONG               t;
+
+    for (t = 0; t < RTL_NUMBER_OF(TranslateTypes); t++)
+    {
+        for (round = 0; round < 200000; round++)
+        {
+            RtlZeroMemory(&state, sizeof(state));
+            state.Buttons = (USHORT)TestRandom(&seed);
+            state.LeftTrigger = (USHORT)TestRandom(&seed);
+            state.RightTrigger = (USHORT)TestRandom(&seed);
+            state.ThumbLX = (SHORT)TestRandom(&seed);
+            state.ThumbLY = (SHORT)TestRandom(&seed);
+            state.ThumbRX = (SHORT)TestRandom(&seed);
+            state.ThumbRY = (SHORT)TestRandom(&seed);
+
+            (void)Translate_EncodeGamepad(&state, TranslateTypes[t], &encoded);
+            (void)Translate_DecodeGamepad(TranslateTypes[t], &encoded, &decoded);
+            (void)Translate_EncodeGamepad(&decoded, TranslateTypes[t], &again);
+
+            // Whatever precision got lost is lost once
+            TEST_CHECK(memcmp(&encoded, &again, sizeof(VIGEM_TARGET_REPORT)) == 0);
+
+            switch (TranslateTypes[t])
+            {
+            case Xbox360Wired:
+                TEST_CHECK_EQUAL(state.Buttons & ~VIGEM_GAMEPAD_TOUCHPAD, decoded.Buttons);
+                TEST_CHECK_EQUAL(state.LeftTrigger >> 8, decoded.LeftTrigger >> 8);
+                TEST_CHECK_EQUAL(state.ThumbRY, decoded.ThumbRY);
+                break;
+            case DualShock4Wired:
+                TEST_CHECK_EQUAL(CancelOpposingDpad(state.Buttons), decoded.Buttons);
+                TEST_CHECK_EQUAL(state.LeftTrigger >> 8, decoded.LeftTrigger >> 8);
+                TEST_CHECK_EQUAL(state.ThumbLX >> 8, decoded.ThumbLX >> 8);
+                TEST_CHECK_EQUAL(state.ThumbRY >> 8, decoded.ThumbRY >> 8);
+                break;
+            case XboxOneWired:
+                TEST_CHECK_EQUAL(state.Buttons & ~(VIGEM_GAMEPAD_GUIDE | VIGEM_GAMEPAD_TOUCHPAD), decoded.Buttons);
+                TEST_CHECK_EQUAL(state.RightTrigger >> 6, decoded.RightTrigger >> 6);
+                TEST_CHECK_EQUAL(state.ThumbLY, decoded.ThumbLY);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+static VOID Cross_ButtonsByPosition(VOID)
+{
+    VIGEM_TARGET_REPORT source;
+    VIGEM_TARGET_REPORT middle;
+    VIGEM_TARGET_REPORT back;
+    ULONG               word;
+
+    RtlZeroMemory(&source, sizeof(source));
+
+    for (word = 0; word < 0x10000; word++)
+    {
+        source.Xusb.wButtons = (USHORT)word;
+
+        // XGIP has neither the guide button nor bit 11
+        (void)Translate_Report(Xbox360Wired, &source, XboxOneWired, &middle);
+        (void)Translate_Report(XboxOneWired, &middle, Xbox360Wired, &back);
+        TEST_CHECK_EQUAL(word & ~(XUSB_GAMEPAD_GUIDE | 0x0800), back.Xusb.wButtons);
+
+        // DS4 folds the D-Pad into a hat, guide is the PS button
+        (void)Translate_Report(Xbox360Wired, &source, DualShock4Wired, &middle);
+        (void)Translate_Report(DualShock4Wired, &middle, Xbox360Wired, &back);
+        TEST_CHECK_EQUAL(CancelOpposingDpad((USHORT)(word & ~0x0800)), back.Xusb.wButtons);
+    }
+
+    source.Xusb.wButtons = XUSB_GAMEPAD_A | XUSB_GAMEPAD_Y | XUSB_GAMEPAD_DPAD_UP | XUSB_GAMEPAD_DPAD_RIGHT | XUSB_GAMEPAD_GUIDE;
+    (void)Translate_Report(Xbox360Wired, &source, DualShock4Wired, &middle);
+    TEST_CHECK_EQUAL(DS4_BUTTON_CROSS | DS4_BUTTON_TRIANGLE | DS4_BUTTON_DPAD_NORTHEAST, middle.Ds4.wButtons);
+    TEST_CHECK_EQUAL(DS4_SPECIAL_BUTTON_PS, middle.Ds4.bSpecial);
+}
+
+static VOID Cross_AxisExtremes(VOID)
+{
+    VIGEM_TARGET_REPORT source;
+    VIGEM_TARGET_REPORT target;
+
+    RtlZeroMemory(&source, sizeof(source));
+    source.Xusb.sThumbLX = -32768;
+    source.Xusb.sThumbLY = 32767;
+    source.Xusb.sThumbRX = 32767;
+    source.Xusb.sThumbRY = -32768;
+    source.Xusb.bLeftTrigger = 0xFF;
+
+    (void)Translate_Report(Xbox360Wired, &source, DualShock4Wired, &target);
+
+    // DS4 vertical axes grow downwards
+    TEST_CHECK_EQUAL(0x00, target.Ds4.bThumbLX);
+    TEST_CHECK_EQUAL(0x00, target.Ds4.bThumbLY);
+    TEST_CHECK_EQUAL(0xFF, target.Ds4.bThumbRX);
+    TEST_CHECK_EQUAL(0xFF, target.Ds4.bThumbRY);
+    TEST_CHECK_EQUAL(0xFF, target.Ds4.bTriggerL);
+    TEST_CHECK_EQUAL(DS4_BUTTON_TRIGGER_LEFT | DS4_BUTTON_DPAD_NONE, target.Ds4.wButtons);
+
+    (void)Translate_Report(DualShock4Wired, &target, Xbox360Wired, &source);
+
+    TEST_CHECK_EQUAL(-32768, source.Xusb.sThumbLX);
+    TEST_CHECK_EQUAL(32767, source.Xusb.sThumbLY);
+    TEST_CHECK_EQUAL(32767, source.Xusb.sThumbRX);
+    TEST_CHECK_EQUAL(-32768, source.Xusb.sThumbRY);
+
+    // Full 8-bit trigger is a full 10-bit one
+    (void)Translate_Report(Xbox360Wired, &source, XboxOneWired, &target);
+    TEST_CHECK_EQUAL(0x3FF, target.Xgip.LeftTrigger);
+    TEST_CHECK_EQUAL(0, target.Xgip.RightTrigger);
+}
+
+static VOID Translate_Unsupported(VOID)
+{
+    VIGEM_TARGET_REPORT report;
+    VIGEM_GAMEPAD_STATE state;
+
+    RtlZeroMemory(&report, sizeof(report));
+    RtlZeroMemory(&state, sizeof(state));
+
+    TEST_CHECK(Translate_IsSupported(Xbox360Wired, XboxOneWired));
+    TEST_CHECK(Translate_IsSupported((VIGEM_TARGET_TYPE)7, (VIGEM_TARGET_TYPE)7));
+    TEST_CHECK(!Translate_IsSupported(Xbox360Wired, (VIGEM_TARGET_TYPE)7));
+    TEST_CHECK_EQUAL(STATUS_NOT_SUPPORTED, Translate_EncodeGamepad(&state, (VIGEM_TARGET_TYPE)7, &report));
+    TEST_CHECK_EQUAL(STATUS_NOT_SUPPORTED, Translate_DecodeGamepad((VIGEM_TARGET_TYPE)7, &report, &state));
+    TEST_CHECK_EQUAL(STATUS_NOT_SUPPORTED, Translate_Report((VIGEM_TARGET_TYPE)7, &report, Xbox360Wired, &report));
+}
+
+static const TEST_CASE Tests[] =
+{
+    TEST_CASE_OF(RoundTrip_NativeFuzz),
+    TEST_CASE_OF(RoundTrip_CanonicalFuzz),
+    TEST_CASE_OF(Cross_ButtonsByPosition),
+    TEST_CASE_OF(Cross_AxisExtremes),
+    TEST_CASE_OF(Translate_Unsupported),
+};
+
+#pragma endregion
+
+#pragma region Benchmarks
+
+#define BENCH_REPORTS   0x400
+
+static const char* TypeName(VIGEM_TARGET_TYPE Type)
+{
+    return Type == Xbox360Wired ? "XUSB" : Type == DualShock4Wired ? "DS4" : "XGIP";
+}
+
+static VOID Bench_TranslateReport(VOID)
+{
+    static VIGEM_TARGET_REPORT  reports[BENCH_REPORTS];
+    VIGEM_TARGET_REPORT         target;
+    ULONG64                     seed = 1;
+    ULONG64                     sum = 0;
+    ULONG64                     start;
+    ULONG                       s;
+    ULONG                       t;
+    ULONG                       i;
+    char                        name[0x40];
+
+    for (s = 0; s < RTL_NUMBER_OF(TranslateTypes); s++)
+    {
+        for (i = 0; i < BENCH_REPORTS; i++)
+        {
+            RandomNative(TranslateTypes[s], &seed, &reports[i]);
+        }
+
+        for (t = 0; t < RTL_NUMBER_OF(TranslateTypes); t++)
+        {
+            start = TestNow();
+
+            for (i = 0; i < 10000000; i++)
+            {
+                (void)Translate_Report(TranslateTypes[s], &reports[i & (BENCH_REPORTS - 1)], TranslateTypes[t], &target);
+                sum += target.Xusb.wButtons;
+            }
+
+            snprintf(name, sizeof(name), "%s to %s", TypeName(TranslateTypes[s]), TypeName(TranslateTypes[t]));
+            TestReport(name, TestNow() - start, i);
+        }
+    }
+
+    TestSink = sum;
+}
+
+static VOID Bench_EncodeGamepad(VOID)
+{
+    static VIGEM_GAMEPAD_STATE  states[BENCH_REPORTS];
+    VIGEM_TARGET_REPORT         target;
+    ULONG64                     seed = 1;
+    ULONG64                     sum = 0;
+    ULONG64                     start;
+    ULONG                       t;
+    ULONG                       i;
+    char                        name[0x40];
+
+    for (i = 0; i < BENCH_REPORTS; i++)
+    {
+        states[i].Buttons = (USHORT)TestRandom(&seed);
+        states[i].LeftTrigger = (USHORT)TestRandom(&seed);
+        states[i].ThumbLX = (SHORT)TestRandom(&seed);
+        states[i].ThumbRY = (SHORT)TestRandom(&seed);
+    }
+
+    for (t = 0; t < RTL_NUMBER_OF(TranslateTypes); t++)
+    {
+        start = TestNow();
+
+        for (i = 0; i < 10000000; i++)
+        {
+            (void)Translate_EncodeGamepad(&states[i & (BENCH_REPORTS - 1)], TranslateTypes[t], &target);
+            sum += target.Xusb.wButtons;
+        }
+
+        snprintf(name, sizeof(name), "canonical state to %s", TypeName(TranslateTypes[t]));
+        TestReport(name, TestNow() - start, i);
+    }
+
+    TestSink = sum;
+}
+
+//
+// Stands in for a mirror group member's PDO context
+// 
+typedef struct _FANOUT_MEMBER
+{
+    VIGEM_TARGET_TYPE TargetType;
+
+    SERIAL_INDEX_ENTRY IndexEntry;
+
+    VIGEM_TARGET_REPORT Delivered;
+
+} FANOUT_MEMBER, *PFANOUT_MEMBER;
+
+//
+// What Bus_MirrorFanOut runs per leader report: snapshot the member list,
+// then look up, translate and hand off to every member
+// 
+static VOID Bench_MirrorFanOut(VOID)
+{
+    static SERIAL_INDEX         index;
+    static FANOUT_MEMBER        members[VIGEM_MIRROR_MAX_MEMBERS];
+    static VIGEM_TARGET_REPORT  reports[BENCH_REPORTS];
+    SEQLOCK                     membersLock;
+    ULONG                       serials[VIGEM_MIRROR_MAX_MEMBERS];
+    ULONG                       snapshot[VIGEM_MIRROR_MAX_MEMBERS];
+    PSERIAL_INDEX_ENTRY         entry;
+    PFANOUT_MEMBER              member;
+    ULONG64                     seed = 1;
+    ULONG64                     sum = 0;
+    ULONG64                     start;
+    ULONG                       count;
+    ULONG                       group;
+    ULONG                       rounds;
+    ULONG                       i;
+    ULONG                       m;
+    LONG                        sequence;
+    char                        name[0x40];
+
+    RtlZeroMemory(&membersLock, sizeof(membersLock));
+
+    // Leader is a DS4, members cycle through all types
+    for (m = 0; m < VIGEM_MIRROR_MAX_MEMBERS; m++)
+    {
+        members[m].TargetType = TranslateTypes[m % RTL_NUMBER_OF(TranslateTypes)];
+        serials[m] = m + 2;
+        SerialIndexPublish(&index, &members[m].IndexEntry, serials[m]);
+    }
+
+    for (i = 0; i < BENCH_REPORTS; i++)
+    {
+        RandomNative(DualShock4Wired, &seed, &reports[i]);
+    }
+
+    for (group = 1; group <= VIGEM_MIRROR_MAX_MEMBERS; group *= 2)
+    {
+        // Same number of member deliveries for every group size
+        rounds = 0x400000 / group;
+
+        start = TestNow();
+
+        for (i = 0; i < rounds; i++)
+        {
+            do
+            {
+                sequence = SeqLockReadBegin(&membersLock);
+
+                count = group;
+                RtlCopyMemory(snapshot, serials, count * sizeof(ULONG));
+
+            } while (SeqLockReadRetry(&membersLock, sequence));
+
+            for (m = 0; m < count; m++)
+            {
+                entry = SerialIndexAcquire(&index, snapshot[m]);
+
+                if (entry == NULL)
+                {
+                    continue;
+                }
+
+                member = CONTAINING_RECORD(entry, FANOUT_MEMBER, IndexEntry);
+
+                (void)Translate_Report(DualShock4Wired, &reports[i & (BENCH_REPORTS - 1)], member->TargetType, &member->Delivered);
+                sum += member->Delivered.Xusb.wButtons;
+
+                SerialIndexRelease(entry);
+            }
+        }
+
+        snprintf(name, sizeof(name), "fan-out, %lu members", (unsigned long)group);
+        TestReport(name, TestNow() - start, rounds);
+    }
+
+    TestSink = sum;
+}
+
+static const TEST_CASE Benchmarks[] =
+{
+    TEST_CASE_OF(Bench_TranslateReport),
+    TEST_CASE_OF(Bench_EncodeGamepad),
+    TEST_CASE_OF(Bench_MirrorFanOut),
+};
+
+#pragma endregion
+
+TEST_MAIN(Tests, Benchmarks)
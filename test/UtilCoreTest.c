@@ -0,0 +1,755 @@
+/*
+* Virtual Gamepad Emulation Framework - Windows kernel-mode bus driver
+*
+* MIT License
+*
+* Copyright (c) 2016-2019 Nefarius Software Solutions e.U. and Contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "Platform.h"
+#include "Util.h"
+#include "Test.h"
+
+#pragma region Latency histogram
+
+static VOID Latency_BucketBoundaries(VOID)
+{
+    ULONG n;
+
+    // First bucket is open towards zero
+    TEST_CHECK_EQUAL(0, LatencyBucketIndex(0));
+    TEST_CHECK_EQUAL(0, LatencyBucketIndex(1));
+
+    // Bucket n holds [2^n, 2^(n+1))
+    for (n = 1; n < VIGEM_LATENCY_BUCKETS - 1; n++)
+    {
+        TEST_CHECK_EQUAL(n - 1, LatencyBucketIndex((1ULL << n) - 1));
+        TEST_CHECK_EQUAL(n, LatencyBucketIndex(1ULL << n));
+        TEST_CHECK_EQUAL(n, LatencyBucketIndex((1ULL << (n + 1)) - 1));
+    }
+
+    // Last bucket is open towards infinity
+    TEST_CHECK_EQUAL(VIGEM_LATENCY_BUCKETS - 1, LatencyBucketIndex(1ULL << (VIGEM_LATENCY_BUCKETS - 1)));
+    TEST_CHECK_EQUAL(VIGEM_LATENCY_BUCKETS - 1, LatencyBucketIndex(1ULL << 40));
+    TEST_CHECK_EQUAL(VIGEM_LATENCY_BUCKETS - 1, LatencyBucketIndex(MAXULONG64));
+}
+
+static VOID Latency_HistogramOfSamples(VOID)
+{
+    ULONG64 histogram[VIGEM_LATENCY_BUCKETS] = { 0 };
+    ULONG64 state = 0x9E3779B97F4A7C15ULL;
+    ULONG64 total = 0;
+    ULONG64 latency;
+    ULONG index;
+    ULONG i;
+
+    //
+    // Every sample has to land in the bucket whose range contains it, and
+    // the histogram has to account for every sample
+    // 
+    for (i = 0; i < 100000; i++)
+    {
+        latency = TestRandom(&state) >> (TestRandom(&state) % 64);
+        index = LatencyBucketIndex(latency);
+
+        TEST_CHECK(index < VIGEM_LATENCY_BUCKETS);
+
+        if (index > 0)
+        {
+            TEST_CHECK(latency >= (1ULL << index));
+        }
+
+        if (index < VIGEM_LATENCY_BUCKETS - 1)
+        {
+            TEST_CHECK(latency < (2ULL << index));
+        }
+
+        histogram[index]++;
+    }
+
+    for (i = 0; i < VIGEM_LATENCY_BUCKETS; i++)
+    {
+        total += histogram[i];
+    }
+
+    TEST_CHECK_EQUAL(100000, total);
+    TEST_CHECK(histogram[0] > 0);
+    TEST_CHECK(histogram[VIGEM_LATENCY_BUCKETS - 1] > 0);
+}
+
+static VOID Bench_LatencyBucketIndex(VOID)
+{
+    static ULONG64 samples[0x1000];
+    ULONG64 state = 1;
+    ULONG64 sum = 0;
+    ULONG64 start;
+    ULONG i;
+
+    // Typical plugin stage latencies, a few hundred us to tens of ms
+    for (i = 0; i < RTL_NUMBER_OF(samples); i++)
+    {
+        samples[i] = 100 + TestRandom(&state) % 50000;
+    }
+
+    start = TestNow();
+
+    for (i = 0; i < 10000000; i++)
+    {
+        sum += LatencyBucketIndex(samples[i & (RTL_NUMBER_OF(samples) - 1)]);
+    }
+
+    TestReport("bucket index, 100us..50ms", TestNow() - start, i);
+
+    TestSink = sum;
+}
+
+#pragma endregion
+
+#pragma region Masked compare
+
+#define COMPARE_MAX_LENGTH  0x50
+
+//
+// Byte by byte reference of ReportEqualMasked
+// 
+static BOOLEAN CompareReference(const UCHAR* Left, const UCHAR* Right, const UCHAR* IgnoreMask, ULONG Length)
+{
+    ULONG i;
+
+    for (i = 0; i < Length; i++)
+    {
+        if ((Left[i] ^ Right[i]) & ~(IgnoreMask != NULL ? IgnoreMask[i] : 0))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static VOID Compare_EveryBitOfEveryLength(VOID)
+{
+    UCHAR left[COMPARE_MAX_LENGTH + 1];
+    UCHAR right[COMPARE_MAX_LENGTH + 1];
+    UCHAR mask[COMPARE_MAX_LENGTH + 1];
+    ULONG64 state = 7;
+    ULONG length;
+    ULONG bit;
+    ULONG i;
+
+    //
+    // Lengths cover the vector, word and byte loops and their seams; the
+    // odd offset keeps the loads unaligned
+    // 
+    for (length = 0; length <= COMPARE_MAX_LENGTH; length++)
+    {
+        for (i = 0; i < length; i++)
+        {
+            left[1 + i] = right[1 + i] = (UCHAR)TestRandom(&state);
+        }
+
+        TEST_CHECK(ReportEqualMasked(left + 1, right + 1, NULL, length));
+
+        for (bit = 0; bit < length * 8; bit++)
+        {
+            right[1 + bit / 8] ^= (UCHAR)(1 << (bit % 8));
+
+            RtlZeroMemory(mask, sizeof(mask));
+            TEST_CHECK(!ReportEqualMasked(left + 1, right + 1, NULL, length));
+            TEST_CHECK(!ReportEqualMasked(left + 1, right + 1, mask + 1, length));
+
+            // Ignoring every other bit of the byte still sees it
+            mask[1 + bit / 8] = (UCHAR)~(1 << (bit % 8));
+            TEST_CHECK(!ReportEqualMasked(left + 1, right + 1, mask + 1, length));
+
+            mask[1 + bit / 8] = (UCHAR)(1 << (bit % 8));
+            TEST_CHECK(ReportEqualMasked(left + 1, right + 1, mask + 1, length));
+
+            right[1 + bit / 8] ^= (UCHAR)(1 << (bit % 8));
+        }
+    }
+}
+
+static VOID Compare_MatchesReference(VOID)
+{
+    UCHAR left[COMPARE_MAX_LENGTH];
+    UCHAR right[COMPARE_MAX_LENGTH];
+    UCHAR mask[COMPARE_MAX_LENGTH];
+    ULONG64 state = 11;
+    ULONG length;
+    ULONG round;
+    ULONG i;
+
+    for (round = 0; round < 100000; round++)
+    {
+        length = (ULONG)(TestRandom(&state) % (COMPARE_MAX_LENGTH + 1));
+
+        for (i = 0; i < length; i++)
+        {
+            left[i] = (UCHAR)TestRandom(&state);
+
+            // Mostly equal with the odd difference, like consecutive reports
+            right[i] = (TestRandom(&state) % 16) ? left[i] : (UCHAR)TestRandom(&state);
+            mask[i] = (TestRandom(&state) % 4) ? 0 : (UCHAR)TestRandom(&state);
+        }
+
+        TEST_CHECK_EQUAL(CompareReference(left, right, NULL, length), ReportEqualMasked(left, right, NULL, length));
+        TEST_CHECK_EQUAL(CompareReference(left, right, mask, length), ReportEqualMasked(left, right, mask, length));
+    }
+}
+
+typedef BOOLEAN(*COMPARE_ROUTINE)(const VOID* Left, const VOID* Right, const UCHAR* IgnoreMask, ULONG Length);
+
+static BOOLEAN CompareMemcmp(const VOID* Left, const VOID* Right, const UCHAR* IgnoreMask, ULONG Length)
+{
+    UNREFERENCED_PARAMETER(IgnoreMask);
+
+    return memcmp(Left, Right, Length) == 0;
+}
+
+static BOOLEAN CompareBytes(const VOID* Left, const VOID* Right, const UCHAR* IgnoreMask, ULONG Length)
+{
+    return CompareReference(Left, Right, IgnoreMask, Length);
+}
+
+static VOID BenchCompareRoutine(const char* Name, COMPARE_ROUTINE Routine, ULONG Length, BOOLEAN Masked)
+{
+    static UCHAR reports[2][0x100];
+    static UCHAR mask[0x100];
+    // Called through a pointer like the kernel's out-of-line call, so none
+    // of them gets inlined into the loop and hoisted
+    COMPARE_ROUTINE volatile routine = Routine;
+    char name[0x50];
+    ULONG64 equal = 0;
+    ULONG64 start;
+    ULONG i;
+
+    // Equal reports are the common case and scan the full length
+    memset(reports, 0x5A, sizeof(reports));
+    memset(mask, 0, sizeof(mask));
+    mask[0] = 0x0F;
+
+    start = TestNow();
+
+    for (i = 0; i < 50000000; i++)
+    {
+        equal += routine(reports[i & 1], reports[~i & 1], Masked ? mask : NULL, Length);
+    }
+
+    snprintf(name, sizeof(name), "%u bytes, %s%s", Length, Name, Masked ? " + mask" : "");
+    TestReport(name, TestNow() - start, i);
+
+    TestSink = equal;
+}
+
+static VOID BenchCompare(ULONG Length)
+{
+    BenchCompareRoutine("ReportEqualMasked", ReportEqualMasked, Length, FALSE);
+    BenchCompareRoutine("ReportEqualMasked", ReportEqualMasked, Length, TRUE);
+    BenchCompareRoutine("memcmp", CompareMemcmp, Length, FALSE);
+    BenchCompareRoutine("byte loop", CompareBytes, Length, FALSE);
+    BenchCompareRoutine("byte loop", CompareBytes, Length, TRUE);
+}
+
+static VOID Bench_CompareXusb(VOID)
+{
+    BenchCompare(sizeof(XUSB_REPORT));
+}
+
+static VOID Bench_CompareDs4(VOID)
+{
+    BenchCompare(sizeof(DS4_REPORT));
+}
+
+static VOID Bench_CompareTargetReport(VOID)
+{
+    BenchCompare(sizeof(VIGEM_TARGET_REPORT));
+}
+
+//
+// Today's reports are all shorter than one vector; this one takes the
+// vector loop
+// 
+static VOID Bench_CompareWide(VOID)
+{
+    BenchCompare(64);
+}
+
+#pragma endregion
+
+#pragma region Masked merge
+
+#define MERGE_MAX_LENGTH    0x50
+#define MERGE_GUARD         0x10
+
+//
+// Byte by byte reference of ReportMergeMasked
+// 
+static VOID MergeReference(UCHAR* Destination, const UCHAR* Source, const UCHAR* KeepMask, ULONG Length)
+{
+    ULONG i;
+
+    for (i = 0; i < Length; i++)
+    {
+        Destination[i] = (Destination[i] & KeepMask[i]) | (Source[i] & ~KeepMask[i]);
+    }
+}
+
+static VOID MergeCheck(PULONG64 State, ULONG Length, ULONG Offset, BOOLEAN WholeBytes)
+{
+    UCHAR destination[MERGE_MAX_LENGTH + 2 * MERGE_GUARD];
+    UCHAR expected[MERGE_MAX_LENGTH + 2 * MERGE_GUARD];
+    UCHAR source[MERGE_MAX_LENGTH + MERGE_GUARD];
+    UCHAR mask[MERGE_MAX_LENGTH + MERGE_GUARD];
+    ULONG i;
+
+    for (i = 0; i < sizeof(destination); i++)
+    {
+        destination[i] = expected[i] = (UCHAR)TestRandom(State);
+    }
+
+    for (i = 0; i < sizeof(source); i++)
+    {
+        source[i] = (UCHAR)TestRandom(State);
+
+        // Deltas keep whole fields; the kernel works on any bit pattern though
+        mask[i] = WholeBytes ? ((TestRandom(State) & 1) ? 0xFF : 0x00) : (UCHAR)TestRandom(State);
+    }
+
+    ReportMergeMasked(destination + MERGE_GUARD + Offset, source + Offset, mask + Offset, Length);
+    MergeReference(expected + MERGE_GUARD + Offset, source + Offset, mask + Offset, Length);
+
+    // Includes the guard bytes around the merged range
+    TEST_CHECK(memcmp(destination, expected, sizeof(destination)) == 0);
+}
+
+static VOID Merge_MatchesReference(VOID)
+{
+    ULONG64 state = 13;
+    ULONG length;
+    ULONG offset;
+    ULONG round;
+
+    for (length = 0; length <= MERGE_MAX_LENGTH; length++)
+    {
+        for (offset = 0; offset < 4; offset++)
+        {
+            for (round = 0; round < 64; round++)
+            {
+                MergeCheck(&state, length, offset, TRUE);
+                MergeCheck(&state, length, offset, FALSE);
+            }
+        }
+    }
+}
+
+static VOID Merge_KeepAllAndNone(VOID)
+{
+    UCHAR destination[MERGE_MAX_LENGTH];
+    UCHAR source[MERGE_MAX_LENGTH];
+    UCHAR mask[MERGE_MAX_LENGTH];
+
+    memset(destination, 0x11, sizeof(destination));
+    memset(source, 0x22, sizeof(source));
+
+    memset(mask, 0xFF, sizeof(mask));
+    ReportMergeMasked(destination, source, mask, sizeof(destination));
+    TEST_CHECK_EQUAL(0x11, destination[0]);
+    TEST_CHECK_EQUAL(0x11, destination[MERGE_MAX_LENGTH - 1]);
+
+    memset(mask, 0x00, sizeof(mask));
+    ReportMergeMasked(destination, source, mask, sizeof(destination));
+    TEST_CHECK_EQUAL(0x22, destination[0]);
+    TEST_CHECK_EQUAL(0x22, destination[MERGE_MAX_LENGTH - 1]);
+}
+
+typedef VOID(*MERGE_ROUTINE)(VOID* Destination, const VOID* Source, const UCHAR* KeepMask, ULONG Length);
+
+static VOID MergeBytes(VOID* Destination, const VOID* Source, const UCHAR* KeepMask, ULONG Length)
+{
+    MergeReference(Destination, Source, KeepMask, Length);
+}
+
+static VOID BenchMergeRoutine(const char* Name, MERGE_ROUTINE Routine, ULONG Length)
+{
+    static UCHAR destination[0x100];
+    static UCHAR source[0x100];
+    static UCHAR mask[0x100];
+    MERGE_ROUTINE volatile routine = Routine;
+    char name[0x50];
+    ULONG64 start;
+    ULONG i;
+
+    // Sticks only, the other fields come from the cache
+    memset(mask, 0, sizeof(mask));
+    memset(mask + 4, 0xFF, 8);
+
+    start = TestNow();
+
+    for (i = 0; i < 50000000; i++)
+    {
+        source[0] = (UCHAR)i;
+        routine(destination, source, mask, Length);
+    }
+
+    snprintf(name, sizeof(name), "%u bytes, %s", Length, Name);
+    TestReport(name, TestNow() - start, i);
+
+    TestSink = destination[0];
+}
+
+static VOID BenchMerge(ULONG Length)
+{
+    BenchMergeRoutine("ReportMergeMasked", ReportMergeMasked, Length);
+    BenchMergeRoutine("byte loop", MergeBytes, Length);
+}
+
+static VOID Bench_MergeXusb(VOID)
+{
+    BenchMerge(sizeof(XUSB_REPORT));
+}
+
+static VOID Bench_MergeDs4(VOID)
+{
+    BenchMerge(sizeof(DS4_REPORT));
+}
+
+static VOID Bench_MergeWide(VOID)
+{
+    BenchMerge(64);
+}
+
+#pragma endregion
+
+#pragma region Axes blend
+
+//
+// Clock of the traces, the performance counter frequency of most machines
+// 
+#define TRACE_FREQUENCY     10000000LL
+#define TRACE_MS            (TRACE_FREQUENCY / 1000)
+
+//
+// Rounded to nearest, ties towards +infinity, saturated to SHORT
+// 
+static SHORT BlendReference(SHORT Previous, SHORT Current, SHORT WeightPrevious, SHORT WeightCurrent)
+{
+    LONG64 sum = (LONG64)Previous * WeightPrevious + (LONG64)Current * WeightCurrent + AXES_BLEND_ONE / 2;
+    LONG64 value = sum >= 0 ? sum / AXES_BLEND_ONE : -((-sum + AXES_BLEND_ONE - 1) / AXES_BLEND_ONE);
+
+    return (SHORT)max(min(value, 32767), -32768);
+}
+
+static VOID Blend_MatchesReference(VOID)
+{
+    SHORT previous[AXES_BLEND_LANES];
+    SHORT current[AXES_BLEND_LANES];
+    SHORT output[AXES_BLEND_LANES];
+    SHORT weightPrevious;
+    SHORT weightCurrent;
+    ULONG64 state = 0x2545F4914F6CDD1DULL;
+    ULONG round;
+    ULONG i;
+
+    for (round = 0; round < 200000; round++)
+    {
+        for (i = 0; i < AXES_BLEND_LANES; i++)
+        {
+            previous[i] = (SHORT)TestRandom(&state);
+            current[i] = (SHORT)TestRandom(&state);
+        }
+
+        // Anything within the documented range, not just the pairs the
+        // weights routine hands out
+        weightPrevious = (SHORT)((LONG)(TestRandom(&state) % (4 * AXES_BLEND_ONE + 1)) - 2 * AXES_BLEND_ONE);
+        weightCurrent = (SHORT)((LONG)(TestRandom(&state) % (4 * AXES_BLEND_ONE + 1)) - 2 * AXES_BLEND_ONE);
+
+        AxesBlend(previous, current, output, weightPrevious, weightCurrent);
+
+        for (i = 0; i < AXES_BLEND_LANES; i++)
+        {
+            TEST_CHECK_EQUAL(BlendReference(previous[i], current[i], weightPrevious, weightCurrent), output[i]);
+        }
+    }
+}
+
+static VOID Blend_Saturates(VOID)
+{
+    static const SHORT previous[AXES_BLEND_LANES] = { -30000, 30000, -32768, 32767, 0, 0, 100, -100 };
+    static const SHORT current[AXES_BLEND_LANES] = { 30000, -30000, 32767, -32768, 0, 0, 100, -100 };
+    SHORT output[AXES_BLEND_LANES];
+
+    // Twice the last motion on top of it runs past either end of the range
+    AxesBlend(previous, current, output, -AXES_BLEND_ONE, 2 * AXES_BLEND_ONE);
+
+    TEST_CHECK_EQUAL(MAXSHORT, output[0]);
+    TEST_CHECK_EQUAL(-MAXSHORT - 1, output[1]);
+    TEST_CHECK_EQUAL(MAXSHORT, output[2]);
+    TEST_CHECK_EQUAL(-MAXSHORT - 1, output[3]);
+    TEST_CHECK_EQUAL(0, output[4]);
+    TEST_CHECK_EQUAL(0, output[5]);
+    TEST_CHECK_EQUAL(100, output[6]);
+    TEST_CHECK_EQUAL(-100, output[7]);
+
+    // Unit weights pass values through untouched, extremes included
+    AxesBlend(previous, current, output, 0, AXES_BLEND_ONE);
+    TEST_CHECK(memcmp(output, current, sizeof(output)) == 0);
+
+    AxesBlend(previous, current, output, AXES_BLEND_ONE, 0);
+    TEST_CHECK(memcmp(output, previous, sizeof(output)) == 0);
+}
+
+//
+// One IN URB the way Bus_InterpolateUrb fills it
+// 
+static VOID TraceSample(
+    VIGEM_INTERPOLATION_MODE Mode,
+    const LONG64* Time,
+    SHORT Axes[2][AXES_BLEND_LANES],
+    LONG64 Now,
+    SHORT* Output)
+{
+    SHORT weightPrevious;
+    SHORT weightCurrent;
+
+    if (!AxesBlendWeights(Mode, Time, Now, TRACE_FREQUENCY, &weightPrevious, &weightCurrent))
+    {
+        memcpy(Output, Axes[1], sizeof(SHORT) * AXES_BLEND_LANES);
+        return;
+    }
+
+    AxesBlend(Axes[0], Axes[1], Output, weightPrevious, weightCurrent);
+}
+
+//
+// Submission k of the ramp trace; every lane moves at its own speed, some
+// of them downwards, by a multiple of 8 per submission
+// 
+static SHORT RampValue(ULONG Lane, ULONG Submission)
+{
+    return (SHORT)(-16000 + (LONG)Submission * 8 * ((LONG)Lane * 9 - 30) + (LONG)Lane * 4000);
+}
+
+//
+// A feeder submitting a ramp every 8 ms, sampled every millisecond
+// 
+static VOID TraceRamp(VIGEM_INTERPOLATION_MODE Mode)
+{
+    const LONG64    interval = 8 * TRACE_MS;
+    SHORT           axes[2][AXES_BLEND_LANES];
+    SHORT           output[AXES_BLEND_LANES];
+    SHORT           last[AXES_BLEND_LANES] = { 0 };
+    LONG64          time[2];
+    LONG64          expected;
+    LONG64          motion;
+    ULONG           k;
+    ULONG           j;
+    ULONG           i;
+
+    for (k = 1; k < 50; k++)
+    {
+        time[0] = (LONG64)(k - 1) * interval;
+        time[1] = (LONG64)k * interval;
+
+        for (i = 0; i < AXES_BLEND_LANES; i++)
+        {
+            axes[0][i] = RampValue(i, k - 1);
+            axes[1][i] = RampValue(i, k);
+        }
+
+        for (j = 0; j < 8; j++)
+        {
+            TraceSample(Mode, time, axes, time[1] + (LONG64)j * TRACE_MS, output);
+
+            for (i = 0; i < AXES_BLEND_LANES; i++)
+            {
+                motion = (LONG64)axes[1][i] - axes[0][i];
+
+                // Linear trails the feeder by one interval, extrapolation
+                // predicts where it is now; both are exact on a ramp
+                expected = Mode == ViGEmInterpolationLinear
+                    ? axes[0][i] + motion * j / 8
+                    : axes[1][i] + motion * j / 8;
+
+                TEST_CHECK_EQUAL(expected, output[i]);
+
+                // The trace moves one way and doesn't jump back at a
+                // submission
+                if (k > 1 || j > 0)
+                {
+                    TEST_CHECK(motion >= 0 ? output[i] >= last[i] : output[i] <= last[i]);
+                }
+
+                last[i] = output[i];
+            }
+        }
+    }
+}
+
+static VOID Blend_LinearTrace(VOID)
+{
+    TraceRamp(ViGEmInterpolationLinear);
+}
+
+static VOID Blend_ExtrapolateTrace(VOID)
+{
+    TraceRamp(ViGEmInterpolationExtrapolate);
+}
+
+static VOID Blend_FeederStops(VOID)
+{
+    SHORT   axes[2][AXES_BLEND_LANES];
+    SHORT   output[AXES_BLEND_LANES];
+    LONG64  time[2] = { 100 * TRACE_MS, 108 * TRACE_MS };
+    ULONG   i;
+
+    for (i = 0; i < AXES_BLEND_LANES; i++)
+    {
+        axes[0][i] = RampValue(i, 0);
+        axes[1][i] = RampValue(i, 1);
+    }
+
+    // Linear lands on the last submission and stays there
+    TraceSample(ViGEmInterpolationLinear, time, axes, time[1] + 8 * TRACE_MS, output);
+    TEST_CHECK(memcmp(output, axes[1], sizeof(output)) == 0);
+
+    TraceSample(ViGEmInterpolationLinear, time, axes, time[1] + 1000 * TRACE_MS, output);
+    TEST_CHECK(memcmp(output, axes[1], sizeof(output)) == 0);
+
+    // Extrapolation overshoots by at most one interval's motion
+    for (i = 0; i <= 16; i++)
+    {
+        TraceSample(ViGEmInterpolationExtrapolate, time, axes, time[1] + (LONG64)(8 + i / 2) * TRACE_MS, output);
+        TEST_CHECK_EQUAL(2 * axes[1][3] - axes[0][3], output[3]);
+    }
+
+    // and gives up once two intervals went by without a submission
+    TraceSample(ViGEmInterpolationExtrapolate, time, axes, time[1] + 17 * TRACE_MS, output);
+    TEST_CHECK(memcmp(output, axes[1], sizeof(output)) == 0);
+}
+
+static VOID Blend_StepsAcrossGaps(VOID)
+{
+    SHORT   weightPrevious;
+    SHORT   weightCurrent;
+    LONG64  time[2];
+
+    // First submission after a reset
+    time[0] = 0;
+    time[1] = 0;
+    TEST_CHECK(!AxesBlendWeights(ViGEmInterpolationLinear, time, TRACE_MS, TRACE_FREQUENCY, &weightPrevious, &weightCurrent));
+
+    // Submissions further apart than the limit are a step
+    time[1] = VIGEM_INTERPOLATION_MAX_INTERVAL_MS * TRACE_MS + 1;
+    TEST_CHECK(!AxesBlendWeights(ViGEmInterpolationLinear, time, time[1], TRACE_FREQUENCY, &weightPrevious, &weightCurrent));
+    TEST_CHECK(!AxesBlendWeights(ViGEmInterpolationExtrapolate, time, time[1], TRACE_FREQUENCY, &weightPrevious, &weightCurrent));
+
+    time[1] = VIGEM_INTERPOLATION_MAX_INTERVAL_MS * TRACE_MS;
+    TEST_CHECK(AxesBlendWeights(ViGEmInterpolationLinear, time, time[1], TRACE_FREQUENCY, &weightPrevious, &weightCurrent));
+    TEST_CHECK_EQUAL(AXES_BLEND_ONE, weightPrevious);
+    TEST_CHECK_EQUAL(0, weightCurrent);
+
+    // A clock read before the last submission landed blends nothing in
+    TEST_CHECK(AxesBlendWeights(ViGEmInterpolationExtrapolate, time, time[1] - TRACE_MS, TRACE_FREQUENCY, &weightPrevious, &weightCurrent));
+    TEST_CHECK_EQUAL(0, weightPrevious);
+    TEST_CHECK_EQUAL(AXES_BLEND_ONE, weightCurrent);
+}
+
+typedef VOID(*BLEND_ROUTINE)(const SHORT* Previous, const SHORT* Current, SHORT* Output, SHORT WeightPrevious, SHORT WeightCurrent);
+
+static VOID BlendLoop(const SHORT* Previous, const SHORT* Current, SHORT* Output, SHORT WeightPrevious, SHORT WeightCurrent)
+{
+    ULONG i;
+
+    for (i = 0; i < AXES_BLEND_LANES; i++)
+    {
+        Output[i] = BlendReference(Previous[i], Current[i], WeightPrevious, WeightCurrent);
+    }
+}
+
+static VOID BenchBlendRoutine(const char* Name, BLEND_ROUTINE Routine)
+{
+    static SHORT axes[2][AXES_BLEND_LANES];
+    static SHORT output[AXES_BLEND_LANES];
+    BLEND_ROUTINE volatile routine = Routine;
+    ULONG64 state = 1;
+    ULONG64 sum = 0;
+    ULONG64 start;
+    ULONG i;
+
+    for (i = 0; i < AXES_BLEND_LANES; i++)
+    {
+        axes[0][i] = (SHORT)TestRandom(&state);
+        axes[1][i] = (SHORT)TestRandom(&state);
+    }
+
+    start = TestNow();
+
+    for (i = 0; i < 50000000; i++)
+    {
+        routine(axes[0], axes[1], output, (SHORT)(AXES_BLEND_ONE - (i & 0x1FFF)), (SHORT)(i & 0x1FFF));
+        sum += (USHORT)output[i & (AXES_BLEND_LANES - 1)];
+    }
+
+    TestReport(Name, TestNow() - start, i);
+
+    TestSink = sum;
+}
+
+static VOID Bench_AxesBlend(VOID)
+{
+    BenchBlendRoutine("AxesBlend, 8 axes", AxesBlend);
+    BenchBlendRoutine("per-axis loop, 8 axes", BlendLoop);
+}
+
+#pragma endregion
+
+static const TEST_CASE Tests[] =
+{
+    TEST_CASE_OF(Latency_BucketBoundaries),
+    TEST_CASE_OF(Latency_HistogramOfSamples),
+    TEST_CASE_OF(Compare_EveryBitOfEveryLength),
+    TEST_CASE_OF(Compare_MatchesReference),
+    TEST_CASE_OF(Merge_MatchesReference),
+    TEST_CASE_OF(Merge_KeepAllAndNone),
+    TEST_CASE_OF(Blend_MatchesReference),
+    TEST_CASE_OF(Blend_Saturates),
+    TEST_CASE_OF(Blend_LinearTrace),
+    TEST_CASE_OF(Blend_ExtrapolateTrace),
+    TEST_CASE_OF(Blend_FeederStops),
+    TEST_CASE_OF(Blend_StepsAcrossGaps),
+};
+
+static const TEST_CASE Benchmarks[] =
+{
+    TEST_CASE_OF(Bench_LatencyBucketIndex),
+    TEST_CASE_OF(Bench_CompareXusb),
+    TEST_CASE_OF(Bench_CompareDs4),
+    TEST_CASE_OF(Bench_CompareTargetReport),
+    TEST_CASE_OF(Bench_CompareWide),
+    TEST_CASE_OF(Bench_MergeXusb),
+    TEST_CASE_OF(Bench_MergeDs4),
+    TEST_CASE_OF(Bench_MergeWide),
+    TEST_CASE_OF(Bench_AxesBlend),
+};
+
+TEST_MAIN(Tests, Benchmarks)